@@ -2,6 +2,7 @@
 #define VM_SCANNER_CAPTURE_HPP
 
 #include <string>
+#include <vector>
 
 #include <opencv2/core/core.hpp>
 
@@ -31,6 +32,13 @@ namespace vm
 
  			bool grab(cv::Mat& depth, cv::Mat& image);
 
+      /** Writes depth (CV_16U) and image (CV_8UC4, RGB byte layout, ready to upload) straight into the caller's
+        * buffers, which are reused when already allocated with the right size and type, e.g. PageLockedMat headers.
+        * The color comes out of a single swizzle pass. With copy_depth off depth is a header over the driver's
+        * buffer instead, valid until the next grab. Returns false at the end of a recording, throws cv::Exception
+        * when the read fails. */
+      bool grabRGBA(cv::Mat& depth, cv::Mat& image, bool copy_depth = true);
+
  			//parameters taken from camera/oni
       int shadow_value, no_sample_value;
       float depth_focal_length_VGA;
@@ -45,6 +53,150 @@ namespace vm
     	cv::Ptr<Impl> impl_;
     	void getParams();
 		};
+
+    /** Sensorless stand-in for OpenNISource: sphere traces an analytic scene on the host along a scripted camera
+      * trajectory, with Kinect-like axial noise and disparity quantization. Frames depend only on the params and
+      * the frame index, so runs repeat exactly. Poses are camera to world, with frame 0 at the identity like
+      * Scanner's, and the scenes sit inside the default volume. */
+    class SyntheticSource
+    {
+    public:
+      typedef vm::scanner::PixelRGB RGB24;
+
+      /** BODY is a person proxy of capsules and spheres standing on the floor, SPHERES_AND_BOX a table top set */
+      enum Scene { BODY, SPHERES_AND_BOX };
+
+      /** ORBIT turns around the scene center as a turntable would, HANDHELD adds a slow wobble on top of a
+        * back and forth arc */
+      enum Trajectory { STILL, ORBIT, HANDHELD };
+
+      struct Params
+      {
+        int cols, rows;       //pixels
+        Intr intr;
+        int scene;            //Scene
+        int trajectory;       //Trajectory
+        int frames;           //grab() returns false after them, 0 for no end
+        float orbit_step;     //radians per frame
+        float limb_swing;     //radians, arm and leg swing of BODY, 0 keeps it rigid and the ground truth exact
+        bool noise;           //axial noise growing with depth squared
+        bool quantize;        //depth comes from 1/8 pixel disparity steps over a 7.5cm baseline
+        unsigned int seed;
+
+        static Params default_params();
+      };
+
+      SyntheticSource();
+      SyntheticSource(const Params& params);
+
+      void open(const Params& params);
+      const Params& params() const;
+
+      /** Rewinds to frame 0 */
+      void reset();
+
+      /** Depth CV_16U in mm and image CV_8UC3 BGR, like OpenNISource::grab */
+      bool grab(cv::Mat& depth, cv::Mat& image);
+
+      /** Image CV_8UC4 in RGB byte layout, like OpenNISource::grabRGBA */
+      bool grabRGBA(cv::Mat& depth, cv::Mat& image);
+
+      /** Ground truth pose of the given frame, or of the last grabbed one */
+      Affine3f pose(int frame) const;
+      Affine3f pose() const;
+
+      /** Frames grabbed since open() or reset() */
+      int frame() const;
+
+    private:
+      void render(int frame, cv::Mat& depth, cv::Mat& image);
+
+      Params params_;
+      int frame_;
+    };
+
+    /** Grabs from an OpenNISource (or a SyntheticSource, for tests) on its own thread into a ring of preallocated
+      * page-locked slots, so sensor reads, the RGBA packing and fusion overlap. Slots are handed over through atomic
+      * indices, neither side takes a lock. With LATEST_ONLY the grab thread never waits and retrieve() returns the
+      * newest frame, anything older is counted as dropped. With LOSSLESS every grabbed frame is delivered in order
+      * and the grab thread waits while the ring is full, which is what .oni replay wants. */
+    class AsyncCapture
+    {
+    public:
+      enum DropPolicy { LATEST_ONLY, LOSSLESS };
+
+      struct Stats
+      {
+        int64 grabbed;    // frames read from the source
+        int64 delivered;  // frames returned by retrieve()
+        int64 dropped;    // frames overwritten before anyone retrieved them
+        int queued;       // frames waiting in the ring right now
+      };
+
+      /** The ring holds capacity slots, one of them is owned by the consumer, LATEST_ONLY always uses three */
+      AsyncCapture(OpenNISource& source, DropPolicy policy = LATEST_ONLY, int capacity = 4);
+      AsyncCapture(SyntheticSource& source, DropPolicy policy = LATEST_ONLY, int capacity = 4);
+      ~AsyncCapture();
+
+      void start();
+      void stop();
+
+      /** Blocks until a frame is ready. Depth is CV_16U and image CV_8UC4, both point into a ring slot and stay
+        * valid until the next retrieve() or stop(). Returns false once the source has no more frames and throws
+        * once the queued frames of a failed source are used up. timestamp, if given, gets the cv::getTickCount()
+        * at which the frame was grabbed. */
+      bool retrieve(cv::Mat& depth, cv::Mat& image, int64* timestamp = 0);
+
+      /** LOSSLESS only: grab time of the frame the next retrieve() returns, false if none is queued */
+      bool peek(int64& timestamp) const;
+
+      /** The grab thread is done, the source ran out of frames or failed. Frames may still be queued. */
+      bool finished() const;
+
+      /** Why the source failed once finished, empty if it ran out of frames or is still grabbing */
+      std::string error() const;
+
+      Stats stats() const;
+      DropPolicy policy() const;
+
+    private:
+      struct Impl;
+      cv::Ptr<Impl> impl_;
+
+      AsyncCapture(const AsyncCapture&);
+      AsyncCapture& operator=(const AsyncCapture&);
+    };
+
+    /** Several sensors as one stream in grab time order, for Scanner's multi sensor mode. Every sensor has its
+      * own capture thread and LOSSLESS AsyncCapture ring, so grabbing and the RGBA packing run in parallel and the
+      * slots are reused, and retrieve() merges the rings on the caller's thread without taking a lock. It returns
+      * the oldest queued frame once every running sensor has one, or once max_wait_ms went by, so one sensor
+      * stalling doesn't hold the others up. */
+    class MultiCapture
+    {
+    public:
+      MultiCapture(const std::vector<OpenNISource*>& sources, int capacity = 4, double max_wait_ms = 40.0);
+      ~MultiCapture();
+
+      void start();
+      void stop();
+
+      /** See AsyncCapture::retrieve, sensor is the index of the source the frame came from. Returns false once
+        * none of the sources has more frames, throws once a failed one has none left. */
+      bool retrieve(int& sensor, cv::Mat& depth, cv::Mat& image, int64* timestamp = 0);
+
+      int size() const;
+      AsyncCapture::Stats stats(int sensor) const;
+
+    private:
+      enum { WAIT_US = 500 };
+
+      std::vector< cv::Ptr<AsyncCapture> > captures_;
+      double max_wait_ms_;
+
+      MultiCapture(const MultiCapture&);
+      MultiCapture& operator=(const MultiCapture&);
+    };
 	}
 }
 
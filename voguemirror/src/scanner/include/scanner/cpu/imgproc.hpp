@@ -0,0 +1,65 @@
+#ifndef VM_SCANNER_CPU_IMGPROC_HPP
+#define VM_SCANNER_CPU_IMGPROC_HPP
+
+#include <scanner/types.hpp>
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace cpu
+		{
+      /** Host counterparts of the cuda:: depth front end, row parallel with AVX2 rows picked at runtime.
+        * The bilateral filter takes its weights from a spatial table and a range lookup table. */
+      void depthBilateralFilter(const Depth& in, Depth& out, int ksz, float sigma_spatial, float sigma_depth);
+
+      void depthTruncation(Depth& depth, float threshold);
+
+      void depthBuildPyramid(const Depth& depth, Depth& pyramid, float sigma_depth);
+
+      /** Counterpart of cuda::computeRays, the functions taking rays look them up instead of computing them */
+      void computeRays(const Intr& intr, int rows, int cols, Rays& rays);
+
+      void computeNormalsAndMaskDepth(const Intr& intr, Depth& depth, Normals& normals, const Rays& rays = Rays());
+
+      void computePointNormals(const Intr& intr, const Depth& depth, Cloud& points, Normals& normals, const Rays& rays = Rays());
+
+      /** Unlike the device version the distances are float meters, as cpu::TsdfVolume::integrate takes them */
+      void computeDists(const Depth& depth, Dists& dists, const Intr& intr, const Rays& rays = Rays());
+
+      /** Counterpart of cuda::depthFrontEnd working on bands of rows that stay in cache, bit exact with the separate calls */
+      void depthFrontEnd(const Intr& intr, const Depth& depth, Dists& dists, Depth& filtered, Cloud& points, Normals& normals,
+                         int ksz, float sigma_spatial, float sigma_depth, float truncate_dist, const Rays& rays = Rays());
+
+      /** Nearest depth within [min_depth, max_depth] of every 2^level square of pixels, 0 where there is none */
+      void foregroundDownsample(const Depth& depth, Depth& small, const ForegroundParams& params);
+
+      /** Mask (255 for the person) of a foregroundDownsample'd frame and the floor plane (n, d), n pointing up to the
+        * camera, all zero if no floor was found. intr is at params.level. The cuda:: pipeline runs it too, on the
+        * downloaded small frame. */
+      void segmentForeground(const Intr& intr, const Depth& small, const ForegroundParams& params, cv::Mat_<unsigned char>& mask, cv::Vec4f& floor);
+
+      /** Depth of the pixels whose square is in the mask, within the band and above the floor, zero elsewhere */
+      void applyForeground(const Intr& intr, const Depth& depth, const cv::Mat_<unsigned char>& mask, const cv::Vec4f& floor,
+                           const ForegroundParams& params, Depth& masked);
+
+      /** foregroundDownsample, segmentForeground and applyForeground */
+      void extractForeground(const Intr& intr, const Depth& depth, Depth& masked, const ForegroundParams& params);
+
+      void resizeDepthNormals(const Depth& depth, const Normals& normals, Depth& depth_out, Normals& normals_out);
+
+      void resizePointsNormals(const Cloud& points, const Normals& normals, Cloud& points_out, Normals& normals_out);
+
+      /** Counterparts of the cuda:: rendering, the same shading with the background gradient where there is no point */
+      void renderTangentColors(const Normals& normals, Image& image);
+
+      void renderVertexColors(const Cloud& points, const Normals& normals, const Intr& intr, const Vec3f& light_pose, const Image& colors, Image& image);
+
+      void renderImage(const Depth& depth, const Normals& normals, const Intr& intr, const Vec3f& light_pose, Image& image);
+
+      void renderImage(const Cloud& points, const Normals& normals, const Intr& intr, const Vec3f& light_pose, Image& image);
+		}
+	}
+}
+
+#endif
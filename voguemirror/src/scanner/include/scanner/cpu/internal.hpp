@@ -0,0 +1,230 @@
+#ifndef VM_SCANNER_CPU_INTERNAL_HPP
+#define VM_SCANNER_CPU_INTERNAL_HPP
+
+#include <scanner/types.hpp>
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+  #include <immintrin.h>
+  #define VM_SCANNER_HAVE_AVX2
+  #define __vm_avx2__ __attribute__((target("avx2,f16c")))
+#endif
+
+namespace vm
+{
+	namespace scanner
+	{
+    namespace host
+    {
+      typedef unsigned short ushort;
+      typedef unsigned char uchar;
+
+      typedef cpu::Dists Dists;
+      typedef cpu::Depth Depth;
+      typedef cpu::Image Image;
+      typedef cpu::Normals Normals;
+      typedef cpu::Cloud Points;
+      typedef cpu::Mesh Mesh;
+      typedef cpu::Rays Rays;
+
+      /** Host twin of device::TsdfVolume::elem_type (ushort4), so volumes can move between backends as is:
+        * half-float tsdf, integration weight, and color packed as (r*256 + g, b*256 + a). */
+      struct Voxel
+      {
+        ushort tsdf;
+        ushort weight;
+        ushort rg;
+        ushort ba;
+      };
+
+      /** Same values and storage as device::VoxelOrder */
+      enum VoxelOrder { ORDER_LINEAR, ORDER_BRICKED };
+
+      /** The 3 low bits of v spread to every third bit */
+      inline size_t spread_bits3(int v) { return (v & 1) | ((v & 2) << 2) | ((v & 4) << 4); }
+
+      /** Offset of voxel (x, y, z) in a volume of dims voxels stored in the given VoxelOrder */
+      inline size_t voxel_offset(int x, int y, int z, const Vec3i& dims, int order)
+      {
+        if (order == ORDER_LINEAR)
+          return x + ((size_t)y + (size_t)z * dims[1]) * dims[0];
+
+        size_t brick = (x >> 3) + ((size_t)(y >> 3) + (size_t)(z >> 3) * (dims[1] >> 3)) * (dims[0] >> 3);
+        return (brick << 9) | spread_bits3(x) | (spread_bits3(y) << 1) | (spread_bits3(z) << 2);
+      }
+
+      struct TsdfVolume
+      {
+      public:
+        typedef Voxel elem_type;
+
+        elem_type *const data;
+        const int order; // VoxelOrder
+
+        const Vec3i dims;
+        const Vec3f voxel_size;
+        const float trunc_dist;
+        const int max_weight;
+
+        TsdfVolume(elem_type* data, int order, const Vec3i& dims, const Vec3f& voxel_size, float trunc_dist, int max_weight);
+
+        elem_type* operator()(int x, int y, int z);
+        const elem_type* operator() (int x, int y, int z) const;
+      private:
+        TsdfVolume& operator=(const TsdfVolume&);
+      };
+
+      /** Returns true if the AVX2 code paths can run on this CPU and cv::useOptimized() allows them */
+      bool useAvx2();
+
+      /** Host twin of device::ComputeIcpHelper: point-to-plane projective association of the current frame
+        * against the previous one, reduced to the 27 sums of the upper triangle of [A|b] in the same order. */
+      struct ComputeIcpHelper
+      {
+        enum { TOTAL = 27, STRIPE_ROWS = 8 };
+
+        float min_cosine;
+        float dist2_thres;
+
+        cv::Matx33f R; // curr -> prev
+        cv::Vec3f t;
+
+        int rows, cols;
+        float fx, fy, cx, cy;
+        float fx_inv, fy_inv;
+
+        const Depth* dcurr;
+        const Normals* ncurr;
+        const Points* vcurr;
+
+        ComputeIcpHelper(float dist_thres, float angle_thres);
+        void setLevelIntr(int level_index, float fx, float fy, float cx, float cy);
+        void setAffine(const Affine3f& aff);
+
+        void operator()(const Depth& dprev, const Normals& nprev, double* data) const;
+        void operator()(const Points& vprev, const Normals& nprev, double* data) const;
+      };
+
+      //image proc functions, the ones taking rays look them up there unless they are null
+      void computeRays(const Intr& intr, Rays& rays);
+      void compute_dists(const Depth& depth, Dists& dists, const Intr& intr, const Rays* rays);
+
+      void truncateDepth(Depth& depth, float max_dist /*meters*/);
+      void bilateralFilter(const Depth& src, Depth& dst, int kernel_size, float sigma_spatial, float sigma_depth);
+      void depthPyr(const Depth& source, Depth& pyramid, float sigma_depth);
+
+      void computeNormalsAndMaskDepth(const Intr& intr, Depth& depth, Normals& normals, const Rays* rays);
+      void computePointNormals(const Intr& intr, const Depth& depth, Points& points, Normals& normals, const Rays* rays);
+
+      /** compute_dists, bilateralFilter, truncateDepth (max_dist <= 0 disables it) and computePointNormals of the filtered depth in one pass */
+      void depthFrontEnd(const Intr& intr, const Depth& depth, Dists& dists, Depth& filtered, Points& points, Normals& normals,
+                         int kernel_size, float sigma_spatial, float sigma_depth, float max_dist /*meters*/, const Rays* rays);
+
+      void foregroundDownsample(const Depth& depth, Depth& small, int level, ushort min_depth, ushort max_depth);
+      /** floor_dist <= 0 keeps the floor */
+      void applyForeground(const Intr& intr, const Depth& depth, const cv::Mat_<uchar>& mask, int level, const cv::Vec4f& floor,
+                           float floor_dist, ushort min_depth, ushort max_depth, Depth& masked);
+
+      void resizeDepthNormals(const Depth& depth, const Normals& normals, Depth& depth_out, Normals& normals_out);
+      void resizePointsNormals(const Points& points, const Normals& normals, Points& points_out, Normals& normals_out);
+
+      //rendering, the points one lights the vertex colors if there are any
+      void renderImage(const Depth& depth, const Normals& normals, const Intr& intr, const Vec3f& light_pose, Image& image);
+      void renderImage(const Points& points, const Normals& normals, const Image* colors, const Vec3f& light_pose, Image& image);
+      void renderTangentColors(const Normals& normals, Image& image);
+
+      //tsdf volume functions
+      void clear_volume(TsdfVolume volume);
+      /** Returns the number of voxels skipped for lying outside the camera frustum or beyond the farthest measurement */
+      int64 integrate(const Dists& dists, const Image& colors, TsdfVolume& volume, const Affine3f& vol2cam, const Intr& intr);
+      /** The frames in order, parallel over slabs of rows instead of per frame, the voxels come out the same */
+      int64 integrate(const std::vector<Dists>& dists, const std::vector<Image>& colors, TsdfVolume& volume,
+                      const std::vector<Affine3f>& vol2cam, const Intr& intr);
+
+      void raycast(const TsdfVolume& volume, const Affine3f& cam2vol, const Intr& intr, const Rays* rays, Depth& depth, Normals& normals, float step_factor, float delta_factor);
+      void raycast(const TsdfVolume& volume, const Affine3f& cam2vol, const Intr& intr, const Rays* rays, Points& points, Normals& normals, float step_factor, float delta_factor);
+
+      //exctraction functionality
+      size_t extractCloud(const TsdfVolume& volume, const Affine3f& aff, Points& output);
+      void extractNormals(const TsdfVolume& volume, const Points& points, const Affine3f& aff, float gradient_delta_factor, Normals& output);
+      void extractTangentColors(const TsdfVolume& volume, const Points& points, const Affine3f& aff, float gradient_delta_factor, Image& output);
+      void extractVertexColors(const TsdfVolume& volume, const Points& points, const Affine3f& aff, Image& output);
+
+      //marching cubes, grows the output arrays as needed and returns the vertex count
+      size_t extractMesh(const TsdfVolume& volume, const Affine3f& aff, float gradient_delta_factor, Mesh& output, size_t& indices_count);
+
+      //packing/unpacking tsdf volume element, bit exact with __float2half_rn/__half2float
+      inline ushort float2half(float value)
+      {
+        union { float f; unsigned int u; } v;
+        v.f = value;
+
+        unsigned int sign = (v.u >> 16) & 0x8000;
+        unsigned int abs = v.u & 0x7fffffff;
+
+        if (abs >= 0x7f800000) // inf or nan
+          return (ushort)(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0));
+
+        if (abs >= 0x477ff000) // rounds above 65504
+          return (ushort)(sign | 0x7c00);
+
+        if (abs < 0x38800000) // half subnormals
+        {
+          if (abs < 0x33000000)
+            return (ushort)sign;
+
+          unsigned int e = abs >> 23;
+          unsigned int m = (abs & 0x7fffff) | 0x800000;
+          unsigned int shift = 126 - e;
+          unsigned int h = m >> shift;
+          unsigned int rem = m & ((1u << shift) - 1);
+          unsigned int half = 1u << (shift - 1);
+          if (rem > half || (rem == half && (h & 1)))
+            ++h;
+          return (ushort)(sign | h);
+        }
+
+        unsigned int h = (abs - 0x38000000) >> 13;
+        unsigned int rem = abs & 0x1fff;
+        if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+          ++h;
+        return (ushort)(sign | h);
+      }
+
+      inline float half2float(ushort value)
+      {
+        unsigned int sign = (value & 0x8000u) << 16;
+        unsigned int exp = (value >> 10) & 0x1f;
+        unsigned int mant = value & 0x3ff;
+
+        union { float f; unsigned int u; } v;
+        if (exp == 0)
+        {
+          v.f = mant * (1.f / 16777216.f); // 2^-24
+          v.u |= sign;
+        }
+        else if (exp == 31)
+          v.u = sign | 0x7f800000 | (mant << 13);
+        else
+          v.u = sign | ((exp + 112) << 23) | (mant << 13);
+        return v.f;
+      }
+
+      inline float unpack_tsdf(const Voxel& value) { return half2float(value.tsdf); }
+      inline float unpack_tsdf(const Voxel& value, int& weight) { weight = value.weight; return half2float(value.tsdf); }
+    }
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// host::TsdfVolume
+
+inline vm::scanner::host::TsdfVolume::TsdfVolume(elem_type* _data, int _order, const Vec3i& _dims, const Vec3f& _voxel_size, float _trunc_dist, int _max_weight)
+: data(_data), order(_order), dims(_dims), voxel_size(_voxel_size), trunc_dist(_trunc_dist), max_weight(_max_weight) {}
+
+inline vm::scanner::host::TsdfVolume::elem_type* vm::scanner::host::TsdfVolume::operator()(int x, int y, int z)
+{ return data + voxel_offset(x, y, z, dims, order); }
+
+inline const vm::scanner::host::TsdfVolume::elem_type* vm::scanner::host::TsdfVolume::operator() (int x, int y, int z) const
+{ return data + voxel_offset(x, y, z, dims, order); }
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef VM_SCANNER_CPU_PROJECTIVE_ICP_HPP
+#define VM_SCANNER_CPU_PROJECTIVE_ICP_HPP
+
+#include <scanner/types.hpp>
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace cpu
+		{
+      /** Host counterpart of cuda::ProjectiveICP, same point-to-plane association and thresholds. Partial sums are
+        * taken over fixed row stripes and merged in a fixed order, so the result doesn't depend on the thread count
+        * and can serve as a reference for the device path. */
+      class ProjectiveICP
+      {
+      public:
+        enum { MAX_PYRAMID_LEVELS = 4 };
+
+        typedef std::vector<Depth> DepthPyr;
+        typedef std::vector<Cloud> PointsPyr;
+        typedef std::vector<Normals> NormalsPyr;
+
+        ProjectiveICP();
+        virtual ~ProjectiveICP();
+
+        float getDistThreshold() const;
+        void setDistThreshold(float distance);
+
+        float getAngleThreshold() const;
+        void setAngleThreshold(float angle);
+
+        void setIterationsNum(const std::vector<int>& iters);
+        int getUsedLevelsNum() const;
+
+        /** Takes masked depth like the device version: if depth(y,x) is not zero, normals(y,x) is not qnan */
+        virtual bool estimateTransform(Affine3f& affine, const Intr& intr, const DepthPyr& dcurr, const NormalsPyr& ncurr, const DepthPyr& dprev, const NormalsPyr& nprev);
+        virtual bool estimateTransform(Affine3f& affine, const Intr& intr, const PointsPyr& vcurr, const NormalsPyr& ncurr, const PointsPyr& vprev, const NormalsPyr& nprev);
+
+      private:
+        std::vector<int> iters_;
+        float angle_thres_;
+        float dist_thres_;
+      };
+		}
+	}
+}
+
+#endif
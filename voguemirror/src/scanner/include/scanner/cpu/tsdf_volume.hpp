@@ -0,0 +1,103 @@
+#ifndef VM_SCANNER_CPU_TSDF_VOLUME_HPP
+#define VM_SCANNER_CPU_TSDF_VOLUME_HPP
+
+#include <scanner/types.hpp>
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace cpu
+		{
+      /** Host memory counterpart of cuda::TsdfVolume. Voxels keep the device layout (half tsdf, weight, packed color),
+        * work is spread over all cores with cv::parallel_for_ and the hot loops switch to AVX2 at runtime when available. */
+			class  TsdfVolume
+ 			{
+ 			public:
+        /** See cuda::TsdfVolume::VoxelOrder, a bricked volume is integrated a brick at a time */
+        enum VoxelOrder { ORDER_LINEAR, ORDER_BRICKED };
+
+ 				TsdfVolume(const cv::Vec3i& dims, int order = ORDER_LINEAR);
+ 				virtual ~TsdfVolume();
+
+ 				void create(const Vec3i& dims);
+
+ 				Vec3i getDims() const;
+        int getOrder() const;
+ 				Vec3f getVoxelSize() const;
+
+        /** Voxels in getOrder(), dims[1] * dims[2] rows of dims[0] whatever the order */
+ 				const cv::Mat data() const;
+ 				cv::Mat data();
+
+ 				Vec3f getSize() const;
+ 				void setSize(const Vec3f& size);
+
+ 				float getTruncDist() const;
+        void setTruncDist(float distance);
+
+        int getMaxWeight() const;
+        void setMaxWeight(int weight);
+
+        Affine3f getPose() const;
+        void setPose(const Affine3f& pose);
+
+        float getRaycastStepFactor() const;
+        void setRaycastStepFactor(float factor);
+
+        float getGradientDeltaFactor() const;
+        void setGradientDeltaFactor(float factor);
+
+        virtual void clear();
+        virtual void applyAffine(const Affine3f& affine);
+
+        virtual void integrate(const Dists& dists, const Image& colors, const Affine3f& camera_pose, const Intr& intr);
+
+        /** Integrates a batch of frames in order, with the same result as one integrate() per frame. Cores take a slab
+          * of the volume each through all the frames instead of meeting after every frame, and the slab stays in cache
+          * between them. colors, or any of them, may be empty. getCulledVoxelsNum() counts over the whole batch. */
+        void integrate(const std::vector<Dists>& dists, const std::vector<Image>& colors,
+                       const std::vector<Affine3f>& camera_poses, const Intr& intr);
+
+        /** Voxels the last integrate() skipped without projecting them, see cuda::TsdfVolume::getCulledVoxelsNum */
+        int64 getCulledVoxelsNum() const;
+
+        /** rays, if given, are the ones of intr for the output's size, see cpu::computeRays */
+        virtual void raycast(const Affine3f& camera_pose, const Intr& intr, Depth& depth, Normals& normals, const Rays& rays = Rays());
+        virtual void raycast(const Affine3f& camera_pose, const Intr& intr, Cloud& points, Normals& normals, const Rays& rays = Rays());
+
+        void swap(cv::Mat& data);
+
+        /** Unlike the device version the buffer is grown when needed, so the cloud is never truncated */
+        Cloud fetchCloud(Cloud& cloud_buffer) const;
+        void fetchNormals(const Cloud& cloud, Normals& normals) const;
+        void fetchTangentColors(const Cloud& cloud, Image& colors) const;
+        void fetchVertexColors(const Cloud& cloud, Image& colors) const;
+
+        /** Marching cubes surface: each vertex is shared by all its triangles and carries the tsdf gradient normal
+          * and the voxel color. Buffers are grown when needed, the returned mesh refers to them. */
+        Mesh fetchMesh(Mesh& mesh_buffer) const;
+
+        /** Name of the code path picked for this machine, "avx2" or "scalar" */
+        static const char* getSimdPath();
+
+      private:
+        cv::Mat data_;
+        int order_;
+
+        float trunc_dist_;
+        int max_weight_;
+        Vec3i dims_;
+        Vec3f size_;
+        Affine3f pose_;
+
+        float gradient_delta_factor_;
+        float raycast_step_factor_;
+
+        int64 culled_voxels_;
+			};
+		}
+	}
+}
+
+#endif
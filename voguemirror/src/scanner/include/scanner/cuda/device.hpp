@@ -15,17 +15,148 @@
 //vm::scanner::device::TsdfVolume::TsdfVolume(const TsdfVolume& other)
 //  : data(other.data), dims(other.dims), voxel_size(other.voxel_size), trunc_dist(other.trunc_dist), max_weight(other.max_weight) {}
 
-__vm_device__ vm::scanner::device::TsdfVolume::elem_type* vm::scanner::device::TsdfVolume::operator()(int x, int y, int z)
-{ return data + x + y*dims.x + z*dims.y*dims.x; }
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+			/** Index into a cyclic axis of n voxels, i is in [0, 2n) */
+			__vm_device__ int wrap_voxel(int i, int n) { return i < n ? i : i - n; }
+
+			/** The 3 low bits of v spread to every third bit */
+			__vm_device__ int spread_bits3(int v) { return (v & 1) | ((v & 2) << 2) | ((v & 4) << 4); }
+
+			/** Offset of storage position (x, y, z) in a volume of dims voxels stored in the given VoxelOrder */
+			__vm_device__ int voxel_offset(int x, int y, int z, int3 dims, int order)
+			{
+			  if (order == ORDER_LINEAR)
+			    return x + (y + z * dims.y) * dims.x;
+
+			  int brick = (x >> 3) + ((y >> 3) + (z >> 3) * (dims.y >> 3)) * (dims.x >> 3);
+			  return (brick << 9) | spread_bits3(x) | (spread_bits3(y) << 1) | (spread_bits3(z) << 2);
+			}
+		}
+	}
+}
+
+template<class Voxel>
+vm::scanner::device::TsdfVolumeT<Voxel>::TsdfVolumeT(elem_type* _data, int _order, int3 _dims, float3 _voxel_size, float _trunc_dist, int _max_weight, int3 _origin)
+: data(_data), order(_order), dims(_dims), voxel_size(_voxel_size), trunc_dist(_trunc_dist), max_weight(_max_weight), origin(_origin) {}
+
+template<class Voxel>
+__vm_device__ Voxel* vm::scanner::device::TsdfVolumeT<Voxel>::operator()(int x, int y, int z)
+{ return at(wrap_voxel(x + origin.x, dims.x), wrap_voxel(y + origin.y, dims.y), wrap_voxel(z + origin.z, dims.z)); }
+
+template<class Voxel>
+__vm_device__ const Voxel* vm::scanner::device::TsdfVolumeT<Voxel>::operator() (int x, int y, int z) const
+{ return at(wrap_voxel(x + origin.x, dims.x), wrap_voxel(y + origin.y, dims.y), wrap_voxel(z + origin.z, dims.z)); }
+
+template<class Voxel>
+__vm_device__ Voxel* vm::scanner::device::TsdfVolumeT<Voxel>::at(int x, int y, int z) const
+{ return data + voxel_offset(x, y, z, dims, order); }
 
-__vm_device__ const vm::scanner::device::TsdfVolume::elem_type* vm::scanner::device::TsdfVolume::operator() (int x, int y, int z) const
-{ return data + x + y*dims.x + z*dims.y*dims.x; }
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// TsdfBricks
+
+__vm_device__ unsigned int* vm::scanner::device::TsdfBricks::operator()(int level, int x, int y, int z) const
+{
+  int shift = level ? LOG_SIZE1 : LOG_SIZE0;
+  return flags[level] + ((z >> shift) * dims[level].y + (y >> shift)) * dims[level].x + (x >> shift);
+}
+
+__vm_device__ void vm::scanner::device::TsdfBricks::mark(int x, int y, int z, unsigned int signs) const
+{
+  if (!signs)
+    return;
+
+  // the bits are set once per brick, after that reading them is enough
+  for(int level = 0; level < LEVELS; ++level)
+  {
+    unsigned int* f = (*this)(level, x, y, z);
+    if ((*f & signs) != signs)
+      atomicOr(f, signs);
+  }
+}
 
-__vm_device__ vm::scanner::device::TsdfVolume::elem_type* vm::scanner::device::TsdfVolume::beg(int x, int y) const
-{ return data + x + dims.x * y; }
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// HashTsdfVolume
 
-__vm_device__ vm::scanner::device::TsdfVolume::elem_type* vm::scanner::device::TsdfVolume::zstep(elem_type *const ptr) const
-{ return ptr + dims.x * dims.y; }
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+			__vm_device__ unsigned long long hash_key(int3 b)
+			{
+			  return ((unsigned long long)(b.x + 1) << 42) | ((unsigned long long)(b.y + 1) << 21) | (unsigned long long)(b.z + 1);
+			}
+
+			__vm_device__ unsigned int hash_slot(int3 b)
+			{
+			  return ((unsigned int)b.x * 73856093u) ^ ((unsigned int)b.y * 19349669u) ^ ((unsigned int)b.z * 83492791u);
+			}
+		}
+	}
+}
+
+__vm_device__ vm::scanner::device::HashTsdfVolume::elem_type* vm::scanner::device::HashTsdfVolume::block(int index) const
+{ return data + index * BLOCK_VOXELS; }
+
+__vm_device__ int vm::scanner::device::HashTsdfVolume::find(int3 b) const
+{
+  if (b.x < 0 || b.y < 0 || b.z < 0 || b.x * BLOCK_SIZE >= dims.x || b.y * BLOCK_SIZE >= dims.y || b.z * BLOCK_SIZE >= dims.z)
+    return 0;
+
+  unsigned long long key = hash_key(b);
+  unsigned int slot = hash_slot(b);
+
+  for(int i = 0; i < MAX_PROBES; ++i, ++slot)
+  {
+    unsigned long long k = keys[slot & hash_mask];
+    if (k == key)
+      return values[slot & hash_mask];
+    if (k == 0)
+      break;
+  }
+  return 0;
+}
+
+__vm_device__ void vm::scanner::device::HashTsdfVolume::insert(int3 b) const
+{
+  if (b.x < 0 || b.y < 0 || b.z < 0 || b.x * BLOCK_SIZE >= dims.x || b.y * BLOCK_SIZE >= dims.y || b.z * BLOCK_SIZE >= dims.z)
+    return;
+
+  unsigned long long key = hash_key(b);
+  unsigned int slot = hash_slot(b);
+
+  for(int i = 0; i < MAX_PROBES; ++i, ++slot)
+  {
+    unsigned long long prev = atomicCAS(keys + (slot & hash_mask), 0ull, key);
+    if (prev == key)
+      return;
+
+    if (prev == 0)
+    {
+      // pool overflow leaves the slot pointing to the empty block, so the surface there is just not fused
+      int index = atomicAdd(blocks_count, 1) + 1;
+      if (index > max_blocks)
+        index = 0;
+      else
+        blocks[index] = b;
+
+      values[slot & hash_mask] = index;
+      return;
+    }
+  }
+}
+
+__vm_device__ vm::scanner::device::HashTsdfVolume::elem_type* vm::scanner::device::HashTsdfVolume::operator()(int x, int y, int z) const
+{
+  int index = find(make_int3(x >> 3, y >> 3, z >> 3));
+  return block(index) + ((z & 7) * BLOCK_SIZE + (y & 7)) * BLOCK_SIZE + (x & 7);
+}
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// Projector
@@ -43,11 +174,41 @@ __vm_device__ float2 vm::scanner::device::Projector::operator()(const float3& p)
 
 __vm_device__ float3 vm::scanner::device::Reprojector::operator()(int u, int v, float z) const
 {
-    float x = z * (u - c.x) * finv.x;
-    float y = z * (v - c.y) * finv.y;
+    if (rays.data)
+    {
+      float4 ray = rays(v, u);
+      return make_float3(z * ray.x, z * ray.y, z);
+    }
+
+    float x = z * ((u - c.x) * finv.x);
+    float y = z * ((v - c.y) * finv.y);
     return make_float3(x, y, z);
 }
 
+__vm_device__ float vm::scanner::device::Reprojector::length(int u, int v) const
+{
+    if (rays.data)
+      return rays(v, u).z;
+
+    float xl = (u - c.x) * finv.x;
+    float yl = (v - c.y) * finv.y;
+    return sqrtf (xl * xl + yl * yl + 1);
+}
+
+__vm_device__ float3 vm::scanner::device::Reprojector::direction(int u, int v) const
+{
+    float4 ray;
+    if (rays.data)
+      ray = rays(v, u);
+    else
+    {
+      ray.x = (u - c.x) * finv.x;
+      ray.y = (v - c.y) * finv.y;
+      ray.w = 1.f / sqrtf (ray.x * ray.x + ray.y * ray.y + 1);
+    }
+    return make_float3(ray.x * ray.w, ray.y * ray.w, ray.w);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// packing/unpacking tsdf volume element
 
@@ -69,6 +230,48 @@ __vm_device__ float vm::scanner::device::unpack_tsdf(ushort4 value, int& weight,
 }
 __vm_device__ float vm::scanner::device::unpack_tsdf (ushort4 value) { return __half2float (value.x); }
 
+__vm_device__ void vm::scanner::device::pack_tsdf(float tsdf, int weight, ushort rg, ushort ba, ushort4& voxel)
+{ voxel = pack_tsdf(tsdf, weight, rg, ba); }
+
+__vm_device__ void vm::scanner::device::pack_tsdf(float tsdf, int weight, ushort rg, ushort ba, voxel6& voxel)
+{
+  voxel6 value;
+  value.tsdf = __float2half_rn(tsdf);
+  value.weight = min(weight, 255);
+  value.r = rg >> 8;
+  value.g = rg & 0xFF;
+  value.b = ba >> 8;
+  voxel = value;
+}
+
+__vm_device__ void vm::scanner::device::pack_tsdf(float tsdf, int weight, ushort /*rg*/, ushort /*ba*/, voxel4& voxel)
+{
+  voxel4 value;
+  value.tsdf = __float2half_rn(tsdf);
+  value.weight = min(weight, 255);
+  value.unused = 0;
+  voxel = value;
+}
+
+__vm_device__ float vm::scanner::device::unpack_tsdf(voxel6 value, int& weight, ushort& rg, ushort& ba)
+{
+  weight = value.weight;
+  rg = value.r * 256 + value.g;
+  ba = value.b * 256 + 255;
+  return __half2float (value.tsdf);
+}
+
+__vm_device__ float vm::scanner::device::unpack_tsdf(voxel6 value) { return __half2float (value.tsdf); }
+
+__vm_device__ float vm::scanner::device::unpack_tsdf(voxel4 value, int& weight, ushort& rg, ushort& ba)
+{
+  weight = value.weight;
+  rg = ba = 0;
+  return __half2float (value.tsdf);
+}
+
+__vm_device__ float vm::scanner::device::unpack_tsdf(voxel4 value) { return __half2float (value.tsdf); }
+
 
 __vm_device__ ushort2 vm::scanner::device::rgba2ushort(uchar4 color)
 {
@@ -109,10 +312,61 @@ namespace vm
 
       struct plus
       {
+        __vm_device__ int operator () (int l, int r) const  { return l + r; }
         __vm_device__ float operator () (float l, float r) const  { return l + r; }
         __vm_device__ double operator () (double l, double r) const  { return l + r; }
       };
 
+      struct maximum
+      {
+        __vm_device__ int operator () (int l, int r) const  { return max(l, r); }
+      };
+
+      __vm_device__ void intersect(float3 ray_org, float3 ray_dir, /*float3 box_min,*/ float3 box_max, float &tnear, float &tfar)
+      {
+        const float3 box_min = make_float3(0.f, 0.f, 0.f);
+
+        // compute intersection of ray with all six bbox planes
+        float3 invR = make_float3(1.f/ray_dir.x, 1.f/ray_dir.y, 1.f/ray_dir.z);
+        float3 tbot = invR * (box_min - ray_org);
+        float3 ttop = invR * (box_max - ray_org);
+
+        // re-order intersections to find smallest and largest on each axis
+        float3 tmin = make_float3(fminf(ttop.x, tbot.x), fminf(ttop.y, tbot.y), fminf(ttop.z, tbot.z));
+        float3 tmax = make_float3(fmaxf(ttop.x, tbot.x), fmaxf(ttop.y, tbot.y), fmaxf(ttop.z, tbot.z));
+
+        // find the largest tmin and the smallest tmax
+        tnear = fmaxf(fmaxf(tmin.x, tmin.y), fmaxf(tmin.x, tmin.z));
+        tfar  = fminf(fminf(tmax.x, tmax.y), fminf(tmax.x, tmax.z));
+      }
+
+      template<typename Vol>
+      __vm_device__ float interpolate(const Vol& volume, const float3& p_voxels)
+      {
+        float3 cf = p_voxels;
+
+        //rounding to negative infinity
+        int3 g = make_int3(__float2int_rd (cf.x), __float2int_rd (cf.y), __float2int_rd (cf.z));
+
+        if (g.x < 0 || g.x >= volume.dims.x - 1 || g.y < 0 || g.y >= volume.dims.y - 1 || g.z < 0 || g.z >= volume.dims.z - 1)
+            return numeric_limits<float>::quiet_NaN();
+
+        float a = cf.x - g.x;
+        float b = cf.y - g.y;
+        float c = cf.z - g.z;
+
+        float tsdf = 0.f;
+        tsdf += unpack_tsdf(*volume(g.x + 0, g.y + 0, g.z + 0)) * (1 - a) * (1 - b) * (1 - c);
+        tsdf += unpack_tsdf(*volume(g.x + 0, g.y + 0, g.z + 1)) * (1 - a) * (1 - b) *      c;
+        tsdf += unpack_tsdf(*volume(g.x + 0, g.y + 1, g.z + 0)) * (1 - a) *      b  * (1 - c);
+        tsdf += unpack_tsdf(*volume(g.x + 0, g.y + 1, g.z + 1)) * (1 - a) *      b  *      c;
+        tsdf += unpack_tsdf(*volume(g.x + 1, g.y + 0, g.z + 0)) *      a  * (1 - b) * (1 - c);
+        tsdf += unpack_tsdf(*volume(g.x + 1, g.y + 0, g.z + 1)) *      a  * (1 - b) *      c;
+        tsdf += unpack_tsdf(*volume(g.x + 1, g.y + 1, g.z + 0)) *      a  *      b  * (1 - c);
+        tsdf += unpack_tsdf(*volume(g.x + 1, g.y + 1, g.z + 1)) *      a  *      b  *      c;
+        return tsdf;
+      }
+
       struct gmem
       {
         template<typename T> __vm_device__ static T LdCs(T *ptr);
@@ -124,6 +378,13 @@ namespace vm
 
       template<> __vm_device__ ushort4 gmem::LdCs(ushort4* ptr);
       template<> __vm_device__ void gmem::StCs(const ushort4& val, ushort4* ptr);
+
+      // no vector instruction fits them, plain accesses
+      template<> __vm_device__ voxel6 gmem::LdCs(voxel6* ptr) { return *ptr; }
+      template<> __vm_device__ void gmem::StCs(const voxel6& val, voxel6* ptr) { *ptr = val; }
+
+      template<> __vm_device__ voxel4 gmem::LdCs(voxel4* ptr) { return *ptr; }
+      template<> __vm_device__ void gmem::StCs(const voxel4& val, voxel4* ptr) { *ptr = val; }
     }
 	}
 }
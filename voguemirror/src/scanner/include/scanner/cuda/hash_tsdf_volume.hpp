@@ -0,0 +1,65 @@
+#ifndef VM_SCANNER_CUDA_HASH_TSDF_VOLUME_HPP
+#define VM_SCANNER_CUDA_HASH_TSDF_VOLUME_HPP
+
+#include <scanner/cuda/tsdf_volume.hpp>
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace cuda
+		{
+      /** Sparse TsdfVolume. Voxels live in 8^3 blocks taken from a fixed pool and found through a hash table, blocks are
+        * allocated along the truncation band of each integrated frame. Memory is set by the pool size instead of dims,
+        * clear and cloud extraction only touch allocated blocks. */
+			class  HashTsdfVolume : public TsdfVolume
+ 			{
+ 			public:
+        enum { BLOCK_SIZE = 8 };
+
+ 				HashTsdfVolume(const cv::Vec3i& dims, int max_blocks);
+ 				virtual ~HashTsdfVolume();
+
+        int getMaxBlocks() const;
+        int getUsedBlocks() const;
+
+        /** Blocks the frames integrated since the last clear found no room for in the pool. Their surface isn't
+          * fused, lookups there keep landing in the empty block. */
+        int getDroppedBlocks() const;
+
+        virtual void clear();
+
+        /** Not supported, blocks are keyed by their position in the volume */
+        virtual DeviceArray<Point> shift(const Vec3i& voxels, DeviceArray<Point>& cloud_buffer);
+
+        virtual void integrate(const Dists& dists, const Image& colors, const Affine3f& camera_pose, const Intr& intr);
+
+        virtual void raycast(const Affine3f& camera_pose, const Intr& intr, Depth& depth, Normals& normals, const Rays& rays = Rays());
+        virtual void raycast(const Affine3f& camera_pose, const Intr& intr, Cloud& points, Normals& normals, const Rays& rays = Rays());
+
+        virtual DeviceArray<Point> fetchCloud(DeviceArray<Point>& cloud_buffer) const;
+        /** Not supported, no brick flags are kept */
+        virtual DeviceArray<Point> fetchChangedCloud(DeviceArray<Point>& cloud_buffer, DeviceArray<int>& changed_bricks);
+        virtual DeviceArray<Surfel> fetchSurfels(DeviceArray<Surfel>& surfel_buffer, bool tangent_colors = false) const;
+        virtual void fetchNormals(const DeviceArray<Point>& cloud, DeviceArray<Normal>& normals) const;
+        virtual void fetchTangentColors(const DeviceArray<Point>& cloud, DeviceArray<RGB>& colors) const;
+        virtual void fetchVertexColors(const DeviceArray<Point>& cloud, DeviceArray<RGB>& colors) const;
+        virtual Mesh fetchMesh(Mesh& mesh_buffer) const;
+
+      private:
+        CudaData blocks_data_;  // (max_blocks + 1) blocks, the first one stays empty
+        CudaData keys_;
+        CudaData values_;
+        CudaData block_coords_;
+        CudaData blocks_count_;
+
+        int hash_size_;
+        int max_blocks_;
+        int used_blocks_;
+        int dropped_blocks_;
+			};
+		}
+	}
+}
+
+#endif
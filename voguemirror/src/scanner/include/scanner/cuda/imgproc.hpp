@@ -15,11 +15,33 @@ namespace vm
 
       void depthBuildPyramid(const Depth& depth, Depth& pyramid, float sigma_depth);
 
-      void computeNormalsAndMaskDepth(const Intr& intr, Depth& depth, Normals& normals);
+      /** Rays of every pixel of a rows x cols frame. The functions taking them look the rays up instead of
+        * computing them from intr, with the same results; they must be of intr and of the frame's size. */
+      void computeRays(const Intr& intr, int rows, int cols, Rays& rays);
 
-      void computePointNormals(const Intr& intr, const Depth& depth, Cloud& points, Normals& normals);
+      void computeNormalsAndMaskDepth(const Intr& intr, Depth& depth, Normals& normals, const Rays& rays = Rays());
 
-      void computeDists(const Depth& depth, Dists& dists, const Intr& intr);
+      void computePointNormals(const Intr& intr, const Depth& depth, Cloud& points, Normals& normals, const Rays& rays = Rays());
+
+      /** stream, here and below, is the CUDA stream the passes go into, 0 for the default one */
+      void computeDists(const Depth& depth, Dists& dists, const Intr& intr, const Rays& rays = Rays(), CUstream_st* stream = 0);
+
+      /** computeDists, depthBilateralFilter, depthTruncation (truncate_dist <= 0 disables it) and computePointNormals
+        * of the filtered depth fused into one pass that keeps the depth tiles in shared memory. Bit exact with the
+        * separate calls, which stay as the reference. */
+      void depthFrontEnd(const Intr& intr, const Depth& depth, Dists& dists, Depth& filtered, Cloud& points, Normals& normals,
+                         int ksz, float sigma_spatial, float sigma_depth, float truncate_dist, const Rays& rays = Rays());
+
+      /** The cpu:: foreground passes on the device, nothing is copied to the host in between. floor holds the 4
+        * coefficients of the floor plane, all zero if none was found, buffer is scratch. The small frame can have up
+        * to 1024 rows. */
+      void foregroundDownsample(const Depth& depth, Depth& small, const ForegroundParams& params, CUstream_st* stream = 0);
+
+      void segmentForeground(const Intr& intr, const Depth& small, const ForegroundParams& params, DeviceArray2D<unsigned char>& mask,
+                             DeviceArray<float>& floor, DeviceArray<int>& buffer, CUstream_st* stream = 0);
+
+      void applyForeground(const Intr& intr, const Depth& depth, const DeviceArray2D<unsigned char>& mask, const DeviceArray<float>& floor,
+                           const ForegroundParams& params, Depth& masked, CUstream_st* stream = 0);
 
       void resizeDepthNormals(const Depth& depth, const Normals& normals, Depth& depth_out, Normals& normals_out);
 
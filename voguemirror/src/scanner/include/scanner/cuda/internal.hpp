@@ -27,31 +27,148 @@ namespace vm
       struct Mat3f { float3 data[3]; };
       struct Aff3f { Mat3f R; Vec3f t; };
 
-      struct TsdfVolume
+      /** 6 byte voxel: half tsdf, 8 bit weight and rgb */
+      struct voxel6
+      {
+        ushort tsdf;
+        uchar weight;
+        uchar r, g, b;
+      };
+
+      /** 4 byte voxel: half tsdf and 8 bit weight, geometry only */
+      struct voxel4
+      {
+        ushort tsdf;
+        uchar weight;
+        uchar unused;
+      };
+
+      /** Voxel type of a TsdfVolume */
+      enum VoxelLayout
+      {
+        VOXEL_RGBA,     // ushort4: half tsdf, 16 bit weight and rgba in two shorts
+        VOXEL_RGB,      // voxel6
+        VOXEL_GEOMETRY  // voxel4, readers see black
+      };
+
+      /** Storage order of a TsdfVolume. Bricked volumes keep each 8^3 brick in one 512 voxel run with its voxels in
+        * Morton order, so the 2x2x2 cells that interpolation and gradients read share a cache line or two. The
+        * bricks follow each other x fastest and the dims have to be multiples of 8. */
+      enum VoxelOrder
+      {
+        ORDER_LINEAR,   // x fastest, then y, then z
+        ORDER_BRICKED
+      };
+
+      /** Dense volume of ushort4, voxel6 or voxel4 voxels, which the volume kernels are templated on */
+      template<class Voxel>
+      struct TsdfVolumeT
       {
     	public:
-        typedef ushort4 elem_type;
+        typedef Voxel elem_type;
 
         elem_type *const data;
+        const int order; // VoxelOrder
 
         const int3 dims;
         const float3 voxel_size;
         const float trunc_dist;
         const int max_weight;
 
-        TsdfVolume(elem_type* data, int3 dims, float3 voxel_size, float trunc_dist, int max_weight);
-
+        /** Storage index of voxel (0, 0, 0). The volume is a cyclic buffer along each axis, so shifting it only moves
+          * the origin and the voxels that stay are never copied. Accessors take voxel coordinates relative to it. */
+        const int3 origin;
 
-        //TsdfVolume(const TsdfVolume&);
+        TsdfVolumeT(elem_type* data, int order, int3 dims, float3 voxel_size, float trunc_dist, int max_weight, int3 origin);
 
         __vm_device__ elem_type* operator()(int x, int y, int z);
         __vm_device__ const elem_type* operator() (int x, int y, int z) const ;
-        __vm_device__ elem_type* beg(int x, int y) const;
-        __vm_device__ elem_type* zstep(elem_type *const ptr) const;
+        /** Voxel at storage position (x, y, z), the origin isn't applied */
+        __vm_device__ elem_type* at(int x, int y, int z) const;
+      private:
+        TsdfVolumeT& operator=(const TsdfVolumeT&);
+      };
+
+      /** Dense volume whose VoxelLayout is known at run time. The volume functions below switch on it once and
+        * run the kernels on the typed view. */
+      struct TsdfVolume
+      {
+    	public:
+        void *const data;
+        const int layout;
+        const int order;
+
+        const int3 dims;
+        const float3 voxel_size;
+        const float trunc_dist;
+        const int max_weight;
+        const int3 origin;
+
+        TsdfVolume(void* data, int layout, int order, int3 dims, float3 voxel_size, float trunc_dist, int max_weight, int3 origin);
+
+        static size_t voxelBytes(int layout);
+
+        template<class Voxel> TsdfVolumeT<Voxel> typed() const
+        { return TsdfVolumeT<Voxel>((Voxel*)data, order, dims, voxel_size, trunc_dist, max_weight, origin); }
       private:
         TsdfVolume& operator=(const TsdfVolume&);
       };
 
+      /** Signs held by the 16^3 (level 0) and 64^3 (level 1) voxel bricks of a TsdfVolume, indexed by storage position.
+        * Integration sets NEGATIVE or POSITIVE for every voxel it writes and never clears them, so the flags only err
+        * towards SURFACE. A brick lacking either bit can't hold a zero crossing and the raycaster leaps over it.
+        * DIRTY marks the bricks written since collect_dirty_bricks last cleared it. */
+      struct TsdfBricks
+      {
+        enum { NEGATIVE = 1, POSITIVE = 2, SURFACE = NEGATIVE | POSITIVE, DIRTY = 4, LEVELS = 2, LOG_SIZE0 = 4, LOG_SIZE1 = 6 };
+
+        unsigned int* flags[LEVELS]; // null disables skipping
+        int3 dims[LEVELS];
+
+        TsdfBricks() {}
+        TsdfBricks(unsigned int* flags, int3 volume_dims);
+
+        /** Flags of all levels for a volume of volume_dims voxels */
+        static int count(int3 volume_dims);
+
+        __vm_device__ unsigned int* operator()(int level, int x, int y, int z) const;
+        __vm_device__ void mark(int x, int y, int z, unsigned int signs) const;
+      };
+
+      /** Sparse counterpart of TsdfVolume: 8^3 voxel blocks allocated on demand and found through an open addressing
+        * hash table keyed by block coordinates. Block 0 of the pool is never handed out and stays empty, every lookup
+        * of unallocated space lands there, so readers see the same zero weight voxels as in the dense volume. */
+      struct HashTsdfVolume
+      {
+      public:
+        typedef ushort4 elem_type;
+        enum { BLOCK_SIZE = 8, BLOCK_VOXELS = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE, MAX_PROBES = 64 };
+
+        elem_type *const data;
+        unsigned long long *const keys;
+        int *const values;
+        int3 *const blocks;
+        int *const blocks_count;
+
+        const int hash_mask;
+        const int max_blocks;
+
+        const int3 dims;
+        const float3 voxel_size;
+        const float trunc_dist;
+        const int max_weight;
+
+        HashTsdfVolume(elem_type* data, unsigned long long* keys, int* values, int3* blocks, int* blocks_count, int hash_size, int max_blocks,
+                       int3 dims, float3 voxel_size, float trunc_dist, int max_weight);
+
+        __vm_device__ elem_type* operator()(int x, int y, int z) const;
+        __vm_device__ elem_type* block(int index) const;
+        __vm_device__ int find(int3 block) const;
+        __vm_device__ void insert(int3 block) const;
+      private:
+        HashTsdfVolume& operator=(const HashTsdfVolume&);
+      };
+
       struct Projector
       {
         float2 f, c;
@@ -60,12 +177,20 @@ namespace vm
         __vm_device__ float2 operator()(const float3& p) const;
       };
 
+      /** With rays set the pixel rays are looked up there instead of being computed from finv and c, with the same
+        * results, as the lookup table was made by the same math */
       struct Reprojector
       {
         Reprojector() {}
         Reprojector(float fx, float fy, float cx, float cy);
         float2 finv, c;
+        PtrStep<float4> rays; // x, y on the z = 1 plane, length and inverse length, see computeRays
+
         __vm_device__ float3 operator()(int x, int y, float z) const;
+        /** Length of the pixel's ray up to z = 1, depth times it is the distance along the ray */
+        __vm_device__ float length(int x, int y) const;
+        /** Unit direction of the pixel's ray */
+        __vm_device__ float3 direction(int x, int y) const;
       };
 
       struct ComputeIcpHelper
@@ -89,6 +214,7 @@ namespace vm
         PtrStep<ushort> dcurr;
         PtrStep<Normal> ncurr;
         PtrStep<Point> vcurr;
+        PtrStep<float4> rays; // of the level, optional, reproject dcurr when set
 
         ComputeIcpHelper(float dist_thres, float angle_thres);
         void setLevelIntr(int level_index, float fx, float fy, float cx, float cy);
@@ -100,22 +226,53 @@ namespace vm
 
         //private:
         __vm_device__ int find_coresp(int x, int y, float3& n, float3& d, float3& s) const;
-        __vm_device__ void partial_reduce(const float row[7], PtrStep<float>& partial_buffer) const;
+        /** row[0..6] make A and b, row[6]^2, row[7] (inlier) and row[8] (has a point) are summed after them */
+        __vm_device__ void partial_reduce(const float row[9], PtrStep<float>& partial_buffer) const;
         __vm_device__ float2 proj(const float3& p) const;
         __vm_device__ float3 reproj(float x, float y, float z)  const;
+        /** reproj of a dcurr pixel, from rays when they are set */
+        __vm_device__ float3 reproj_curr(int x, int y, float z)  const;
       };
 
       //tsdf volume functions
       void clear_volume(TsdfVolume volume);
+      /** Clears the voxels in [beg, end) only */
+      void clear_volume(TsdfVolume volume, int3 beg, int3 end);
       //void integrate(const Dists& depth, TsdfVolume& volume, const Aff3f& aff, const Projector& proj);
-      void integrate(const Dists& depth, const Image& colors, TsdfVolume& volume, const Aff3f& aff, const Projector& proj);
-
-      void raycast(const TsdfVolume& volume, const Aff3f& aff, const Mat3f& Rinv,
+      /** Returns the number of voxels skipped for lying outside the camera frustum or beyond the farthest measurement */
+      unsigned long long integrate(const Dists& depth, const Image& colors, TsdfVolume& volume, const TsdfBricks& bricks, const Aff3f& aff, const Projector& proj);
+
+      /** Sets every flag byte to value, 0 for a cleared volume */
+      void reset_bricks(const TsdfBricks& bricks, int value);
+      /** Recomputes the flags of the bricks holding voxels in [beg, end) from their voxels, they become DIRTY */
+      void update_bricks(const TsdfVolume& volume, const TsdfBricks& bricks, int3 beg, int3 end);
+      /** Lists the level 0 bricks that are DIRTY or have a DIRTY +x, +y or +z neighbour, whose zero crossings they own,
+        * or all of them. Returns the number listed, the bits stay until clear_dirty_bricks. */
+      int collect_dirty_bricks(const TsdfBricks& bricks, bool all, PtrSz<int> output);
+      /** Clears the DIRTY bits, once the points of the listed bricks are out */
+      void clear_dirty_bricks(const TsdfBricks& bricks);
+
+      void raycast(const TsdfVolume& volume, const TsdfBricks& bricks, const Aff3f& aff, const Mat3f& Rinv,
                    const Reprojector& reproj, Depth& depth, Normals& normals, float step_factor, float delta_factor);
 
-      void raycast(const TsdfVolume& volume, const Aff3f& aff, const Mat3f& Rinv,
+      void raycast(const TsdfVolume& volume, const TsdfBricks& bricks, const Aff3f& aff, const Mat3f& Rinv,
                    const Reprojector& reproj, Points& points, Normals& normals, float step_factor, float delta_factor);
 
+      /** Tsdf samples taken by the raycasts since the last call, waits for them */
+      unsigned long long raycast_steps();
+
+
+      //hashed tsdf volume functions, blocks_used is the number of allocated blocks
+      void clear_volume(HashTsdfVolume volume, int blocks_used);
+      /** Returns the blocks requested since the last clear, past max_blocks the rest found no room in the pool */
+      int allocate_blocks(const Dists& dists, HashTsdfVolume& volume, const Aff3f& cam2vol, const Reprojector& reproj);
+      void integrate(const Dists& dists, const Image& colors, HashTsdfVolume& volume, int blocks_used, const Aff3f& aff, const Projector& proj);
+
+      void raycast(const HashTsdfVolume& volume, const Aff3f& aff, const Mat3f& Rinv,
+                   const Reprojector& reproj, Depth& depth, Normals& normals, float step_factor, float delta_factor);
+
+      void raycast(const HashTsdfVolume& volume, const Aff3f& aff, const Mat3f& Rinv,
+                   const Reprojector& reproj, Points& points, Normals& normals, float step_factor, float delta_factor);
 
       __vm_device__ ushort2 pack_tsdf(float tsdf, int weight);
       __vm_device__ float unpack_tsdf(ushort2 value, int& weight);
@@ -125,11 +282,21 @@ namespace vm
       __vm_device__ float unpack_tsdf(ushort4 value, int& weight, ushort& rg, ushort& ba);
       __vm_device__ float unpack_tsdf(ushort4 value);
 
+      // the same for every voxel layout, weights saturate at 255 and colors drop what the layout can't hold
+      __vm_device__ void pack_tsdf(float tsdf, int weight, ushort rg, ushort ba, ushort4& voxel);
+      __vm_device__ void pack_tsdf(float tsdf, int weight, ushort rg, ushort ba, voxel6& voxel);
+      __vm_device__ void pack_tsdf(float tsdf, int weight, ushort rg, ushort ba, voxel4& voxel);
+      __vm_device__ float unpack_tsdf(voxel6 value, int& weight, ushort& rg, ushort& ba);
+      __vm_device__ float unpack_tsdf(voxel6 value);
+      __vm_device__ float unpack_tsdf(voxel4 value, int& weight, ushort& rg, ushort& ba);
+      __vm_device__ float unpack_tsdf(voxel4 value);
+
       __vm_device__ ushort2 rgba2ushort(uchar4 color);
       __vm_device__ uchar4 ushort2rgba(ushort2 color);
       
       //image proc functions
-      void compute_dists(const Depth& depth, Dists dists, float2 f, float2 c);
+      void compute_dists(const Reprojector& reproj, const Depth& depth, Dists dists, cudaStream_t stream = 0);
+      void computeRays(const Reprojector& reproj, PtrStepSz<float4> rays);
 
       void truncateDepth(Depth& depth, float max_dist /*meters*/);
       void bilateralFilter(const Depth& src, Depth& dst, int kernel_size, float sigma_spatial, float sigma_depth);
@@ -141,6 +308,20 @@ namespace vm
       void computeNormalsAndMaskDepth(const Reprojector& reproj, Depth& depth, Normals& normals);
       void computePointNormals(const Reprojector& reproj, const Depth& depth, Points& points, Normals& normals);
 
+      /** compute_dists, bilateralFilter, truncateDepth (max_dist <= 0 disables it) and computePointNormals of the filtered depth in one pass */
+      void depthFrontEnd(const Reprojector& reproj, const Depth& depth, Dists dists, Depth& filtered, Points& points, Normals& normals,
+                         int kernel_size, float sigma_spatial, float sigma_depth, float max_dist /*meters*/);
+
+      void foregroundDownsample(const Depth& depth, Depth& small, int level, ushort min_depth, ushort max_depth, cudaStream_t stream = 0);
+      /** intr is fx, fy, cx, cy of the small frame, which can have up to 1024 rows. buffer holds
+        * segmentForegroundBufferSize ints, floor gets the plane or all zero. floor_dist <= 0 skips the fit */
+      void segmentForeground(const PtrStepSz<ushort>& small, float4 intr, float floor_dist, float floor_max_tilt, int depth_jump,
+                             int min_area, int* buffer, PtrStepSz<uchar> mask, float4* floor, cudaStream_t stream = 0);
+      int segmentForegroundBufferSize(int rows, int cols);
+      /** floor_dist <= 0 or an all zero floor keeps the floor */
+      void applyForeground(const Reprojector& reproj, const Depth& depth, const PtrStepSz<uchar>& mask, int level, const float4* floor,
+                           float floor_dist, ushort min_depth, ushort max_depth, Depth& masked, cudaStream_t stream = 0);
+
       void renderImage(const Depth& depth, const Normals& normals, const Reprojector& reproj, const Vec3f& light_pose, Image& image);
       void renderImage(const Points& points, const Normals& normals, const Reprojector& reproj, const Vec3f& light_pose, Image& image);
       void renderTangentColors(const Normals& normals, Image& image);
@@ -149,10 +330,49 @@ namespace vm
 
       //exctraction functionality
       size_t extractCloud(const TsdfVolume& volume, const Aff3f& aff, PtrSz<Point> output);
+      /** Zero crossings found from the voxels in [beg, end), their neighbours may lie outside */
+      size_t extractCloud(const TsdfVolume& volume, const Aff3f& aff, int3 beg, int3 end, PtrSz<Point> output);
+      /** Number of points the call above finds in [beg, end), to size its output exactly */
+      size_t countCloud(const TsdfVolume& volume, int3 beg, int3 end);
+      /** Zero crossings found from the voxels of the listed level 0 bricks, w holds the index of the brick */
+      size_t extractCloud(const TsdfVolume& volume, const Aff3f& aff, const PtrSz<int>& bricks, PtrSz<Point> output);
+      /** Number of points the call above finds in the listed bricks */
+      size_t countCloud(const TsdfVolume& volume, const PtrSz<int>& bricks);
       void extractNormals(const TsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, float4* output);
       void extractTangentColors(const TsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, uchar4* output);
       void extractVertexColors(const TsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, uchar4* output);
 
+      /** Point, tsdf gradient normal and bgr color of a zero crossing, 48 bytes like float12 */
+      struct Surfel
+      {
+        Point point;
+        Normal normal;
+        uchar4 color;
+        int pad[3];
+      };
+
+      /** First pass of the surfel extraction: counts[y * dims.x + x] gets the zero crossings of column (x, y), returns their sum */
+      size_t countSurfels(const TsdfVolume& volume, int* counts);
+      /** Second pass, writes the crossings counted by countSurfels with vertex or tangent colors, output must hold all of them */
+      void extractSurfels(const TsdfVolume& volume, const Aff3f& aff, float gradient_delta_factor, bool tangent_colors,
+                          const int* counts, PtrSz<Surfel> output);
+
+      size_t extractCloud(const HashTsdfVolume& volume, int blocks_used, const Aff3f& aff, PtrSz<Point> output);
+      /** Surfels of the allocated blocks in the two passes above, counts[i] gets the crossings of block i, 1 <= i <= blocks_used */
+      size_t countSurfels(const HashTsdfVolume& volume, int blocks_used, int* counts);
+      void extractSurfels(const HashTsdfVolume& volume, int blocks_used, const Aff3f& aff, float gradient_delta_factor,
+                          bool tangent_colors, const int* counts, PtrSz<Surfel> output);
+      void extractNormals(const HashTsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, float4* output);
+      void extractTangentColors(const HashTsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, uchar4* output);
+      void extractVertexColors(const HashTsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, uchar4* output);
+
+      //marching cubes, returns the vertex count. Both counts are the full ones: when one exceeds its buffer, vertices past the
+      //end were dropped together with their triangles, and a run with buffers of those sizes gets the whole surface
+      size_t extractMesh(const TsdfVolume& volume, const Aff3f& aff, float gradient_delta_factor, PtrSz<Point> vertices, Normal* normals,
+                         uchar4* colors, PtrSz<int> indices, size_t& indices_count);
+      size_t extractMesh(const HashTsdfVolume& volume, const Aff3f& aff, float gradient_delta_factor, PtrSz<Point> vertices, Normal* normals,
+                         uchar4* colors, PtrSz<int> indices, size_t& indices_count);
+
       struct float8  { float x, y, z, w, c1, c2, c3, c4; };
       struct float12 { float x, y, z, w, normal_x, normal_y, normal_z, n4, c1, c2, c3, c4; };
       void mergePointNormal(const DeviceArray<Point>& cloud, const DeviceArray<float8>& normals, const DeviceArray<float12>& output);
@@ -27,9 +27,26 @@ namespace vm
         float getAngleThreshold() const;
         void setAngleThreshold(float angle);
 
+        /** Maximum iterations per level index 0,1,..,3, a level without any isn't used */
         void setIterationsNum(const std::vector<int>& iters);
         int getUsedLevelsNum() const;
 
+        /** Iterations a level runs before it may stop early, 0 by default */
+        void setMinIterationsNum(const std::vector<int>& iters);
+
+        /** A level stops early when the update is below rotation (radians) and translation (meters), or when the rms
+          * point to plane residual of the inliers changes by less than residual_change of the previous iteration's.
+          * Either counts only while at least min_inlier_ratio of the current pixels with a point are inliers. All zero,
+          * the default, always runs the maximum iterations. */
+        void setConvergenceCriteria(float rotation, float translation, float residual_change, float min_inlier_ratio);
+
+        /** Iterations each level ran in the last estimateTransform, fewer than the maximum where it converged */
+        const std::vector<int>& getIterationsDone() const;
+
+        /** Rays of every level of the current frames, see computeRays. Reprojecting the current depth looks them up
+          * then, none are set by default. */
+        void setRays(const std::vector<Rays>& rays);
+
         virtual bool estimateTransform(Affine3f& affine, const Intr& intr, const Frame& curr, const Frame& prev);
 
         /** The function takes masked depth, i.e. it assumes for performance reasons that
@@ -39,9 +56,20 @@ namespace vm
 
         //static Vec3f rodrigues2(const Mat3f& matrix);
       private:
+        /** Updates residual to the one of stats */
+        bool converged(const cv::Vec6f& update, const cv::Vec3f& stats, float& residual) const;
+
         std::vector<int> iters_;
+        std::vector<int> min_iters_;
         float angle_thres_;
         float dist_thres_;
+
+        float min_rotation_update_;
+        float min_translation_update_;
+        float min_residual_change_;
+        float min_inlier_ratio_;
+        std::vector<int> iters_done_;
+        std::vector<Rays> rays_;
         DeviceArray2D<float> buffer_;
 
         struct StreamHelper;
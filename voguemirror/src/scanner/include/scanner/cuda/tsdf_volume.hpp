@@ -12,7 +12,16 @@ namespace vm
 			class  TsdfVolume
  			{
  			public:
- 				TsdfVolume(const cv::Vec3i& dims);
+        /** Bytes per voxel: 8 (half tsdf, 16 bit weight, rgba), 6 (half tsdf, 8 bit weight, rgb) or
+          * 4 (half tsdf, 8 bit weight, no color). The 8 bit weights saturate at 255 whatever the max weight. */
+        enum VoxelLayout { VOXEL_RGBA, VOXEL_RGB, VOXEL_GEOMETRY };
+
+        /** Voxels one x row after the other, or in 8^3 bricks with the voxels of each brick in Morton order, which
+          * keeps the neighbours read by raycasting, interpolation and gradients close together. Bricked volumes
+          * need dims that are multiples of 8. */
+        enum VoxelOrder { ORDER_LINEAR, ORDER_BRICKED };
+
+ 				TsdfVolume(const cv::Vec3i& dims, int layout = VOXEL_RGBA, int order = ORDER_LINEAR);
  				virtual ~TsdfVolume();
 
  				void create(const Vec3i& dims);
@@ -20,6 +29,7 @@ namespace vm
  				Vec3i getDims() const;
  				Vec3f getVoxelSize() const;
 
+        /** Voxels in getOrder() */
  				const CudaData data() const;
  				CudaData data();
 
@@ -29,6 +39,9 @@ namespace vm
  				float getTruncDist() const;
         void setTruncDist(float distance);
 
+        int getLayout() const;
+        int getOrder() const;
+
         int getMaxWeight() const;
         void setMaxWeight(int weight);
 
@@ -41,24 +54,58 @@ namespace vm
         float getGradientDeltaFactor() const;
         void setGradientDeltaFactor(float factor);
 
+        /** Rays leap over bricks of voxels that integrate() has seen only one sign of, on by default */
+        bool getEmptySpaceSkipping() const;
+        void setEmptySpaceSkipping(bool enabled);
+
+        /** Storage index of voxel (0, 0, 0), the volume wraps around at dims along every axis */
         Vec3i getGridOrigin() const;
         void setGridOrigin(const Vec3i& origin);
 
         virtual void clear();
         virtual void applyAffine(const Affine3f& affine);
+
+        /** Moves the volume by whole voxels along its own axes to follow the camera. The surface in the slices that
+          * leave is returned as points in cloud_buffer, grown to hold all of them, then they are cleared and reused on the
+          * other side by moving the grid origin, the remaining voxels aren't copied. */
+        virtual DeviceArray<Point> shift(const Vec3i& voxels, DeviceArray<Point>& cloud_buffer);
         
         //virtual void integrate(const Dists& dists, const Affine3f& camera_pose, const Intr& intr);
         virtual void integrate(const Dists& dists, const Image& colors, const Affine3f& camera_pose, const Intr& intr);
+
+        /** Voxels the last integrate() skipped without projecting them: those behind the camera, outside the image
+          * or farther than the farthest measurement plus the truncation distance, none of which could be updated. */
+        int64 getCulledVoxelsNum() const;
         
-        virtual void raycast(const Affine3f& camera_pose, const Intr& intr, Depth& depth, Normals& normals);
-        virtual void raycast(const Affine3f& camera_pose, const Intr& intr, Cloud& points, Normals& normals);
+        /** rays, if given, are the ones of intr for the output's size, see computeRays */
+        virtual void raycast(const Affine3f& camera_pose, const Intr& intr, Depth& depth, Normals& normals, const Rays& rays = Rays());
+        virtual void raycast(const Affine3f& camera_pose, const Intr& intr, Cloud& points, Normals& normals, const Rays& rays = Rays());
+
+        /** Tsdf samples taken by all rays of the raycasts since the last call. Waits for the device. */
+        int64 fetchRaycastSteps();
 
         void swap(CudaData& data);
 
-        DeviceArray<Point> fetchCloud(DeviceArray<Point>& cloud_buffer) const;
-        void fetchNormals(const DeviceArray<Point>& cloud, DeviceArray<Normal>& normals) const;
-        void fetchTangentColors(const DeviceArray<Point>& cloud, DeviceArray<RGB>& colors) const;
-        void fetchVertexColors(const DeviceArray<Point>& cloud, DeviceArray<RGB>& colors) const;
+        /** Recomputes the brick flags from the voxels, after data() was written directly */
+        void updateBricks();
+
+        virtual DeviceArray<Point> fetchCloud(DeviceArray<Point>& cloud_buffer) const;
+
+        /** Surface points of the 16^3 voxel bricks changed since the last call, each with the index of its brick in w.
+          * changed_bricks receives the indices of those bricks, points kept from them by the caller are stale. After
+          * create, clear, swap or a pose, size or grid origin change every brick is listed. Shifted slices count as
+          * changed. cloud_buffer grows to fit all the points. changed_bricks stays valid until the next call. */
+        virtual DeviceArray<Point> fetchChangedCloud(DeviceArray<Point>& cloud_buffer, DeviceArray<int>& changed_bricks);
+        /** Surface points with their normals and vertex (or tangent) colors in one extraction. A counting sweep comes
+          * first, surfel_buffer grows to fit all of them and the result is a view of exactly that many. */
+        virtual DeviceArray<Surfel> fetchSurfels(DeviceArray<Surfel>& surfel_buffer, bool tangent_colors = false) const;
+        virtual void fetchNormals(const DeviceArray<Point>& cloud, DeviceArray<Normal>& normals) const;
+        virtual void fetchTangentColors(const DeviceArray<Point>& cloud, DeviceArray<RGB>& colors) const;
+        virtual void fetchVertexColors(const DeviceArray<Point>& cloud, DeviceArray<RGB>& colors) const;
+
+        /** Marching cubes surface: each vertex is shared by all its triangles and carries the tsdf gradient normal
+          * and the voxel color. Allocates default sized buffers if empty and grows them when the surface doesn't fit. */
+        virtual Mesh fetchMesh(Mesh& mesh_buffer) const;
         
         struct Entry
         {
@@ -71,19 +118,32 @@ namespace vm
           static half float2half(float value);
         };
 
+      protected:
+        /** For volumes with their own storage, leaves data_ unallocated */
+        TsdfVolume(const Vec3i& dims, bool allocate);
+
       private:
       	CudaData data_;
+        CudaData bricks_;
+        CudaData changed_bricks_;
 
         CudaData color_;
 
+        int layout_;
+        int order_;
         float trunc_dist_;
         int max_weight_;
         Vec3i dims_;
         Vec3f size_;
         Affine3f pose_;
+        Vec3i grid_origin_;
 
         float gradient_delta_factor_;
         float raycast_step_factor_;
+        bool all_bricks_changed_;
+        bool empty_space_skipping_;
+
+        int64 culled_voxels_;
 			};
 		}
 	}
@@ -0,0 +1,28 @@
+#ifndef VM_SCANNER_MARCHING_CUBES_HPP
+#define VM_SCANNER_MARCHING_CUBES_HPP
+
+namespace vm
+{
+	namespace scanner
+	{
+    /** Marching cubes cases shared by the host and device mesh extractors. A cell spans voxels (x..x+1, y..y+1, z..z+1),
+      * its corners are numbered (0,0,0) (1,0,0) (1,1,0) (0,1,0) and then the same at z + 1. Bit i of the case index is set
+      * when corner i has a negative tsdf. Faces with two inside corners on a diagonal always keep those corners apart,
+      * so neighbouring cells agree on every shared face and the mesh has no cracks. */
+    namespace mc
+    {
+      enum { MAX_TRIANGLES = 5 };
+
+      /** Corner offsets of a cell in the numbering above */
+      extern const signed char corners[8][3];
+
+      /** Triangles of each case as triples of cell edges, terminated by -1 */
+      extern const signed char triangles[256][16];
+
+      /** Cell edge e is the +axis edge of voxel (x + dx, y + dy, z + dz), stored as {dx, dy, dz, axis} */
+      extern const signed char edge_owner[12][4];
+    }
+	}
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef VM_SCANNER_PLY_HPP
+#define VM_SCANNER_PLY_HPP
+
+#include <string>
+
+#include <scanner/types.hpp>
+
+namespace vm
+{
+	namespace scanner
+	{
+    /** Writes a binary little endian PLY in a single pass through a large write buffer. Points and normals are CV_32FC4
+      * (Point layout), colors CV_8UC4 (RGB layout), indices CV_32S with three entries per triangle. Empty normals, colors
+      * or indices leave their properties out. Throws cv::Exception if the file can't be written. */
+    void writePly(const std::string& filename, const cv::Mat& points, const cv::Mat& normals = cv::Mat(),
+                  const cv::Mat& colors = cv::Mat(), const cv::Mat& indices = cv::Mat());
+
+    void writePly(const std::string& filename, const cpu::Mesh& mesh);
+
+    /** Saves PLYs on a background thread. Device data is downloaded before save() returns, so the fetch buffers
+      * can be reused right away. One save is in flight at a time, the next one waits for it. */
+    class PlyWriter
+    {
+    public:
+      PlyWriter();
+      ~PlyWriter();
+
+      void save(const std::string& filename, const cuda::Mesh& mesh);
+      void save(const std::string& filename, const cuda::DeviceArray<Point>& cloud,
+                const cuda::DeviceArray<Normal>& normals, const cuda::DeviceArray<RGB>& colors);
+
+      /** Host data is copied, the caller keeps ownership of the mesh buffers */
+      void save(const std::string& filename, const cpu::Mesh& mesh);
+
+      /** Blocks until the pending save is done, returns false if it or any save since the last wait() failed */
+      bool wait();
+      bool busy() const;
+
+      /** File and reason of the first failed save that wait() reported, empty if none did */
+      const std::string& error() const;
+
+    private:
+      struct Impl;
+      cv::Ptr<Impl> impl_;
+
+      PlyWriter(const PlyWriter&);
+      PlyWriter& operator=(const PlyWriter&);
+    };
+	}
+}
+
+#endif
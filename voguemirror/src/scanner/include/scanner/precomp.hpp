@@ -11,6 +11,9 @@
 #include <scanner/cuda/tsdf_volume.hpp>
 #include <scanner/cuda/imgproc.hpp>
 #include <scanner/cuda/projective_icp.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+#include <scanner/cpu/imgproc.hpp>
+#include <scanner/cpu/projective_icp.hpp>
 
 namespace vm
 {
@@ -32,6 +35,16 @@ namespace vm
 			aff.t = device_cast<device::Vec3f>(t);
 			return aff;
 		}
+
+		/** Reprojector of intr, looking the rays up in rays unless they are empty. They must be of a rows x cols frame. */
+		inline device::Reprojector make_reprojector(const Intr& intr, const cuda::Rays& rays, int rows, int cols)
+		{
+			CV_Assert(rays.empty() || (rays.rows() == rows && rays.cols() == cols));
+
+			device::Reprojector reproj(intr.fx, intr.fy, intr.cx, intr.cy);
+			reproj.rays = rays;
+			return reproj;
+		}
 	}
 }
 
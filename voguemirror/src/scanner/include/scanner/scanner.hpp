@@ -6,7 +6,14 @@
 
 #include <scanner/types.hpp>
 #include <scanner/cuda/tsdf_volume.hpp>
+#include <scanner/cuda/hash_tsdf_volume.hpp>
 #include <scanner/cuda/projective_icp.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+#include <scanner/cpu/projective_icp.hpp>
+#include <scanner/ply.hpp>
+#include <scanner/snapshot.hpp>
+#include <scanner/session.hpp>
+#include <scanner/trace.hpp>
 
 namespace vm
 {
@@ -24,8 +31,15 @@ namespace vm
 
     struct  ScannerParams
     {
+      /** BACKEND_CPU runs the whole pipeline on the host cores with the cpu:: volume, ICP and front end and never
+        * touches a device. It fuses the frames Scanner takes in host memory, 8 byte voxels whatever the layout,
+        * and supports neither the sparse nor the shifting volume, nor snapshots. */
+      enum Backend { BACKEND_CUDA, BACKEND_CPU };
+
       static ScannerParams default_params();
 
+      int backend; //Backend
+
       int cols;  //pixels
       int rows;  //pixels
 
@@ -34,15 +48,30 @@ namespace vm
       Vec3i volume_dims; //number of voxels
       Vec3f volume_size; //meters
       Affine3f volume_pose; //meters, inital pose
+      int volume_max_blocks; //8^3 voxel blocks of the sparse volume, 0 selects the dense one
+      float volume_shift_dist; //meters, the dense volume shifts to follow the camera once it moves farther, 0 disables it
+      int volume_voxel_layout; //cuda::TsdfVolume::VoxelLayout of the dense volume, 6 and 4 byte voxels fit 512^3 into 768MB and 512MB
+      int volume_voxel_order; //cuda::TsdfVolume::VoxelOrder of the dense volume, bricked needs dims that are multiples of 8
+
+      std::vector<Affine3f> sensor_poses; //meters, rig extrinsics: sensor i in the frame of sensor 0, [0] is the identity.
+                                          //Empty for a single sensor. All sensors share cols, rows and intr.
 
       float bilateral_sigma_depth;   //meters
       float bilateral_sigma_spatial;   //pixels
       int   bilateral_kernel_size;   //pixels
+      bool  fused_front_end;         //dists, bilateral, truncation and level 0 normals in one pass, false runs the separate reference kernels
+
+      ForegroundParams foreground;   //when enabled only the person's depth reaches tracking and integration
 
       float icp_truncate_depth_dist; //meters
       float icp_dist_thres;          //meters
       float icp_angle_thres;         //radians
-      std::vector<int> icp_iter_num; //iterations for level index 0,1,..,3
+      std::vector<int> icp_iter_num; //iterations for level index 0,1,..,3, the most a level runs
+      std::vector<int> icp_min_iter_num; //iterations a level runs before it may stop early
+      float icp_min_rotation_update;     //radians, a level has converged once the update is below this
+      float icp_min_translation_update;  //meters, and this
+      float icp_min_residual_change;     //relative, or once the inlier residual changes less, 0 disables it
+      float icp_min_inlier_ratio;        //inliers of the pixels with a point, convergence only counts above it
 
       float tsdf_min_camera_movement; //meters, integrate only if exceedes
       float tsdf_trunc_dist;             //meters;
@@ -54,33 +83,131 @@ namespace vm
       Vec3f light_pose; //meters
     };
 
+    /** Times of the stages of the last Scanner frame in ms, filled in only with stage timing on.
+      * Stages that didn't run in that frame stay zero, total is their sum. */
+    struct ScannerTimes
+    {
+      enum Stage { FOREGROUND, DISTS, BILATERAL, PYRAMID, NORMALS, ICP, INTEGRATE, RAYCAST, STAGES_COUNT };
+
+      /** SYNC waits for the device after every stage and measures wall time. GPU_EVENTS records a CUDA event
+        * between stages instead and measures device time without stalling the pipeline. The cpu backend times
+        * host stages as they end, GPU_EVENTS falls back to SYNC there. */
+      enum Mode { OFF, SYNC, GPU_EVENTS };
+
+      double stage_ms[STAGES_COUNT];
+      double total_ms;
+
+      ScannerTimes();
+      void clear();
+      static const char* name(int stage);
+    };
+
     class  Scanner
     {
     public:
       typedef cv::Ptr<Scanner> Ptr;
       
       Scanner(const ScannerParams& params);
+      ~Scanner();
 
       const ScannerParams& params() const;
       ScannerParams& params();
 
+      /** Volume and ICP of the backend in use, the others throw */
       const cuda::TsdfVolume& tsdf() const;
       cuda::TsdfVolume& tsdf();
 
       const cuda::ProjectiveICP& icp() const;
       cuda::ProjectiveICP& icp();
 
+      const cpu::TsdfVolume& cpuTsdf() const;
+      cpu::TsdfVolume& cpuTsdf();
+
+      const cpu::ProjectiveICP& cpuIcp() const;
+      cpu::ProjectiveICP& cpuIcp();
+
       void reset();
 
+      /** Frame already on the device, cuda backend only. With the sparse volume the blocks of a frame that didn't
+        * all fit into the pool are fused as far as they fit and tracking goes on, see getDroppedBlocks. */
       bool operator()(const cuda::Depth& dpeth, const cuda::Image& image = cuda::Image());
 
+      /** Frame in host memory, either backend: the cpu one runs the pipeline on it in place, the cuda one uploads it first */
+      bool operator()(const cpu::Depth& depth, const cpu::Image& image = cpu::Image());
+
+      /** Frame of sensor i of a rig, see ScannerParams::sensor_poses, frames of all sensors in grab order as
+        * MultiCapture delivers them with their grab timestamps. Sensor 0 is tracked as above. The others skip
+        * tracking and raycasting: their foreground and dists run on a CUDA stream of their own, overlapping the rest,
+        * and the frame is held until sensor 0 has a pose at or after its timestamp. It is then integrated at the pose
+        * of sensor 0 interpolated to that time and composed with the extrinsics. A held frame that a newer one of its
+        * sensor replaces goes in at the nearest pose. depth and image must be complete on the device, as upload
+        * leaves them. The default stream waits for their copies without the host doing so, the caller may overwrite
+        * them there once this returns. Returns true only when the model was raycast for a new pose. */
+      bool operator()(int sensor, const cuda::Depth& depth, const cuda::Image& image, int64 timestamp);
+
       void renderImage(cuda::Image& image, int flags = 0);
       void renderImage(cuda::Image& image, const Affine3f& pose, int flags = 0);
 
+      /** Same into host memory, either backend */
+      void renderImage(cpu::Image& image, int flags = 0);
+      void renderImage(cpu::Image& image, const Affine3f& pose, int flags = 0);
+
       Affine3f getCameraPose (int time = -1) const;
 
+      /** Blocks of the sparse volume whose surface found no room in the pool since the last reset, 0 for the dense
+        * volumes. Polled by the caller after each frame, a rising count means volume_max_blocks is too low. */
+      int getDroppedBlocks() const;
+
+      /** Surface points of the slices the volume shifted out since the last call, in world coordinates.
+        * Appends them to cloud, the scanner keeps none of them afterwards. */
+      void fetchShiftedCloud(std::vector<Point>& cloud);
+
+      /** Snapshot of the volume and the camera poses so far, written on a background thread, see SnapshotWriter */
+      void checkpoint(const std::string& filename);
+
+      /** Blocks until the pending checkpoint is written, returns false if it or any since the last call failed */
+      bool waitCheckpoint();
+      const SnapshotWriter& checkpointWriter() const;
+
+      /** Resumes a session from a checkpoint of a volume with the same dims and layout: tracking goes on from its
+        * last pose against the restored volume. Waits for a pending checkpoint first and throws if it failed. */
+      void restore(const std::string& filename);
+
+      /** Records every frame fused from now on, its dists, color and pose, for refuseSession. Compression and writes
+        * happen on a background thread, see SessionRecorder. Closes a running recording first. */
+      void startRecording(const std::string& filename);
+
+      /** Returns false if the recording couldn't be written */
+      bool stopRecording();
+      const SessionRecorder& recorder() const;
+
+      /** Times every stage of operator(), see ScannerTimes::Mode. Off by default unless tracing was turned on
+        * through VM_SCANNER_TRACE, which selects GPU_EVENTS. With tracing on, stages also go into the trace. */
+      void setStageTiming(int mode);
+      const ScannerTimes& getTimes() const;
+
+      /** Rolling histograms of the frames timed so far, per stage and for the whole frame */
+      const TimeHistogram& getHistogram(int stage) const;
+      const TimeHistogram& getFrameHistogram() const;
+
     private:
       void allocate_buffers();
+      void update_rays();
+      void shift_volume();
+      void raycast_prev();
+      void frame_begin();
+      void stage_done(int stage);
+      void frame_done();
+      void add_times();
+      void record(const cuda::Dists& dists, const cuda::Image& image, const Affine3f& pose, int sensor);
+      void record(const cpu::Image& image);
+      const cuda::Depth& foreground(const cuda::Depth& input);
+      const cpu::Depth& foreground(const cpu::Depth& input);
+      bool process(const cpu::Depth& input, const cpu::Image& image);
+      bool on_cpu() const;
+      void hold_sensor_frame(int sensor, const cuda::Depth& input, const cuda::Image& image, int64 timestamp);
+      void integrate_sensor_frame(int sensor, const Affine3f& pose);
+      Affine3f pose_at(int64 timestamp) const;
 
       int frame_counter_;
       ScannerParams params_;
@@ -90,13 +217,95 @@ namespace vm
       cuda::Dists dists_;
       cuda::Frame curr_, prev_;
 
+      // pixel rays per pyramid level, rebuilt when params_.intr changes
+      std::vector<cuda::Rays> rays_;
+      Intr rays_intr_;
+
       cuda::Cloud points_;
       cuda::Normals normals_;
       cuda::Depth depths_;
       cuda::Image images_;
 
+      // foreground segmentation, all of it on the device
+      cuda::Depth fg_small_, fg_depth_;
+      cuda::DeviceArray2D<unsigned char> fg_mask_;
+      cuda::DeviceArray<float> fg_floor_;
+      cuda::DeviceArray<int> fg_buffer_;
+
       cv::Ptr<cuda::TsdfVolume> volume_;
       cv::Ptr<cuda::ProjectiveICP> icp_;
+
+      // a rig sensor after the first, preprocessed on its own stream and held for a pose of sensor 0. Only the
+      // dists and image reach the default stream, they alternate between two buffers so the next frame can be
+      // preprocessed while the held one is still being integrated
+      struct SensorFrame
+      {
+        CUstream_st* stream;
+        CUevent_st* copied;      // the caller's depth and image are read
+
+        cuda::Depth depth;
+        cuda::Depth fg_small, fg_depth;
+        cuda::DeviceArray2D<unsigned char> fg_mask;
+        cuda::DeviceArray<float> fg_floor;
+        cuda::DeviceArray<int> fg_buffer;
+
+        struct Buffers
+        {
+          CUevent_st* ready;     // dists and image are done
+          CUevent_st* consumed;  // the default stream is done with them
+          cuda::Dists dists;
+          cuda::Image image;
+        };
+        Buffers buffers[2];
+        int current;             // buffers of the held or last frame
+
+        int64 timestamp;
+        bool held;
+      };
+      std::vector<SensorFrame> sensors_; // [0] unused
+
+      // the last two timestamped poses of sensor 0, [1] the newest, held frames are integrated between them
+      Affine3f timed_poses_[2];
+      int64 pose_times_[2];
+      int timed_poses_count_;
+
+      Vec3f shift_anchor_; // camera position at which the volume would sit where it started relative to it
+      cuda::DeviceArray<Point> shift_buffer_;
+      std::vector<Point> shifted_cloud_;
+
+      // cpu backend, the same pipeline in host memory
+      cv::Ptr<cpu::TsdfVolume> cpu_volume_;
+      cv::Ptr<cpu::ProjectiveICP> cpu_icp_;
+
+      cpu::Dists cpu_dists_;
+      cpu::Frame cpu_curr_, cpu_prev_;
+      std::vector<cpu::Rays> cpu_rays_;
+
+      cpu::Depth cpu_fg_depth_, cpu_depths_;
+      cpu::Cloud cpu_points_;
+      cpu::Normals cpu_normals_;
+      cpu::Image cpu_images_;
+
+      // cuda backend, host frames and images go through these
+      cuda::Depth depth_upload_;
+      cuda::Image image_upload_, image_download_;
+
+      SnapshotWriter snapshot_writer_;
+      SessionRecorder recorder_;
+
+      int stage_timing_;
+      ScannerTimes times_;
+      int64 stage_start_, frame_start_;
+
+      // GPU_EVENTS: events_[0] marks the frame start, events_[i + 1] the end of stages_[i]
+      std::vector<CUevent_st*> events_;
+      std::vector<int> stages_;
+
+      TimeHistogram histograms_[ScannerTimes::STAGES_COUNT];
+      TimeHistogram frame_histogram_;
+
+      Scanner(const Scanner&);
+      Scanner& operator=(const Scanner&);
     };
   }
 }
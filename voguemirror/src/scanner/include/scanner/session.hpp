@@ -0,0 +1,137 @@
+#ifndef VM_SCANNER_SESSION_HPP
+#define VM_SCANNER_SESSION_HPP
+
+#include <string>
+#include <vector>
+
+#include <scanner/types.hpp>
+#include <scanner/cuda/tsdf_volume.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+
+namespace vm
+{
+	namespace scanner
+	{
+    /** Recording of the frames a Scanner fused, so a session can be fused again offline, little endian:
+      *
+      *   SessionHeader
+      *   frames back to back, each a SessionFrame followed by dists_bytes of dists and color_bytes of color
+      *
+      * Dists are the half float distances along the pixel rays that Scanner integrates (cuda::Dists), after the
+      * foreground segmentation if it was on, stored as a 16 bit PNG of their bits. Color is a JPEG. */
+    struct SessionHeader
+    {
+      enum { MAGIC = 0x5345534D /* "MSES" */, VERSION = 2 };
+
+      unsigned int magic;
+      unsigned int version;
+      int cols, rows;         // pixels
+      float intr[4];          // fx, fy, cx, cy
+      float volume_size[3];   // meters, of the volume fused live
+      float volume_pose[16];  // row major
+      float trunc_dist;
+      int frames;             // 0 until the recording is closed, SessionReader counts them then
+    };
+
+    struct SessionFrame
+    {
+      int frame;                // index of its pose in Scanner::getCameraPose(), from 0 again after a reset
+      int segment;              // bumped when frame goes back, at a reset or a restore, segments don't share a volume
+      int sensor;               // of a multi sensor rig, 0 is the tracked one
+      float pose[16];           // row major camera pose of sensor 0
+      float sensor_pose[16];    // row major, the sensor in the frame of sensor 0
+      unsigned int dists_bytes;
+      unsigned int color_bytes; // 0 for frames without color
+    };
+
+    /** Appends frames to a session file on a background thread. add() only downloads the frame into a ring of
+      * preallocated host slots, the compression and the writes happen on the thread. A frame that finds the ring
+      * full is dropped and counted rather than stalling fusion. Throws cv::Exception if the file can't be opened. */
+    class SessionRecorder
+    {
+    public:
+      SessionRecorder();
+      ~SessionRecorder();
+
+      /** Closes the running recording first. The volume gives the size, pose and truncation distance kept as reference. */
+      void open(const std::string& filename, int cols, int rows, const Intr& intr, const cuda::TsdfVolume& volume, int capacity = 8);
+      void open(const std::string& filename, int cols, int rows, const Intr& intr, const cpu::TsdfVolume& volume, int capacity = 8);
+
+      /** Writes what is queued and the frame count, returns false if any write failed */
+      bool close();
+      bool isOpen() const;
+
+      /** The first failure of the last recording, empty if it had none, kept until the next open() */
+      const std::string& error() const;
+
+      /** Returns false if the frame was dropped. Frames of other sensors of a rig come with their sensor_pose. */
+      bool add(int frame, const Affine3f& pose, const cuda::Dists& dists, const cuda::Image& colors = cuda::Image(),
+               int sensor = 0, const Affine3f& sensor_pose = Affine3f::Identity());
+
+      /** Same for frames fused on the host, the dists in meters are stored as the same half floats */
+      bool add(int frame, const Affine3f& pose, const cpu::Dists& dists, const cpu::Image& colors = cpu::Image(),
+               int sensor = 0, const Affine3f& sensor_pose = Affine3f::Identity());
+
+      int64 recorded() const;
+      int64 dropped() const;
+
+    private:
+      struct Impl;
+      cv::Ptr<Impl> impl_;
+
+      SessionRecorder(const SessionRecorder&);
+      SessionRecorder& operator=(const SessionRecorder&);
+    };
+
+    /** Read only mmap of a session. Frames are indexed on opening, a recording cut short ends at its last whole
+      * frame. Throws cv::Exception if the file can't be mapped or isn't a session. */
+    class SessionReader
+    {
+    public:
+      SessionReader(const std::string& filename);
+      ~SessionReader();
+
+      const SessionHeader& header() const;
+      Intr intr() const;
+
+      int size() const;
+      const SessionFrame& frame(int i) const;
+
+      /** Camera pose of frame i, the pose of sensor 0 composed with the sensor's */
+      Affine3f pose(int i) const;
+
+      /** Highest segment, the one a scan that ended without a reset is in */
+      int lastSegment() const;
+
+      /** Decodes frame i, dists in meters as cpu::TsdfVolume::integrate takes them. colors is left empty for
+        * a frame without color. Safe to call from several threads. */
+      void decode(int i, cpu::Dists& dists, cpu::Image& colors) const;
+
+      /** Same, dists stay half floats and are uploaded as cuda::TsdfVolume::integrate takes them */
+      void decode(int i, cv::Mat_<unsigned short>& dists, cpu::Image& colors) const;
+
+    private:
+      const unsigned char* data_;
+      size_t size_;
+      std::vector<size_t> offsets_;
+
+      SessionReader(const SessionReader&);
+      SessionReader& operator=(const SessionReader&);
+    };
+
+    /** Fuses the frames of one segment of a session again, with the recorded poses or poses[SessionFrame::frame]
+      * when poses isn't empty, e.g. ones refined after the scan, composed with SessionFrame::sensor_pose. The volume sets the resolution, size and pose of the
+      * result and isn't cleared first. segment -1 takes the last one. Returns the number of frames fused.
+      *
+      * Frames are decoded a batch at a time in parallel, then the batch is integrated by slabs of the volume, see
+      * cpu::TsdfVolume::integrate. A batch holds about 2.4MB per 640x480 frame. */
+    int refuseSession(const SessionReader& session, cpu::TsdfVolume& volume, const std::vector<Affine3f>& poses = std::vector<Affine3f>(),
+                      int segment = -1, int batch = 32);
+
+    /** Same on the device, the next frame is decoded on the host while the device integrates the current one */
+    int refuseSession(const SessionReader& session, cuda::TsdfVolume& volume, const std::vector<Affine3f>& poses = std::vector<Affine3f>(),
+                      int segment = -1);
+	}
+}
+
+#endif
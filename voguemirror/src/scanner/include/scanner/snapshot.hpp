@@ -0,0 +1,128 @@
+#ifndef VM_SCANNER_SNAPSHOT_HPP
+#define VM_SCANNER_SNAPSHOT_HPP
+
+#include <string>
+#include <vector>
+
+#include <scanner/types.hpp>
+#include <scanner/cuda/tsdf_volume.hpp>
+
+namespace vm
+{
+	namespace scanner
+	{
+    /** Snapshot of a dense cuda::TsdfVolume, little endian:
+      *
+      *   SnapshotHeader
+      *   voxels of the stored bricks, each at its SnapshotBrick::offset
+      *   SnapshotBrick[bricks] at table_offset, ascending brick index
+      *   Affine3f::matrix[poses] at poses_offset, row major camera poses of the session
+      *
+      * Bricks are the 16^3 voxel storage bricks of the volume (see TsdfVolume::fetchChangedCloud), their voxels in
+      * storage order, x fastest, padded with empty voxels past the volume. Bricks whose voxels are all zero bytes, as
+      * clear() leaves them, are left out. A brick of fewer bytes than brickBytes() is packed: a control byte c < 128
+      * is followed by c + 1 literal voxels, c >= 128 by one voxel repeated c - 126 times. */
+    struct SnapshotHeader
+    {
+      enum { MAGIC = 0x5344544D /* "MTDS" */, VERSION = 1, BRICK_SIZE = 16 };
+
+      unsigned int magic;
+      unsigned int version;
+      int layout;          // cuda::TsdfVolume::VoxelLayout
+      int voxel_bytes;
+      int dims[3];
+      float size[3];       // meters
+      float pose[16];      // row major
+      float trunc_dist;
+      int max_weight;
+      int grid_origin[3];
+      int bricks;          // stored ones
+      int poses;
+      int reserved;
+      uint64 table_offset;
+      uint64 poses_offset;
+
+      /** Bricks along each axis */
+      Vec3i brickDims() const;
+      size_t brickBytes() const;
+    };
+
+    struct SnapshotBrick
+    {
+      int index;           // (z * brick_dims[1] + y) * brick_dims[0] + x
+      unsigned int bytes;  // brickBytes() for a brick stored as is
+      uint64 offset;       // from the start of the file
+    };
+
+    /** Writes the volume and the poses. The voxels are downloaded a brick layer at a time and only the non empty
+      * bricks are kept on the host. compress packs runs of equal voxels. Throws cv::Exception on failure. */
+    void saveSnapshot(const std::string& filename, const cuda::TsdfVolume& volume,
+                      const std::vector<Affine3f>& poses = std::vector<Affine3f>(), bool compress = true);
+
+    /** Replaces the voxels, pose, size, truncation distance, max weight and grid origin of a volume with the dims
+      * and voxel layout of the snapshot, uploading a brick layer at a time. The poses go to poses if it isn't null. */
+    void loadSnapshot(const std::string& filename, cuda::TsdfVolume& volume, std::vector<Affine3f>* poses = 0);
+
+    /** Read only mmap of a snapshot, for inspecting volumes on the cpu without a device. Throws cv::Exception if
+      * the file can't be mapped or isn't a snapshot. */
+    class SnapshotReader
+    {
+    public:
+      SnapshotReader(const std::string& filename);
+      ~SnapshotReader();
+
+      const SnapshotHeader& header() const;
+      const SnapshotBrick& brick(int i) const;
+
+      /** Position of brick index in the table, -1 if it wasn't stored */
+      int find(int index) const;
+
+      /** Voxels of stored brick i, in place if it isn't packed, otherwise unpacked into buffer */
+      const unsigned char* voxels(int i, std::vector<unsigned char>& buffer) const;
+
+      /** Voxel (x, y, z) in volume coordinates, false for voxels of bricks left out, which are empty */
+      bool voxel(int x, int y, int z, float& tsdf, int& weight) const;
+
+      std::vector<Affine3f> poses() const;
+
+    private:
+      const unsigned char* data_;
+      size_t size_;
+
+      // last brick unpacked by voxel()
+      mutable int cached_;
+      mutable std::vector<unsigned char> cache_;
+
+      SnapshotReader(const SnapshotReader&);
+      SnapshotReader& operator=(const SnapshotReader&);
+    };
+
+    /** Checkpoints on a background thread. The non empty bricks are downloaded before save() returns, so fusion can
+      * go on right away, packing and writing happen on the thread. One save is in flight at a time. */
+    class SnapshotWriter
+    {
+    public:
+      SnapshotWriter();
+      ~SnapshotWriter();
+
+      void save(const std::string& filename, const cuda::TsdfVolume& volume,
+                const std::vector<Affine3f>& poses = std::vector<Affine3f>(), bool compress = true);
+
+      /** Blocks until the pending save is done, returns false if it or any save since the last wait() failed */
+      bool wait();
+      bool busy() const;
+
+      /** File and reason of the first failed save that wait() reported, empty if none did */
+      const std::string& error() const;
+
+    private:
+      struct Impl;
+      cv::Ptr<Impl> impl_;
+
+      SnapshotWriter(const SnapshotWriter&);
+      SnapshotWriter& operator=(const SnapshotWriter&);
+    };
+	}
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef VM_SCANNER_TRACE_HPP
+#define VM_SCANNER_TRACE_HPP
+
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+namespace vm
+{
+	namespace scanner
+	{
+    /** Rolling histogram over the last WINDOW samples, in log spaced bins from 0.01ms growing by 2^(1/4) */
+    class TimeHistogram
+    {
+    public:
+      enum { WINDOW = 1024, BINS = 64 };
+
+      TimeHistogram();
+
+      void add(double ms);
+      void clear();
+
+      int count() const;
+      double mean() const;
+      double max() const;
+
+      /** p-th quantile (p in [0, 1]), interpolated within its bin and clamped to the largest sample */
+      double percentile(double p) const;
+
+      int bin(int index) const;
+      static double binUpper(int index);
+      static int binIndex(double ms);
+
+    private:
+      double samples_[WINDOW];
+      int bins_[BINS];
+      int pos_, count_;
+      double sum_;
+    };
+
+    /** Records named nested scopes into a per thread ring of RING_SIZE events, recording takes no locks and with
+      * tracing off a scope costs a single branch. Setting VM_SCANNER_TRACE=<file> in the environment turns tracing
+      * on at startup and makes <file> the default Chrome trace output. */
+    class Trace
+    {
+    public:
+      enum { RING_SIZE = 1 << 15 };
+
+      static void setEnabled(bool enable);
+      static bool enabled();
+
+      /** Name of the calling thread in the trace */
+      static void setThreadName(const char* name);
+
+      /** Names must outlive the trace, string literals are what's expected */
+      static void begin(const char* name);
+      static void end();
+
+      /** Adds a span measured elsewhere in cv::getTickCount() units. Spans on the GPU go to their own track. */
+      static void record(const char* name, int64 begin_ticks, int64 end_ticks, bool gpu = false);
+
+      /** Chrome trace JSON (chrome://tracing, Perfetto) of the events the rings still hold. Safe while threads keep
+        * recording, events overwritten during the export are left out. An empty filename uses VM_SCANNER_TRACE. */
+      static bool writeChromeTrace(const std::string& filename = std::string());
+
+      static void clear();
+    };
+
+    class TraceScope
+    {
+    public:
+      explicit TraceScope(const char* name) : active_(Trace::enabled()) { if (active_) Trace::begin(name); }
+      ~TraceScope() { if (active_) Trace::end(); }
+
+    private:
+      bool active_;
+
+      TraceScope(const TraceScope&);
+      TraceScope& operator=(const TraceScope&);
+    };
+	}
+}
+
+#endif
@@ -11,6 +11,7 @@
 #include <scanner/cuda/device_array.hpp>
 
 struct CUevent_st;
+struct CUstream_st;
 
 namespace vm
 {
@@ -32,6 +33,20 @@ namespace vm
 
      std::ostream& operator << (std::ostream& os, const Intr& intr);
 
+    /** Segmentation of the person in a depth frame: a depth band, a floor plane fit and the largest connected
+      * component, found on a downsampled frame and applied back at full resolution */
+    struct ForegroundParams
+    {
+      bool enabled;
+      int level;            //pyramid level the segmentation runs at, 2 is 160x120 for 640x480
+      float min_depth;      //meters
+      float max_depth;      //meters
+      float floor_dist;     //meters, points closer to the floor plane or below it are background, 0 skips the fit
+      float floor_max_tilt; //radians, between the floor normal and the camera's up (-y) axis
+      float depth_jump;     //meters, neighbours farther apart along z aren't connected
+      int min_area;         //pixels at level, a smaller largest component leaves nothing in the frame
+    };
+
     struct Point
     {
       union
@@ -52,6 +67,21 @@ namespace vm
       };
     };
 
+    /** Surface point with its normal and color, interleaved for a single download */
+    struct Surfel
+    {
+      Point point;
+      Normal normal;
+      RGB color;
+      int pad[3];
+    };
+
+    /** Ray through a pixel: x and y where it crosses the z = 1 plane, its length up to there and the inverse */
+    struct Ray
+    {
+      float x, y, length, inv_length;
+    };
+
     struct PixelRGB
     {
       unsigned char r, g, b;
@@ -65,6 +95,39 @@ namespace vm
       typedef cuda::DeviceArray2D<RGB> Image;
       typedef cuda::DeviceArray2D<Normal> Normals;
       typedef cuda::DeviceArray2D<Point> Cloud;
+      typedef cuda::DeviceArray2D<Ray> Rays;
+
+      /** Indexed triangle mesh, every three consecutive indices make a triangle */
+      struct Mesh
+      {
+        DeviceArray<Point> vertices;
+        DeviceArray<Normal> normals;
+        DeviceArray<RGB> colors;
+        DeviceArray<int> indices;
+      };
+
+      /** Host image in page-locked memory, uploads from it go straight over DMA instead of through the driver's
+        * pageable staging copy. mat() is a header over the locked memory, keep it at its size and type. */
+      class PageLockedMat
+      {
+      public:
+        PageLockedMat();
+        PageLockedMat(int rows, int cols, int type);
+        ~PageLockedMat();
+
+        void create(int rows, int cols, int type);
+        void release();
+
+        cv::Mat& mat() { return mat_; }
+        const cv::Mat& mat() const { return mat_; }
+
+      private:
+        void* data_;
+        cv::Mat mat_;
+
+        PageLockedMat(const PageLockedMat&);
+        PageLockedMat& operator=(const PageLockedMat&);
+      };
 
       struct Frame
       {
@@ -76,6 +139,32 @@ namespace vm
       };
     }
 
+    namespace cpu
+    {
+      typedef cv::Mat_<unsigned short> Depth;  // millimeters
+      typedef cv::Mat_<float> Dists;           // meters along the pixel ray
+      typedef cv::Mat_<cv::Vec4b> Image;       // same byte layout as RGB
+      typedef cv::Mat_<cv::Vec4f> Normals;     // same layout as Normal
+      typedef cv::Mat_<cv::Vec4f> Cloud;       // same layout as Point
+      typedef cv::Mat_<cv::Vec4f> Rays;        // same layout as Ray
+
+      /** Indexed triangle mesh, every three consecutive indices make a triangle */
+      struct Mesh
+      {
+        Cloud vertices;
+        Normals normals;
+        Image colors;
+        cv::Mat_<int> indices;
+      };
+
+      struct Frame
+      {
+        std::vector<Depth> depth_pyr;
+        std::vector<Cloud> points_pyr;
+        std::vector<Normals> normals_pyr;
+      };
+    }
+
     inline float deg2rad (float alpha) { return alpha * 0.017453293f; }
 
     struct  ScopeTime
@@ -2,6 +2,20 @@
 
 #include <scanner/capture.hpp>
 
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <pthread.h>
+#include <unistd.h>
+
+// the swizzle is built for SSSE3 whatever the compiler flags and picked at run time, like the AVX2 paths of cpu::
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+  #include <immintrin.h>
+  #define VM_SCANNER_HAVE_SSSE3
+  #define __vm_ssse3__ __attribute__((target("ssse3")))
+#endif
+
 using namespace std;
 using namespace xn;
 
@@ -22,6 +36,29 @@ struct vm::scanner::OpenNISource::Impl
 	bool has_image;
 };
 
+namespace
+{
+  /** Creates the generator of the given type that hangs off device. A plain Create() takes whichever device comes
+    * first, so with several sensors plugged in all of them would read the same one. */
+  XnStatus createOnDevice(Context& context, NodeInfo& device, XnProductionNodeType type, ProductionNode& generator)
+  {
+    NodeInfoList list;
+    XnStatus rc = context.EnumerateProductionTrees (type, NULL, list, 0);
+    if (rc != XN_STATUS_OK)
+      return rc;
+
+    for (NodeInfoList::Iterator it = list.Begin (); it != list.End (); ++it)
+    {
+      NodeInfo info = *it;
+      NodeInfoList& needed = info.GetNeededNodes ();
+      for (NodeInfoList::Iterator n = needed.Begin (); n != needed.End (); ++n)
+        if (strcmp ((*n).GetCreationInfo (), device.GetCreationInfo ()) == 0)
+          return context.CreateProductionTree (info, generator);
+    }
+    return XN_STATUS_NO_NODE_PRESENT;
+  }
+}
+
 vm::scanner::OpenNISource::OpenNISource(): depth_focal_length_VGA(0.f), baseline(0.f),
 	shadow_value(0), no_sample_value(0), pixelSize(0.0), max_depth(0) {}
 
@@ -79,7 +116,7 @@ void vm::scanner::OpenNISource::open(int device)
     REPORT_ERROR (impl_->strError);
   }
 
-  rc = impl_->depth.Create (impl_->context);
+  rc = createOnDevice (impl_->context, node, XN_NODE_TYPE_DEPTH, impl_->depth);
   if (rc != XN_STATUS_OK)
   {
     sprintf (impl_->strError, "Depth generator  failed: %s\n", xnGetStatusString (rc));
@@ -89,7 +126,7 @@ void vm::scanner::OpenNISource::open(int device)
   rc = impl_->depth.SetMapOutputMode (mode);
   impl_->has_depth = true;
 
-  rc = impl_->image.Create (impl_->context);
+  rc = createOnDevice (impl_->context, node, XN_NODE_TYPE_IMAGE, impl_->image);
   if (rc != XN_STATUS_OK)
   {
     printf ("Image generator creation failed: %s\n", xnGetStatusString (rc));
@@ -173,9 +210,12 @@ bool vm::scanner::OpenNISource::grab(cv::Mat& depth, cv::Mat& image)
 {
   XnStatus rc = XN_STATUS_OK;
 
+  // only the end of a recording played without repeat ends the stream, anything else is a failed read
   rc = impl_->context.WaitAndUpdateAll ();
+  if (rc == XN_STATUS_EOF)
+    return false;
   if (rc != XN_STATUS_OK)
-      return printf ("Read failed: %s\n", xnGetStatusString (rc)), false;
+    CV_Error(CV_StsError, cv::format("Read failed: %s", xnGetStatusString (rc)));
 
   if (impl_->has_depth)
   {
@@ -212,6 +252,84 @@ bool vm::scanner::OpenNISource::grab(cv::Mat& depth, cv::Mat& image)
   return impl_->has_image || impl_->has_depth;
 }
 
+namespace
+{
+#if defined VM_SCANNER_HAVE_SSSE3
+  /** Returns true if the SSSE3 swizzle can run on this CPU and cv::useOptimized() allows it */
+  bool useSsse3()
+  {
+    static const bool supported = __builtin_cpu_supports("ssse3") != 0;
+    return supported && cv::useOptimized();
+  }
+
+  /** Swizzles whole groups of 4 pixels, returns how many pixels it converted */
+  __vm_ssse3__ size_t packRGBASsse3(const XnRGB24Pixel* src, vm::scanner::RGB* dst, size_t count)
+  {
+    const __m128i swizzle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+
+    // each load reads 16 bytes for 4 pixels, so stop while the next one would run past the end
+    size_t i = 0;
+    for(; i + 6 <= count; i += 4)
+    {
+      __m128i rgb = _mm_loadu_si128((const __m128i*)(src + i));
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_shuffle_epi8(rgb, swizzle), alpha));
+    }
+    return i;
+  }
+#endif
+
+  /** RGB24 -> RGB (b, g, r, 255 in memory) */
+  void packRGBA(const XnRGB24Pixel* src, vm::scanner::RGB* dst, size_t count)
+  {
+    size_t i = 0;
+#if defined VM_SCANNER_HAVE_SSSE3
+    if (useSsse3())
+      i = packRGBASsse3(src, dst, count);
+#endif
+    for(; i < count; ++i)
+      dst[i].bgra = (int)(0xFF000000 | (src[i].nRed << 16) | (src[i].nGreen << 8) | src[i].nBlue);
+  }
+}
+
+bool vm::scanner::OpenNISource::grabRGBA(cv::Mat& depth, cv::Mat& image, bool copy_depth)
+{
+  XnStatus rc = XN_STATUS_OK;
+
+  // only the end of a recording played without repeat ends the stream, anything else is a failed read
+  rc = impl_->context.WaitAndUpdateAll ();
+  if (rc == XN_STATUS_EOF)
+    return false;
+  if (rc != XN_STATUS_OK)
+    CV_Error(CV_StsError, cv::format("Read failed: %s", xnGetStatusString (rc)));
+
+  if (impl_->has_depth)
+  {
+    impl_->depth.GetMetaData (impl_->depthMD);
+    cv::Mat map(impl_->depthMD.FullYRes (), impl_->depthMD.FullXRes (), CV_16U, (void*)impl_->depthMD.Data ());
+
+    if (copy_depth)
+      map.copyTo(depth);
+    else
+      depth = map;
+  }
+  else
+    depth.release();
+
+  if (impl_->has_image)
+  {
+    impl_->image.GetMetaData (impl_->imageMD);
+    image.create(impl_->imageMD.FullYRes (), impl_->imageMD.FullXRes (), CV_8UC4);
+    CV_Assert(image.isContinuous());
+
+    packRGBA(impl_->imageMD.RGB24Data (), image.ptr<RGB>(), image.total());
+  }
+  else
+    image.release();
+
+  return impl_->has_image || impl_->has_depth;
+}
+
 void vm::scanner::OpenNISource::getParams()
 {
 	XnStatus rc = XN_STATUS_OK;
@@ -300,4 +418,325 @@ bool vm::scanner::OpenNISource::setRegistration(bool value)
 
   getParams ();
   return rc == XN_STATUS_OK;
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// AsyncCapture
+
+struct vm::scanner::AsyncCapture::Impl
+{
+  // page-locked, so the consumer's uploads from a slot go straight over DMA
+  struct Slot
+  {
+    cuda::PageLockedMat depth, image;
+    int64 timestamp;
+  };
+
+  enum { FRESH = 1 << 8, SLOT_MASK = FRESH - 1, WAIT_US = 500 };
+
+  // the source's grabRGBA, so the ring runs the same on a sensor and on synthetic frames
+  typedef bool (*Grab)(void* source, cv::Mat& depth, cv::Mat& image);
+
+  template<class Source>
+  static bool grab(void* source, cv::Mat& depth, cv::Mat& image) { return static_cast<Source*>(source)->grabRGBA(depth, image); }
+
+  void* source;
+  Grab grab_source;
+  DropPolicy policy;
+  std::vector< cv::Ptr<Slot> > slots;
+
+  pthread_t thread;
+  bool running;
+  volatile int stopping, finished;
+  std::string error; // written by the grab thread before it sets finished
+
+  // LOSSLESS ring: head is advanced by the grab thread, tail by the consumer. At most size-1 frames are queued,
+  // so the slot the consumer got last (tail-1) is never written while it may still be in use.
+  volatile unsigned int head, tail;
+
+  // LATEST_ONLY triple buffer: back belongs to the grab thread, front to the consumer, middle is swapped
+  // between them and carries FRESH while it holds a frame nobody retrieved yet
+  int back, front;
+  volatile int middle;
+
+  volatile int64 grabbed, delivered, dropped;
+
+  Impl(void* src, Grab grab, DropPolicy pol, int capacity) : source(src), grab_source(grab), policy(pol), running(false), stopping(0), finished(0)
+  {
+    CV_Assert(policy == LATEST_ONLY || capacity >= 2);
+    slots.resize(policy == LATEST_ONLY ? 3 : capacity);
+
+    for(size_t i = 0; i < slots.size(); ++i)
+    {
+      slots[i] = new Slot();
+      slots[i]->depth.create(XN_VGA_Y_RES, XN_VGA_X_RES, CV_16U);
+      slots[i]->image.create(XN_VGA_Y_RES, XN_VGA_X_RES, CV_8UC4);
+    }
+    reset();
+  }
+
+  void reset()
+  {
+    stopping = finished = 0;
+    error.clear();
+    head = tail = 0;
+    back = 0, middle = 1, front = 2;
+    grabbed = delivered = dropped = 0;
+  }
+
+  static int exchange(volatile int& value, int next)
+  {
+    int prev;
+    do prev = value; while(!__sync_bool_compare_and_swap(&value, prev, next));
+    return prev;
+  }
+
+  Slot* acquire()
+  {
+    if (policy == LATEST_ONLY)
+      return slots[back];
+
+    while(head - tail >= slots.size() - 1)
+      if (stopping)
+        return 0;
+      else
+        usleep(WAIT_US);
+
+    return slots[head % slots.size()];
+  }
+
+  void publish()
+  {
+    __sync_fetch_and_add(&grabbed, 1);
+
+    if (policy == LATEST_ONLY)
+    {
+      int prev = exchange(middle, back | FRESH);
+      if (prev & FRESH)
+        __sync_fetch_and_add(&dropped, 1);
+      back = prev & SLOT_MASK;
+    }
+    else
+      __sync_fetch_and_add(&head, 1);
+  }
+
+  Slot* take()
+  {
+    if (policy == LATEST_ONLY)
+    {
+      if (!(middle & FRESH))
+        return 0;
+
+      front = exchange(middle, front) & SLOT_MASK;
+      return slots[front];
+    }
+
+    if (tail == head)
+      return 0;
+
+    Slot* slot = slots[tail % slots.size()];
+    __sync_fetch_and_add(&tail, 1);
+    return slot;
+  }
+
+  int queued() const
+  {
+    return policy == LATEST_ONLY ? (middle & FRESH ? 1 : 0) : (int)(head - tail);
+  }
+
+  static void* run(void* pthis)
+  {
+    Impl& impl = *static_cast<Impl*>(pthis);
+    Trace::setThreadName("capture");
+    try
+    {
+      while(!impl.stopping)
+      {
+        Slot* slot = impl.acquire();
+        TraceScope trace("grab");
+        if (!slot || !impl.grab_source(impl.source, slot->depth.mat(), slot->image.mat()))
+          break;
+
+        // host time, so frames of different sensors compare
+        slot->timestamp = cv::getTickCount();
+
+        cv::Mat& image = slot->image.mat();
+        if (image.empty())
+        {
+          image.create(slot->depth.mat().rows, slot->depth.mat().cols, CV_8UC4);
+          image.setTo(cv::Scalar::all(0));
+        }
+        impl.publish();
+      }
+    }
+    catch(const std::exception& e)
+    {
+      impl.error = e.what();
+    }
+    __sync_synchronize();
+    __sync_lock_test_and_set(&impl.finished, 1);
+    return 0;
+  }
+};
+
+vm::scanner::AsyncCapture::AsyncCapture(OpenNISource& source, DropPolicy policy, int capacity)
+  : impl_(new Impl(&source, &Impl::grab<OpenNISource>, policy, capacity)) {}
+
+vm::scanner::AsyncCapture::AsyncCapture(SyntheticSource& source, DropPolicy policy, int capacity)
+  : impl_(new Impl(&source, &Impl::grab<SyntheticSource>, policy, capacity)) {}
+
+vm::scanner::AsyncCapture::~AsyncCapture() { stop(); }
+
+void vm::scanner::AsyncCapture::start()
+{
+  CV_Assert(!impl_->running);
+  impl_->reset();
+
+  if (pthread_create(&impl_->thread, 0, &Impl::run, static_cast<Impl*>(impl_)) != 0)
+    CV_Error(CV_StsError, "Can't start capture thread");
+
+  impl_->running = true;
+}
+
+void vm::scanner::AsyncCapture::stop()
+{
+  if (!impl_->running)
+    return;
+
+  __sync_lock_test_and_set(&impl_->stopping, 1);
+  pthread_join(impl_->thread, 0);
+  impl_->running = false;
+}
+
+bool vm::scanner::AsyncCapture::retrieve(cv::Mat& depth, cv::Mat& image, int64* timestamp)
+{
+  if (!impl_->running)
+    return false;
+
+  for(;;)
+  {
+    // read before take() so a frame published right before the grab thread finished isn't lost
+    bool finished = impl_->finished != 0;
+
+    Impl::Slot* slot = impl_->take();
+    if (slot)
+    {
+      depth = slot->depth.mat();
+      image = slot->image.mat();
+      if (timestamp)
+        *timestamp = slot->timestamp;
+      __sync_fetch_and_add(&impl_->delivered, 1);
+      return true;
+    }
+
+    if (finished)
+    {
+      // a failed read isn't the end of the stream
+      if (!impl_->error.empty())
+        CV_Error(CV_StsError, "AsyncCapture: " + impl_->error);
+      return false;
+    }
+
+    usleep(Impl::WAIT_US);
+  }
+}
+
+vm::scanner::AsyncCapture::Stats vm::scanner::AsyncCapture::stats() const
+{
+  Stats stats;
+  stats.grabbed = impl_->grabbed;
+  stats.delivered = impl_->delivered;
+  stats.dropped = impl_->dropped;
+  stats.queued = impl_->queued();
+  return stats;
+}
+
+bool vm::scanner::AsyncCapture::peek(int64& timestamp) const
+{
+  CV_Assert(impl_->policy == LOSSLESS);
+  if (!impl_->running || impl_->tail == impl_->head)
+    return false;
+
+  // the slot at tail was published before head moved past it and is only rewritten after the next retrieve()
+  timestamp = impl_->slots[impl_->tail % impl_->slots.size()]->timestamp;
+  return true;
+}
+
+bool vm::scanner::AsyncCapture::finished() const { return !impl_->running || impl_->finished != 0; }
+
+std::string vm::scanner::AsyncCapture::error() const { return finished() ? impl_->error : std::string(); }
+
+vm::scanner::AsyncCapture::DropPolicy vm::scanner::AsyncCapture::policy() const { return impl_->policy; }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// MultiCapture
+
+vm::scanner::MultiCapture::MultiCapture(const std::vector<OpenNISource*>& sources, int capacity, double max_wait_ms) : max_wait_ms_(max_wait_ms)
+{
+  CV_Assert(!sources.empty());
+  for(size_t i = 0; i < sources.size(); ++i)
+    captures_.push_back(cv::Ptr<AsyncCapture>(new AsyncCapture(*sources[i], AsyncCapture::LOSSLESS, capacity)));
+}
+
+vm::scanner::MultiCapture::~MultiCapture() { stop(); }
+
+void vm::scanner::MultiCapture::start()
+{
+  for(size_t i = 0; i < captures_.size(); ++i)
+    captures_[i]->start();
+}
+
+void vm::scanner::MultiCapture::stop()
+{
+  for(size_t i = 0; i < captures_.size(); ++i)
+    captures_[i]->stop();
+}
+
+bool vm::scanner::MultiCapture::retrieve(int& sensor, cv::Mat& depth, cv::Mat& image, int64* timestamp)
+{
+  int64 start = cv::getTickCount();
+  int64 max_wait = (int64)(max_wait_ms_ * cv::getTickFrequency() / 1000.0);
+
+  for(;;)
+  {
+    int oldest = -1, waiting = 0;
+    int64 oldest_time = 0;
+
+    for(int i = 0; i < (int)captures_.size(); ++i)
+    {
+      // read before peek() so a frame published right before the grab thread finished isn't lost
+      bool finished = captures_[i]->finished();
+
+      int64 time;
+      if (captures_[i]->peek(time))
+      {
+        if (oldest < 0 || time < oldest_time)
+          oldest = i, oldest_time = time;
+      }
+      else if (!finished)
+        ++waiting;
+      else if (!captures_[i]->error().empty())
+        CV_Error(CV_StsError, cv::format("MultiCapture, sensor %d: ", i) + captures_[i]->error());
+    }
+
+    // a sensor with nothing queued might still deliver an older frame, unless it's late by more than max_wait
+    if (oldest >= 0 && (waiting == 0 || cv::getTickCount() - start > max_wait))
+    {
+      sensor = oldest;
+      return captures_[oldest]->retrieve(depth, image, timestamp);
+    }
+
+    if (oldest < 0 && waiting == 0)
+      return false;
+
+    usleep(WAIT_US);
+  }
+}
+
+int vm::scanner::MultiCapture::size() const { return (int)captures_.size(); }
+
+vm::scanner::AsyncCapture::Stats vm::scanner::MultiCapture::stats(int sensor) const
+{
+  CV_Assert(0 <= sensor && sensor < size());
+  return captures_[sensor]->stats();
+}
@@ -200,6 +200,28 @@ void vm::scanner::cuda::printShortCudaDeviceInfo(int device)
     fflush(stdout);
 }
 
+vm::scanner::cuda::PageLockedMat::PageLockedMat() : data_(0) {}
+vm::scanner::cuda::PageLockedMat::PageLockedMat(int rows, int cols, int type) : data_(0) { create(rows, cols, type); }
+vm::scanner::cuda::PageLockedMat::~PageLockedMat() { release(); }
+
+void vm::scanner::cuda::PageLockedMat::create(int rows, int cols, int type)
+{
+  if (data_ && mat_.rows == rows && mat_.cols == cols && mat_.type() == type)
+    return;
+
+  release();
+  cudaSafeCall( cudaMallocHost(&data_, (size_t)rows * cols * CV_ELEM_SIZE(type)) );
+  mat_ = cv::Mat(rows, cols, type, data_);
+}
+
+void vm::scanner::cuda::PageLockedMat::release()
+{
+  mat_.release();
+  if (data_)
+    cudaSafeCall( cudaFreeHost(data_) );
+  data_ = 0;
+}
+
 vm::scanner::SampledScopeTime::SampledScopeTime(double& time_ms) : time_ms_(time_ms)
 {
     start = (double)cv::getTickCount();
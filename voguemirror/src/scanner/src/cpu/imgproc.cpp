@@ -0,0 +1,1433 @@
+#include <scanner/precomp.hpp>
+#include <scanner/cpu/internal.hpp>
+
+#include <algorithm>
+#include <limits>
+
+using namespace vm::scanner;
+
+////////////////////////////
+// Depth Bilateral Filter //
+////////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Same taps and clamping as device::bilateral_kernel, but the weight is spatial[tap] * range[|center - depth|]
+        * looked up from two tables instead of one exp per tap. The range table ends with a zero that all larger
+        * differences are clamped to. */
+      struct BilateralFilter : public cv::ParallelLoopBody
+      {
+        const Depth& src;
+        Depth& dst;
+
+        int ksz;
+        const float* spatial; // ksz * ksz, indexed by the tap offset from (x - ksz/2, y - ksz/2)
+        const float* range;
+        int range_last;
+        bool use_avx2;
+
+        BilateralFilter(const Depth& s, Depth& d) : src(s), dst(d) {}
+
+        ushort filter_pixel(int x, int y) const
+        {
+          const int half = ksz / 2;
+          int value = src(y, x);
+
+          int tx = std::min(x - half + ksz, src.cols - 1);
+          int ty = std::min(y - half + ksz, src.rows - 1);
+
+          float sum1 = 0;
+          float sum2 = 0;
+
+          for(int cy = std::max(y - half, 0); cy < ty; ++cy)
+          {
+            const ushort* s = src[cy];
+            const float* sw = spatial + (cy - y + half) * ksz;
+
+            for(int cx = std::max(x - half, 0); cx < tx; ++cx)
+            {
+              int depth = s[cx];
+              float weight = sw[cx - x + half] * range[std::min(std::abs(value - depth), range_last)];
+
+              sum1 += depth * weight;
+              sum2 += weight;
+            }
+          }
+          return sum2 > 0 ? (ushort)cvRound(sum1 / sum2) : 0;
+        }
+
+        int filter_row_avx2(int y, ushort* d) const;
+
+        void filter_row(int y, ushort* d) const
+        {
+          // lanes need all taps inside the clamped window, the borders go scalar
+          int x = 0;
+          for(; x < src.cols && x < ksz / 2; ++x)
+            d[x] = filter_pixel(x, y);
+
+          if (use_avx2)
+            x = filter_row_avx2(y, d);
+
+          for(; x < src.cols; ++x)
+            d[x] = filter_pixel(x, y);
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int y = range.start; y < range.end; ++y)
+            filter_row(y, dst[y]);
+        }
+      };
+
+#if defined VM_SCANNER_HAVE_AVX2
+      /** Filters 8 neighbouring pixels per iteration, summing the taps in the scalar order. Returns the first x left. */
+      __vm_avx2__
+      int BilateralFilter::filter_row_avx2(int y, ushort* d) const
+      {
+        const int half = ksz / 2;
+        const __m256i last = _mm256_set1_epi32(range_last);
+
+        int ty = std::min(y - half + ksz, src.rows - 1);
+        int cy0 = std::max(y - half, 0);
+
+        int x = half;
+        for(; x + 7 - half + ksz <= src.cols - 1; x += 8)
+        {
+          __m256i center = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src[y] + x)));
+
+          __m256 sum1 = _mm256_setzero_ps();
+          __m256 sum2 = _mm256_setzero_ps();
+
+          for(int cy = cy0; cy < ty; ++cy)
+          {
+            const ushort* s = src[cy] + x - half;
+            const float* sw = spatial + (cy - y + half) * ksz;
+
+            for(int j = 0; j < ksz; ++j)
+            {
+              __m256i depth = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(s + j)));
+              __m256i diff = _mm256_min_epi32(_mm256_abs_epi32(_mm256_sub_epi32(center, depth)), last);
+
+              __m256 weight = _mm256_mul_ps(_mm256_set1_ps(sw[j]), _mm256_i32gather_ps(range, diff, 4));
+
+              sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_cvtepi32_ps(depth), weight));
+              sum2 = _mm256_add_ps(sum2, weight);
+            }
+          }
+
+          // 0/0 converts to 0x80000000, which the unsigned saturation turns to 0 like the scalar path
+          __m256i result = _mm256_cvtps_epi32(_mm256_div_ps(sum1, sum2));
+          __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+          _mm_storeu_si128((__m128i*)(d + x), packed);
+        }
+        return x;
+      }
+#else
+      int BilateralFilter::filter_row_avx2(int, ushort*) const { return ksz / 2; }
+#endif
+		}
+	}
+}
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Weight tables of BilateralFilter, sigma_depth in mm */
+      struct BilateralTables
+      {
+        std::vector<float> spatial;
+        std::vector<float> range;
+
+        BilateralTables(int kernel_size, float sigma_spatial, float sigma_depth)
+        {
+          float sigma_spatial2_inv_half = 0.5f / (sigma_spatial * sigma_spatial);
+          float sigma_depth2_inv_half = 0.5f / (sigma_depth * sigma_depth);
+
+          const int half = kernel_size / 2;
+          spatial.resize(kernel_size * kernel_size);
+          for(int i = 0; i < kernel_size; ++i)
+            for(int j = 0; j < kernel_size; ++j)
+              spatial[i * kernel_size + j] = std::exp(-((half - i) * (half - i) + (half - j) * (half - j)) * sigma_spatial2_inv_half);
+
+          // exp underflows past 104, so the table only needs to reach that difference
+          int range_size = std::min(65536, (int)std::ceil(std::sqrt(104.f / sigma_depth2_inv_half)) + 1);
+          range.assign(range_size + 1, 0.f);
+          for(int d = 0; d < range_size; ++d)
+            range[d] = std::exp(-(float)d * d * sigma_depth2_inv_half);
+        }
+
+        void setup(BilateralFilter& bf, int kernel_size) const
+        {
+          bf.ksz = kernel_size;
+          bf.spatial = &spatial[0];
+          bf.range = &range[0];
+          bf.range_last = (int)range.size() - 1;
+          bf.use_avx2 = useAvx2();
+        }
+      };
+		}
+	}
+}
+
+void vm::scanner::host::bilateralFilter(const Depth& src, Depth& dst, int kernel_size, float sigma_spatial, float sigma_depth)
+{
+  CV_Assert(src.data != dst.data);
+
+  sigma_depth *= 1000; // meters -> mm
+  BilateralTables tables(kernel_size, sigma_spatial, sigma_depth);
+
+  BilateralFilter bf(src, dst);
+  tables.setup(bf, kernel_size);
+
+  cv::parallel_for_(cv::Range(0, src.rows), bf);
+}
+
+//////////////////////
+// Depth Truncation //
+//////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      inline void truncate_row(ushort* d, int cols, ushort max_mm)
+      {
+        for(int x = 0; x < cols; ++x)
+          d[x] = d[x] > max_mm ? 0 : d[x];
+      }
+		}
+	}
+}
+
+void vm::scanner::host::truncateDepth(Depth& depth, float max_dist /*meters*/)
+{
+  ushort max_mm = static_cast<ushort>(max_dist * 1000.f);
+
+  for(int y = 0; y < depth.rows; ++y)
+    truncate_row(depth[y], depth.cols, max_mm);
+}
+
+/////////////////////////
+// Build Depth Pyramid //
+/////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Host twin of device::pyramid_kernel: mean of the 5x5 taps around the source pixel that are close to it */
+      struct PyramidBuilder : public cv::ParallelLoopBody
+      {
+        enum { D = 5 };
+
+        const Depth& src;
+        Depth& dst;
+
+        float sigma_depth_mult3;
+        bool use_avx2;
+
+        PyramidBuilder(const Depth& s, Depth& d) : src(s), dst(d) {}
+
+        ushort reduce_pixel(int x, int y) const
+        {
+          int center = src(2 * y, 2 * x);
+
+          int tx = std::min(2 * x - D / 2 + D, src.cols - 1);
+          int ty = std::min(2 * y - D / 2 + D, src.rows - 1);
+
+          int sum = 0;
+          int count = 0;
+
+          for(int cy = std::max(0, 2 * y - D / 2); cy < ty; ++cy)
+          {
+            const ushort* s = src[cy];
+            for(int cx = std::max(0, 2 * x - D / 2); cx < tx; ++cx)
+            {
+              int val = s[cx];
+              if (std::abs(val - center) < sigma_depth_mult3)
+              {
+                sum += val;
+                ++count;
+              }
+            }
+          }
+          return (count == 0) ? 0 : (ushort)(sum / count);
+        }
+
+        int reduce_row_avx2(int y) const;
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int y = range.start; y < range.end; ++y)
+          {
+            ushort* d = dst[y];
+
+            int x = 0;
+            if (use_avx2 && dst.cols > 1)
+            {
+              d[0] = reduce_pixel(0, y);
+              x = reduce_row_avx2(y);
+            }
+
+            for(; x < dst.cols; ++x)
+              d[x] = reduce_pixel(x, y);
+          }
+        }
+      };
+
+#if defined VM_SCANNER_HAVE_AVX2
+      /** Reduces 8 neighbouring pixels from x = 1 on, reading the even source columns of 16 wide loads.
+        * Sums stay below 2^24, so the float division truncates to the integer quotient. */
+      __vm_avx2__
+      int PyramidBuilder::reduce_row_avx2(int y) const
+      {
+        const __m256i even = _mm256_set1_epi32(0xffff);
+        const __m256 thres = _mm256_set1_ps(sigma_depth_mult3);
+        const __m256i zero = _mm256_setzero_si256();
+
+        int ty = std::min(2 * y - D / 2 + D, src.rows - 1);
+        int cy0 = std::max(0, 2 * y - D / 2);
+
+        int x = 1;
+        for(; 2 * x + 17 <= src.cols - 1; x += 8)
+        {
+          __m256i center = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(src[2 * y] + 2 * x)), even);
+
+          __m256i sum = zero;
+          __m256i count = zero;
+
+          for(int cy = cy0; cy < ty; ++cy)
+          {
+            const ushort* s = src[cy] + 2 * x - D / 2;
+            for(int k = 0; k < D; ++k)
+            {
+              __m256i val = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(s + k)), even);
+              __m256 diff = _mm256_cvtepi32_ps(_mm256_abs_epi32(_mm256_sub_epi32(val, center)));
+              __m256i close = _mm256_castps_si256(_mm256_cmp_ps(diff, thres, _CMP_LT_OQ));
+
+              sum = _mm256_add_epi32(sum, _mm256_and_si256(val, close));
+              count = _mm256_sub_epi32(count, close);
+            }
+          }
+
+          __m256i result = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(sum), _mm256_cvtepi32_ps(count)));
+          result = _mm256_andnot_si256(_mm256_cmpeq_epi32(count, zero), result);
+
+          __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+          _mm_storeu_si128((__m128i*)(dst[y] + x), packed);
+        }
+        return x;
+      }
+#else
+      int PyramidBuilder::reduce_row_avx2(int) const { return 1; }
+#endif
+		}
+	}
+}
+
+void vm::scanner::host::depthPyr(const Depth& source, Depth& pyramid, float sigma_depth)
+{
+  sigma_depth *= 1000; // meters -> mm
+
+  PyramidBuilder pb(source, pyramid);
+  pb.sigma_depth_mult3 = sigma_depth * 3;
+  pb.use_avx2 = useAvx2();
+
+  cv::parallel_for_(cv::Range(0, pyramid.rows), pb);
+}
+
+////////////////////////////////
+// Compute Points and Normals //
+////////////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Host twin of device::points_normals_kernel and device::compute_normals_kernel. Points are optional,
+        * invalid pixels get qnan normals with the given w and all-qnan points. */
+      struct PointNormalsComputer : public cv::ParallelLoopBody
+      {
+        const Depth& depth;
+        Points* points;
+        Normals& normals;
+
+        float fx_inv, fy_inv, cx, cy;
+        const Rays* rays;
+        float invalid_w;
+        bool use_avx2;
+
+        PointNormalsComputer(const Depth& d, Points* p, Normals& n) : depth(d), points(p), normals(n), rays(0) {}
+
+        /** d0 is the depth row y, d1 the row below it or null for the last row */
+        void compute_pixel(int x, int y, const ushort* d0, const ushort* d1) const
+        {
+          const float qnan = std::numeric_limits<float>::quiet_NaN();
+
+          cv::Vec4f n_out(qnan, qnan, qnan, invalid_w);
+          cv::Vec4f p_out = cv::Vec4f::all(qnan);
+
+          if (x < depth.cols - 1 && d1)
+          {
+            //mm -> meters
+            float z00 = d0[x]   * 0.001f;
+            float z01 = d0[x+1] * 0.001f;
+            float z10 = d1[x]   * 0.001f;
+
+            if (z00 * z01 * z10 != 0)
+            {
+              cv::Vec3f v00 = reproj(x,   y, z00);
+              cv::Vec3f v01 = reproj(x+1, y, z01);
+              cv::Vec3f v10 = reproj(x, y+1, z10);
+
+              cv::Vec3f e1 = v01 - v00, e2 = v10 - v00;
+              float nx = e1[1] * e2[2] - e1[2] * e2[1];
+              float ny = e1[2] * e2[0] - e1[0] * e2[2];
+              float nz = e1[0] * e2[1] - e1[1] * e2[0];
+              float inv = 1.f / std::sqrt(nx * nx + ny * ny + nz * nz);
+
+              n_out = cv::Vec4f(-(nx * inv), -(ny * inv), -(nz * inv), 0.f);
+              p_out = cv::Vec4f(v00[0], v00[1], v00[2], 0.f);
+            }
+          }
+
+          normals(y, x) = n_out;
+          if (points)
+            (*points)(y, x) = p_out;
+        }
+
+        cv::Vec3f reproj(int u, int v, float z) const
+        {
+          if (rays)
+          {
+            const cv::Vec4f& ray = (*rays)(v, u);
+            return cv::Vec3f(z * ray[0], z * ray[1], z);
+          }
+          return cv::Vec3f(z * ((u - cx) * fx_inv), z * ((v - cy) * fy_inv), z);
+        }
+
+        int compute_row_avx2(int y, const ushort* d0, const ushort* d1) const;
+
+        void compute_row(int y, const ushort* d0, const ushort* d1) const
+        {
+          int x = use_avx2 && d1 ? compute_row_avx2(y, d0, d1) : 0;
+          for(; x < depth.cols; ++x)
+            compute_pixel(x, y, d0, d1);
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int y = range.start; y < range.end; ++y)
+            compute_row(y, depth[y], y < depth.rows - 1 ? depth[y + 1] : 0);
+        }
+      };
+
+      struct DepthMasker : public cv::ParallelLoopBody
+      {
+        const Normals& normals;
+        Depth& depth;
+
+        DepthMasker(const Normals& n, Depth& d) : normals(n), depth(d) {}
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int y = range.start; y < range.end; ++y)
+          {
+            const cv::Vec4f* n = normals[y];
+            ushort* d = depth[y];
+
+            for(int x = 0; x < depth.cols; ++x)
+              if (cvIsNaN(n[x][0]))
+                d[x] = 0;
+          }
+        }
+      };
+
+#if defined VM_SCANNER_HAVE_AVX2
+      /** Writes 8 consecutive Vec4f from their x, y, z, w lanes */
+      __vm_avx2__ inline void store_vec4_avx2(float* dst, __m256 x, __m256 y, __m256 z, __m256 w)
+      {
+        __m256 xy_lo = _mm256_unpacklo_ps(x, y), xy_hi = _mm256_unpackhi_ps(x, y);
+        __m256 zw_lo = _mm256_unpacklo_ps(z, w), zw_hi = _mm256_unpackhi_ps(z, w);
+
+        __m256 p04 = _mm256_shuffle_ps(xy_lo, zw_lo, 0x44), p15 = _mm256_shuffle_ps(xy_lo, zw_lo, 0xEE);
+        __m256 p26 = _mm256_shuffle_ps(xy_hi, zw_hi, 0x44), p37 = _mm256_shuffle_ps(xy_hi, zw_hi, 0xEE);
+
+        _mm256_storeu_ps(dst +  0, _mm256_permute2f128_ps(p04, p15, 0x20));
+        _mm256_storeu_ps(dst +  8, _mm256_permute2f128_ps(p26, p37, 0x20));
+        _mm256_storeu_ps(dst + 16, _mm256_permute2f128_ps(p04, p15, 0x31));
+        _mm256_storeu_ps(dst + 24, _mm256_permute2f128_ps(p26, p37, 0x31));
+      }
+
+      __vm_avx2__ inline __m256 load_mm_avx2(const ushort* src)
+      {
+        __m256i z = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)src));
+        return _mm256_mul_ps(_mm256_cvtepi32_ps(z), _mm256_set1_ps(0.001f));
+      }
+
+      /** 8 pixels of a row that has a row below, in the scalar operation order. The rays are computed, which gives the
+        * values a ray table would hold, and is cheaper than gathering them. Returns the first x left. */
+      __vm_avx2__
+      int PointNormalsComputer::compute_row_avx2(int y, const ushort* d0, const ushort* d1) const
+      {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 sign = _mm256_set1_ps(-0.f);
+        const __m256 qnan = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+        const __m256 lane = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+        const __m256 fxi = _mm256_set1_ps(fx_inv), c_x = _mm256_set1_ps(cx);
+
+        float* nptr = (float*)normals[y];
+        float* pptr = points ? (float*)(*points)[y] : 0;
+
+        __m256 yl0 = _mm256_set1_ps(((float)y - cy) * fy_inv), yl1 = _mm256_set1_ps(((float)(y + 1) - cy) * fy_inv);
+
+        int x = 0;
+        for(; x + 8 <= depth.cols - 1; x += 8)
+        {
+          __m256 z00 = load_mm_avx2(d0 + x);
+          __m256 z01 = load_mm_avx2(d0 + x + 1);
+          __m256 z10 = load_mm_avx2(d1 + x);
+
+          __m256 valid = _mm256_cmp_ps(_mm256_mul_ps(_mm256_mul_ps(z00, z01), z10), zero, _CMP_NEQ_UQ);
+
+          __m256 rx0 = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)x), lane), c_x);
+          __m256 rx1 = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)(x + 1)), lane), c_x);
+
+          __m256 xl0 = _mm256_mul_ps(rx0, fxi), xl1 = _mm256_mul_ps(rx1, fxi);
+
+          __m256 v00x = _mm256_mul_ps(z00, xl0), v00y = _mm256_mul_ps(z00, yl0);
+          __m256 v01x = _mm256_mul_ps(z01, xl1), v01y = _mm256_mul_ps(z01, yl0);
+          __m256 v10x = _mm256_mul_ps(z10, xl0), v10y = _mm256_mul_ps(z10, yl1);
+
+          __m256 e1x = _mm256_sub_ps(v01x, v00x), e1y = _mm256_sub_ps(v01y, v00y), e1z = _mm256_sub_ps(z01, z00);
+          __m256 e2x = _mm256_sub_ps(v10x, v00x), e2y = _mm256_sub_ps(v10y, v00y), e2z = _mm256_sub_ps(z10, z00);
+
+          __m256 nx = _mm256_sub_ps(_mm256_mul_ps(e1y, e2z), _mm256_mul_ps(e1z, e2y));
+          __m256 ny = _mm256_sub_ps(_mm256_mul_ps(e1z, e2x), _mm256_mul_ps(e1x, e2z));
+          __m256 nz = _mm256_sub_ps(_mm256_mul_ps(e1x, e2y), _mm256_mul_ps(e1y, e2x));
+
+          __m256 norm2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)), _mm256_mul_ps(nz, nz));
+          __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(norm2));
+
+          nx = _mm256_blendv_ps(qnan, _mm256_xor_ps(_mm256_mul_ps(nx, inv), sign), valid);
+          ny = _mm256_blendv_ps(qnan, _mm256_xor_ps(_mm256_mul_ps(ny, inv), sign), valid);
+          nz = _mm256_blendv_ps(qnan, _mm256_xor_ps(_mm256_mul_ps(nz, inv), sign), valid);
+          __m256 nw = _mm256_blendv_ps(_mm256_set1_ps(invalid_w), zero, valid);
+
+          store_vec4_avx2(nptr + x * 4, nx, ny, nz, nw);
+
+          if (pptr)
+            store_vec4_avx2(pptr + x * 4, _mm256_blendv_ps(qnan, v00x, valid), _mm256_blendv_ps(qnan, v00y, valid),
+                            _mm256_blendv_ps(qnan, z00, valid), _mm256_blendv_ps(qnan, zero, valid));
+        }
+        return x;
+      }
+#else
+      int PointNormalsComputer::compute_row_avx2(int, const ushort*, const ushort*) const { return 0; }
+#endif
+		}
+	}
+}
+
+void vm::scanner::host::computeNormalsAndMaskDepth(const Intr& intr, Depth& depth, Normals& normals, const Rays* rays)
+{
+  PointNormalsComputer pnc(depth, 0, normals);
+  pnc.fx_inv = 1.f/intr.fx;
+  pnc.fy_inv = 1.f/intr.fy;
+  pnc.cx = intr.cx;
+  pnc.cy = intr.cy;
+  pnc.rays = rays;
+  pnc.invalid_w = 0.f;
+  pnc.use_avx2 = useAvx2();
+
+  // masking waits for all normals, the ones of row y read depth of row y + 1
+  cv::parallel_for_(cv::Range(0, depth.rows), pnc);
+  cv::parallel_for_(cv::Range(0, depth.rows), DepthMasker(normals, depth));
+}
+
+void vm::scanner::host::computePointNormals(const Intr& intr, const Depth& depth, Points& points, Normals& normals, const Rays* rays)
+{
+  PointNormalsComputer pnc(depth, &points, normals);
+  pnc.fx_inv = 1.f/intr.fx;
+  pnc.fy_inv = 1.f/intr.fy;
+  pnc.cx = intr.cx;
+  pnc.cy = intr.cy;
+  pnc.rays = rays;
+  pnc.invalid_w = std::numeric_limits<float>::quiet_NaN();
+  pnc.use_avx2 = useAvx2();
+
+  cv::parallel_for_(cv::Range(0, depth.rows), pnc);
+}
+
+///////////////////
+// Compute dists //
+///////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Host twin of device::compute_dists_kernel, the distances stay in float meters */
+      struct DistsComputer : public cv::ParallelLoopBody
+      {
+        const Depth& depth;
+        Dists& dists;
+
+        float fx_inv, fy_inv, cx, cy;
+        const Rays* rays;
+        bool use_avx2;
+
+        DistsComputer(const Depth& d, Dists& ds) : depth(d), dists(ds), rays(0) {}
+
+        int compute_row_avx2(int y) const;
+
+        void compute_row(int y) const
+        {
+          const ushort* d = depth[y];
+          float* out = dists[y];
+          float yl = (y - cy) * fy_inv;
+
+          int x = use_avx2 ? compute_row_avx2(y) : 0;
+          for(; x < depth.cols; ++x)
+          {
+            float lambda;
+            if (rays)
+              lambda = (*rays)(y, x)[2];
+            else
+            {
+              float xl = (x - cx) * fx_inv;
+              lambda = std::sqrt(xl * xl + yl * yl + 1);
+            }
+
+            out[x] = d[x] * lambda * 0.001f; //meters
+          }
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int y = range.start; y < range.end; ++y)
+            compute_row(y);
+        }
+      };
+
+#if defined VM_SCANNER_HAVE_AVX2
+      __vm_avx2__
+      int DistsComputer::compute_row_avx2(int y) const
+      {
+        const __m256 lane = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 mm = _mm256_set1_ps(0.001f);
+
+        const ushort* d = depth[y];
+        float* out = dists[y];
+
+        float yl = (y - cy) * fy_inv;
+        __m256 yl2 = _mm256_set1_ps(yl * yl);
+
+        // the lengths are every fourth float of a ray table row
+        const float* lengths = rays ? (const float*)(*rays)[y] + 2 : 0;
+        const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+
+        int x = 0;
+        for(; x + 8 <= depth.cols; x += 8)
+        {
+          __m256 lambda;
+          if (lengths)
+            lambda = _mm256_i32gather_ps(lengths + x * 4, stride, 4);
+          else
+          {
+            __m256 xl = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)x), lane), _mm256_set1_ps(cx)), _mm256_set1_ps(fx_inv));
+            lambda = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xl, xl), yl2), one));
+          }
+
+          __m256 z = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(d + x))));
+          _mm256_storeu_ps(out + x, _mm256_mul_ps(_mm256_mul_ps(z, lambda), mm));
+        }
+        return x;
+      }
+#else
+      int DistsComputer::compute_row_avx2(int) const { return 0; }
+#endif
+		}
+	}
+}
+
+void vm::scanner::host::compute_dists(const Depth& depth, Dists& dists, const Intr& intr, const Rays* rays)
+{
+  DistsComputer dc(depth, dists);
+  dc.fx_inv = 1.f/intr.fx;
+  dc.fy_inv = 1.f/intr.fy;
+  dc.cx = intr.cx;
+  dc.cy = intr.cy;
+  dc.rays = rays;
+  dc.use_avx2 = useAvx2();
+
+  cv::parallel_for_(cv::Range(0, depth.rows), dc);
+}
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      struct RaysComputer : public cv::ParallelLoopBody
+      {
+        Rays& rays;
+        float fx_inv, fy_inv, cx, cy;
+
+        RaysComputer(Rays& r) : rays(r) {}
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int y = range.start; y < range.end; ++y)
+          {
+            cv::Vec4f* ray = rays[y];
+            float yl = (y - cy) * fy_inv;
+
+            // the math of the computed rays, so lookups give the same results
+            for(int x = 0; x < rays.cols; ++x)
+            {
+              float xl = (x - cx) * fx_inv;
+              float length = std::sqrt(xl * xl + yl * yl + 1);
+              ray[x] = cv::Vec4f(xl, yl, length, 1.f / length);
+            }
+          }
+        }
+      };
+		}
+	}
+}
+
+void vm::scanner::host::computeRays(const Intr& intr, Rays& rays)
+{
+  RaysComputer rc(rays);
+  rc.fx_inv = 1.f/intr.fx;
+  rc.fy_inv = 1.f/intr.fy;
+  rc.cx = intr.cx;
+  rc.cy = intr.cy;
+
+  cv::parallel_for_(cv::Range(0, rays.rows), rc);
+}
+
+///////////////////////////
+// Fused Depth Front End //
+///////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Runs the rows of the separate stages band by band, so a band's source rows, filtered rows and the filtered
+        * row below it are still in cache when its normals are computed. Same row functions, same results. */
+      struct DepthFrontEnd : public cv::ParallelLoopBody
+      {
+        enum { BAND_ROWS = 8 };
+
+        const Depth& depth;
+        Depth& filtered;
+
+        const DistsComputer& dc;
+        const BilateralFilter& bf;
+        const PointNormalsComputer& pnc;
+        ushort max_mm;
+
+        DepthFrontEnd(const Depth& d, Depth& f, const DistsComputer& dc_, const BilateralFilter& bf_, const PointNormalsComputer& pnc_, ushort max)
+          : depth(d), filtered(f), dc(dc_), bf(bf_), pnc(pnc_), max_mm(max) {}
+
+        void filter_row(int y, ushort* out) const
+        {
+          bf.filter_row(y, out);
+          truncate_row(out, depth.cols, max_mm);
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          cv::AutoBuffer<ushort> below_buffer(depth.cols);
+
+          for(int band = range.start; band < range.end; ++band)
+          {
+            int y0 = band * BAND_ROWS;
+            int y1 = std::min(y0 + BAND_ROWS, depth.rows);
+
+            for(int y = y0; y < y1; ++y)
+            {
+              dc.compute_row(y);
+              filter_row(y, filtered[y]);
+            }
+
+            // the first filtered row of the next band belongs to another thread, it is recomputed here
+            const ushort* below = 0;
+            if (y1 < depth.rows)
+            {
+              filter_row(y1, below_buffer);
+              below = below_buffer;
+            }
+
+            for(int y = y0; y < y1; ++y)
+              pnc.compute_row(y, filtered[y], y + 1 < y1 ? filtered[y + 1] : below);
+          }
+        }
+      };
+		}
+	}
+}
+
+void vm::scanner::host::depthFrontEnd(const Intr& intr, const Depth& depth, Dists& dists, Depth& filtered, Points& points, Normals& normals,
+                                      int kernel_size, float sigma_spatial, float sigma_depth, float max_dist, const Rays* rays)
+{
+  CV_Assert(depth.data != filtered.data);
+
+  DistsComputer dc(depth, dists);
+  dc.fx_inv = 1.f/intr.fx;
+  dc.fy_inv = 1.f/intr.fy;
+  dc.cx = intr.cx;
+  dc.cy = intr.cy;
+  dc.rays = rays;
+  dc.use_avx2 = useAvx2();
+
+  BilateralTables tables(kernel_size, sigma_spatial, sigma_depth * 1000 /* meters -> mm */);
+  BilateralFilter bf(depth, filtered);
+  tables.setup(bf, kernel_size);
+
+  PointNormalsComputer pnc(filtered, &points, normals);
+  pnc.fx_inv = 1.f/intr.fx;
+  pnc.fy_inv = 1.f/intr.fy;
+  pnc.cx = intr.cx;
+  pnc.cy = intr.cy;
+  pnc.rays = rays;
+  pnc.invalid_w = std::numeric_limits<float>::quiet_NaN();
+  pnc.use_avx2 = useAvx2();
+
+  ushort max_mm = max_dist > 0 ? static_cast<ushort>(max_dist * 1000.f) : std::numeric_limits<ushort>::max();
+
+  int bands = (depth.rows + DepthFrontEnd::BAND_ROWS - 1) / DepthFrontEnd::BAND_ROWS;
+  cv::parallel_for_(cv::Range(0, bands), DepthFrontEnd(depth, filtered, dc, bf, pnc, max_mm));
+}
+
+///////////////////////////
+// Foreground Extraction //
+///////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      struct ForegroundDownsample : public cv::ParallelLoopBody
+      {
+        const Depth& depth;
+        Depth& small;
+        int level;
+        ushort min_depth, max_depth;
+
+        ForegroundDownsample(const Depth& d, Depth& s) : depth(d), small(s) {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+          const int size = 1 << level;
+          for(int y = range.start; y < range.end; ++y)
+            for(int x = 0; x < small.cols; ++x)
+            {
+              ushort nearest = 0;
+              for(int dy = 0; dy < size; ++dy)
+              {
+                const ushort* d = depth[y * size + dy] + x * size;
+                for(int dx = 0; dx < size; ++dx)
+                  if (d[dx] >= min_depth && d[dx] <= max_depth && (!nearest || d[dx] < nearest))
+                    nearest = d[dx];
+              }
+              small(y, x) = nearest;
+            }
+        }
+      };
+
+      struct ApplyForeground : public cv::ParallelLoopBody
+      {
+        const Depth& depth;
+        const cv::Mat_<uchar>& mask;
+        Depth& masked;
+
+        Intr intr;
+        int level;
+        cv::Vec4f floor;
+        float floor_dist;
+        ushort min_depth, max_depth;
+
+        ApplyForeground(const Depth& d, const cv::Mat_<uchar>& m, Depth& o) : depth(d), mask(m), masked(o) {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+          for(int y = range.start; y < range.end; ++y)
+          {
+            const ushort* d = depth[y];
+            ushort* o = masked[y];
+            const uchar* m = mask[std::min(y >> level, mask.rows - 1)];
+
+            for(int x = 0; x < depth.cols; ++x)
+            {
+              ushort value = d[x];
+              bool keep = value >= min_depth && value <= max_depth && m[std::min(x >> level, mask.cols - 1)];
+
+              if (keep && floor_dist > 0)
+              {
+                float z = value * 0.001f;
+                cv::Vec3f p((x - intr.cx) * z / intr.fx, (y - intr.cy) * z / intr.fy, z);
+                keep = floor[0] * p[0] + floor[1] * p[1] + floor[2] * p[2] + floor[3] >= floor_dist;
+              }
+              o[x] = keep ? value : 0;
+            }
+          }
+        }
+      };
+		}
+	}
+}
+
+void vm::scanner::host::foregroundDownsample(const Depth& depth, Depth& small, int level, ushort min_depth, ushort max_depth)
+{
+  ForegroundDownsample fd(depth, small);
+  fd.level = level;
+  fd.min_depth = min_depth;
+  fd.max_depth = max_depth;
+  cv::parallel_for_(cv::Range(0, small.rows), fd);
+}
+
+void vm::scanner::host::applyForeground(const Intr& intr, const Depth& depth, const cv::Mat_<uchar>& mask, int level, const cv::Vec4f& floor,
+                                        float floor_dist, ushort min_depth, ushort max_depth, Depth& masked)
+{
+  ApplyForeground af(depth, mask, masked);
+  af.intr = intr;
+  af.level = level;
+  af.floor = floor;
+  af.floor_dist = floor_dist;
+  af.min_depth = min_depth;
+  af.max_depth = max_depth;
+  cv::parallel_for_(cv::Range(0, depth.rows), af);
+}
+
+///////////////////////////////
+// Resize Points and Normals //
+///////////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Host twin of device::resize_depth_normals_kernel and device::resize_points_normals_kernel, points are null for the depth one */
+      struct NormalsResizer : public cv::ParallelLoopBody
+      {
+        const Depth* dsrc;
+        const Points* vsrc;
+        const Normals& nsrc;
+        Depth* ddst;
+        Points* vdst;
+        Normals& ndst;
+
+        NormalsResizer(const Normals& ns, Normals& nd) : dsrc(0), vsrc(0), nsrc(ns), ddst(0), vdst(0), ndst(nd) {}
+
+        void resize_depth(int x, int y) const
+        {
+          const float qnan = std::numeric_limits<float>::quiet_NaN();
+          int xs = x * 2, ys = y * 2;
+
+          int d00 = (*dsrc)(ys+0, xs+0), d01 = (*dsrc)(ys+0, xs+1);
+          int d10 = (*dsrc)(ys+1, xs+0), d11 = (*dsrc)(ys+1, xs+1);
+
+          ushort d = 0;
+          cv::Vec4f n = cv::Vec4f::all(qnan);
+
+          if (d00 * d01 != 0 && d10 * d11 != 0)
+          {
+            d = (ushort)((d00 + d01 + d10 + d11)/4);
+
+            const cv::Vec4f& n00 = nsrc(ys+0, xs+0);
+            const cv::Vec4f& n01 = nsrc(ys+0, xs+1);
+            const cv::Vec4f& n10 = nsrc(ys+1, xs+0);
+            const cv::Vec4f& n11 = nsrc(ys+1, xs+1);
+
+            for(int i = 0; i < 3; ++i)
+              n[i] = (n00[i] + n01[i] + n10[i] + n11[i]) * 0.25f;
+          }
+          (*ddst)(y, x) = d;
+          ndst(y, x) = n;
+        }
+
+        void resize_points(int x, int y) const
+        {
+          const float qnan = std::numeric_limits<float>::quiet_NaN();
+          int xs = x * 2, ys = y * 2;
+
+          (*vdst)(y, x) = ndst(y, x) = cv::Vec4f(qnan, qnan, qnan, 0.f);
+
+          const cv::Vec4f& v00 = (*vsrc)(ys+0, xs+0);
+          const cv::Vec4f& v01 = (*vsrc)(ys+0, xs+1);
+          const cv::Vec4f& v10 = (*vsrc)(ys+1, xs+0);
+          const cv::Vec4f& v11 = (*vsrc)(ys+1, xs+1);
+
+          if (cvIsNaN(v00[0] * v01[0] * v10[0] * v11[0]))
+            return;
+
+          const cv::Vec4f& n00 = nsrc(ys+0, xs+0);
+          const cv::Vec4f& n01 = nsrc(ys+0, xs+1);
+          const cv::Vec4f& n10 = nsrc(ys+1, xs+0);
+          const cv::Vec4f& n11 = nsrc(ys+1, xs+1);
+
+          cv::Vec4f v(0.f, 0.f, 0.f, 0.f), n(0.f, 0.f, 0.f, 0.f);
+          for(int i = 0; i < 3; ++i)
+          {
+            v[i] = (v00[i] + v01[i] + v10[i] + v11[i]) * 0.25f;
+            n[i] = (n00[i] + n01[i] + n10[i] + n11[i]) * 0.25f;
+          }
+          (*vdst)(y, x) = v;
+          ndst(y, x) = n;
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int y = range.start; y < range.end; ++y)
+            for(int x = 0; x < ndst.cols; ++x)
+              if (vsrc)
+                resize_points(x, y);
+              else
+                resize_depth(x, y);
+        }
+      };
+		}
+	}
+}
+
+void vm::scanner::host::resizeDepthNormals(const Depth& depth, const Normals& normals, Depth& depth_out, Normals& normals_out)
+{
+  NormalsResizer nr(normals, normals_out);
+  nr.dsrc = &depth;
+  nr.ddst = &depth_out;
+  cv::parallel_for_(cv::Range(0, depth_out.rows), nr);
+}
+
+void vm::scanner::host::resizePointsNormals(const Points& points, const Normals& normals, Points& points_out, Normals& normals_out)
+{
+  NormalsResizer nr(normals, normals_out);
+  nr.vsrc = &points;
+  nr.vdst = &points_out;
+  cv::parallel_for_(cv::Range(0, points_out.rows), nr);
+}
+
+//////////////////
+// Render Image //
+//////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Host twin of device::render_image_kernel and device::vertex_colors_kernel: Phong shading of the points,
+        * lit in the vertex colors when there are any, over the background gradient. Points are reprojected from
+        * depth when it isn't null. */
+      struct Renderer : public cv::ParallelLoopBody
+      {
+        const Depth* depth;
+        const Points* points;
+        const Normals& normals;
+        const Image* colors;
+        Image& image;
+
+        Intr intr;
+        cv::Vec3f light_pose;
+
+        Renderer(const Normals& n, Image& i) : depth(0), points(0), normals(n), colors(0), image(i) {}
+
+        static uchar saturate(float value) { return (uchar)(std::min(std::max(value, 0.f), 1.f) * 255.f); }
+
+        cv::Vec4b shade(int x, int y, const cv::Vec3f& P) const
+        {
+          const cv::Vec4f& n = normals(y, x);
+          cv::Vec3f N(n[0], n[1], n[2]);
+
+          cv::Vec3f L = cv::normalize(light_pose - P);
+          cv::Vec3f V = cv::normalize(-P);
+          cv::Vec3f R = cv::normalize(2 * N * N.dot(L) - L);
+
+          float diffuse = std::max(0.f, N.dot(L));
+          float specular = std::pow(std::max(0.f, R.dot(V)), 20.f);
+
+          if (!colors)
+          {
+            uchar I = saturate(0.3f + 0.5f * diffuse + 0.2f * specular);
+            return cv::Vec4b(I, I, I, 0);
+          }
+
+          // ambient, diffuse and specular coeffs 0.1, 0.7 and 0.2 under a 1.5 light
+          const cv::Vec4b& t = (*colors)(y, x);
+          cv::Vec4b out(0, 0, 0, 0);
+          for(int i = 0; i < 3; ++i)
+          {
+            float D = t[i]/255.f;
+            out[i] = saturate(0.1f * D + 1.5f * 0.7f * D * diffuse + 1.5f * 0.2f * specular);
+          }
+          return out;
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          const float qnan = std::numeric_limits<float>::quiet_NaN();
+
+          for(int y = range.start; y < range.end; ++y)
+          {
+            float w = (float)y / image.rows;
+            cv::Vec4b background(saturate(4.f/255.f * (1 - w) + 236.f/255.f * w),
+                                 saturate(2.f/255.f * (1 - w) + 120.f/255.f * w),
+                                 saturate(2.f/255.f * (1 - w) + 120.f/255.f * w), 0);
+
+            for(int x = 0; x < image.cols; ++x)
+            {
+              cv::Vec3f P(qnan, qnan, qnan);
+              if (depth)
+              {
+                float z = (*depth)(y, x) * 0.001f;
+                if (z != 0)
+                  P = cv::Vec3f(z * (x - intr.cx) / intr.fx, z * (y - intr.cy) / intr.fy, z);
+              }
+              else
+              {
+                const cv::Vec4f& p = (*points)(y, x);
+                P = cv::Vec3f(p[0], p[1], p[2]);
+              }
+
+              image(y, x) = cvIsNaN(P[0]) ? background : shade(x, y, P);
+            }
+          }
+        }
+      };
+
+      struct TangentColors : public cv::ParallelLoopBody
+      {
+        const Normals& normals;
+        Image& image;
+
+        TangentColors(const Normals& n, Image& i) : normals(n), image(i) {}
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int y = range.start; y < range.end; ++y)
+            for(int x = 0; x < image.cols; ++x)
+            {
+              const cv::Vec4f& n = normals(y, x);
+              uchar r = (uchar)(int)((5.f - n[0] * 3.5f) * 25.5f);
+              uchar g = (uchar)(int)((5.f - n[1] * 2.5f) * 25.5f);
+              uchar b = (uchar)(int)((5.f - n[2] * 3.5f) * 25.5f);
+              image(y, x) = cv::Vec4b(b, g, r, 0);
+            }
+        }
+      };
+		}
+	}
+}
+
+void vm::scanner::host::renderImage(const Depth& depth, const Normals& normals, const Intr& intr, const Vec3f& light_pose, Image& image)
+{
+  Renderer r(normals, image);
+  r.depth = &depth;
+  r.intr = intr;
+  r.light_pose = light_pose;
+  cv::parallel_for_(cv::Range(0, image.rows), r);
+}
+
+void vm::scanner::host::renderImage(const Points& points, const Normals& normals, const Image* colors, const Vec3f& light_pose, Image& image)
+{
+  Renderer r(normals, image);
+  r.points = &points;
+  r.colors = colors;
+  r.light_pose = light_pose;
+  cv::parallel_for_(cv::Range(0, image.rows), r);
+}
+
+void vm::scanner::host::renderTangentColors(const Normals& normals, Image& image)
+{ cv::parallel_for_(cv::Range(0, image.rows), TangentColors(normals, image)); }
+
+namespace
+{
+  /** RANSAC plane through the points whose normal is within max_tilt of the camera's up axis, oriented towards the
+    * camera, which has to be above it. All zero if fewer than a twentieth of the points lie within dist of it. */
+  cv::Vec4f fitFloor(const std::vector<cv::Vec3f>& points, float dist, float max_tilt)
+  {
+    enum { ITERATIONS = 64 };
+
+    cv::Vec4f best = cv::Vec4f::all(0.f);
+    if (points.size() < 3)
+      return best;
+
+    // fixed seed, the same frame always segments the same way
+    cv::RNG rng(0x6c6f6f72);
+    const float min_cosine = std::cos(max_tilt);
+    const int n = (int)points.size();
+    size_t best_inliers = std::max<size_t>(3, points.size() / 20) - 1;
+
+    for(int i = 0; i < ITERATIONS; ++i)
+    {
+      const cv::Vec3f& a = points[rng.uniform(0, n)];
+      const cv::Vec3f& b = points[rng.uniform(0, n)];
+      const cv::Vec3f& c = points[rng.uniform(0, n)];
+
+      cv::Vec3f normal = (b - a).cross(c - a);
+      float length = (float)cv::norm(normal);
+      if (length < 1e-9f)
+        continue;
+
+      // camera y points down, the floor normal up
+      normal *= (normal[1] > 0 ? -1.f : 1.f) / length;
+      float d = -normal.dot(a);
+
+      if (-normal[1] < min_cosine || d <= 0)
+        continue;
+
+      size_t inliers = 0;
+      for(int k = 0; k < n; ++k)
+        inliers += std::abs(normal.dot(points[k]) + d) < dist;
+
+      if (inliers > best_inliers)
+      {
+        best_inliers = inliers;
+        best = cv::Vec4f(normal[0], normal[1], normal[2], d);
+      }
+    }
+    return best;
+  }
+}
+
+/////////////////
+// cpu imgproc //
+/////////////////
+
+void vm::scanner::cpu::depthBilateralFilter(const Depth& in, Depth& out, int kernel_size, float sigma_spatial, float sigma_depth)
+{
+  out.create(in.rows, in.cols);
+  host::bilateralFilter(in, out, kernel_size, sigma_spatial, sigma_depth);
+}
+
+void vm::scanner::cpu::depthTruncation(Depth& depth, float threshold)
+{ host::truncateDepth(depth, threshold); }
+
+void vm::scanner::cpu::depthBuildPyramid(const Depth& depth, Depth& pyramid, float sigma_depth)
+{
+  pyramid.create(depth.rows / 2, depth.cols / 2);
+  host::depthPyr(depth, pyramid, sigma_depth);
+}
+
+namespace
+{
+  const vm::scanner::cpu::Rays* raysOf(const vm::scanner::cpu::Rays& rays, int rows, int cols)
+  {
+    CV_Assert(rays.empty() || (rays.rows == rows && rays.cols == cols));
+    return rays.empty() ? 0 : &rays;
+  }
+}
+
+void vm::scanner::cpu::computeRays(const Intr& intr, int rows, int cols, Rays& rays)
+{
+  rays.create(rows, cols);
+  host::computeRays(intr, rays);
+}
+
+void vm::scanner::cpu::computeNormalsAndMaskDepth(const Intr& intr, Depth& depth, Normals& normals, const Rays& rays)
+{
+  normals.create(depth.rows, depth.cols);
+  host::computeNormalsAndMaskDepth(intr, depth, normals, raysOf(rays, depth.rows, depth.cols));
+}
+
+void vm::scanner::cpu::computePointNormals(const Intr& intr, const Depth& depth, Cloud& points, Normals& normals, const Rays& rays)
+{
+  points.create(depth.rows, depth.cols);
+  normals.create(depth.rows, depth.cols);
+  host::computePointNormals(intr, depth, points, normals, raysOf(rays, depth.rows, depth.cols));
+}
+
+void vm::scanner::cpu::computeDists(const Depth& depth, Dists& dists, const Intr& intr, const Rays& rays)
+{
+  dists.create(depth.rows, depth.cols);
+  host::compute_dists(depth, dists, intr, raysOf(rays, depth.rows, depth.cols));
+}
+
+void vm::scanner::cpu::depthFrontEnd(const Intr& intr, const Depth& depth, Dists& dists, Depth& filtered, Cloud& points, Normals& normals,
+                                     int kernel_size, float sigma_spatial, float sigma_depth, float truncate_dist, const Rays& rays)
+{
+  dists.create(depth.rows, depth.cols);
+  filtered.create(depth.rows, depth.cols);
+  points.create(depth.rows, depth.cols);
+  normals.create(depth.rows, depth.cols);
+  host::depthFrontEnd(intr, depth, dists, filtered, points, normals, kernel_size, sigma_spatial, sigma_depth, truncate_dist,
+                      raysOf(rays, depth.rows, depth.cols));
+}
+
+void vm::scanner::cpu::foregroundDownsample(const Depth& depth, Depth& small, const ForegroundParams& params)
+{
+  small.create(depth.rows >> params.level, depth.cols >> params.level);
+  host::foregroundDownsample(depth, small, params.level, (ushort)(params.min_depth * 1000), (ushort)std::min(params.max_depth * 1000, 65535.f));
+}
+
+void vm::scanner::cpu::segmentForeground(const Intr& intr, const Depth& small, const ForegroundParams& params, cv::Mat_<unsigned char>& mask, cv::Vec4f& floor)
+{
+  mask.create(small.rows, small.cols);
+  mask.setTo(0);
+
+  std::vector<cv::Vec3f> points;
+  points.reserve(small.total());
+  for(int y = 0; y < small.rows; ++y)
+    for(int x = 0; x < small.cols; ++x)
+      if (small(y, x))
+      {
+        float z = small(y, x) * 0.001f;
+        points.push_back(cv::Vec3f((x - intr.cx) * z / intr.fx, (y - intr.cy) * z / intr.fy, z));
+      }
+
+  floor = params.floor_dist > 0 ? fitFloor(points, params.floor_dist, params.floor_max_tilt) : cv::Vec4f::all(0.f);
+  bool has_floor = floor != cv::Vec4f::all(0.f);
+
+  // pixels left after the floor, -1 for background, 0 for not labeled yet
+  cv::Mat_<int> labels(small.rows, small.cols);
+  for(int y = 0, i = 0; y < small.rows; ++y)
+    for(int x = 0; x < small.cols; ++x)
+    {
+      bool keep = small(y, x) != 0;
+      if (keep && has_floor)
+      {
+        const cv::Vec3f& p = points[i];
+        keep = floor[0] * p[0] + floor[1] * p[1] + floor[2] * p[2] + floor[3] >= params.floor_dist;
+      }
+      i += small(y, x) != 0;
+      labels(y, x) = keep ? 0 : -1;
+    }
+
+  // 4-connected components whose neighbours are within depth_jump, the largest one is the person
+  const int jump = (int)(params.depth_jump * 1000);
+  const int dx[] = { 1, -1, 0, 0 };
+  const int dy[] = { 0, 0, 1, -1 };
+
+  std::vector<int> stack;
+  int label = 0, best_label = 0, best_area = 0;
+
+  for(int y = 0; y < small.rows; ++y)
+    for(int x = 0; x < small.cols; ++x)
+    {
+      if (labels(y, x))
+        continue;
+
+      int area = 0;
+      labels(y, x) = ++label;
+      stack.push_back(y * small.cols + x);
+
+      while(!stack.empty())
+      {
+        int cy = stack.back() / small.cols, cx = stack.back() % small.cols;
+        stack.pop_back();
+        ++area;
+
+        for(int k = 0; k < 4; ++k)
+        {
+          int nx = cx + dx[k], ny = cy + dy[k];
+          if (nx < 0 || ny < 0 || nx >= small.cols || ny >= small.rows || labels(ny, nx))
+            continue;
+
+          if (std::abs((int)small(ny, nx) - (int)small(cy, cx)) > jump)
+            continue;
+
+          labels(ny, nx) = label;
+          stack.push_back(ny * small.cols + nx);
+        }
+      }
+
+      if (area > best_area)
+      {
+        best_area = area;
+        best_label = label;
+      }
+    }
+
+  if (best_area < params.min_area)
+    return;
+
+  for(int y = 0; y < small.rows; ++y)
+    for(int x = 0; x < small.cols; ++x)
+      mask(y, x) = labels(y, x) == best_label ? 255 : 0;
+}
+
+void vm::scanner::cpu::applyForeground(const Intr& intr, const Depth& depth, const cv::Mat_<unsigned char>& mask, const cv::Vec4f& floor,
+                                       const ForegroundParams& params, Depth& masked)
+{
+  masked.create(depth.rows, depth.cols);
+  float floor_dist = floor != cv::Vec4f::all(0.f) ? params.floor_dist : 0.f;
+  host::applyForeground(intr, depth, mask, params.level, floor, floor_dist,
+                        (ushort)(params.min_depth * 1000), (ushort)std::min(params.max_depth * 1000, 65535.f), masked);
+}
+
+void vm::scanner::cpu::extractForeground(const Intr& intr, const Depth& depth, Depth& masked, const ForegroundParams& params)
+{
+  Depth small;
+  cv::Mat_<unsigned char> mask;
+  cv::Vec4f floor;
+
+  foregroundDownsample(depth, small, params);
+  segmentForeground(intr(params.level), small, params, mask, floor);
+  applyForeground(intr, depth, mask, floor, params, masked);
+}
+
+void vm::scanner::cpu::resizeDepthNormals(const Depth& depth, const Normals& normals, Depth& depth_out, Normals& normals_out)
+{
+  depth_out.create(depth.rows/2, depth.cols/2);
+  normals_out.create(normals.rows/2, normals.cols/2);
+  host::resizeDepthNormals(depth, normals, depth_out, normals_out);
+}
+
+void vm::scanner::cpu::resizePointsNormals(const Cloud& points, const Normals& normals, Cloud& points_out, Normals& normals_out)
+{
+  points_out.create(points.rows/2, points.cols/2);
+  normals_out.create(normals.rows/2, normals.cols/2);
+  host::resizePointsNormals(points, normals, points_out, normals_out);
+}
+
+void vm::scanner::cpu::renderImage(const Depth& depth, const Normals& normals, const Intr& intr, const Vec3f& light_pose, Image& image)
+{
+  image.create(depth.rows, depth.cols);
+  host::renderImage(depth, normals, intr, light_pose, image);
+}
+
+void vm::scanner::cpu::renderImage(const Cloud& points, const Normals& normals, const Intr& /*intr*/, const Vec3f& light_pose, Image& image)
+{
+  image.create(points.rows, points.cols);
+  host::renderImage(points, normals, 0, light_pose, image);
+}
+
+void vm::scanner::cpu::renderTangentColors(const Normals& normals, Image& image)
+{
+  image.create(normals.rows, normals.cols);
+  host::renderTangentColors(normals, image);
+}
+
+void vm::scanner::cpu::renderVertexColors(const Cloud& points, const Normals& normals, const Intr& /*intr*/, const Vec3f& light_pose, const Image& colors, Image& image)
+{
+  CV_Assert(colors.rows == points.rows && colors.cols == points.cols);
+  image.create(points.rows, points.cols);
+  host::renderImage(points, normals, &colors, light_pose, image);
+}
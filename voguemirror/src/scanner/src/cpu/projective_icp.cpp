@@ -0,0 +1,565 @@
+#include <scanner/precomp.hpp>
+#include <scanner/cpu/internal.hpp>
+
+#include <algorithm>
+
+using namespace vm::scanner;
+
+///////////////////////////////
+// host::ComputeIcpHelper //
+///////////////////////////////
+
+vm::scanner::host::ComputeIcpHelper::ComputeIcpHelper(float dist_thres, float angle_thres)
+  : rows(0), cols(0), dcurr(0), ncurr(0), vcurr(0)
+{
+  min_cosine = std::cos(angle_thres);
+  dist2_thres = dist_thres * dist_thres;
+  setLevelIntr(0, 1.f, 1.f, 0.f, 0.f);
+  setAffine(Affine3f::Identity());
+}
+
+void vm::scanner::host::ComputeIcpHelper::setLevelIntr(int level_index, float fx_, float fy_, float cx_, float cy_)
+{
+  int div = 1 << level_index;
+  fx = fx_/div;
+  fy = fy_/div;
+  cx = cx_/div;
+  cy = cy_/div;
+  fx_inv = 1.f/fx;
+  fy_inv = 1.f/fy;
+}
+
+void vm::scanner::host::ComputeIcpHelper::setAffine(const Affine3f& aff)
+{
+  R = aff.rotation();
+  t = aff.translation();
+}
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      inline void accumulate(double* sums, const float row[7])
+      {
+        for(int i = 0, k = 0; i < 6; ++i)
+          for(int j = i; j < 7; ++j, ++k)
+            sums[k] += (double)row[i] * row[j];
+      }
+
+      /** Filters a correspondence the way device::ComputeIcpHelper::find_coresp does and builds its system row */
+      struct IcpAssociation
+      {
+        const ComputeIcpHelper& helper;
+        const Normals& nprev;
+
+        IcpAssociation(const ComputeIcpHelper& h, const Normals& n) : helper(h), nprev(n) {}
+
+        bool project(const cv::Vec3f& s, float& u, float& v) const
+        {
+          u = helper.fx * (s[0] / s[2]) + helper.cx;
+          v = helper.fy * (s[1] / s[2]) + helper.cy;
+          return !(s[2] <= 0 || u < 0 || v < 0 || u >= helper.cols || v >= helper.rows);
+        }
+
+        cv::Vec3f reproj(float u, float v, float z) const
+        {
+          return cv::Vec3f(z * (u - helper.cx) * helper.fx_inv, z * (v - helper.cy) * helper.fy_inv, z);
+        }
+
+        bool finish(int x, int y, int ix, int iy, const cv::Vec3f& s, const cv::Vec3f& d, float row[7]) const
+        {
+          cv::Vec3f diff = s - d;
+          if (diff.dot(diff) > helper.dist2_thres)
+            return false;
+
+          const cv::Vec4f& nc = (*helper.ncurr)(y, x);
+          const cv::Vec4f& np = nprev(iy, ix);
+
+          cv::Vec3f ns = helper.R * cv::Vec3f(nc[0], nc[1], nc[2]);
+          cv::Vec3f nd(np[0], np[1], np[2]);
+
+          if (std::abs(ns.dot(nd)) < helper.min_cosine)
+            return false;
+
+          cv::Vec3f c = s.cross(nd);
+          row[0] = c[0], row[1] = c[1], row[2] = c[2];
+          row[3] = nd[0], row[4] = nd[1], row[5] = nd[2];
+          row[6] = nd.dot(d - s);
+          return true;
+        }
+      };
+
+      struct IcpPoints : public IcpAssociation
+      {
+        const Points& vprev;
+
+        IcpPoints(const ComputeIcpHelper& h, const Points& v, const Normals& n) : IcpAssociation(h, n), vprev(v) {}
+
+        bool find(int x, int y, float row[7]) const
+        {
+          const cv::Vec4f& v = (*helper.vcurr)(y, x);
+          if (cvIsNaN(v[0]))
+            return false;
+
+          cv::Vec3f s = helper.R * cv::Vec3f(v[0], v[1], v[2]) + helper.t;
+
+          float u, w;
+          if (!project(s, u, w))
+            return false;
+
+          int ix = (int)u, iy = (int)w;
+
+          const cv::Vec4f& d = vprev(iy, ix);
+          if (cvIsNaN(d[0]))
+            return false;
+
+          return finish(x, y, ix, iy, s, cv::Vec3f(d[0], d[1], d[2]), row);
+        }
+
+        int reduce_row_avx2(int y, double* sums) const;
+      };
+
+      struct IcpDepth : public IcpAssociation
+      {
+        const Depth& dprev;
+
+        IcpDepth(const ComputeIcpHelper& h, const Depth& d, const Normals& n) : IcpAssociation(h, n), dprev(d) {}
+
+        bool find(int x, int y, float row[7]) const
+        {
+          int src_z = (*helper.dcurr)(y, x);
+          if (src_z == 0)
+            return false;
+
+          cv::Vec3f s = helper.R * reproj((float)x, (float)y, src_z * 0.001f) + helper.t;
+
+          float u, w;
+          if (!project(s, u, w))
+            return false;
+
+          int ix = (int)u, iy = (int)w;
+
+          int dst_z = dprev(iy, ix);
+          if (dst_z == 0)
+            return false;
+
+          return finish(x, y, ix, iy, s, reproj(u, w, dst_z * 0.001f), row);
+        }
+
+        int reduce_row_avx2(int y, double* sums) const;
+      };
+
+      /** Sums of every STRIPE_ROWS rows go to their own partial, so no two threads ever share one */
+      template<typename Association>
+      struct IcpReducer : public cv::ParallelLoopBody
+      {
+        const Association& association;
+        double* partials;
+        bool use_avx2;
+
+        IcpReducer(const Association& a, double* p) : association(a), partials(p), use_avx2(useAvx2()) {}
+
+        void operator()(const cv::Range& range) const
+        {
+          const ComputeIcpHelper& h = association.helper;
+          float row[7];
+
+          for(int stripe = range.start; stripe < range.end; ++stripe)
+          {
+            double* sums = partials + stripe * ComputeIcpHelper::TOTAL;
+            std::fill(sums, sums + ComputeIcpHelper::TOTAL, 0.0);
+
+            int y_end = std::min(h.rows, (stripe + 1) * ComputeIcpHelper::STRIPE_ROWS);
+            for(int y = stripe * ComputeIcpHelper::STRIPE_ROWS; y < y_end; ++y)
+            {
+              int x = use_avx2 ? association.reduce_row_avx2(y, sums) : 0;
+              for(; x < h.cols; ++x)
+                if (association.find(x, y, row))
+                  accumulate(sums, row);
+            }
+          }
+        }
+      };
+
+      template<typename Association>
+      void reduce(const Association& association, double* data)
+      {
+        const int TOTAL = ComputeIcpHelper::TOTAL;
+        const int STRIPE_ROWS = ComputeIcpHelper::STRIPE_ROWS;
+
+        int stripes = (association.helper.rows + STRIPE_ROWS - 1) / STRIPE_ROWS;
+        std::vector<double> partials(std::max(stripes, 1) * TOTAL, 0.0);
+
+        cv::parallel_for_(cv::Range(0, stripes), IcpReducer<Association>(association, &partials[0]));
+
+        // pairwise merge in a fixed order, so the sums don't depend on how the stripes were scheduled
+        for(int step = 1; step < stripes; step *= 2)
+          for(int i = 0; i + step < stripes; i += 2 * step)
+          {
+            double* dst = &partials[i * TOTAL];
+            const double* src = &partials[(i + step) * TOTAL];
+            for(int k = 0; k < TOTAL; ++k)
+              dst[k] += src[k];
+          }
+
+        std::copy(partials.begin(), partials.begin() + TOTAL, data);
+      }
+
+#if defined VM_SCANNER_HAVE_AVX2
+      /** R * p, summed in the same order as cv::Matx33f * cv::Vec3f so both paths round alike */
+      __vm_avx2__ inline void rotate_avx2(const ComputeIcpHelper& h, __m256 px, __m256 py, __m256 pz, __m256& x, __m256& y, __m256& z)
+      {
+        x = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(h.R(0, 0)), px), _mm256_mul_ps(_mm256_set1_ps(h.R(0, 1)), py)), _mm256_mul_ps(_mm256_set1_ps(h.R(0, 2)), pz));
+        y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(h.R(1, 0)), px), _mm256_mul_ps(_mm256_set1_ps(h.R(1, 1)), py)), _mm256_mul_ps(_mm256_set1_ps(h.R(1, 2)), pz));
+        z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(h.R(2, 0)), px), _mm256_mul_ps(_mm256_set1_ps(h.R(2, 1)), py)), _mm256_mul_ps(_mm256_set1_ps(h.R(2, 2)), pz));
+      }
+
+      __vm_avx2__ inline void transform_avx2(const ComputeIcpHelper& h, __m256 px, __m256 py, __m256 pz, __m256& x, __m256& y, __m256& z)
+      {
+        rotate_avx2(h, px, py, pz, x, y, z);
+        x = _mm256_add_ps(x, _mm256_set1_ps(h.t[0]));
+        y = _mm256_add_ps(y, _mm256_set1_ps(h.t[1]));
+        z = _mm256_add_ps(z, _mm256_set1_ps(h.t[2]));
+      }
+
+      /** Projects 8 transformed points, returns valid narrowed to the lanes that land inside the previous frame */
+      __vm_avx2__ inline __m256 project_avx2(const ComputeIcpHelper& h, __m256 sx, __m256 sy, __m256 sz, __m256 valid, __m256& u, __m256& v)
+      {
+        const __m256 zero = _mm256_setzero_ps();
+
+        u = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(h.fx), _mm256_div_ps(sx, sz)), _mm256_set1_ps(h.cx));
+        v = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(h.fy), _mm256_div_ps(sy, sz)), _mm256_set1_ps(h.cy));
+
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(sz, zero, _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, _mm256_set1_ps((float)h.cols), _CMP_LT_OQ));
+        return _mm256_and_ps(valid, _mm256_cmp_ps(v, _mm256_set1_ps((float)h.rows), _CMP_LT_OQ));
+      }
+
+      /** 8 lane IcpAssociation::finish for pixels x..x+7 of row y, rows of filtered lanes add zeros to acc */
+      __vm_avx2__ inline void finish_avx2(const IcpAssociation& a, int x, int y, __m256i iu, __m256i iv,
+                                          __m256 sx, __m256 sy, __m256 sz, __m256 dx, __m256 dy, __m256 dz, __m256 valid, __m256* acc)
+      {
+        const ComputeIcpHelper& h = a.helper;
+        const __m256i lanes4 = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+        const __m256 zero = _mm256_setzero_ps();
+
+        __m256 ex = _mm256_sub_ps(sx, dx), ey = _mm256_sub_ps(sy, dy), ez = _mm256_sub_ps(sz, dz);
+        __m256 dist2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)), _mm256_mul_ps(ez, ez));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(dist2, _mm256_set1_ps(h.dist2_thres), _CMP_NGT_UQ));
+
+        if (!_mm256_movemask_ps(valid))
+          return;
+
+        const float* nc = (const float*)h.ncurr->ptr(y) + x * 4;
+        __m256 ncx = _mm256_i32gather_ps(nc + 0, lanes4, 4);
+        __m256 ncy = _mm256_i32gather_ps(nc + 1, lanes4, 4);
+        __m256 ncz = _mm256_i32gather_ps(nc + 2, lanes4, 4);
+
+        __m256 nsx, nsy, nsz;
+        rotate_avx2(h, ncx, ncy, ncz, nsx, nsy, nsz);
+
+        const float* np = (const float*)a.nprev.ptr();
+        __m256i nindex = _mm256_slli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(iv, _mm256_set1_epi32((int)(a.nprev.step / sizeof(cv::Vec4f)))), iu), 2);
+        __m256 ndx = _mm256_mask_i32gather_ps(zero, np + 0, nindex, valid, 4);
+        __m256 ndy = _mm256_mask_i32gather_ps(zero, np + 1, nindex, valid, 4);
+        __m256 ndz = _mm256_mask_i32gather_ps(zero, np + 2, nindex, valid, 4);
+
+        __m256 cosine = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nsx, ndx), _mm256_mul_ps(nsy, ndy)), _mm256_mul_ps(nsz, ndz));
+        cosine = _mm256_andnot_ps(_mm256_set1_ps(-0.f), cosine);
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(cosine, _mm256_set1_ps(h.min_cosine), _CMP_NLT_UQ));
+
+        __m256 row[7];
+        row[0] = _mm256_sub_ps(_mm256_mul_ps(sy, ndz), _mm256_mul_ps(sz, ndy));
+        row[1] = _mm256_sub_ps(_mm256_mul_ps(sz, ndx), _mm256_mul_ps(sx, ndz));
+        row[2] = _mm256_sub_ps(_mm256_mul_ps(sx, ndy), _mm256_mul_ps(sy, ndx));
+        row[3] = ndx;
+        row[4] = ndy;
+        row[5] = ndz;
+        row[6] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ndx, ex), _mm256_mul_ps(ndy, ey)), _mm256_mul_ps(ndz, ez));
+        row[6] = _mm256_sub_ps(zero, row[6]); // dot(n, d - s)
+
+        for(int i = 0; i < 7; ++i)
+          row[i] = _mm256_and_ps(row[i], valid);
+
+        for(int i = 0, k = 0; i < 6; ++i)
+          for(int j = i; j < 7; ++j, ++k)
+            acc[k] = _mm256_add_ps(acc[k], _mm256_mul_ps(row[i], row[j]));
+      }
+
+      /** Row sums are kept in float lanes and go to the double stripe sums once per row, lanes in a fixed order */
+      __vm_avx2__ inline void flush_avx2(const __m256* acc, double* sums)
+      {
+        float lanes[8];
+        for(int k = 0; k < ComputeIcpHelper::TOTAL; ++k)
+        {
+          _mm256_storeu_ps(lanes, acc[k]);
+
+          double sum = 0.0;
+          for(int l = 0; l < 8; ++l)
+            sum += lanes[l];
+          sums[k] += sum;
+        }
+      }
+
+      __vm_avx2__
+      int IcpPoints::reduce_row_avx2(int y, double* sums) const
+      {
+        const ComputeIcpHelper& h = helper;
+        const __m256i lanes4 = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256i vstep = _mm256_set1_epi32((int)(vprev.step / sizeof(cv::Vec4f)));
+
+        __m256 acc[ComputeIcpHelper::TOTAL];
+        for(int k = 0; k < ComputeIcpHelper::TOTAL; ++k)
+          acc[k] = zero;
+
+        const float* vp = (const float*)vprev.ptr();
+
+        int x = 0;
+        for(; x + 8 <= h.cols; x += 8)
+        {
+          const float* vc = (const float*)h.vcurr->ptr(y) + x * 4;
+          __m256 px = _mm256_i32gather_ps(vc + 0, lanes4, 4);
+          __m256 py = _mm256_i32gather_ps(vc + 1, lanes4, 4);
+          __m256 pz = _mm256_i32gather_ps(vc + 2, lanes4, 4);
+
+          __m256 valid = _mm256_cmp_ps(px, px, _CMP_ORD_Q);
+          if (!_mm256_movemask_ps(valid))
+            continue;
+
+          __m256 sx, sy, sz, u, v;
+          transform_avx2(h, px, py, pz, sx, sy, sz);
+
+          valid = project_avx2(h, sx, sy, sz, valid, u, v);
+          if (!_mm256_movemask_ps(valid))
+            continue;
+
+          __m256i iu = _mm256_cvttps_epi32(u);
+          __m256i iv = _mm256_cvttps_epi32(v);
+          __m256i vindex = _mm256_slli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(iv, vstep), iu), 2);
+
+          __m256 dx = _mm256_mask_i32gather_ps(zero, vp + 0, vindex, valid, 4);
+          __m256 dy = _mm256_mask_i32gather_ps(zero, vp + 1, vindex, valid, 4);
+          __m256 dz = _mm256_mask_i32gather_ps(zero, vp + 2, vindex, valid, 4);
+          valid = _mm256_and_ps(valid, _mm256_cmp_ps(dx, dx, _CMP_ORD_Q));
+
+          finish_avx2(*this, x, y, iu, iv, sx, sy, sz, dx, dy, dz, valid, acc);
+        }
+
+        flush_avx2(acc, sums);
+        return x;
+      }
+
+      __vm_avx2__
+      int IcpDepth::reduce_row_avx2(int y, double* sums) const
+      {
+        const ComputeIcpHelper& h = helper;
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 mm = _mm256_set1_ps(0.001f);
+        const __m256 lane = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+        const __m256 fx_inv = _mm256_set1_ps(h.fx_inv), fy_inv = _mm256_set1_ps(h.fy_inv);
+        const __m256 c_x = _mm256_set1_ps(h.cx), c_y = _mm256_set1_ps(h.cy);
+        const __m256i dstep = _mm256_set1_epi32((int)(dprev.step / sizeof(ushort)));
+
+        __m256 acc[ComputeIcpHelper::TOTAL];
+        for(int k = 0; k < ComputeIcpHelper::TOTAL; ++k)
+          acc[k] = zero;
+
+        const ushort* dc = (*h.dcurr)[y];
+        const ushort* dp = dprev[0];
+        __m256 row_y = _mm256_sub_ps(_mm256_set1_ps((float)y), c_y);
+
+        int x = 0;
+        for(; x + 8 <= h.cols; x += 8)
+        {
+          __m256 pz = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(dc + x))));
+          __m256 valid = _mm256_cmp_ps(pz, zero, _CMP_NEQ_OQ);
+          if (!_mm256_movemask_ps(valid))
+            continue;
+
+          pz = _mm256_mul_ps(pz, mm);
+          __m256 px = _mm256_mul_ps(_mm256_mul_ps(pz, _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)x), lane), c_x)), fx_inv);
+
+          __m256 sx, sy, sz, u, v;
+          __m256 py = _mm256_mul_ps(_mm256_mul_ps(pz, row_y), fy_inv);
+          transform_avx2(h, px, py, pz, sx, sy, sz);
+
+          valid = project_avx2(h, sx, sy, sz, valid, u, v);
+          int mask = _mm256_movemask_ps(valid);
+          if (!mask)
+            continue;
+
+          __m256i iu = _mm256_cvttps_epi32(u);
+          __m256i iv = _mm256_cvttps_epi32(v);
+
+          // ushort lookups, a 32 bit gather could read past the end of the last row
+          int index[8];
+          float dst_z[8];
+          _mm256_storeu_si256((__m256i*)index, _mm256_add_epi32(_mm256_mullo_epi32(iv, dstep), iu));
+          for(int l = 0; l < 8; ++l)
+            dst_z[l] = (mask >> l) & 1 ? (float)dp[index[l]] : 0.f;
+
+          __m256 dz = _mm256_loadu_ps(dst_z);
+          valid = _mm256_and_ps(valid, _mm256_cmp_ps(dz, zero, _CMP_NEQ_OQ));
+          dz = _mm256_mul_ps(dz, mm);
+
+          __m256 dx = _mm256_mul_ps(_mm256_mul_ps(dz, _mm256_sub_ps(u, c_x)), fx_inv);
+          __m256 dy = _mm256_mul_ps(_mm256_mul_ps(dz, _mm256_sub_ps(v, c_y)), fy_inv);
+
+          finish_avx2(*this, x, y, iu, iv, sx, sy, sz, dx, dy, dz, valid, acc);
+        }
+
+        flush_avx2(acc, sums);
+        return x;
+      }
+#else
+      int IcpPoints::reduce_row_avx2(int, double*) const { return 0; }
+      int IcpDepth::reduce_row_avx2(int, double*) const { return 0; }
+#endif
+		}
+	}
+}
+
+void vm::scanner::host::ComputeIcpHelper::operator()(const Depth& dprev, const Normals& nprev, double* data) const
+{
+  CV_Assert(dcurr && ncurr);
+  reduce(IcpDepth(*this, dprev, nprev), data);
+}
+
+void vm::scanner::host::ComputeIcpHelper::operator()(const Points& vprev, const Normals& nprev, double* data) const
+{
+  CV_Assert(vcurr && ncurr);
+  reduce(IcpPoints(*this, vprev, nprev), data);
+}
+
+////////////////////////
+// cpu::ProjectiveICP //
+////////////////////////
+
+namespace
+{
+  /** Solves [A|b] given as the upper triangle row by row and applies the increment, with the device version's
+    * nullspace check. Returns false if the system is degenerate. */
+  bool solveIncrement(const double* data, Affine3f& affine)
+  {
+    cv::Matx66d A;
+    cv::Vec6d b;
+
+    int shift = 0;
+    for(int i = 0; i < 6; ++i)   //rows
+      for(int j = i; j < 7; ++j) // cols + b
+      {
+        double value = data[shift++];
+        if (j == 6)               // vector b
+          b[i] = value;
+        else
+          A(j, i) = A(i, j) = value;
+      }
+
+    double det = cv::determinant(A);
+    if (std::abs(det) < 1e-15 || cvIsNaN(det))
+      return false;
+
+    cv::Vec6d r;
+    cv::solve(A, b, r, cv::DECOMP_SVD);
+
+    Affine3f Tinc(Vec3f((float)r[0], (float)r[1], (float)r[2]), Vec3f((float)r[3], (float)r[4], (float)r[5]));
+    affine = Tinc * affine;
+    return true;
+  }
+}
+
+vm::scanner::cpu::ProjectiveICP::ProjectiveICP() : angle_thres_(deg2rad(20.f)), dist_thres_(0.1f)
+{
+  const int iters[] = {10, 5, 4, 0};
+  setIterationsNum(std::vector<int>(iters, iters + 4));
+}
+
+vm::scanner::cpu::ProjectiveICP::~ProjectiveICP() {}
+
+float vm::scanner::cpu::ProjectiveICP::getDistThreshold() const
+{ return dist_thres_; }
+
+void vm::scanner::cpu::ProjectiveICP::setDistThreshold(float distance)
+{ dist_thres_ = distance; }
+
+float vm::scanner::cpu::ProjectiveICP::getAngleThreshold() const
+{ return angle_thres_; }
+
+void vm::scanner::cpu::ProjectiveICP::setAngleThreshold(float angle)
+{ angle_thres_ = angle; }
+
+void vm::scanner::cpu::ProjectiveICP::setIterationsNum(const std::vector<int>& iters)
+{
+  iters_.assign(MAX_PYRAMID_LEVELS, 0);
+  std::copy(iters.begin(), iters.begin() + std::min(iters.size(), (size_t)MAX_PYRAMID_LEVELS), iters_.begin());
+}
+
+int vm::scanner::cpu::ProjectiveICP::getUsedLevelsNum() const
+{
+  int i = MAX_PYRAMID_LEVELS - 1;
+  for(; i >= 0 && !iters_[i]; --i);
+  return i + 1;
+}
+
+bool vm::scanner::cpu::ProjectiveICP::estimateTransform(Affine3f& affine, const Intr& intr, const DepthPyr& dcurr, const NormalsPyr& ncurr, const DepthPyr& dprev, const NormalsPyr& nprev)
+{
+  const int LEVELS = getUsedLevelsNum();
+
+  host::ComputeIcpHelper helper(dist_thres_, angle_thres_);
+  affine = Affine3f::Identity();
+
+  double data[host::ComputeIcpHelper::TOTAL];
+
+  for(int level_index = LEVELS - 1; level_index >= 0; --level_index)
+  {
+    helper.rows = nprev[level_index].rows;
+    helper.cols = nprev[level_index].cols;
+    helper.setLevelIntr(level_index, intr.fx, intr.fy, intr.cx, intr.cy);
+    helper.dcurr = &dcurr[level_index];
+    helper.ncurr = &ncurr[level_index];
+
+    for(int iter = 0; iter < iters_[level_index]; ++iter)
+    {
+      helper.setAffine(affine);
+      helper(dprev[level_index], nprev[level_index], data);
+
+      if (!solveIncrement(data, affine))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool vm::scanner::cpu::ProjectiveICP::estimateTransform(Affine3f& affine, const Intr& intr, const PointsPyr& vcurr, const NormalsPyr& ncurr, const PointsPyr& vprev, const NormalsPyr& nprev)
+{
+  const int LEVELS = getUsedLevelsNum();
+
+  host::ComputeIcpHelper helper(dist_thres_, angle_thres_);
+  affine = Affine3f::Identity();
+
+  double data[host::ComputeIcpHelper::TOTAL];
+
+  for(int level_index = LEVELS - 1; level_index >= 0; --level_index)
+  {
+    helper.rows = nprev[level_index].rows;
+    helper.cols = nprev[level_index].cols;
+    helper.setLevelIntr(level_index, intr.fx, intr.fy, intr.cx, intr.cy);
+    helper.vcurr = &vcurr[level_index];
+    helper.ncurr = &ncurr[level_index];
+
+    for(int iter = 0; iter < iters_[level_index]; ++iter)
+    {
+      helper.setAffine(affine);
+      helper(vprev[level_index], nprev[level_index], data);
+
+      if (!solveIncrement(data, affine))
+        return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,1311 @@
+#include <scanner/precomp.hpp>
+#include <scanner/cpu/internal.hpp>
+#include <scanner/marching_cubes.hpp>
+
+#include <algorithm>
+#include <limits>
+
+using namespace vm::scanner;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Runtime dispatch
+
+bool vm::scanner::host::useAvx2()
+{
+#if defined VM_SCANNER_HAVE_AVX2
+  static const bool supported = __builtin_cpu_supports("avx2") != 0;
+  return supported && cv::useOptimized();
+#else
+  return false;
+#endif
+}
+
+///////////////////////////
+// Volume Initialization //
+///////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      struct VolumeCleaner : public cv::ParallelLoopBody
+      {
+        TsdfVolume volume;
+        VolumeCleaner(const TsdfVolume& vol) : volume(vol) {}
+
+        void operator()(const cv::Range& range) const
+        {
+          size_t slice = (size_t)volume.dims[0] * volume.dims[1];
+          std::fill(volume.data + slice * range.start, volume.data + slice * range.end, Voxel());
+        }
+      };
+		}
+	}
+}
+
+void vm::scanner::host::clear_volume(TsdfVolume volume)
+{
+  cv::parallel_for_(cv::Range(0, volume.dims[2]), VolumeCleaner(volume));
+}
+
+////////////////////////
+// Volume Integration //
+////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      struct TsdfIntegrator : public cv::ParallelLoopBody
+      {
+        TsdfVolume volume;
+
+        cv::Matx33f R; // vol2cam
+        cv::Vec3f t;
+        float fx, fy, cx, cy;
+
+        const float* dists;
+        const int* colors; // BGRA packed in one int
+        size_t dists_step, colors_step; // elements
+        int cols, rows;
+
+        float tranc_dist_inv;
+        float far; // farthest measurement plus the truncation distance
+        bool use_avx2;
+
+        int64* culled;
+
+        TsdfIntegrator(const TsdfVolume& vol) : volume(vol) {}
+
+        /** Narrows [lo, hi] to the steps i where a + b * i >= 0 */
+        static void clip_range(float a, float b, float& lo, float& hi)
+        {
+          if (b > 0)
+            lo = std::max(lo, -a / b);
+          else if (b < 0)
+            hi = std::min(hi, -a / b);
+          else if (a < 0)
+            hi = -1.f;
+        }
+
+        /** Voxels [x0, x1) of a row of n starting at vc that can receive a measurement, see device::TsdfIntegrator::column_range */
+        void row_range(const cv::Vec3f& vc, const cv::Vec3f& xstep, int n, int& x0, int& x1) const
+        {
+          float lo = 0.f, hi = (float)n;
+
+          clip_range(vc[2], xstep[2], lo, hi);
+          clip_range(far - vc[2], -xstep[2], lo, hi);
+          clip_range(fx * vc[0] + cx * vc[2], fx * xstep[0] + cx * xstep[2], lo, hi);
+          clip_range(fy * vc[1] + cy * vc[2], fy * xstep[1] + cy * xstep[2], lo, hi);
+          clip_range((cols - cx) * vc[2] - fx * vc[0], (cols - cx) * xstep[2] - fx * xstep[0], lo, hi);
+          clip_range((rows - cy) * vc[2] - fy * vc[1], (rows - cy) * xstep[2] - fy * xstep[1], lo, hi);
+
+          x0 = x1 = 0;
+          if (lo <= hi)
+          {
+            x0 = std::max(0, (int)std::floor(lo) - 1);
+            x1 = std::min(n, (int)std::ceil(hi) + 2);
+          }
+        }
+
+        void integrate_voxel(Voxel& voxel, float vx, float vy, float vz) const
+        {
+          if (vz <= 0)
+            return;
+
+          float u = fx * (vx / vz) + cx;
+          float v = fy * (vy / vz) + cy;
+
+          if (u < 0 || v < 0 || u >= cols || v >= rows)
+            return;
+
+          int iu = (int)u;
+          int iv = (int)v;
+
+          float Dp = dists[iv * dists_step + iu];
+          if (Dp == 0)
+            return;
+
+          float sdf = Dp - std::sqrt(vx * vx + vy * vy + vz * vz); //Dp - norm(v)
+          if (sdf < -volume.trunc_dist)
+            return;
+
+          float tsdf = std::min(1.f, sdf * tranc_dist_inv);
+
+          int weight_prev = voxel.weight;
+          float tsdf_prev = half2float(voxel.tsdf);
+          float weight_inc = (float)(weight_prev + 1);
+
+          voxel.tsdf = float2half((tsdf_prev * weight_prev + tsdf) / weight_inc);
+          voxel.weight = (ushort)std::min(weight_prev + 1, volume.max_weight);
+
+          if (colors)
+          {
+            const uchar* Cp = (const uchar*)(colors + iv * colors_step + iu); // bgra
+
+            int r = voxel.rg >> 8, g = voxel.rg & 0xff;
+            int b = voxel.ba >> 8, a = voxel.ba & 0xff;
+
+            r = (int)((r * weight_prev + Cp[2]) / weight_inc);
+            g = (int)((g * weight_prev + Cp[1]) / weight_inc);
+            b = (int)((b * weight_prev + Cp[0]) / weight_inc);
+            a = (int)((a * weight_prev + Cp[3]) / weight_inc);
+
+            voxel.rg = (ushort)(r * 256 + g);
+            voxel.ba = (ushort)(b * 256 + a);
+          }
+        }
+
+        /** With offsets set voxel x of the row is at row[offsets[x]], otherwise at row[x] */
+        int integrate_row_avx2(Voxel* row, const int* offsets, const cv::Vec3f& vc, const cv::Vec3f& xstep, int x, int x_end) const;
+
+        void integrate_row(Voxel* row, const int* offsets, const cv::Vec3f& vc, const cv::Vec3f& xstep, int n, int64& skipped) const
+        {
+          int x0, x1;
+          row_range(vc, xstep, n, x0, x1);
+          skipped += n - (x1 - x0);
+
+          int x = use_avx2 ? integrate_row_avx2(row, offsets, vc, xstep, x0, x1) : x0;
+          for (; x < x1; ++x)
+            integrate_voxel(row[offsets ? offsets[x] : x], vc[0] + x * xstep[0], vc[1] + x * xstep[1], vc[2] + x * xstep[2]);
+        }
+
+        /** Rows of y for a linear volume, rows of 8^3 bricks for a bricked one */
+        void operator()(const cv::Range& range) const
+        {
+          const cv::Vec3f& vs = volume.voxel_size;
+          cv::Vec3f xstep(R(0, 0) * vs[0], R(1, 0) * vs[0], R(2, 0) * vs[0]);
+          int64 skipped = 0;
+
+          if (volume.order == ORDER_BRICKED)
+          {
+            // offsets of the 8 voxels of a brick row, the brick is done before the next one so its 4KB stay in cache
+            int offsets[8];
+            for(int x = 0; x < 8; ++x)
+              offsets[x] = (int)spread_bits3(x);
+
+            for (int bz = 0; bz < volume.dims[2]; bz += 8)
+              for (int by = range.start * 8; by < range.end * 8; by += 8)
+                for (int bx = 0; bx < volume.dims[0]; bx += 8)
+                  for (int z = bz; z < bz + 8; ++z)
+                    for (int y = by; y < by + 8; ++y)
+                    {
+                      cv::Vec3f vc = R * cv::Vec3f(bx * vs[0], y * vs[1], z * vs[2]) + t;
+                      integrate_row(volume(bx, y, z), offsets, vc, xstep, 8, skipped);
+                    }
+          }
+          else
+          {
+            // z outer, so that every thread streams its rows of each slice contiguously
+            for (int z = 0; z < volume.dims[2]; ++z)
+              for (int y = range.start; y < range.end; ++y)
+              {
+                cv::Vec3f vc = R * cv::Vec3f(0.f, y * vs[1], z * vs[2]) + t;
+                integrate_row(volume(0, y, z), 0, vc, xstep, volume.dims[0], skipped);
+              }
+          }
+
+          __sync_fetch_and_add(culled, skipped);
+        }
+      };
+
+#if defined VM_SCANNER_HAVE_AVX2
+      /** Integrates 8 neighbouring voxels of [x, x_end) per iteration. Returns the first x left for the scalar tail.
+        * A brick row is a whole iteration, its voxels come in pairs that are adjacent in Morton order. */
+      __vm_avx2__
+      int TsdfIntegrator::integrate_row_avx2(Voxel* row, const int* offsets, const cv::Vec3f& vc, const cv::Vec3f& xstep, int x, int x_end) const
+      {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 lane = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+
+        const __m256 f_x = _mm256_set1_ps(fx), f_y = _mm256_set1_ps(fy);
+        const __m256 c_x = _mm256_set1_ps(cx), c_y = _mm256_set1_ps(cy);
+        const __m256 size_x = _mm256_set1_ps((float)cols), size_y = _mm256_set1_ps((float)rows);
+        const __m256 neg_trunc = _mm256_set1_ps(-volume.trunc_dist);
+        const __m256 trunc_inv = _mm256_set1_ps(tranc_dist_inv);
+
+        const __m256i dstep = _mm256_set1_epi32((int)dists_step);
+        const __m256i cstep = _mm256_set1_epi32((int)colors_step);
+        const __m256i lo16 = _mm256_set1_epi32(0xffff);
+        const __m256i lo8 = _mm256_set1_epi32(0xff);
+        const __m256i one_i = _mm256_set1_epi32(1);
+        const __m256i max_weight = _mm256_set1_epi32(volume.max_weight);
+        const __m256i deinterleave = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+        for (; x + 8 <= x_end; x += 8)
+        {
+          __m256 xs = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+          __m256 vx = _mm256_add_ps(_mm256_set1_ps(vc[0]), _mm256_mul_ps(xs, _mm256_set1_ps(xstep[0])));
+          __m256 vy = _mm256_add_ps(_mm256_set1_ps(vc[1]), _mm256_mul_ps(xs, _mm256_set1_ps(xstep[1])));
+          __m256 vz = _mm256_add_ps(_mm256_set1_ps(vc[2]), _mm256_mul_ps(xs, _mm256_set1_ps(xstep[2])));
+
+          // projection
+          __m256 u = _mm256_add_ps(_mm256_mul_ps(f_x, _mm256_div_ps(vx, vz)), c_x);
+          __m256 v = _mm256_add_ps(_mm256_mul_ps(f_y, _mm256_div_ps(vy, vz)), c_y);
+
+          __m256 valid = _mm256_cmp_ps(vz, zero, _CMP_GT_OQ);
+          valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+          valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+          valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, size_x, _CMP_LT_OQ));
+          valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, size_y, _CMP_LT_OQ));
+
+          if (!_mm256_movemask_ps(valid))
+            continue;
+
+          __m256i iu = _mm256_cvttps_epi32(u);
+          __m256i iv = _mm256_cvttps_epi32(v);
+
+          // sdf
+          __m256i didx = _mm256_add_epi32(_mm256_mullo_epi32(iv, dstep), iu);
+          __m256 Dp = _mm256_mask_i32gather_ps(zero, dists, didx, valid, 4);
+
+          __m256 norm = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz)));
+          __m256 sdf = _mm256_sub_ps(Dp, norm);
+
+          valid = _mm256_and_ps(valid, _mm256_cmp_ps(Dp, zero, _CMP_NEQ_OQ));
+          valid = _mm256_and_ps(valid, _mm256_cmp_ps(sdf, neg_trunc, _CMP_GE_OQ));
+
+          if (!_mm256_movemask_ps(valid))
+            continue;
+
+          __m256 tsdf = _mm256_min_ps(one, _mm256_mul_ps(sdf, trunc_inv));
+
+          // read and unpack: lo = tsdf | weight << 16, hi = rg | ba << 16
+          Voxel* vptr = row + x;
+          __m256i v0, v1;
+          if (offsets)
+          {
+            v0 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(vptr + offsets[0]))),
+                                         _mm_loadu_si128((const __m128i*)(vptr + offsets[2])), 1);
+            v1 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(vptr + offsets[4]))),
+                                         _mm_loadu_si128((const __m128i*)(vptr + offsets[6])), 1);
+          }
+          else
+          {
+            v0 = _mm256_loadu_si256((const __m256i*)vptr);
+            v1 = _mm256_loadu_si256((const __m256i*)(vptr + 4));
+          }
+          v0 = _mm256_permutevar8x32_epi32(v0, deinterleave);
+          v1 = _mm256_permutevar8x32_epi32(v1, deinterleave);
+          __m256i lo = _mm256_permute2x128_si256(v0, v1, 0x20);
+          __m256i hi = _mm256_permute2x128_si256(v0, v1, 0x31);
+
+          __m256i weight_prev = _mm256_srli_epi32(lo, 16);
+          __m256i halfs = _mm256_and_si256(lo, lo16);
+          halfs = _mm256_permute4x64_epi64(_mm256_packus_epi32(halfs, halfs), 0x08);
+
+          __m256 tsdf_prev = _mm256_cvtph_ps(_mm256_castsi256_si128(halfs));
+          __m256 weight = _mm256_cvtepi32_ps(weight_prev);
+          __m256 weight_inc = _mm256_add_ps(weight, one);
+
+          // weight update
+          __m256 tsdf_new = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(tsdf_prev, weight), tsdf), weight_inc);
+          __m256i weight_new = _mm256_min_epi32(_mm256_add_epi32(weight_prev, one_i), max_weight);
+
+          __m256i lo_new = _mm256_cvtepu16_epi32(_mm256_cvtps_ph(tsdf_new, _MM_FROUND_TO_NEAREST_INT));
+          lo_new = _mm256_or_si256(lo_new, _mm256_slli_epi32(weight_new, 16));
+
+          __m256i hi_new = hi;
+          if (colors)
+          {
+            __m256i cidx = _mm256_add_epi32(_mm256_mullo_epi32(iv, cstep), iu);
+            __m256i Cp = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), colors, cidx, _mm256_castps_si256(valid), 4);
+
+            // new colors come as bgra bytes, stored ones as g, r, a, b bytes
+            __m256 b_new = _mm256_cvtepi32_ps(_mm256_and_si256(Cp, lo8));
+            __m256 g_new = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(Cp, 8), lo8));
+            __m256 r_new = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(Cp, 16), lo8));
+            __m256 a_new = _mm256_cvtepi32_ps(_mm256_srli_epi32(Cp, 24));
+
+            __m256 g_prev = _mm256_cvtepi32_ps(_mm256_and_si256(hi, lo8));
+            __m256 r_prev = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(hi, 8), lo8));
+            __m256 a_prev = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(hi, 16), lo8));
+            __m256 b_prev = _mm256_cvtepi32_ps(_mm256_srli_epi32(hi, 24));
+
+            __m256i g = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(g_prev, weight), g_new), weight_inc));
+            __m256i r = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(r_prev, weight), r_new), weight_inc));
+            __m256i a = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(a_prev, weight), a_new), weight_inc));
+            __m256i b = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(b_prev, weight), b_new), weight_inc));
+
+            hi_new = _mm256_or_si256(_mm256_or_si256(g, _mm256_slli_epi32(r, 8)), _mm256_or_si256(_mm256_slli_epi32(a, 16), _mm256_slli_epi32(b, 24)));
+          }
+
+          // pack and write only lanes that received a measurement
+          lo = _mm256_blendv_epi8(lo, lo_new, _mm256_castps_si256(valid));
+          hi = _mm256_blendv_epi8(hi, hi_new, _mm256_castps_si256(valid));
+
+          __m256i i0 = _mm256_unpacklo_epi32(lo, hi);
+          __m256i i1 = _mm256_unpackhi_epi32(lo, hi);
+          __m256i o0 = _mm256_permute2x128_si256(i0, i1, 0x20);
+          __m256i o1 = _mm256_permute2x128_si256(i0, i1, 0x31);
+          if (offsets)
+          {
+            _mm_storeu_si128((__m128i*)(vptr + offsets[0]), _mm256_castsi256_si128(o0));
+            _mm_storeu_si128((__m128i*)(vptr + offsets[2]), _mm256_extracti128_si256(o0, 1));
+            _mm_storeu_si128((__m128i*)(vptr + offsets[4]), _mm256_castsi256_si128(o1));
+            _mm_storeu_si128((__m128i*)(vptr + offsets[6]), _mm256_extracti128_si256(o1, 1));
+          }
+          else
+          {
+            _mm256_storeu_si256((__m256i*)vptr, o0);
+            _mm256_storeu_si256((__m256i*)(vptr + 4), o1);
+          }
+        }
+        return x;
+      }
+#else
+      int TsdfIntegrator::integrate_row_avx2(Voxel*, const int*, const cv::Vec3f&, const cv::Vec3f&, int x, int) const { return x; }
+#endif
+		}
+	}
+}
+
+namespace
+{
+  void setup_integrator(host::TsdfIntegrator& ti, const host::Dists& dists, const host::Image& colors, const Affine3f& vol2cam, const Intr& intr, int64* culled)
+  {
+    ti.R = vol2cam.rotation();
+    ti.t = vol2cam.translation();
+    ti.fx = intr.fx;
+    ti.fy = intr.fy;
+    ti.cx = intr.cx;
+    ti.cy = intr.cy;
+
+    ti.dists = dists.ptr<float>();
+    ti.dists_step = dists.step / sizeof(float);
+    ti.cols = dists.cols;
+    ti.rows = dists.rows;
+
+    ti.colors = colors.empty() ? 0 : colors.ptr<int>();
+    ti.colors_step = colors.step / sizeof(int);
+
+    double max_dist = 0;
+    cv::minMaxLoc(dists, 0, &max_dist);
+
+    ti.tranc_dist_inv = 1.f/ti.volume.trunc_dist;
+    ti.far = (float)max_dist + ti.volume.trunc_dist;
+    ti.use_avx2 = host::useAvx2();
+    ti.culled = culled;
+  }
+
+  /** Takes each slab of rows through all the frames before moving on to the next one */
+  struct SlabIntegrator : public cv::ParallelLoopBody
+  {
+    std::vector< cv::Ptr<host::TsdfIntegrator> > frames;
+
+    void operator()(const cv::Range& range) const
+    {
+      for(size_t i = 0; i < frames.size(); ++i)
+        (*frames[i])(range);
+    }
+  };
+
+  inline int slab_rows(const host::TsdfVolume& volume)
+  { return volume.order == host::ORDER_BRICKED ? volume.dims[1] / 8 : volume.dims[1]; }
+}
+
+int64 vm::scanner::host::integrate(const Dists& dists, const Image& colors, TsdfVolume& volume, const Affine3f& vol2cam, const Intr& intr)
+{
+  int64 culled = 0;
+
+  TsdfIntegrator ti(volume);
+  setup_integrator(ti, dists, colors, vol2cam, intr, &culled);
+
+  cv::parallel_for_(cv::Range(0, slab_rows(volume)), ti);
+  return culled;
+}
+
+int64 vm::scanner::host::integrate(const std::vector<Dists>& dists, const std::vector<Image>& colors, TsdfVolume& volume,
+                                   const std::vector<Affine3f>& vol2cam, const Intr& intr)
+{
+  CV_Assert(dists.size() == vol2cam.size() && (colors.empty() || colors.size() == dists.size()));
+
+  int64 culled = 0;
+
+  SlabIntegrator si;
+  si.frames.resize(dists.size());
+  for(size_t i = 0; i < dists.size(); ++i)
+  {
+    si.frames[i] = new TsdfIntegrator(volume);
+    setup_integrator(*si.frames[i], dists[i], colors.empty() ? Image() : colors[i], vol2cam[i], intr, &culled);
+  }
+
+  // a stripe per slab, so a core keeps its slab in cache while it goes through the frames
+  int rows = slab_rows(volume);
+  cv::parallel_for_(cv::Range(0, rows), si, rows);
+  return culled;
+}
+
+////////////////////////
+// Volume Ray Casting //
+////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      inline void intersect(const cv::Vec3f& ray_org, const cv::Vec3f& ray_dir, const cv::Vec3f& box_max, float &tnear, float &tfar)
+      {
+        // compute intersection of ray with all six bbox planes
+        float tmin[3], tmax[3];
+        for(int i = 0; i < 3; ++i)
+        {
+          float inv = 1.f/ray_dir[i];
+          float tbot = inv * (0.f - ray_org[i]);
+          float ttop = inv * (box_max[i] - ray_org[i]);
+          tmin[i] = std::min(ttop, tbot);
+          tmax[i] = std::max(ttop, tbot);
+        }
+
+        // find the largest tmin and the smallest tmax
+        tnear = std::max(std::max(tmin[0], tmin[1]), tmin[2]);
+        tfar  = std::min(std::min(tmax[0], tmax[1]), tmax[2]);
+      }
+
+      /** Tsdf of the 8 voxels of the cell at (x, y, z), bit 0 of the index is +x, bit 1 +y and bit 2 +z */
+      inline void cell_tsdf(const TsdfVolume& volume, int x, int y, int z, float* F)
+      {
+        if (volume.order == ORDER_LINEAR)
+        {
+          const Voxel* v = volume(x, y, z);
+          size_t ys = volume.dims[0], zs = (size_t)volume.dims[0] * volume.dims[1];
+          for(int i = 0; i < 8; ++i)
+            F[i] = unpack_tsdf(v[(i & 1) + (i & 2 ? ys : 0) + (i & 4 ? zs : 0)]);
+        }
+        else
+          for(int i = 0; i < 8; ++i)
+            F[i] = unpack_tsdf(*volume(x + (i & 1), y + (i >> 1 & 1), z + (i >> 2)));
+      }
+
+      inline float interpolate(const TsdfVolume& volume, const cv::Vec3f& p_voxels)
+      {
+        //rounding to negative infinity
+        int gx = cvFloor(p_voxels[0]), gy = cvFloor(p_voxels[1]), gz = cvFloor(p_voxels[2]);
+
+        if (gx < 0 || gx >= volume.dims[0] - 1 || gy < 0 || gy >= volume.dims[1] - 1 || gz < 0 || gz >= volume.dims[2] - 1)
+          return std::numeric_limits<float>::quiet_NaN();
+
+        float a = p_voxels[0] - gx;
+        float b = p_voxels[1] - gy;
+        float c = p_voxels[2] - gz;
+
+        float F[8];
+        cell_tsdf(volume, gx, gy, gz, F);
+
+        float tsdf = 0.f;
+        tsdf += F[0] * (1 - a) * (1 - b) * (1 - c);
+        tsdf += F[4] * (1 - a) * (1 - b) *      c;
+        tsdf += F[2] * (1 - a) *      b  * (1 - c);
+        tsdf += F[6] * (1 - a) *      b  *      c;
+        tsdf += F[1] *      a  * (1 - b) * (1 - c);
+        tsdf += F[5] *      a  * (1 - b) *      c;
+        tsdf += F[3] *      a  *      b  * (1 - c);
+        tsdf += F[7] *      a  *      b  *      c;
+        return tsdf;
+      }
+
+      inline cv::Vec3f gradient(const TsdfVolume& volume, const cv::Vec3f& p, const cv::Vec3f& delta, const cv::Vec3f& voxel_size_inv)
+      {
+        cv::Vec3f n;
+        for(int i = 0; i < 3; ++i)
+        {
+          cv::Vec3f p1 = p, p2 = p;
+          p1[i] += delta[i];
+          p2[i] -= delta[i];
+
+          float F1 = interpolate(volume, p1.mul(voxel_size_inv));
+          float F2 = interpolate(volume, p2.mul(voxel_size_inv));
+          n[i] = (F1 - F2) / delta[i];
+        }
+        return n;
+      }
+
+      struct TsdfRaycaster : public cv::ParallelLoopBody
+      {
+        TsdfVolume volume;
+
+        cv::Matx33f R, Rinv;
+        cv::Vec3f t;
+        float fx_inv, fy_inv, cx, cy;
+        const Rays* rays;
+
+        cv::Vec3f volume_size;
+        float time_step;
+        cv::Vec3f gradient_delta;
+        cv::Vec3f voxel_size_inv;
+
+        Depth* depth;
+        Points* points;
+        Normals* normals;
+
+        TsdfRaycaster(const TsdfVolume& vol) : volume(vol), rays(0), depth(0), points(0), normals(0) {}
+
+        float fetch_tsdf(const cv::Vec3f& p) const
+        {
+          //rounding to nearest even
+          int x = cvRound(p[0] * voxel_size_inv[0]);
+          int y = cvRound(p[1] * voxel_size_inv[1]);
+          int z = cvRound(p[2] * voxel_size_inv[2]);
+
+          if (x < 0 || y < 0 || z < 0 || x >= volume.dims[0] || y >= volume.dims[1] || z >= volume.dims[2])
+            return std::numeric_limits<float>::quiet_NaN();
+
+          return unpack_tsdf(*volume(x, y, z));
+        }
+
+        /** Marches the ray through (x, y), returns false if it doesn't hit the surface */
+        bool cast(int x, int y, cv::Vec3f& vertex, cv::Vec3f& normal) const
+        {
+          cv::Vec3f ray_org = t;
+          cv::Vec3f ray_dir;
+          if (rays)
+          {
+            const cv::Vec4f& ray = (*rays)(y, x);
+            ray_dir = R * cv::Vec3f(ray[0] * ray[3], ray[1] * ray[3], ray[3]);
+          }
+          else
+          {
+            ray_dir = R * cv::Vec3f((x - cx) * fx_inv, (y - cy) * fy_inv, 1.f);
+            ray_dir *= 1.f/(float)cv::norm(ray_dir);
+          }
+
+          // We do subtract voxel size to minimize checks after
+          // Note: origin of volume coordinate is placeed
+          // in the center of voxel (0,0,0), not in the corener of the voxel!
+          cv::Vec3f box_max = volume_size - volume.voxel_size;
+
+          float tmin, tmax;
+          intersect(ray_org, ray_dir, box_max, tmin, tmax);
+
+          const float min_dist = 0.f;
+          tmin = std::max(min_dist, tmin);
+          if (tmin >= tmax)
+            return false;
+
+          tmax -= time_step;
+          cv::Vec3f vstep = ray_dir * time_step;
+          cv::Vec3f next = ray_org + ray_dir * tmin;
+
+          float tsdf_next = fetch_tsdf(next);
+          for (float tcurr = tmin; tcurr < tmax; tcurr += time_step)
+          {
+            float tsdf_curr = tsdf_next;
+            cv::Vec3f curr = next;
+            next += vstep;
+
+            tsdf_next = fetch_tsdf(next);
+            if (tsdf_curr < 0.f && tsdf_next > 0.f)
+              break;
+
+            if (tsdf_curr > 0.f && tsdf_next < 0.f)
+            {
+              float Ft   = interpolate(volume, curr.mul(voxel_size_inv));
+              float Ftdt = interpolate(volume, next.mul(voxel_size_inv));
+
+              float Ts = tcurr - time_step * Ft / (Ftdt - Ft);
+
+              vertex = ray_org + ray_dir * Ts;
+              normal = gradient(volume, vertex, gradient_delta, voxel_size_inv);
+
+              float norm = (float)cv::norm(normal);
+              if (cvIsNaN(norm) || norm == 0)
+                return false;
+
+              normal = Rinv * (normal * (1.f/norm));
+              vertex = Rinv * (vertex - t);
+              return true;
+            }
+          } /* for (;;) */
+          return false;
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          const float qnan = std::numeric_limits<float>::quiet_NaN();
+          const cv::Vec4f nans = cv::Vec4f::all(qnan);
+
+          int cols = normals->cols;
+          for(int y = range.start; y < range.end; ++y)
+          {
+            cv::Vec4f* nrow = (*normals)[y];
+            ushort* drow = depth ? (*depth)[y] : 0;
+            cv::Vec4f* prow = points ? (*points)[y] : 0;
+
+            for(int x = 0; x < cols; ++x)
+            {
+              cv::Vec3f vertex, normal;
+              bool hit = cast(x, y, vertex, normal);
+
+              nrow[x] = hit ? cv::Vec4f(normal[0], normal[1], normal[2], 0.f) : nans;
+
+              if (drow)
+                drow[x] = hit ? static_cast<ushort>(vertex[2] * 1000) : 0;
+              if (prow)
+                prow[x] = hit ? cv::Vec4f(vertex[0], vertex[1], vertex[2], 0.f) : nans;
+            }
+          }
+        }
+      };
+
+      inline void setup_raycaster(TsdfRaycaster& rc, const Affine3f& cam2vol, const Intr& intr, const Rays* rays, float step_factor, float delta_factor)
+      {
+        rc.rays = rays;
+        rc.R = cam2vol.rotation();
+        rc.Rinv = rc.R.inv(cv::DECOMP_SVD);
+        rc.t = cam2vol.translation();
+        rc.fx_inv = 1.f/intr.fx;
+        rc.fy_inv = 1.f/intr.fy;
+        rc.cx = intr.cx;
+        rc.cy = intr.cy;
+
+        const TsdfVolume& volume = rc.volume;
+        rc.volume_size = cv::Vec3f(volume.voxel_size[0] * volume.dims[0], volume.voxel_size[1] * volume.dims[1], volume.voxel_size[2] * volume.dims[2]);
+        rc.time_step = volume.trunc_dist * step_factor;
+        rc.gradient_delta = volume.voxel_size * delta_factor;
+        rc.voxel_size_inv = cv::Vec3f(1.f/volume.voxel_size[0], 1.f/volume.voxel_size[1], 1.f/volume.voxel_size[2]);
+      }
+		}
+	}
+}
+
+void vm::scanner::host::raycast(const TsdfVolume& volume, const Affine3f& cam2vol, const Intr& intr, const Rays* rays, Depth& depth, Normals& normals,
+                                float step_factor, float delta_factor)
+{
+  TsdfRaycaster rc(volume);
+  setup_raycaster(rc, cam2vol, intr, rays, step_factor, delta_factor);
+  rc.depth = &depth;
+  rc.normals = &normals;
+
+  cv::parallel_for_(cv::Range(0, depth.rows), rc);
+}
+
+void vm::scanner::host::raycast(const TsdfVolume& volume, const Affine3f& cam2vol, const Intr& intr, const Rays* rays, Points& points, Normals& normals,
+                                float step_factor, float delta_factor)
+{
+  TsdfRaycaster rc(volume);
+  setup_raycaster(rc, cam2vol, intr, rays, step_factor, delta_factor);
+  rc.points = &points;
+  rc.normals = &normals;
+
+  cv::parallel_for_(cv::Range(0, points.rows), rc);
+}
+
+/////////////////////////////
+// Volume Cloud Extraction //
+/////////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Zero crossings along +x, +y, +z of every voxel, collected per z slice so the output order doesn't depend on threading */
+      struct FullScan6 : public cv::ParallelLoopBody
+      {
+        TsdfVolume volume;
+        Affine3f aff;
+        std::vector< std::vector<cv::Vec4f> >* slices;
+
+        FullScan6(const TsdfVolume& vol) : volume(vol), slices(0) {}
+
+        static bool crossing(float F, float Fn, int Wn)
+        {
+          return Wn != 0 && Fn != 1.f && ((F > 0 && Fn < 0) || (F < 0 && Fn > 0));
+        }
+
+        void store(std::vector<cv::Vec4f>& out, const cv::Vec3f& p) const
+        {
+          cv::Vec3f g = aff * p;
+          out.push_back(cv::Vec4f(g[0], g[1], g[2], 0.f));
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          const cv::Vec3f& vs = volume.voxel_size;
+
+          for(int z = range.start; z < range.end; ++z)
+          {
+            std::vector<cv::Vec4f>& out = (*slices)[z];
+            out.clear();
+
+            for(int y = 0; y < volume.dims[1]; ++y)
+              for(int x = 0; x < volume.dims[0]; ++x)
+              {
+                int W;
+                float F = unpack_tsdf(*volume(x, y, z), W);
+
+                if (W == 0 || F == 1.f)
+                  continue;
+
+                cv::Vec3f V((x + 0.5f) * vs[0], (y + 0.5f) * vs[1], (z + 0.5f) * vs[2]);
+
+                //process dx
+                if (x + 1 < volume.dims[0])
+                {
+                  int Wn;
+                  float Fn = unpack_tsdf(*volume(x + 1, y, z), Wn);
+                  if (crossing(F, Fn, Wn))
+                  {
+                    cv::Vec3f p = V;
+                    p[0] = (V[0] * std::abs(Fn) + (V[0] + vs[0]) * std::abs(F)) / (std::abs(F) + std::abs(Fn));
+                    store(out, p);
+                  }
+                }
+
+                //process dy
+                if (y + 1 < volume.dims[1])
+                {
+                  int Wn;
+                  float Fn = unpack_tsdf(*volume(x, y + 1, z), Wn);
+                  if (crossing(F, Fn, Wn))
+                  {
+                    cv::Vec3f p = V;
+                    p[1] = (V[1] * std::abs(Fn) + (V[1] + vs[1]) * std::abs(F)) / (std::abs(F) + std::abs(Fn));
+                    store(out, p);
+                  }
+                }
+
+                //process dz, z + 1 < dims.z is guaranteed by the range
+                {
+                  int Wn;
+                  float Fn = unpack_tsdf(*volume(x, y, z + 1), Wn);
+                  if (crossing(F, Fn, Wn))
+                  {
+                    cv::Vec3f p = V;
+                    p[2] = (V[2] * std::abs(Fn) + (V[2] + vs[2]) * std::abs(F)) / (std::abs(F) + std::abs(Fn));
+                    store(out, p);
+                  }
+                }
+              }
+          }
+        }
+      };
+
+      /** Shared part of the per point extractors: maps a cloud point back to the volume */
+      struct PointExtractor
+      {
+        TsdfVolume volume;
+        const Points* points;
+        cv::Vec3f voxel_size_inv;
+        cv::Vec3f gradient_delta;
+        cv::Matx33f R, Rinv;
+        cv::Vec3f t;
+
+        PointExtractor(const TsdfVolume& vol, const Points& cloud, const Affine3f& aff, float gradient_delta_factor) : volume(vol), points(&cloud)
+        {
+          voxel_size_inv = cv::Vec3f(1.f/volume.voxel_size[0], 1.f/volume.voxel_size[1], 1.f/volume.voxel_size[2]);
+          gradient_delta = volume.voxel_size * gradient_delta_factor;
+          R = aff.rotation();
+          Rinv = R.inv(cv::DECOMP_SVD);
+          t = aff.translation();
+        }
+
+        /** Returns false if the point is too close to the volume border to take a gradient */
+        bool locate(int idx, cv::Vec3f& point, Vec3i& g) const
+        {
+          const cv::Vec4f& p = (*points)(0, idx);
+          point = Rinv * (cv::Vec3f(p[0], p[1], p[2]) - t);
+
+          //rounding to nearest even
+          g = Vec3i(cvRound(point[0] * voxel_size_inv[0]), cvRound(point[1] * voxel_size_inv[1]), cvRound(point[2] * voxel_size_inv[2]));
+          return g[0] > 1 && g[1] > 1 && g[2] > 1 && g[0] < volume.dims[0] - 2 && g[1] < volume.dims[1] - 2 && g[2] < volume.dims[2] - 2;
+        }
+
+        cv::Vec3f normal(const cv::Vec3f& point) const
+        {
+          cv::Vec3f n = R * gradient(volume, point, gradient_delta, voxel_size_inv);
+          return n * (1.f/(float)cv::norm(n));
+        }
+      };
+
+      struct ExtractNormals : public cv::ParallelLoopBody, public PointExtractor
+      {
+        Normals* output;
+        ExtractNormals(const TsdfVolume& vol, const Points& cloud, const Affine3f& aff, float delta) : PointExtractor(vol, cloud, aff, delta) {}
+
+        void operator()(const cv::Range& range) const
+        {
+          const float qnan = std::numeric_limits<float>::quiet_NaN();
+          for(int idx = range.start; idx < range.end; ++idx)
+          {
+            cv::Vec3f point, n = cv::Vec3f::all(qnan);
+            Vec3i g;
+            if (locate(idx, point, g))
+              n = normal(point);
+            (*output)(0, idx) = cv::Vec4f(n[0], n[1], n[2], 0.f);
+          }
+        }
+      };
+
+      struct ExtractTangentColors : public cv::ParallelLoopBody, public PointExtractor
+      {
+        Image* output;
+        ExtractTangentColors(const TsdfVolume& vol, const Points& cloud, const Affine3f& aff, float delta) : PointExtractor(vol, cloud, aff, delta) {}
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int idx = range.start; idx < range.end; ++idx)
+          {
+            cv::Vec4b color = cv::Vec4b::all(0);
+
+            cv::Vec3f point;
+            Vec3i g;
+            if (locate(idx, point, g))
+            {
+              cv::Vec3f n = normal(point);
+              if (!cvIsNaN(n[0] * n[1] * n[2]))
+              {
+                uchar c_r = static_cast<uchar>((5.f - n[0] * 3.5f) * 25.5f);
+                uchar c_g = static_cast<uchar>((5.f - n[1] * 2.5f) * 25.5f);
+                uchar c_b = static_cast<uchar>((5.f - n[2] * 3.5f) * 25.5f);
+                color = cv::Vec4b(c_b, c_g, c_r, 0);
+              }
+            }
+            (*output)(0, idx) = color;
+          }
+        }
+      };
+
+      struct ExtractVertexColors : public cv::ParallelLoopBody, public PointExtractor
+      {
+        Image* output;
+        ExtractVertexColors(const TsdfVolume& vol, const Points& cloud, const Affine3f& aff) : PointExtractor(vol, cloud, aff, 0.f) {}
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int idx = range.start; idx < range.end; ++idx)
+          {
+            cv::Vec4b color = cv::Vec4b::all(0);
+
+            cv::Vec3f point;
+            Vec3i g;
+            if (locate(idx, point, g))
+            {
+              const Voxel& v = *volume(g[0], g[1], g[2]);
+              color = cv::Vec4b(v.ba >> 8, v.rg & 0xff, v.rg >> 8, v.ba & 0xff); // bgra
+            }
+            (*output)(0, idx) = color;
+          }
+        }
+      };
+		}
+	}
+}
+
+size_t vm::scanner::host::extractCloud(const TsdfVolume& volume, const Affine3f& aff, Points& output)
+{
+  std::vector< std::vector<cv::Vec4f> > slices(volume.dims[2]);
+
+  FullScan6 fs(volume);
+  fs.aff = aff;
+  fs.slices = &slices;
+  cv::parallel_for_(cv::Range(0, volume.dims[2] - 1), fs);
+
+  size_t total = 0;
+  for(size_t i = 0; i < slices.size(); ++i)
+    total += slices[i].size();
+
+  if ((size_t)output.cols < total || output.rows != 1)
+    output.create(1, (int)total);
+
+  cv::Vec4f* pos = output[0];
+  for(size_t i = 0; i < slices.size(); ++i)
+    pos = std::copy(slices[i].begin(), slices[i].end(), pos);
+
+  return total;
+}
+
+void vm::scanner::host::extractNormals(const TsdfVolume& volume, const Points& points, const Affine3f& aff, float gradient_delta_factor, Normals& output)
+{
+  ExtractNormals en(volume, points, aff, gradient_delta_factor);
+  en.output = &output;
+  cv::parallel_for_(cv::Range(0, points.cols), en);
+}
+
+void vm::scanner::host::extractTangentColors(const TsdfVolume& volume, const Points& points, const Affine3f& aff, float gradient_delta_factor, Image& output)
+{
+  ExtractTangentColors ec(volume, points, aff, gradient_delta_factor);
+  ec.output = &output;
+  cv::parallel_for_(cv::Range(0, points.cols), ec);
+}
+
+void vm::scanner::host::extractVertexColors(const TsdfVolume& volume, const Points& points, const Affine3f& aff, Image& output)
+{
+  ExtractVertexColors evc(volume, points, aff);
+  evc.output = &output;
+  cv::parallel_for_(cv::Range(0, points.cols), evc);
+}
+
+////////////////////
+// Marching Cubes //
+////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace host
+		{
+      /** Mesh pieces of one z slice. Vertices sit on the +x, +y, +z edges of the slice voxels and are ordered by
+        * (y, x, axis) key, indices hold the triangles of the cell layer between this slice and the next one. */
+      struct MeshSlice
+      {
+        std::vector<int> keys;
+        std::vector<cv::Vec4f> vertices;
+        std::vector<cv::Vec4f> normals;
+        std::vector<cv::Vec4b> colors;
+        std::vector<int> indices;
+      };
+
+      /** One vertex per observed zero crossing, so cells sharing an edge also share its vertex */
+      struct MeshVertices : public cv::ParallelLoopBody
+      {
+        TsdfVolume volume;
+        Affine3f aff;
+        cv::Matx33f R;
+        cv::Vec3f voxel_size_inv;
+        cv::Vec3f gradient_delta;
+        std::vector<MeshSlice>* slices;
+
+        MeshVertices(const TsdfVolume& vol, const Affine3f& pose, float gradient_delta_factor) : volume(vol), aff(pose), slices(0)
+        {
+          R = aff.rotation();
+          voxel_size_inv = cv::Vec3f(1.f/volume.voxel_size[0], 1.f/volume.voxel_size[1], 1.f/volume.voxel_size[2]);
+          gradient_delta = volume.voxel_size * gradient_delta_factor;
+        }
+
+        static cv::Vec4b color(const Voxel& v)
+        {
+          return cv::Vec4b(v.ba >> 8, v.rg & 0xff, v.rg >> 8, v.ba & 0xff); // bgra
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          const cv::Vec3f& vs = volume.voxel_size;
+
+          for(int z = range.start; z < range.end; ++z)
+          {
+            MeshSlice& slice = (*slices)[z];
+            slice.keys.clear();
+            slice.vertices.clear();
+            slice.normals.clear();
+            slice.colors.clear();
+
+            for(int y = 0; y < volume.dims[1]; ++y)
+              for(int x = 0; x < volume.dims[0]; ++x)
+              {
+                const Voxel& voxel = *volume(x, y, z);
+
+                int W;
+                float F = unpack_tsdf(voxel, W);
+
+                if (W == 0)
+                  continue;
+
+                int coo[] = { x, y, z };
+                for(int axis = 0; axis < 3; ++axis)
+                {
+                  if (coo[axis] + 1 >= volume.dims[axis])
+                    continue;
+
+                  const Voxel& next = *volume(x + (axis == 0), y + (axis == 1), z + (axis == 2));
+
+                  int Wn;
+                  float Fn = unpack_tsdf(next, Wn);
+
+                  if (Wn == 0 || (F < 0) == (Fn < 0))
+                    continue;
+
+                  float t = F / (F - Fn);
+
+                  cv::Vec3f p(x * vs[0], y * vs[1], z * vs[2]);
+                  p[axis] += t * vs[axis];
+
+                  cv::Vec3f n = R * gradient(volume, p, gradient_delta, voxel_size_inv);
+                  n *= 1.f/(float)cv::norm(n);
+
+                  cv::Vec4b c0 = color(voxel), c1 = color(next), c;
+                  for(int i = 0; i < 4; ++i)
+                    c[i] = cv::saturate_cast<uchar>(c0[i] + (c1[i] - c0[i]) * t);
+
+                  cv::Vec3f g = aff * p;
+                  slice.keys.push_back((y * volume.dims[0] + x) * 3 + axis);
+                  slice.vertices.push_back(cv::Vec4f(g[0], g[1], g[2], 0.f));
+                  slice.normals.push_back(cv::Vec4f(n[0], n[1], n[2], 0.f));
+                  slice.colors.push_back(c);
+                }
+              }
+          }
+        }
+      };
+
+      /** Triangulates the cells of each layer, cells touching an unobserved voxel are left open */
+      struct MeshTriangles : public cv::ParallelLoopBody
+      {
+        TsdfVolume volume;
+        std::vector<MeshSlice>* slices;
+        const std::vector<int>* offsets;
+
+        MeshTriangles(const TsdfVolume& vol) : volume(vol), slices(0), offsets(0) {}
+
+        int vertex(int x, int y, int z, int axis) const
+        {
+          const std::vector<int>& keys = (*slices)[z].keys;
+          int key = (y * volume.dims[0] + x) * 3 + axis;
+          return (*offsets)[z] + (int)(std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+          for(int z = range.start; z < range.end; ++z)
+          {
+            std::vector<int>& indices = (*slices)[z].indices;
+            indices.clear();
+
+            for(int y = 0; y < volume.dims[1] - 1; ++y)
+              for(int x = 0; x < volume.dims[0] - 1; ++x)
+              {
+                int cube = 0, i = 0;
+                for(; i < 8; ++i)
+                {
+                  int W;
+                  float F = unpack_tsdf(*volume(x + mc::corners[i][0], y + mc::corners[i][1], z + mc::corners[i][2]), W);
+                  if (W == 0)
+                    break;
+                  cube |= (F < 0) << i;
+                }
+
+                if (i < 8 || cube == 0 || cube == 255)
+                  continue;
+
+                for(const signed char* e = mc::triangles[cube]; *e != -1; ++e)
+                {
+                  const signed char* o = mc::edge_owner[(int)*e];
+                  indices.push_back(vertex(x + o[0], y + o[1], z + o[2], o[3]));
+                }
+              }
+          }
+        }
+      };
+		}
+	}
+}
+
+size_t vm::scanner::host::extractMesh(const TsdfVolume& volume, const Affine3f& aff, float gradient_delta_factor, Mesh& output, size_t& indices_count)
+{
+  std::vector<MeshSlice> slices(volume.dims[2]);
+
+  MeshVertices mv(volume, aff, gradient_delta_factor);
+  mv.slices = &slices;
+  cv::parallel_for_(cv::Range(0, volume.dims[2]), mv);
+
+  std::vector<int> offsets(slices.size() + 1, 0);
+  for(size_t i = 0; i < slices.size(); ++i)
+    offsets[i + 1] = offsets[i] + (int)slices[i].keys.size();
+
+  MeshTriangles mt(volume);
+  mt.slices = &slices;
+  mt.offsets = &offsets;
+  cv::parallel_for_(cv::Range(0, volume.dims[2] - 1), mt);
+
+  size_t total = offsets.back();
+  indices_count = 0;
+  for(size_t i = 0; i < slices.size(); ++i)
+    indices_count += slices[i].indices.size();
+
+  if ((size_t)output.vertices.cols < total || output.vertices.rows != 1)
+  {
+    output.vertices.create(1, (int)total);
+    output.normals.create(1, (int)total);
+    output.colors.create(1, (int)total);
+  }
+
+  if ((size_t)output.indices.cols < indices_count || output.indices.rows != 1)
+    output.indices.create(1, (int)indices_count);
+
+  cv::Vec4f* vpos = output.vertices[0];
+  cv::Vec4f* npos = output.normals[0];
+  cv::Vec4b* cpos = output.colors[0];
+  int* ipos = output.indices[0];
+  for(size_t i = 0; i < slices.size(); ++i)
+  {
+    vpos = std::copy(slices[i].vertices.begin(), slices[i].vertices.end(), vpos);
+    npos = std::copy(slices[i].normals.begin(), slices[i].normals.end(), npos);
+    cpos = std::copy(slices[i].colors.begin(), slices[i].colors.end(), cpos);
+    ipos = std::copy(slices[i].indices.begin(), slices[i].indices.end(), ipos);
+  }
+
+  return total;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// cpu::TsdfVolume
+
+vm::scanner::cpu::TsdfVolume::TsdfVolume(const Vec3i& dims, int order) : data_(), order_(order), trunc_dist_(0.03f), max_weight_(128), dims_(dims),
+  size_(Vec3f::all(3.f)), pose_(Affine3f::Identity()), gradient_delta_factor_(0.75f), raycast_step_factor_(0.75f), culled_voxels_(0)
+{ create(dims_); }
+
+vm::scanner::cpu::TsdfVolume::~TsdfVolume() {}
+
+void vm::scanner::cpu::TsdfVolume::create(const Vec3i& dims)
+{
+  CV_Assert(order_ == ORDER_LINEAR || (order_ == ORDER_BRICKED && dims[0] % 8 == 0 && dims[1] % 8 == 0 && dims[2] % 8 == 0));
+
+  dims_ = dims;
+  data_.create(dims[1] * dims[2], dims[0], CV_16UC4);
+  setTruncDist(trunc_dist_);
+  clear();
+}
+
+Vec3i vm::scanner::cpu::TsdfVolume::getDims() const
+{ return dims_; }
+
+int vm::scanner::cpu::TsdfVolume::getOrder() const
+{ return order_; }
+
+Vec3f vm::scanner::cpu::TsdfVolume::getVoxelSize() const
+{
+  return Vec3f(size_[0]/dims_[0], size_[1]/dims_[1], size_[2]/dims_[2]);
+}
+
+const cv::Mat vm::scanner::cpu::TsdfVolume::data() const { return data_; }
+cv::Mat vm::scanner::cpu::TsdfVolume::data() {  return data_; }
+
+Vec3f vm::scanner::cpu::TsdfVolume::getSize() const { return size_; }
+void vm::scanner::cpu::TsdfVolume::setSize(const Vec3f& size)
+{ size_ = size; setTruncDist(trunc_dist_); }
+
+float vm::scanner::cpu::TsdfVolume::getTruncDist() const { return trunc_dist_; }
+
+void vm::scanner::cpu::TsdfVolume::setTruncDist(float distance)
+{
+  Vec3f vsz = getVoxelSize();
+  float max_coeff = std::max<float>(std::max<float>(vsz[0], vsz[1]), vsz[2]);
+  trunc_dist_ = std::max (distance, 2.1f * max_coeff);
+}
+
+int vm::scanner::cpu::TsdfVolume::getMaxWeight() const { return max_weight_; }
+void vm::scanner::cpu::TsdfVolume::setMaxWeight(int weight) { max_weight_ = weight; }
+Affine3f vm::scanner::cpu::TsdfVolume::getPose() const  { return pose_; }
+void vm::scanner::cpu::TsdfVolume::setPose(const Affine3f& pose) { pose_ = pose; }
+float vm::scanner::cpu::TsdfVolume::getRaycastStepFactor() const { return raycast_step_factor_; }
+void vm::scanner::cpu::TsdfVolume::setRaycastStepFactor(float factor) { raycast_step_factor_ = factor; }
+float vm::scanner::cpu::TsdfVolume::getGradientDeltaFactor() const { return gradient_delta_factor_; }
+void vm::scanner::cpu::TsdfVolume::setGradientDeltaFactor(float factor) { gradient_delta_factor_ = factor; }
+void vm::scanner::cpu::TsdfVolume::swap(cv::Mat& data) { std::swap(data_, data); }
+void vm::scanner::cpu::TsdfVolume::applyAffine(const Affine3f& affine) { pose_ = affine * pose_; }
+
+const char* vm::scanner::cpu::TsdfVolume::getSimdPath()
+{ return host::useAvx2() ? "avx2" : "scalar"; }
+
+void vm::scanner::cpu::TsdfVolume::clear()
+{
+  host::TsdfVolume volume(data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+  host::clear_volume(volume);
+}
+
+void vm::scanner::cpu::TsdfVolume::integrate(const Dists& dists, const Image& colors, const Affine3f& camera_pose, const Intr& intr)
+{
+  CV_Assert(colors.empty() || (colors.rows == dists.rows && colors.cols == dists.cols));
+
+  Affine3f vol2cam = camera_pose.inv() * pose_;
+
+  host::TsdfVolume volume(data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+  culled_voxels_ = host::integrate(dists, colors, volume, vol2cam, intr);
+}
+
+void vm::scanner::cpu::TsdfVolume::integrate(const std::vector<Dists>& dists, const std::vector<Image>& colors,
+                                              const std::vector<Affine3f>& camera_poses, const Intr& intr)
+{
+  CV_Assert(dists.size() == camera_poses.size() && (colors.empty() || colors.size() == dists.size()));
+  for(size_t i = 0; i < colors.size(); ++i)
+    CV_Assert(colors[i].empty() || (colors[i].rows == dists[i].rows && colors[i].cols == dists[i].cols));
+
+  std::vector<Affine3f> vol2cam(camera_poses.size());
+  for(size_t i = 0; i < camera_poses.size(); ++i)
+    vol2cam[i] = camera_poses[i].inv() * pose_;
+
+  host::TsdfVolume volume(data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+  culled_voxels_ = host::integrate(dists, colors, volume, vol2cam, intr);
+}
+
+int64 vm::scanner::cpu::TsdfVolume::getCulledVoxelsNum() const { return culled_voxels_; }
+
+void vm::scanner::cpu::TsdfVolume::raycast(const Affine3f& camera_pose, const Intr& intr, Depth& depth, Normals& normals, const Rays& rays)
+{
+  CV_Assert(!depth.empty());
+  CV_Assert(rays.empty() || (rays.rows == depth.rows && rays.cols == depth.cols));
+  normals.create(depth.rows, depth.cols);
+
+  Affine3f cam2vol = pose_.inv() * camera_pose;
+
+  host::TsdfVolume volume(data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+  host::raycast(volume, cam2vol, intr, rays.empty() ? 0 : &rays, depth, normals, raycast_step_factor_, gradient_delta_factor_);
+}
+
+void vm::scanner::cpu::TsdfVolume::raycast(const Affine3f& camera_pose, const Intr& intr, Cloud& points, Normals& normals, const Rays& rays)
+{
+  CV_Assert(!points.empty());
+  CV_Assert(rays.empty() || (rays.rows == points.rows && rays.cols == points.cols));
+  normals.create(points.rows, points.cols);
+
+  Affine3f cam2vol = pose_.inv() * camera_pose;
+
+  host::TsdfVolume volume(data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+  host::raycast(volume, cam2vol, intr, rays.empty() ? 0 : &rays, points, normals, raycast_step_factor_, gradient_delta_factor_);
+}
+
+vm::scanner::cpu::Cloud vm::scanner::cpu::TsdfVolume::fetchCloud(Cloud& cloud_buffer) const
+{
+  host::TsdfVolume volume((host::Voxel*)data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+  size_t size = host::extractCloud(volume, pose_, cloud_buffer);
+
+  return cloud_buffer.colRange(0, (int)size);
+}
+
+void vm::scanner::cpu::TsdfVolume::fetchNormals(const Cloud& cloud, Normals& normals) const
+{
+  normals.create(1, cloud.cols);
+
+  host::TsdfVolume volume((host::Voxel*)data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+  host::extractNormals(volume, cloud, pose_, gradient_delta_factor_, normals);
+}
+
+void vm::scanner::cpu::TsdfVolume::fetchTangentColors(const Cloud& cloud, Image& colors) const
+{
+  colors.create(1, cloud.cols);
+
+  host::TsdfVolume volume((host::Voxel*)data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+  host::extractTangentColors(volume, cloud, pose_, gradient_delta_factor_, colors);
+}
+
+void vm::scanner::cpu::TsdfVolume::fetchVertexColors(const Cloud& cloud, Image& colors) const
+{
+  colors.create(1, cloud.cols);
+
+  host::TsdfVolume volume((host::Voxel*)data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+  host::extractVertexColors(volume, cloud, pose_, colors);
+}
+
+vm::scanner::cpu::Mesh vm::scanner::cpu::TsdfVolume::fetchMesh(Mesh& mesh_buffer) const
+{
+  host::TsdfVolume volume((host::Voxel*)data_.ptr<host::Voxel>(), order_, dims_, getVoxelSize(), trunc_dist_, max_weight_);
+
+  size_t indices_count;
+  size_t size = host::extractMesh(volume, pose_, gradient_delta_factor_, mesh_buffer, indices_count);
+
+  Mesh mesh;
+  mesh.vertices = mesh_buffer.vertices.colRange(0, (int)size);
+  mesh.normals = mesh_buffer.normals.colRange(0, (int)size);
+  mesh.colors = mesh_buffer.colors.colRange(0, (int)size);
+  mesh.indices = mesh_buffer.indices.colRange(0, (int)indices_count);
+  return mesh;
+}
@@ -0,0 +1,884 @@
+#include <scanner/cuda/device.hpp>
+#include <scanner/cuda/texture_binder.hpp>
+
+///////////////////////////
+// Volume Initialization //
+///////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+			__global__ void clear_blocks_kernel(HashTsdfVolume volume, int blocks_used)
+      {
+        // block 0 is the shared empty block and is cleared too, it never gets written but costs nothing
+        for(int index = blockIdx.x; index <= blocks_used; index += gridDim.x)
+        {
+          ushort4* beg = volume.block(index);
+          for(int i = threadIdx.x; i < HashTsdfVolume::BLOCK_VOXELS; i += blockDim.x)
+            beg[i] = pack_tsdf (0.f, 0, 0, 0);
+        }
+      }
+		}
+	}
+}
+
+void vm::scanner::device::clear_volume(HashTsdfVolume volume, int blocks_used)
+{
+  cudaSafeCall ( cudaMemset(volume.keys, 0, (volume.hash_mask + 1) * sizeof(unsigned long long)) );
+  cudaSafeCall ( cudaMemset(volume.blocks_count, 0, sizeof(int)) );
+
+  dim3 block (256);
+  dim3 grid (min (blocks_used + 1, 65535));
+
+  clear_blocks_kernel<<<grid, block>>>(volume, blocks_used);
+  cudaSafeCall ( cudaGetLastError () );
+}
+
+//////////////////////
+// Block Allocation //
+//////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+			texture<float, 2> hash_dists_tex(0, cudaFilterModePoint, cudaAddressModeBorder, cudaCreateChannelDescHalf());
+      texture<uchar4, 2> hash_color_tex(0, cudaFilterModePoint, cudaAddressModeBorder, cudaCreateChannelDescHalf());
+
+      struct BlockAllocator
+      {
+        Aff3f cam2vol;
+        Reprojector reproj;
+        int2 dists_size;
+
+        float3 voxel_size_inv;
+        float step;
+
+        /** Walks the truncation band of the pixel ray and inserts every block it passes */
+        __vm_device__
+        void operator()(const HashTsdfVolume& volume) const
+        {
+          int x = blockIdx.x * blockDim.x + threadIdx.x;
+          int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+          if (x >= dists_size.x || y >= dists_size.y)
+            return;
+
+          float Dp = tex2D(hash_dists_tex, x, y);
+          if (Dp == 0)
+            return;
+
+          float3 ray_dir = cam2vol.R * reproj.direction(x, y);
+
+          float tmin = fmaxf(0.f, Dp - volume.trunc_dist);
+          float tmax = Dp + volume.trunc_dist;
+
+          int3 prev = make_int3(-1, -1, -1);
+          for(float t = tmin; ; t = fminf(t + step, tmax))
+          {
+            float3 v = (cam2vol.t + ray_dir * t) * voxel_size_inv;
+            int3 b = make_int3(__float2int_rd(v.x) >> 3, __float2int_rd(v.y) >> 3, __float2int_rd(v.z) >> 3);
+
+            if (b.x != prev.x || b.y != prev.y || b.z != prev.z)
+              volume.insert(b);
+
+            prev = b;
+            if (t >= tmax)
+              break;
+          }
+        }
+      };
+
+      __global__ void allocate_kernel(const BlockAllocator allocator, const HashTsdfVolume volume) { allocator(volume); }
+		}
+	}
+}
+
+int vm::scanner::device::allocate_blocks(const Dists& dists, HashTsdfVolume& volume, const Aff3f& cam2vol, const Reprojector& reproj)
+{
+  BlockAllocator ba;
+  ba.cam2vol = cam2vol;
+  ba.reproj = reproj;
+  ba.dists_size = make_int2(dists.cols, dists.rows);
+  ba.voxel_size_inv = 1.f/volume.voxel_size;
+
+  // half of the block size, so a ray can't jump over a block it passes through the middle of
+  ba.step = fminf(volume.voxel_size.x, fminf(volume.voxel_size.y, volume.voxel_size.z)) * HashTsdfVolume::BLOCK_SIZE * 0.5f;
+
+  hash_dists_tex.filterMode = cudaFilterModePoint;
+  hash_dists_tex.addressMode[0] = cudaAddressModeBorder;
+  hash_dists_tex.addressMode[1] = cudaAddressModeBorder;
+  hash_dists_tex.addressMode[2] = cudaAddressModeBorder;
+  TextureBinder binder(dists, hash_dists_tex, cudaCreateChannelDescHalf()); (void)binder;
+
+  dim3 block(32, 8);
+  dim3 grid(divUp(dists.cols, block.x), divUp(dists.rows, block.y));
+
+  allocate_kernel<<<grid, block>>>(ba, volume);
+  cudaSafeCall ( cudaGetLastError () );
+
+  int count;
+  cudaSafeCall ( cudaMemcpy(&count, volume.blocks_count, sizeof(count), cudaMemcpyDeviceToHost) );
+  return count;
+}
+
+////////////////////////
+// Volume Integration //
+////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+			struct HashIntegrator
+      {
+        Aff3f vol2cam;
+        Projector proj;
+        int2 dists_size;
+
+        float tranc_dist_inv;
+
+        /** One thread per voxel, one cta per allocated block */
+        __vm_device__
+        void operator()(HashTsdfVolume& volume, int blocks_used) const
+        {
+          for(int index = blockIdx.x + 1; index <= blocks_used; index += gridDim.x)
+          {
+            int3 b = volume.blocks[index];
+
+            int x = b.x * HashTsdfVolume::BLOCK_SIZE + threadIdx.x;
+            int y = b.y * HashTsdfVolume::BLOCK_SIZE + threadIdx.y;
+            int z = b.z * HashTsdfVolume::BLOCK_SIZE + threadIdx.z;
+
+            float3 vc = vol2cam * make_float3(x * volume.voxel_size.x, y * volume.voxel_size.y, z * volume.voxel_size.z);
+            float2 coo = proj(vc);
+
+            if (coo.x < 0 || coo.y < 0 || coo.x >= dists_size.x || coo.y >= dists_size.y)
+              continue;
+
+            float Dp = tex2D(hash_dists_tex, coo.x, coo.y);
+            uchar4 Cp = tex2D(hash_color_tex, coo.x, coo.y);
+
+            if(Dp == 0 || vc.z <= 0)
+              continue;
+
+            float sdf = Dp - __fsqrt_rn(dot(vc, vc)); //Dp - norm(v)
+
+            if (sdf >= -volume.trunc_dist)
+            {
+              float tsdf = fmin(1.f, sdf * tranc_dist_inv);
+              uchar4 rc = make_uchar4(Cp.z, Cp.y, Cp.x, Cp.w);
+
+              ushort4* vptr = volume.block(index) + (threadIdx.z * HashTsdfVolume::BLOCK_SIZE + threadIdx.y) * HashTsdfVolume::BLOCK_SIZE + threadIdx.x;
+
+              //read and unpack
+              int weight_prev;
+              ushort2 color_prev;
+              float tsdf_prev = unpack_tsdf (*vptr, weight_prev, color_prev.x, color_prev.y);
+              uchar4 tcdf = ushort2rgba(color_prev);
+
+              uchar cx = __fdividef(__fmaf_rn(tcdf.x, weight_prev, rc.x), weight_prev+1);
+              uchar cy = __fdividef(__fmaf_rn(tcdf.y, weight_prev, rc.y), weight_prev+1);
+              uchar cz = __fdividef(__fmaf_rn(tcdf.z, weight_prev, rc.z), weight_prev+1);
+              uchar cw = __fdividef(__fmaf_rn(tcdf.w, weight_prev, rc.w), weight_prev+1);
+
+              ushort2 color_new = rgba2ushort(make_uchar4(cx, cy, cz, cw));
+
+              float tsdf_new = __fdividef(__fmaf_rn(tsdf_prev, weight_prev, tsdf), weight_prev + 1);
+              int weight_new = min (weight_prev + 1, volume.max_weight);
+
+              //pack and write
+              *vptr = pack_tsdf (tsdf_new, weight_new, color_new.x, color_new.y);
+            }
+          }
+        }
+      };
+
+      __global__ void integrate_kernel(const HashIntegrator integrator, HashTsdfVolume volume, int blocks_used) { integrator(volume, blocks_used); };
+		}
+	}
+}
+
+void vm::scanner::device::integrate(const Dists& dists, const Image& colors, HashTsdfVolume& volume, int blocks_used, const Aff3f& aff, const Projector& proj)
+{
+  if (blocks_used == 0)
+    return;
+
+  HashIntegrator hi;
+  hi.dists_size = make_int2(dists.cols, dists.rows);
+  hi.vol2cam = aff;
+  hi.proj = proj;
+  hi.tranc_dist_inv = 1.f/volume.trunc_dist;
+
+  hash_dists_tex.filterMode = cudaFilterModePoint;
+  hash_dists_tex.addressMode[0] = cudaAddressModeBorder;
+  hash_dists_tex.addressMode[1] = cudaAddressModeBorder;
+  hash_dists_tex.addressMode[2] = cudaAddressModeBorder;
+  TextureBinder binder(dists, hash_dists_tex, cudaCreateChannelDescHalf()); (void)binder;
+
+  hash_color_tex.filterMode = cudaFilterModePoint;
+  hash_color_tex.addressMode[0] = cudaAddressModeBorder;
+  hash_color_tex.addressMode[1] = cudaAddressModeBorder;
+  hash_color_tex.addressMode[2] = cudaAddressModeBorder;
+  TextureBinder color_binder(colors, hash_color_tex); (void)color_binder;
+
+  dim3 block(HashTsdfVolume::BLOCK_SIZE, HashTsdfVolume::BLOCK_SIZE, HashTsdfVolume::BLOCK_SIZE);
+  dim3 grid(min(blocks_used, 65535));
+
+  integrate_kernel<<<grid, block>>>(hi, volume, blocks_used);
+  cudaSafeCall ( cudaGetLastError () );
+  cudaSafeCall ( cudaDeviceSynchronize() );
+}
+
+////////////////////////
+// Volume Ray Casting //
+////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+			struct HashRaycaster
+      {
+        HashTsdfVolume volume;
+
+        Aff3f aff;
+        Mat3f Rinv;
+
+        Vec3f volume_size;
+        Reprojector reproj;
+        float time_step;
+        float3 gradient_delta;
+        float3 voxel_size_inv;
+
+        HashRaycaster(const HashTsdfVolume& _volume, const Aff3f& _aff, const Mat3f& _Rinv, const Reprojector& _reproj)
+          : volume(_volume), aff(_aff), Rinv(_Rinv), reproj(_reproj) {}
+
+        __vm_device__
+        float fetch_tsdf(const float3& p) const
+        {
+          //rounding to nearest even
+          int x = __float2int_rn (p.x * voxel_size_inv.x);
+          int y = __float2int_rn (p.y * voxel_size_inv.y);
+          int z = __float2int_rn (p.z * voxel_size_inv.z);
+          return unpack_tsdf(*volume(x, y, z));
+        }
+
+        /** Marches the ray, returns false if it doesn't hit the surface. Vertex and normal are in camera frame. */
+        __vm_device__
+        bool cast(int x, int y, float3& vertex, float3& normal) const
+        {
+          float3 ray_org = aff.t;
+          float3 ray_dir = aff.R * reproj.direction(x, y);
+
+          float3 box_max = volume_size - volume.voxel_size;
+
+          float tmin, tmax;
+          intersect(ray_org, ray_dir, box_max, tmin, tmax);
+
+          const float min_dist = 0.f;
+          tmin = fmax(min_dist, tmin);
+          if (tmin >= tmax)
+            return false;
+
+          tmax -= time_step;
+          float3 vstep = ray_dir * time_step;
+          float3 next = ray_org + ray_dir * tmin;
+
+          float tsdf_next = fetch_tsdf(next);
+          for (float tcurr = tmin; tcurr < tmax; tcurr += time_step)
+          {
+            float tsdf_curr = tsdf_next;
+            float3     curr = next;
+            next += vstep;
+
+            tsdf_next = fetch_tsdf(next);
+            if (tsdf_curr < 0.f && tsdf_next > 0.f)
+              return false;
+
+            if (tsdf_curr > 0.f && tsdf_next < 0.f)
+            {
+              float Ft   = interpolate(volume, curr * voxel_size_inv);
+              float Ftdt = interpolate(volume, next * voxel_size_inv);
+
+              float Ts = tcurr - __fdividef(time_step * Ft, Ftdt - Ft);
+
+              vertex = ray_org + ray_dir * Ts;
+              normal = compute_normal(vertex);
+
+              if (isnan(normal.x * normal.y * normal.z))
+                return false;
+
+              normal = Rinv * normal;
+              vertex = Rinv * (vertex - aff.t);
+              return true;
+            }
+          } /* for (;;) */
+          return false;
+        }
+
+        __vm_device__
+        void operator()(PtrStepSz<ushort> depth, PtrStep<Normal> normals) const
+        {
+          int x = blockIdx.x * blockDim.x + threadIdx.x;
+          int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+          if (x >= depth.cols || y >= depth.rows)
+            return;
+
+          const float qnan = numeric_limits<float>::quiet_NaN();
+
+          float3 vertex, normal;
+          bool hit = cast(x, y, vertex, normal);
+
+          normals(y, x) = hit ? make_float4(normal.x, normal.y, normal.z, 0) : make_float4(qnan, qnan, qnan, qnan);
+          depth(y, x) = hit ? static_cast<ushort>(vertex.z * 1000) : 0;
+        }
+
+        __vm_device__
+        void operator()(PtrStepSz<Point> points, PtrStep<Normal> normals) const
+        {
+          int x = blockIdx.x * blockDim.x + threadIdx.x;
+          int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+          if (x >= points.cols || y >= points.rows)
+            return;
+
+          const float qnan = numeric_limits<float>::quiet_NaN();
+
+          float3 vertex, normal;
+          bool hit = cast(x, y, vertex, normal);
+
+          normals(y, x) = hit ? make_float4(normal.x, normal.y, normal.z, 0.f) : make_float4(qnan, qnan, qnan, qnan);
+          points(y, x) = hit ? make_float4(vertex.x, vertex.y, vertex.z, 0.f) : make_float4(qnan, qnan, qnan, qnan);
+        }
+
+        __vm_device__
+        float3 compute_normal(const float3& p) const
+        {
+          float3 n;
+
+          float Fx1 = interpolate(volume, make_float3(p.x + gradient_delta.x, p.y, p.z) * voxel_size_inv);
+          float Fx2 = interpolate(volume, make_float3(p.x - gradient_delta.x, p.y, p.z) * voxel_size_inv);
+          n.x = __fdividef(Fx1 - Fx2, gradient_delta.x);
+
+          float Fy1 = interpolate(volume, make_float3(p.x, p.y + gradient_delta.y, p.z) * voxel_size_inv);
+          float Fy2 = interpolate(volume, make_float3(p.x, p.y - gradient_delta.y, p.z) * voxel_size_inv);
+          n.y = __fdividef(Fy1 - Fy2, gradient_delta.y);
+
+          float Fz1 = interpolate(volume, make_float3(p.x, p.y, p.z + gradient_delta.z) * voxel_size_inv);
+          float Fz2 = interpolate(volume, make_float3(p.x, p.y, p.z - gradient_delta.z) * voxel_size_inv);
+          n.z = __fdividef(Fz1 - Fz2, gradient_delta.z);
+
+          return normalized (n);
+        }
+      };
+
+      __global__ void raycast_kernel(const HashRaycaster raycaster, PtrStepSz<ushort> depth, PtrStep<Normal> normals)
+      { raycaster(depth, normals); };
+
+      __global__ void raycast_kernel(const HashRaycaster raycaster, PtrStepSz<Point> points, PtrStep<Normal> normals)
+      { raycaster(points, normals); };
+		}
+	}
+}
+
+void vm::scanner::device::raycast(const HashTsdfVolume& volume, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& reproj,
+                              Depth& depth, Normals& normals, float raycaster_step_factor, float gradient_delta_factor)
+{
+  HashRaycaster rc(volume, aff, Rinv, reproj);
+
+  rc.volume_size = volume.voxel_size * volume.dims;
+  rc.time_step = volume.trunc_dist * raycaster_step_factor;
+  rc.gradient_delta = volume.voxel_size * gradient_delta_factor;
+  rc.voxel_size_inv = 1.f/volume.voxel_size;
+
+  dim3 block(32, 8);
+  dim3 grid (divUp (depth.cols(), block.x), divUp (depth.rows(), block.y));
+
+  raycast_kernel<<<grid, block>>>(rc, (PtrStepSz<ushort>)depth, normals);
+  cudaSafeCall (cudaGetLastError ());
+}
+
+void vm::scanner::device::raycast(const HashTsdfVolume& volume, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& reproj,
+                              Points& points, Normals& normals, float raycaster_step_factor, float gradient_delta_factor)
+{
+  HashRaycaster rc(volume, aff, Rinv, reproj);
+
+  rc.volume_size = volume.voxel_size * volume.dims;
+  rc.time_step = volume.trunc_dist * raycaster_step_factor;
+  rc.gradient_delta = volume.voxel_size * gradient_delta_factor;
+  rc.voxel_size_inv = 1.f/volume.voxel_size;
+
+  dim3 block(32, 8);
+  dim3 grid (divUp (points.cols(), block.x), divUp (points.rows(), block.y));
+
+  raycast_kernel<<<grid, block>>>(rc, (PtrStepSz<Point>)points, normals);
+  cudaSafeCall (cudaGetLastError ());
+}
+
+/////////////////////////////
+// Volume Cloud Extraction //
+/////////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+			__device__ int hash_global_count;
+
+      /** FullScan6 over allocated blocks only, so the cost follows the surface area instead of the grid volume */
+      struct HashScan6
+      {
+        HashTsdfVolume volume;
+        Aff3f aff;
+
+        HashScan6(const HashTsdfVolume& vol) : volume(vol) {}
+
+        __vm_device__ bool crossing(float F, int x, int y, int z, float& Fn) const
+        {
+          int Wn;
+          ushort rg, ba;
+          Fn = unpack_tsdf(*volume(x, y, z), Wn, rg, ba);
+          return Wn != 0 && Fn != 1.f && ((F > 0 && Fn < 0) || (F < 0 && Fn > 0));
+        }
+
+        __vm_device__ void store(const float3& p, PtrSz<Point> output) const
+        {
+          int index = atomicAdd(&hash_global_count, 1);
+          if (index < output.size)
+          {
+            float3 g = aff * p;
+            output.data[index] = make_float4(g.x, g.y, g.z, 0.f);
+          }
+        }
+
+        __vm_device__ void operator () (int blocks_used, PtrSz<Point> output) const
+        {
+          for(int index = blockIdx.x + 1; index <= blocks_used; index += gridDim.x)
+          {
+            int3 b = volume.blocks[index];
+
+            int x = b.x * HashTsdfVolume::BLOCK_SIZE + threadIdx.x;
+            int y = b.y * HashTsdfVolume::BLOCK_SIZE + threadIdx.y;
+            int z = b.z * HashTsdfVolume::BLOCK_SIZE + threadIdx.z;
+
+            int W;
+            ushort rg, ba;
+            const ushort4* vptr = volume.block(index) + (threadIdx.z * HashTsdfVolume::BLOCK_SIZE + threadIdx.y) * HashTsdfVolume::BLOCK_SIZE + threadIdx.x;
+            float F = unpack_tsdf(*vptr, W, rg, ba);
+
+            if (W == 0 || F == 1.f)
+              continue;
+
+            float3 V = make_float3((x + 0.5f) * volume.voxel_size.x, (y + 0.5f) * volume.voxel_size.y, (z + 0.5f) * volume.voxel_size.z);
+            float Fn;
+
+            //process dx
+            if (x + 1 < volume.dims.x && crossing(F, x + 1, y, z, Fn))
+            {
+              float3 p = V;
+              p.x = (V.x * fabs (Fn) + (V.x + volume.voxel_size.x) * fabs (F)) / (fabs (F) + fabs (Fn));
+              store(p, output);
+            }
+
+            //process dy
+            if (y + 1 < volume.dims.y && crossing(F, x, y + 1, z, Fn))
+            {
+              float3 p = V;
+              p.y = (V.y * fabs (Fn) + (V.y + volume.voxel_size.y) * fabs (F)) / (fabs (F) + fabs (Fn));
+              store(p, output);
+            }
+
+            //process dz
+            if (z + 1 < volume.dims.z && crossing(F, x, y, z + 1, Fn))
+            {
+              float3 p = V;
+              p.z = (V.z * fabs (Fn) + (V.z + volume.voxel_size.z) * fabs (F)) / (fabs (F) + fabs (Fn));
+              store(p, output);
+            }
+          }
+        }
+      };
+
+      __global__ void extract_kernel(const HashScan6 fs, int blocks_used, PtrSz<Point> output) { fs(blocks_used, output); }
+
+      struct HashExtractPoint
+      {
+        HashTsdfVolume volume;
+        PtrSz<Point> points;
+        float3 voxel_size_inv;
+        float3 gradient_delta;
+        Aff3f aff;
+        Mat3f Rinv;
+
+        HashExtractPoint(const HashTsdfVolume& vol) : volume(vol)
+        {
+          voxel_size_inv.x = 1.f/volume.voxel_size.x;
+          voxel_size_inv.y = 1.f/volume.voxel_size.y;
+          voxel_size_inv.z = 1.f/volume.voxel_size.z;
+        }
+
+        /** Maps the cloud point back to the volume, returns false if it is too close to the border for a gradient */
+        __vm_device__ bool locate(int idx, float3& point, int3& g) const
+        {
+          point = Rinv * (tr(points.data[idx]) - aff.t);
+
+          //rounding to nearest even
+          g = make_int3(__float2int_rn (point.x * voxel_size_inv.x), __float2int_rn (point.y * voxel_size_inv.y), __float2int_rn (point.z * voxel_size_inv.z));
+          return g.x > 1 && g.y > 1 && g.z > 1 && g.x < volume.dims.x - 2 && g.y < volume.dims.y - 2 && g.z < volume.dims.z - 2;
+        }
+
+        __vm_device__ float3 normal(const float3& point) const
+        {
+          float3 n;
+
+          float Fx1 = interpolate(volume, make_float3(point.x + gradient_delta.x, point.y, point.z) * voxel_size_inv);
+          float Fx2 = interpolate(volume, make_float3(point.x - gradient_delta.x, point.y, point.z) * voxel_size_inv);
+          n.x = __fdividef(Fx1 - Fx2, gradient_delta.x);
+
+          float Fy1 = interpolate(volume, make_float3(point.x, point.y + gradient_delta.y, point.z) * voxel_size_inv);
+          float Fy2 = interpolate(volume, make_float3(point.x, point.y - gradient_delta.y, point.z) * voxel_size_inv);
+          n.y = __fdividef(Fy1 - Fy2, gradient_delta.y);
+
+          float Fz1 = interpolate(volume, make_float3(point.x, point.y, point.z + gradient_delta.z) * voxel_size_inv);
+          float Fz2 = interpolate(volume, make_float3(point.x, point.y, point.z - gradient_delta.z) * voxel_size_inv);
+          n.z = __fdividef(Fz1 - Fz2, gradient_delta.z);
+
+          return normalized (aff.R * n);
+        }
+      };
+
+      __global__ void extract_normals_kernel (const HashExtractPoint ep, float4* output)
+      {
+        int idx = threadIdx.x + blockIdx.x * blockDim.x;
+        if (idx >= ep.points.size)
+          return;
+
+        const float qnan = numeric_limits<float>::quiet_NaN ();
+        float3 n = make_float3 (qnan, qnan, qnan);
+
+        float3 point;
+        int3 g;
+        if (ep.locate(idx, point, g))
+          n = ep.normal(point);
+
+        output[idx] = make_float4(n.x, n.y, n.z, 0);
+      }
+
+      __global__ void extract_tangent_colors_kernel (const HashExtractPoint ep, uchar4* output)
+      {
+        int idx = threadIdx.x + blockIdx.x * blockDim.x;
+        if (idx >= ep.points.size)
+          return;
+
+        const float qnan = numeric_limits<float>::quiet_NaN ();
+        float3 n = make_float3 (qnan, qnan, qnan);
+
+        float3 point;
+        int3 g;
+        if (ep.locate(idx, point, g))
+          n = ep.normal(point);
+
+        unsigned char c_r = static_cast<unsigned char>((5.f - n.x * 3.5f) * 25.5f);
+        unsigned char c_g = static_cast<unsigned char>((5.f - n.y * 2.5f) * 25.5f);
+        unsigned char c_b = static_cast<unsigned char>((5.f - n.z * 3.5f) * 25.5f);
+
+        output[idx] = make_uchar4(c_b, c_g, c_r, 0);
+      }
+
+      __global__ void extract_vertex_colors_kernel (const HashExtractPoint ep, uchar4* output)
+      {
+        int idx = threadIdx.x + blockIdx.x * blockDim.x;
+        if (idx >= ep.points.size)
+          return;
+
+        float3 point;
+        int3 g;
+        if (ep.locate(idx, point, g))
+        {
+          int W;
+          ushort2 C;
+          unpack_tsdf(*ep.volume(g.x, g.y, g.z), W, C.x, C.y);
+          uchar4 tmp = ushort2rgba(C);  // rgb
+
+          output[idx] = make_uchar4(tmp.z, tmp.y, tmp.x, tmp.w); // bgr
+        }
+      }
+
+      __device__ int hash_surfel_count;
+
+      /** Zero crossings as HashScan6 finds them, with the gradient normal and a color each. One cta per allocated block:
+        * count() stores the crossings of every block, fill() reserves that many records with one atomic per block and
+        * writes them, so an output sized by count() is never overrun. */
+      struct HashExtractSurfels : public HashExtractPoint
+      {
+        bool tangent_colors;
+
+        HashExtractSurfels(const HashTsdfVolume& vol) : HashExtractPoint(vol) {}
+
+        /** Crossings on the +x, +y and +z edges of the voxel of this thread in block index, in volume coordinates */
+        __vm_device__ int crossings(int index, float3 points[3]) const
+        {
+          int3 b = volume.blocks[index];
+
+          int x = b.x * HashTsdfVolume::BLOCK_SIZE + threadIdx.x;
+          int y = b.y * HashTsdfVolume::BLOCK_SIZE + threadIdx.y;
+          int z = b.z * HashTsdfVolume::BLOCK_SIZE + threadIdx.z;
+
+          int W;
+          ushort rg, ba;
+          const ushort4* vptr = volume.block(index) + (threadIdx.z * HashTsdfVolume::BLOCK_SIZE + threadIdx.y) * HashTsdfVolume::BLOCK_SIZE + threadIdx.x;
+          float F = unpack_tsdf(*vptr, W, rg, ba);
+
+          if (W == 0 || F == 1.f)
+            return 0;
+
+          float3 V = make_float3((x + 0.5f) * volume.voxel_size.x, (y + 0.5f) * volume.voxel_size.y, (z + 0.5f) * volume.voxel_size.z);
+
+          int count = 0;
+          for(int axis = 0; axis < 3; ++axis)
+          {
+            int3 g = make_int3(x + (axis == 0), y + (axis == 1), z + (axis == 2));
+
+            if (g.x >= volume.dims.x || g.y >= volume.dims.y || g.z >= volume.dims.z)
+              continue;
+
+            int Wn;
+            float Fn = unpack_tsdf(*volume(g.x, g.y, g.z), Wn, rg, ba);
+
+            if (Wn == 0 || Fn == 1.f || !((F > 0 && Fn < 0) || (F < 0 && Fn > 0)))
+              continue;
+
+            float3 p = V;
+            if (axis == 0) p.x = (V.x * fabs (Fn) + (V.x + volume.voxel_size.x) * fabs (F)) / (fabs (F) + fabs (Fn));
+            if (axis == 1) p.y = (V.y * fabs (Fn) + (V.y + volume.voxel_size.y) * fabs (F)) / (fabs (F) + fabs (Fn));
+            if (axis == 2) p.z = (V.z * fabs (Fn) + (V.z + volume.voxel_size.z) * fabs (F)) / (fabs (F) + fabs (Fn));
+
+            points[count++] = p;
+          }
+          return count;
+        }
+
+        __vm_device__ Surfel surfel(const float3& point) const
+        {
+          const float qnan = numeric_limits<float>::quiet_NaN ();
+          float3 n = make_float3 (qnan, qnan, qnan);
+          uchar4 color = make_uchar4(0, 0, 0, 0);
+
+          int3 g = make_int3(__float2int_rn (point.x * voxel_size_inv.x), __float2int_rn (point.y * voxel_size_inv.y), __float2int_rn (point.z * voxel_size_inv.z));
+
+          if (g.x > 1 && g.y > 1 && g.z > 1 && g.x < volume.dims.x - 2 && g.y < volume.dims.y - 2 && g.z < volume.dims.z - 2)
+          {
+            n = normal(point);
+
+            if (!tangent_colors)
+            {
+              int W;
+              ushort2 C;
+              unpack_tsdf(*volume(g.x, g.y, g.z), W, C.x, C.y);
+              uchar4 tmp = ushort2rgba(C);  // rgb
+              color = make_uchar4(tmp.z, tmp.y, tmp.x, tmp.w); // bgr
+            }
+          }
+
+          if (tangent_colors)
+          {
+            unsigned char c_r = static_cast<unsigned char>((5.f - n.x * 3.5f) * 25.5f);
+            unsigned char c_g = static_cast<unsigned char>((5.f - n.y * 2.5f) * 25.5f);
+            unsigned char c_b = static_cast<unsigned char>((5.f - n.z * 3.5f) * 25.5f);
+            color = make_uchar4(c_b, c_g, c_r, 0);
+          }
+
+          float3 v = aff * point;
+
+          Surfel s;
+          s.point = make_float4(v.x, v.y, v.z, 0.f);
+          s.normal = make_float4(n.x, n.y, n.z, 0.f);
+          s.color = color;
+          s.pad[0] = s.pad[1] = s.pad[2] = 0;
+          return s;
+        }
+
+        __vm_device__ void count(int blocks_used, int* counts) const
+        {
+          __shared__ int cta_count;
+          int tid = Block::flattenedThreadId ();
+
+          for(int index = blockIdx.x + 1; index <= blocks_used; index += gridDim.x)
+          {
+            if (tid == 0)
+              cta_count = 0;
+            __syncthreads();
+
+            float3 points[3];
+            int n = crossings(index, points);
+            if (n)
+              atomicAdd(&cta_count, n);
+            __syncthreads();
+
+            if (tid == 0)
+            {
+              counts[index] = cta_count;
+              if (cta_count)
+                atomicAdd(&hash_surfel_count, cta_count);
+            }
+            __syncthreads();
+          }
+        }
+
+        __vm_device__ void fill(int blocks_used, const int* counts, PtrSz<Surfel> output) const
+        {
+          __shared__ int cta_pos;
+          int tid = Block::flattenedThreadId ();
+
+          for(int index = blockIdx.x + 1; index <= blocks_used; index += gridDim.x)
+          {
+            int total = counts[index];
+            if (!total)
+              continue;
+
+            if (tid == 0)
+              cta_pos = atomicAdd(&hash_surfel_count, total);
+            __syncthreads();
+
+            float3 points[3];
+            int n = crossings(index, points);
+            int pos = n ? atomicAdd(&cta_pos, n) : 0;
+            __syncthreads();
+
+            for(int i = 0; i < n && pos + i < output.size; ++i)
+              output.data[pos + i] = surfel(points[i]);
+          }
+        }
+      };
+
+      __global__ void count_surfels_kernel(const HashExtractSurfels es, int blocks_used, int* counts) { es.count(blocks_used, counts); }
+
+      __global__ void extract_surfels_kernel(const HashExtractSurfels es, int blocks_used, const int* counts, PtrSz<Surfel> output)
+      { es.fill(blocks_used, counts, output); }
+		}
+	}
+}
+
+size_t vm::scanner::device::extractCloud (const HashTsdfVolume& volume, int blocks_used, const Aff3f& aff, PtrSz<Point> output)
+{
+  if (blocks_used == 0)
+    return 0;
+
+  HashScan6 fs(volume);
+  fs.aff = aff;
+
+  int zero = 0;
+  cudaSafeCall ( cudaMemcpyToSymbol (hash_global_count, &zero, sizeof(zero)) );
+
+  dim3 block (HashTsdfVolume::BLOCK_SIZE, HashTsdfVolume::BLOCK_SIZE, HashTsdfVolume::BLOCK_SIZE);
+  dim3 grid (min (blocks_used, 65535));
+
+  extract_kernel<<<grid, block>>>(fs, blocks_used, output);
+  cudaSafeCall ( cudaGetLastError () );
+  cudaSafeCall (cudaDeviceSynchronize ());
+
+  int size;
+  cudaSafeCall ( cudaMemcpyFromSymbol (&size, hash_global_count, sizeof(size)) );
+  return (size_t)min ((int)output.size, size);
+}
+
+void vm::scanner::device::extractNormals (const HashTsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, float4* output)
+{
+  HashExtractPoint ep(volume);
+  ep.points = points;
+  ep.gradient_delta = volume.voxel_size * gradient_delta_factor;
+  ep.aff = aff;
+  ep.Rinv = Rinv;
+
+  dim3 block (256);
+  dim3 grid (divUp ((int)points.size, block.x));
+
+  extract_normals_kernel<<<grid, block>>>(ep, output);
+  cudaSafeCall ( cudaGetLastError () );
+  cudaSafeCall (cudaDeviceSynchronize ());
+}
+
+void vm::scanner::device::extractTangentColors (const HashTsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, uchar4* output)
+{
+  HashExtractPoint ep(volume);
+  ep.points = points;
+  ep.gradient_delta = volume.voxel_size * gradient_delta_factor;
+  ep.aff = aff;
+  ep.Rinv = Rinv;
+
+  dim3 block(256);
+  dim3 grid(divUp ((int)points.size, block.x));
+
+  extract_tangent_colors_kernel<<<grid, block>>>(ep, output);
+  cudaSafeCall(cudaGetLastError());
+  cudaSafeCall(cudaDeviceSynchronize());
+}
+
+void vm::scanner::device::extractVertexColors(const HashTsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, uchar4* output)
+{
+  HashExtractPoint ep(volume);
+  ep.points = points;
+  ep.aff = aff;
+  ep.Rinv = Rinv;
+
+  dim3 block(256);
+  dim3 grid(divUp ((int)points.size, block.x));
+
+  extract_vertex_colors_kernel<<<grid, block>>>(ep, output);
+  cudaSafeCall(cudaGetLastError());
+  cudaSafeCall(cudaDeviceSynchronize());
+}
+
+size_t vm::scanner::device::countSurfels(const HashTsdfVolume& volume, int blocks_used, int* counts)
+{
+  if (blocks_used == 0)
+    return 0;
+
+  HashExtractSurfels es(volume);
+
+  int zero = 0;
+  cudaSafeCall ( cudaMemcpyToSymbol (hash_surfel_count, &zero, sizeof(zero)) );
+
+  dim3 block (HashTsdfVolume::BLOCK_SIZE, HashTsdfVolume::BLOCK_SIZE, HashTsdfVolume::BLOCK_SIZE);
+  dim3 grid (min (blocks_used, 65535));
+
+  count_surfels_kernel<<<grid, block>>>(es, blocks_used, counts);
+  cudaSafeCall ( cudaGetLastError () );
+  cudaSafeCall (cudaDeviceSynchronize ());
+
+  int count;
+  cudaSafeCall ( cudaMemcpyFromSymbol (&count, hash_surfel_count, sizeof(count)) );
+  return (size_t)count;
+}
+
+void vm::scanner::device::extractSurfels(const HashTsdfVolume& volume, int blocks_used, const Aff3f& aff, float gradient_delta_factor,
+                                         bool tangent_colors, const int* counts, PtrSz<Surfel> output)
+{
+  HashExtractSurfels es(volume);
+  es.aff = aff;
+  es.gradient_delta = volume.voxel_size * gradient_delta_factor;
+  es.tangent_colors = tangent_colors;
+
+  int zero = 0;
+  cudaSafeCall ( cudaMemcpyToSymbol (hash_surfel_count, &zero, sizeof(zero)) );
+
+  dim3 block (HashTsdfVolume::BLOCK_SIZE, HashTsdfVolume::BLOCK_SIZE, HashTsdfVolume::BLOCK_SIZE);
+  dim3 grid (min (blocks_used, 65535));
+
+  extract_surfels_kernel<<<grid, block>>>(es, blocks_used, counts, output);
+  cudaSafeCall ( cudaGetLastError () );
+  cudaSafeCall (cudaDeviceSynchronize ());
+}
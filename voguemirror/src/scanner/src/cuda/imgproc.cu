@@ -10,18 +10,15 @@ namespace vm
 	{
     namespace device
     {
-  		__global__ void bilateral_kernel(const PtrStepSz<ushort> src, PtrStep<ushort> dst, const int ksz, const float sigma_spatial2_inv_half, const float sigma_depth2_inv_half)
+      /** Bilateral filtered src(y, x), shared with the fused front end so both give the same result. Src is anything
+        * with operator()(y, x) that covers the clamped window. */
+      template<class Src>
+      __vm_device__ ushort bilateral_pixel(const Src& src, int x, int y, int cols, int rows, const int ksz, const float sigma_spatial2_inv_half, const float sigma_depth2_inv_half)
       {
-        int x = threadIdx.x + blockIdx.x * blockDim.x;
-        int y = threadIdx.y + blockIdx.y * blockDim.y;
-
-        if (x >= src.cols || y >= src.rows)
-          return;
-
         int value = src(y, x);
 
-        int tx = min (x - ksz / 2 + ksz, src.cols - 1);
-        int ty = min (y - ksz / 2 + ksz, src.rows - 1);
+        int tx = min (x - ksz / 2 + ksz, cols - 1);
+        int ty = min (y - ksz / 2 + ksz, rows - 1);
 
         float sum1 = 0;
         float sum2 = 0;
@@ -41,7 +38,18 @@ namespace vm
             sum2 += weight;
           }
         }
-        dst(y, x) = __float2int_rn (sum1 / sum2);
+        return __float2int_rn (sum1 / sum2);
+      }
+
+  		__global__ void bilateral_kernel(const PtrStepSz<ushort> src, PtrStep<ushort> dst, const int ksz, const float sigma_spatial2_inv_half, const float sigma_depth2_inv_half)
+      {
+        int x = threadIdx.x + blockIdx.x * blockDim.x;
+        int y = threadIdx.y + blockIdx.y * blockDim.y;
+
+        if (x >= src.cols || y >= src.rows)
+          return;
+
+        dst(y, x) = bilateral_pixel(src, x, y, src.cols, src.rows, ksz, sigma_spatial2_inv_half, sigma_depth2_inv_half);
       }
     }
 	}
@@ -226,6 +234,22 @@ namespace vm
 	{
 		namespace device
 		{
+      /** Point and normal of pixel (x, y) from its depth and the depths right of and below it, in meters.
+        * Shared with the fused front end. Leaves both untouched when one of the depths is missing. */
+      __vm_device__ void point_normal(const Reprojector& reproj, int x, int y, float z00, float z01, float z10, float4& point, float4& normal)
+      {
+        if (z00 * z01 * z10 != 0)
+        {
+          float3 v00 = reproj(x,   y, z00);
+          float3 v01 = reproj(x+1, y, z01);
+          float3 v10 = reproj(x, y+1, z10);
+
+          float3 n = normalized( cross (v01 - v00, v10 - v00) );
+          normal = make_float4(-n.x, -n.y, -n.z, 0.f);
+          point = make_float4(v00.x, v00.y, v00.z, 0.f);
+        }
+      }
+
 			__global__ void points_normals_kernel(const Reprojector reproj, const PtrStepSz<ushort> depth, PtrStep<Point> points, PtrStep<Normal> normals)
       {
         int x = threadIdx.x + blockIdx.x * blockDim.x;
@@ -235,26 +259,15 @@ namespace vm
           return;
 
         const float qnan = numeric_limits<float>::quiet_NaN ();
-        points(y, x) = normals(y, x) = make_float4(qnan, qnan, qnan, qnan);
-
-        if (x >= depth.cols - 1 || y >= depth.rows - 1)
-          return;
+        float4 p = make_float4(qnan, qnan, qnan, qnan);
+        float4 n = p;
 
         //mm -> meters
-        float z00 = depth(y,   x) * 0.001f;
-        float z01 = depth(y, x+1) * 0.001f;
-        float z10 = depth(y+1, x) * 0.001f;
-
-        if (z00 * z01 * z10 != 0)
-        {
-          float3 v00 = reproj(x,   y, z00);
-          float3 v01 = reproj(x+1, y, z01);
-          float3 v10 = reproj(x, y+1, z10);
+        if (x < depth.cols - 1 && y < depth.rows - 1)
+          point_normal(reproj, x, y, depth(y, x) * 0.001f, depth(y, x+1) * 0.001f, depth(y+1, x) * 0.001f, p, n);
 
-          float3 n = normalized( cross (v01 - v00, v10 - v00) );
-          normals(y, x) = make_float4(-n.x, -n.y, -n.z, 0.f);
-          points(y, x) = make_float4(v00.x, v00.y, v00.z, 0.f);
-        }
+        points(y, x) = p;
+        normals(y, x) = n;
       }
 		}
 	}
@@ -279,30 +292,597 @@ namespace vm
 	{
 		namespace device
 		{
-			__global__ void compute_dists_kernel(const PtrStepSz<ushort> depth, Dists dists, float2 finv, float2 c)
+      __vm_device__ ushort dist_pixel(const Reprojector& reproj, int x, int y, int depth)
+      {
+        return __float2half_rn(depth * reproj.length(x, y) * 0.001f); //meters
+      }
+
+			__global__ void compute_dists_kernel(const Reprojector reproj, const PtrStepSz<ushort> depth, Dists dists)
       {
         int x = threadIdx.x + blockIdx.x * blockDim.x;
         int y = threadIdx.y + blockIdx.y * blockDim.y;
 
-        if (x < depth.cols || y < depth.rows)
+        if (x < depth.cols && y < depth.rows)
+          dists(y, x) = dist_pixel(reproj, x, y, depth(y, x));
+      }
+
+      __global__ void compute_rays_kernel(const Reprojector reproj, PtrStepSz<float4> rays)
+      {
+        int x = threadIdx.x + blockIdx.x * blockDim.x;
+        int y = threadIdx.y + blockIdx.y * blockDim.y;
+
+        if (x >= rays.cols || y >= rays.rows)
+          return;
+
+        // the math of Reprojector without a table
+        float4 ray;
+        ray.x = (x - reproj.c.x) * reproj.finv.x;
+        ray.y = (y - reproj.c.y) * reproj.finv.y;
+        ray.z = sqrtf (ray.x * ray.x + ray.y * ray.y + 1);
+        ray.w = 1.f / ray.z;
+        rays(y, x) = ray;
+      }
+		}
+	}
+}
+
+void vm::scanner::device::compute_dists(const Reprojector& reproj, const Depth& depth, Dists dists, cudaStream_t stream)
+{
+  dim3 block (32, 8);
+  dim3 grid (divUp (depth.cols (), block.x), divUp (depth.rows (), block.y));
+
+  compute_dists_kernel<<<grid, block, 0, stream>>>(reproj, depth, dists);
+  cudaSafeCall ( cudaGetLastError () );
+}
+
+void vm::scanner::device::computeRays(const Reprojector& reproj, PtrStepSz<float4> rays)
+{
+  dim3 block (32, 8);
+  dim3 grid (divUp (rays.cols, block.x), divUp (rays.rows, block.y));
+
+  compute_rays_kernel<<<grid, block>>>(reproj, rays);
+  cudaSafeCall ( cudaGetLastError () );
+}
+
+///////////////////////////
+// Fused Depth Front End //
+///////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+      /** Shared memory tile read with image coordinates */
+      struct SharedTile
+      {
+        const ushort* data;
+        int step, x0, y0;
+
+        __vm_device__ ushort operator()(int y, int x) const { return data[(y - y0) * step + x - x0]; }
+      };
+
+      /** One block does dists, bilateral, truncation and level 0 points/normals of a CTA_SIZE_X x CTA_SIZE_Y
+        * tile. The raw depth tile with the filter apron is staged in shared memory once, the filtered tile with
+        * a one pixel apron right and below stays there for the normals, so nothing goes back to global memory
+        * to be read again. Per pixel math is the one of the separate kernels, the results are bit exact. */
+      struct DepthFrontEnd
+      {
+        enum { CTA_SIZE_X = 32, CTA_SIZE_Y = 8, CTA_SIZE = CTA_SIZE_X * CTA_SIZE_Y };
+
+        PtrStepSz<ushort> depth;
+        Reprojector reproj;
+
+        int ksz;
+        float sigma_spatial2_inv_half;
+        float sigma_depth2_inv_half;
+        int max_depth; // mm, larger filtered depth is truncated to 0
+
+        static __vm_hdevice__ int tileCols(int ksz) { return CTA_SIZE_X + ksz; }
+        static __vm_hdevice__ int tileRows(int ksz) { return CTA_SIZE_Y + ksz; }
+
+        __vm_device__ ushort filter(const SharedTile& tile, int x, int y) const
+        {
+          ushort value = bilateral_pixel(tile, x, y, depth.cols, depth.rows, ksz, sigma_spatial2_inv_half, sigma_depth2_inv_half);
+          return value > max_depth ? 0 : value;
+        }
+
+        __vm_device__ void operator()(Dists& dists, PtrStep<ushort>& filtered, PtrStep<Point>& points, PtrStep<Normal>& normals) const
         {
-          float xl = (x - c.x) * finv.x;
-          float yl = (y - c.y) * finv.y;
-          float lambda = sqrtf (xl * xl + yl * yl + 1);
+          extern __shared__ ushort smem[];
+
+          const int x0 = blockIdx.x * CTA_SIZE_X;
+          const int y0 = blockIdx.y * CTA_SIZE_Y;
+          const int tid = Block::flattenedThreadId();
+
+          SharedTile raw;
+          raw.data = smem;
+          raw.step = tileCols(ksz);
+          raw.x0 = x0 - ksz / 2;
+          raw.y0 = y0 - ksz / 2;
+
+          for(int i = tid; i < tileCols(ksz) * tileRows(ksz); i += CTA_SIZE)
+          {
+            int gx = raw.x0 + i % raw.step;
+            int gy = raw.y0 + i / raw.step;
+            smem[i] = (gx >= 0 && gy >= 0 && gx < depth.cols && gy < depth.rows) ? depth(gy, gx) : 0;
+          }
+
+          // filtered tile and its apron: column CTA_SIZE_X and row CTA_SIZE_Y
+          ushort* fdata = smem + tileCols(ksz) * tileRows(ksz);
+          const int fstep = CTA_SIZE_X + 1;
+          __syncthreads();
+
+          int x = x0 + threadIdx.x;
+          int y = y0 + threadIdx.y;
+          bool inside = x < depth.cols && y < depth.rows;
+
+          if (inside)
+          {
+            ushort f = filter(raw, x, y);
+            fdata[threadIdx.y * fstep + threadIdx.x] = f;
+            filtered(y, x) = f;
+            dists(y, x) = dist_pixel(reproj, x, y, raw(y, x));
+          }
+
+          if (tid < CTA_SIZE_X + 1 + CTA_SIZE_Y)
+          {
+            int ax = tid < CTA_SIZE_Y ? CTA_SIZE_X : tid - CTA_SIZE_Y;
+            int ay = tid < CTA_SIZE_Y ? tid : CTA_SIZE_Y;
+
+            if (x0 + ax < depth.cols && y0 + ay < depth.rows)
+              fdata[ay * fstep + ax] = filter(raw, x0 + ax, y0 + ay);
+          }
+          __syncthreads();
+
+          if (!inside)
+            return;
+
+          const float qnan = numeric_limits<float>::quiet_NaN ();
+          float4 p = make_float4(qnan, qnan, qnan, qnan);
+          float4 n = p;
+
+          //mm -> meters
+          if (x < depth.cols - 1 && y < depth.rows - 1)
+          {
+            const ushort* f = fdata + threadIdx.y * fstep + threadIdx.x;
+            point_normal(reproj, x, y, f[0] * 0.001f, f[1] * 0.001f, f[fstep] * 0.001f, p, n);
+          }
+
+          points(y, x) = p;
+          normals(y, x) = n;
+        }
+      };
+
+      __global__ void depth_front_end_kernel(const DepthFrontEnd fe, Dists dists, PtrStep<ushort> filtered, PtrStep<Point> points, PtrStep<Normal> normals)
+      { fe(dists, filtered, points, normals); }
+		}
+	}
+}
+
+void vm::scanner::device::depthFrontEnd(const Reprojector& reproj, const Depth& depth, Dists dists, Depth& filtered, Points& points, Normals& normals,
+                                        int kernel_size, float sigma_spatial, float sigma_depth, float max_dist)
+{
+  sigma_depth *= 1000; // meters -> mm
+
+  DepthFrontEnd fe;
+  fe.depth = depth;
+  fe.reproj = reproj;
+  fe.ksz = kernel_size;
+  fe.sigma_spatial2_inv_half = 0.5f / (sigma_spatial * sigma_spatial);
+  fe.sigma_depth2_inv_half = 0.5f / (sigma_depth * sigma_depth);
+  fe.max_depth = max_dist > 0 ? static_cast<ushort>(max_dist * 1000.f) : USHRT_MAX;
+
+  dim3 block (DepthFrontEnd::CTA_SIZE_X, DepthFrontEnd::CTA_SIZE_Y);
+  dim3 grid (divUp (depth.cols (), block.x), divUp (depth.rows (), block.y));
+
+  size_t smem = (DepthFrontEnd::tileCols(kernel_size) * DepthFrontEnd::tileRows(kernel_size) + (block.x + 1) * (block.y + 1)) * sizeof(ushort);
+
+  depth_front_end_kernel<<<grid, block, smem>>>(fe, dists, filtered, points, normals);
+  cudaSafeCall ( cudaGetLastError () );
+}
+
+///////////////////////////
+// Foreground Extraction //
+///////////////////////////
 
-          dists(y, x) = __float2half_rn(depth(y, x) * lambda * 0.001f); //meters
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+      __global__ void foreground_downsample_kernel(const PtrStepSz<ushort> depth, PtrStepSz<ushort> small, int level, ushort min_depth, ushort max_depth)
+      {
+        int x = threadIdx.x + blockIdx.x * blockDim.x;
+        int y = threadIdx.y + blockIdx.y * blockDim.y;
+
+        if (x >= small.cols || y >= small.rows)
+          return;
+
+        const int size = 1 << level;
+
+        ushort nearest = 0;
+        for(int dy = 0; dy < size; ++dy)
+          for(int dx = 0; dx < size; ++dx)
+          {
+            ushort d = depth((y << level) + dy, (x << level) + dx);
+            if (d >= min_depth && d <= max_depth && (!nearest || d < nearest))
+              nearest = d;
+          }
+        small(y, x) = nearest;
+      }
+
+      __global__ void apply_foreground_kernel(const PtrStepSz<ushort> depth, const PtrStepSz<uchar> mask, PtrStep<ushort> masked, const Reprojector reproj,
+                                              int level, const float4* floor_ptr, float floor_dist, ushort min_depth, ushort max_depth)
+      {
+        int x = threadIdx.x + blockIdx.x * blockDim.x;
+        int y = threadIdx.y + blockIdx.y * blockDim.y;
+
+        if (x >= depth.cols || y >= depth.rows)
+          return;
+
+        ushort value = depth(y, x);
+        bool keep = value >= min_depth && value <= max_depth && mask(min(y >> level, mask.rows - 1), min(x >> level, mask.cols - 1));
+
+        // all zero when no floor was found
+        float4 floor = *floor_ptr;
+        if (keep && floor_dist > 0 && (floor.x != 0 || floor.y != 0 || floor.z != 0 || floor.w != 0))
+        {
+          float3 p = reproj(x, y, value * 0.001f);
+          keep = floor.x * p.x + floor.y * p.y + floor.z * p.z + floor.w >= floor_dist;
         }
+        masked(y, x) = keep ? value : 0;
       }
+
+      /** cpu::segmentForeground in three kernels, so the frame never leaves the device. The floor fit draws the same
+        * points as the host RANSAC, from a point list in the same order and with cv::RNG's generator, and the labelling
+        * keeps the largest component, the one found first on ties. */
+      struct ForegroundSegmenter
+      {
+        enum { ITERATIONS = 64, CTA_SIZE = 256, LABEL_CTA_SIZE = 1024 };
+
+        PtrStepSz<ushort> small;
+        float4 intr; // fx, fy, cx, cy
+        float floor_dist, min_cosine;
+        int jump, min_area;
+
+        float4* points;  // small.rows * small.cols, the valid pixels in row major order
+        int* offsets;    // small.rows + 1, first point of each row, the last is their count
+        float4* planes;  // ITERATIONS
+        int* inliers;    // ITERATIONS, -1 for a rejected sample
+        int* labels;     // small.rows * small.cols
+        int* areas;      // small.rows * small.cols
+        float4* floor;
+
+        __vm_device__ float3 point(int x, int y, ushort d) const
+        {
+          float z = d * 0.001f;
+          return make_float3((x - intr.z) * z / intr.x, (y - intr.w) * z / intr.y, z);
+        }
+
+        /** One cta, a thread per row */
+        __vm_device__ void collect() const
+        {
+          __shared__ int counts[LABEL_CTA_SIZE];
+
+          int y = threadIdx.x;
+          const ushort* row = small.ptr(min(y, small.rows - 1));
+
+          int count = 0;
+          if (y < small.rows)
+            for(int x = 0; x < small.cols; ++x)
+              count += row[x] != 0;
+          counts[y] = count;
+          __syncthreads();
+
+          if (y == 0)
+          {
+            offsets[0] = 0;
+            for(int i = 0; i < small.rows; ++i)
+              offsets[i + 1] = offsets[i] + counts[i];
+          }
+          __syncthreads();
+
+          if (y < small.rows)
+            for(int x = 0, i = offsets[y]; x < small.cols; ++x)
+              if (row[x])
+              {
+                float3 p = point(x, y, row[x]);
+                points[i++] = make_float4(p.x, p.y, p.z, 0.f);
+              }
+        }
+
+        /** cv::RNG::next() */
+        static __vm_device__ unsigned int next(unsigned long long& state)
+        {
+          state = (unsigned long long)(unsigned int)state * 4164903690U + (unsigned int)(state >> 32);
+          return (unsigned int)state;
+        }
+
+        /** One cta per RANSAC iteration, iteration i draws the 3 samples after the 3 i before it */
+        __vm_device__ void fit() const
+        {
+          __shared__ float4 plane;
+          __shared__ bool valid;
+          __shared__ int cta_buffer[CTA_SIZE];
+
+          const int n = offsets[small.rows];
+          if (n < 3)
+          {
+            if (threadIdx.x == 0)
+              inliers[blockIdx.x] = -1;
+            return;
+          }
+
+          if (threadIdx.x == 0)
+          {
+            unsigned long long state = 0x6c6f6f72;
+            for(int i = 0; i < 3 * (int)blockIdx.x; ++i)
+              next(state);
+
+            float4 a = points[next(state) % n];
+            float4 b = points[next(state) % n];
+            float4 c = points[next(state) % n];
+
+            float3 ab = make_float3(b.x - a.x, b.y - a.y, b.z - a.z);
+            float3 ac = make_float3(c.x - a.x, c.y - a.y, c.z - a.z);
+            float3 normal = cross(ab, ac);
+            float length = sqrtf(dot(normal, normal));
+
+            valid = length >= 1e-9f;
+            if (valid)
+            {
+              // camera y points down, the floor normal up
+              normal *= (normal.y > 0 ? -1.f : 1.f) / length;
+              float d = -(normal.x * a.x + normal.y * a.y + normal.z * a.z);
+              valid = -normal.y >= min_cosine && d > 0;
+              plane = make_float4(normal.x, normal.y, normal.z, d);
+            }
+          }
+          __syncthreads();
+
+          if (!valid)
+          {
+            if (threadIdx.x == 0)
+              inliers[blockIdx.x] = -1;
+            return;
+          }
+
+          int count = 0;
+          for(int k = threadIdx.x; k < n; k += CTA_SIZE)
+          {
+            float4 p = points[k];
+            count += fabsf(plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w) < floor_dist;
+          }
+          cta_buffer[threadIdx.x] = count;
+          __syncthreads();
+
+          for(int s = CTA_SIZE / 2; s > 0; s >>= 1)
+          {
+            if (threadIdx.x < s)
+              cta_buffer[threadIdx.x] += cta_buffer[threadIdx.x + s];
+            __syncthreads();
+          }
+
+          if (threadIdx.x == 0)
+          {
+            inliers[blockIdx.x] = cta_buffer[0];
+            planes[blockIdx.x] = plane;
+          }
+        }
+
+        __vm_device__ bool connected(int i, int j) const
+        {
+          return abs((int)small(i / small.cols, i % small.cols) - (int)small(j / small.cols, j % small.cols)) <= jump;
+        }
+
+        /** One cta: picks the floor, cuts it away, labels 4-connected components by propagating the smallest pixel
+          * index with pointer jumping, counts their areas and masks the largest */
+        __vm_device__ void label(PtrStepSz<uchar> mask) const
+        {
+          __shared__ float4 best_plane;
+          __shared__ int changed;
+          __shared__ int best_area[LABEL_CTA_SIZE];
+          __shared__ int best_index[LABEL_CTA_SIZE];
+
+          const int tid = threadIdx.x;
+          const int total = small.rows * small.cols;
+          volatile int* L = labels;
+
+          if (tid == 0)
+          {
+            // the first iteration above the smallest count wins, as in the host loop
+            best_plane = make_float4(0.f, 0.f, 0.f, 0.f);
+            int n = offsets[small.rows];
+            if (floor_dist > 0 && n >= 3)
+            {
+              int best = max(3, n / 20) - 1;
+              for(int i = 0; i < ITERATIONS; ++i)
+                if (inliers[i] > best)
+                {
+                  best = inliers[i];
+                  best_plane = planes[i];
+                }
+            }
+            *floor = best_plane;
+          }
+          __syncthreads();
+
+          bool has_floor = best_plane.x != 0 || best_plane.y != 0 || best_plane.z != 0 || best_plane.w != 0;
+
+          for(int i = tid; i < total; i += LABEL_CTA_SIZE)
+          {
+            int x = i % small.cols, y = i / small.cols;
+            ushort d = small(y, x);
+
+            bool keep = d != 0;
+            if (keep && has_floor)
+            {
+              float3 p = point(x, y, d);
+              keep = best_plane.x * p.x + best_plane.y * p.y + best_plane.z * p.z + best_plane.w >= floor_dist;
+            }
+            L[i] = keep ? i : -1;
+            areas[i] = 0;
+          }
+
+          const int dx[] = { 1, -1, 0, 0 };
+          const int dy[] = { 0, 0, 1, -1 };
+
+          // labels only decrease and always name a pixel of the same component, so races just cost an iteration
+          for(;;)
+          {
+            if (tid == 0)
+              changed = 0;
+            __syncthreads();
+
+            for(int i = tid; i < total; i += LABEL_CTA_SIZE)
+            {
+              int l = L[i];
+              if (l < 0)
+                continue;
+
+              int x = i % small.cols, y = i / small.cols, m = l;
+              for(int k = 0; k < 4; ++k)
+              {
+                int nx = x + dx[k], ny = y + dy[k];
+                if (nx < 0 || ny < 0 || nx >= small.cols || ny >= small.rows)
+                  continue;
+
+                int j = ny * small.cols + nx, lj = L[j];
+                if (lj >= 0 && lj < m && connected(i, j))
+                  m = lj;
+              }
+
+              if (m < l)
+              {
+                L[i] = m;
+                changed = 1;
+              }
+            }
+            __syncthreads();
+
+            for(int i = tid; i < total; i += LABEL_CTA_SIZE)
+            {
+              int l = L[i];
+              if (l < 0)
+                continue;
+
+              while (L[l] != l)
+                l = L[l];
+              L[i] = l;
+            }
+            __syncthreads();
+
+            if (!changed)
+              break;
+            __syncthreads();
+          }
+
+          for(int i = tid; i < total; i += LABEL_CTA_SIZE)
+            if (L[i] >= 0)
+              atomicAdd(areas + L[i], 1);
+          __syncthreads();
+
+          // the smallest pixel index of a component is its first pixel in the host's scan
+          int area = 0, index = -1;
+          for(int i = tid; i < total; i += LABEL_CTA_SIZE)
+            if (L[i] == i && areas[i] > area)
+            {
+              area = areas[i];
+              index = i;
+            }
+          best_area[tid] = area;
+          best_index[tid] = index;
+          __syncthreads();
+
+          for(int s = LABEL_CTA_SIZE / 2; s > 0; s >>= 1)
+          {
+            if (tid < s)
+            {
+              int a = best_area[tid + s], b = best_index[tid + s];
+              if (a > best_area[tid] || (a == best_area[tid] && a > 0 && b < best_index[tid]))
+              {
+                best_area[tid] = a;
+                best_index[tid] = b;
+              }
+            }
+            __syncthreads();
+          }
+
+          int best = best_area[0] >= min_area && best_area[0] > 0 ? best_index[0] : -1;
+          for(int i = tid; i < total; i += LABEL_CTA_SIZE)
+            mask(i / small.cols, i % small.cols) = best >= 0 && L[i] == best ? 255 : 0;
+        }
+      };
+
+      __global__ void foreground_collect_kernel(const ForegroundSegmenter fs) { fs.collect(); }
+      __global__ void foreground_fit_kernel(const ForegroundSegmenter fs) { fs.fit(); }
+      __global__ void foreground_label_kernel(const ForegroundSegmenter fs, PtrStepSz<uchar> mask) { fs.label(mask); }
 		}
 	}
 }
 
-void vm::scanner::device::compute_dists(const Depth& depth, Dists dists, float2 f, float2 c)
+void vm::scanner::device::foregroundDownsample(const Depth& depth, Depth& small, int level, ushort min_depth, ushort max_depth, cudaStream_t stream)
+{
+  dim3 block (32, 8);
+  dim3 grid (divUp (small.cols (), block.x), divUp (small.rows (), block.y));
+
+  foreground_downsample_kernel<<<grid, block, 0, stream>>>(depth, small, level, min_depth, max_depth);
+  cudaSafeCall ( cudaGetLastError () );
+}
+
+void vm::scanner::device::segmentForeground(const PtrStepSz<ushort>& small, float4 intr, float floor_dist, float floor_max_tilt, int depth_jump,
+                                            int min_area, int* buffer, PtrStepSz<uchar> mask, float4* floor, cudaStream_t stream)
+{
+  typedef ForegroundSegmenter FS;
+  const int total = small.rows * small.cols;
+
+  FS fs;
+  fs.small = small;
+  fs.intr = intr;
+  fs.floor_dist = floor_dist;
+  fs.min_cosine = cosf(floor_max_tilt);
+  fs.jump = depth_jump;
+  fs.min_area = min_area;
+  fs.floor = floor;
+
+  // float4s first, they need the alignment
+  fs.points = (float4*)buffer;
+  fs.planes = fs.points + total;
+  fs.inliers = (int*)(fs.planes + FS::ITERATIONS);
+  fs.offsets = fs.inliers + FS::ITERATIONS;
+  fs.labels = fs.offsets + small.rows + 1;
+  fs.areas = fs.labels + total;
+
+  foreground_collect_kernel<<<1, FS::LABEL_CTA_SIZE, 0, stream>>>(fs);
+  cudaSafeCall ( cudaGetLastError () );
+
+  // with fewer than 3 points every iteration rejects its sample
+  if (floor_dist > 0)
+  {
+    foreground_fit_kernel<<<FS::ITERATIONS, FS::CTA_SIZE, 0, stream>>>(fs);
+    cudaSafeCall ( cudaGetLastError () );
+  }
+
+  foreground_label_kernel<<<1, FS::LABEL_CTA_SIZE, 0, stream>>>(fs, mask);
+  cudaSafeCall ( cudaGetLastError () );
+}
+
+int vm::scanner::device::segmentForegroundBufferSize(int rows, int cols)
+{
+  typedef ForegroundSegmenter FS;
+  return (rows * cols + FS::ITERATIONS) * 4 + FS::ITERATIONS + rows + 1 + 2 * rows * cols;
+}
+
+void vm::scanner::device::applyForeground(const Reprojector& reproj, const Depth& depth, const PtrStepSz<uchar>& mask, int level, const float4* floor,
+                                          float floor_dist, ushort min_depth, ushort max_depth, Depth& masked, cudaStream_t stream)
 {
   dim3 block (32, 8);
   dim3 grid (divUp (depth.cols (), block.x), divUp (depth.rows (), block.y));
 
-  compute_dists_kernel<<<grid, block>>>(depth, dists, make_float2(1.f/f.x, 1.f/f.y), c);
+  apply_foreground_kernel<<<grid, block, 0, stream>>>(depth, mask, masked, reproj, level, floor, floor_dist, min_depth, max_depth);
   cudaSafeCall ( cudaGetLastError () );
 }
 
@@ -0,0 +1,265 @@
+#include <scanner/cuda/device.hpp>
+#include <scanner/marching_cubes.hpp>
+
+////////////////////
+// Marching Cubes //
+////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+      __constant__ signed char mc_corners[8][3];
+      __constant__ signed char mc_edge_owner[12][4];
+      __constant__ signed char mc_triangles[256][16];
+
+      __device__ int mc_vertex_count;
+      __device__ int mc_index_count;
+
+      /** Marching cubes one cell layer at a time. Every zero crossing gets its vertex once, from the voxel owning the edge,
+        * and the vertex index is kept in a map of two slices, so the triangles of a layer find the vertices of both its
+        * slices without a global edge table. Works on any volume with operator()(x, y, z). */
+      template<typename Vol>
+      struct MarchingCubes
+      {
+        enum
+        {
+          CTA_SIZE_X = 32,
+          CTA_SIZE_Y = 8
+        };
+
+        Vol volume;
+        Aff3f aff;
+        float3 voxel_size_inv;
+        float3 gradient_delta;
+
+        PtrSz<Point> vertices;
+        Normal* normals;
+        uchar4* colors;
+        PtrSz<int> indices;
+
+        MarchingCubes(const Vol& vol) : volume(vol)
+        {
+          voxel_size_inv.x = 1.f/volume.voxel_size.x;
+          voxel_size_inv.y = 1.f/volume.voxel_size.y;
+          voxel_size_inv.z = 1.f/volume.voxel_size.z;
+        }
+
+        __vm_device__ float fetch(int x, int y, int z, int& weight, ushort2& color) const
+        {
+          return unpack_tsdf(*volume(x, y, z), weight, color.x, color.y);
+        }
+
+        __vm_device__ float3 normal(const float3& point) const
+        {
+          float3 n;
+
+          float Fx1 = interpolate(volume, make_float3(point.x + gradient_delta.x, point.y, point.z) * voxel_size_inv);
+          float Fx2 = interpolate(volume, make_float3(point.x - gradient_delta.x, point.y, point.z) * voxel_size_inv);
+          n.x = __fdividef(Fx1 - Fx2, gradient_delta.x);
+
+          float Fy1 = interpolate(volume, make_float3(point.x, point.y + gradient_delta.y, point.z) * voxel_size_inv);
+          float Fy2 = interpolate(volume, make_float3(point.x, point.y - gradient_delta.y, point.z) * voxel_size_inv);
+          n.y = __fdividef(Fy1 - Fy2, gradient_delta.y);
+
+          float Fz1 = interpolate(volume, make_float3(point.x, point.y, point.z + gradient_delta.z) * voxel_size_inv);
+          float Fz2 = interpolate(volume, make_float3(point.x, point.y, point.z - gradient_delta.z) * voxel_size_inv);
+          n.z = __fdividef(Fz1 - Fz2, gradient_delta.z);
+
+          return normalized (aff.R * n);
+        }
+
+        static __vm_device__ unsigned char lerp(unsigned char a, unsigned char b, float t)
+        {
+          return (unsigned char)__float2int_rn(a + (b - a) * t);
+        }
+
+        /** Vertices on the +x, +y, +z edges of slice z, map gets their indices or -1 */
+        __vm_device__ void makeVertices(int z, int* map) const
+        {
+          int x = threadIdx.x + blockIdx.x * blockDim.x;
+          int y = threadIdx.y + blockIdx.y * blockDim.y;
+
+          if (x >= volume.dims.x || y >= volume.dims.y)
+            return;
+
+          int* out = map + (y * volume.dims.x + x) * 3;
+          out[0] = out[1] = out[2] = -1;
+
+          int W;
+          ushort2 C;
+          float F = fetch(x, y, z, W, C);
+
+          if (W == 0)
+            return;
+
+          for(int axis = 0; axis < 3; ++axis)
+          {
+            int3 g = make_int3(x + (axis == 0), y + (axis == 1), z + (axis == 2));
+
+            if (g.x >= volume.dims.x || g.y >= volume.dims.y || g.z >= volume.dims.z)
+              continue;
+
+            int Wn;
+            ushort2 Cn;
+            float Fn = fetch(g.x, g.y, g.z, Wn, Cn);
+
+            if (Wn == 0 || (F < 0) == (Fn < 0))
+              continue;
+
+            int idx = atomicAdd(&mc_vertex_count, 1);
+            if (idx >= vertices.size)
+              continue;
+
+            float t = F / (F - Fn);
+
+            float3 p = make_float3(x * volume.voxel_size.x, y * volume.voxel_size.y, z * volume.voxel_size.z);
+            if (axis == 0) p.x += t * volume.voxel_size.x;
+            if (axis == 1) p.y += t * volume.voxel_size.y;
+            if (axis == 2) p.z += t * volume.voxel_size.z;
+
+            float3 n = normal(p);
+            float3 v = aff * p;
+
+            uchar4 c0 = ushort2rgba(C);  // rgb
+            uchar4 c1 = ushort2rgba(Cn);
+
+            vertices.data[idx] = make_float4(v.x, v.y, v.z, 0.f);
+            normals[idx] = make_float4(n.x, n.y, n.z, 0.f);
+            colors[idx] = make_uchar4(lerp(c0.z, c1.z, t), lerp(c0.y, c1.y, t), lerp(c0.x, c1.x, t), lerp(c0.w, c1.w, t)); // bgr
+            out[axis] = idx;
+          }
+        }
+
+        /** Triangles of the cells between slices z and z + 1, cells touching an unobserved voxel are left open */
+        __vm_device__ void makeTriangles(int z, const int* map0, const int* map1) const
+        {
+          int x = threadIdx.x + blockIdx.x * blockDim.x;
+          int y = threadIdx.y + blockIdx.y * blockDim.y;
+
+          if (x >= volume.dims.x - 1 || y >= volume.dims.y - 1)
+            return;
+
+          int cube = 0;
+          for(int i = 0; i < 8; ++i)
+          {
+            int W;
+            ushort2 C;
+            float F = fetch(x + mc_corners[i][0], y + mc_corners[i][1], z + mc_corners[i][2], W, C);
+
+            if (W == 0)
+              return;
+
+            cube |= (F < 0) << i;
+          }
+
+          if (cube == 0 || cube == 255)
+            return;
+
+          for(int t = 0; mc_triangles[cube][t] != -1; t += 3)
+          {
+            int v[3];
+            bool valid = true;
+
+            for(int k = 0; k < 3; ++k)
+            {
+              const signed char* o = mc_edge_owner[mc_triangles[cube][t + k]];
+              const int* map = o[2] ? map1 : map0;
+
+              v[k] = map[((y + o[1]) * volume.dims.x + x + o[0]) * 3 + o[3]];
+              valid = valid && v[k] >= 0;
+            }
+
+            // a vertex that didn't fit into the buffer takes its triangles with it, the caller grows them and runs again
+            if (!valid)
+              continue;
+
+            int pos = atomicAdd(&mc_index_count, 3);
+            if (pos + 3 > indices.size)
+              continue;
+
+            indices.data[pos + 0] = v[0];
+            indices.data[pos + 1] = v[1];
+            indices.data[pos + 2] = v[2];
+          }
+        }
+      };
+
+      template<typename Vol>
+      __global__ void mc_vertices_kernel(const MarchingCubes<Vol> mc, int z, int* map) { mc.makeVertices(z, map); }
+
+      template<typename Vol>
+      __global__ void mc_triangles_kernel(const MarchingCubes<Vol> mc, int z, const int* map0, const int* map1) { mc.makeTriangles(z, map0, map1); }
+
+      template<typename Vol>
+      size_t extract_mesh(const Vol& volume, const Aff3f& aff, float gradient_delta_factor, PtrSz<Point> vertices, Normal* normals, uchar4* colors,
+                          PtrSz<int> indices, size_t& indices_count)
+      {
+        typedef MarchingCubes<Vol> MC;
+
+        MC cubes(volume);
+        cubes.aff = aff;
+        cubes.gradient_delta = volume.voxel_size * gradient_delta_factor;
+        cubes.vertices = vertices;
+        cubes.normals = normals;
+        cubes.colors = colors;
+        cubes.indices = indices;
+
+        cudaSafeCall ( cudaMemcpyToSymbol (mc_corners, mc::corners, sizeof(mc::corners)) );
+        cudaSafeCall ( cudaMemcpyToSymbol (mc_edge_owner, mc::edge_owner, sizeof(mc::edge_owner)) );
+        cudaSafeCall ( cudaMemcpyToSymbol (mc_triangles, mc::triangles, sizeof(mc::triangles)) );
+
+        int zero = 0;
+        cudaSafeCall ( cudaMemcpyToSymbol (mc_vertex_count, &zero, sizeof(zero)) );
+        cudaSafeCall ( cudaMemcpyToSymbol (mc_index_count, &zero, sizeof(zero)) );
+
+        size_t slice = (size_t)volume.dims.x * volume.dims.y * 3;
+        DeviceArray<int> maps(slice * 2);
+        int* map[] = { maps.ptr(), maps.ptr() + slice };
+
+        dim3 block (MC::CTA_SIZE_X, MC::CTA_SIZE_Y);
+        dim3 grid (divUp (volume.dims.x, block.x), divUp (volume.dims.y, block.y));
+
+        // launches are serialized, so a map slot is only refilled after the layer reading it is done
+        mc_vertices_kernel<<<grid, block>>>(cubes, 0, map[0]);
+        for(int z = 0; z < volume.dims.z - 1; ++z)
+        {
+          mc_vertices_kernel<<<grid, block>>>(cubes, z + 1, map[(z + 1) & 1]);
+          mc_triangles_kernel<<<grid, block>>>(cubes, z, map[z & 1], map[(z + 1) & 1]);
+        }
+        cudaSafeCall ( cudaGetLastError () );
+        cudaSafeCall (cudaDeviceSynchronize ());
+
+        int vertices_count, index_count;
+        cudaSafeCall ( cudaMemcpyFromSymbol (&vertices_count, mc_vertex_count, sizeof(vertices_count)) );
+        cudaSafeCall ( cudaMemcpyFromSymbol (&index_count, mc_index_count, sizeof(index_count)) );
+
+        // the full counts, past the buffer ends when the surface didn't fit
+        indices_count = (size_t)index_count;
+        return (size_t)vertices_count;
+      }
+		}
+	}
+}
+
+size_t vm::scanner::device::extractMesh(const TsdfVolume& volume, const Aff3f& aff, float gradient_delta_factor, PtrSz<Point> vertices, Normal* normals,
+                                        uchar4* colors, PtrSz<int> indices, size_t& indices_count)
+{
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:
+    return extract_mesh(volume.typed<voxel6>(), aff, gradient_delta_factor, vertices, normals, colors, indices, indices_count);
+  case VOXEL_GEOMETRY:
+    return extract_mesh(volume.typed<voxel4>(), aff, gradient_delta_factor, vertices, normals, colors, indices, indices_count);
+  default:
+    return extract_mesh(volume.typed<ushort4>(), aff, gradient_delta_factor, vertices, normals, colors, indices, indices_count);
+  }
+}
+
+size_t vm::scanner::device::extractMesh(const HashTsdfVolume& volume, const Aff3f& aff, float gradient_delta_factor, PtrSz<Point> vertices, Normal* normals,
+                                        uchar4* colors, PtrSz<int> indices, size_t& indices_count)
+{
+  return extract_mesh(volume, aff, gradient_delta_factor, vertices, normals, colors, indices, indices_count);
+}
@@ -21,7 +21,8 @@ namespace vm
 
           B = 6, COLS = 6, ROWS = 6, DIAG = 6,
           UPPER_DIAG_MAT = (COLS * ROWS - DIAG) / 2 + DIAG,
-          TOTAL = UPPER_DIAG_MAT + B,
+          STATS = 3, // squared residual of the inliers, inliers, current pixels with a point
+          TOTAL = UPPER_DIAG_MAT + B + STATS,
 
           FINAL_REDUCE_CTA_SIZE = 256,
           FINAL_REDUCE_STRIDE = FINAL_REDUCE_CTA_SIZE
@@ -40,11 +41,21 @@ namespace vm
       __vm_device__
       float3 ComputeIcpHelper::reproj(float u, float v, float z)  const
       {
-        float x = z * (u - c.x) * finv.x;
-        float y = z * (v - c.y) * finv.y;
+        float x = z * ((u - c.x) * finv.x);
+        float y = z * ((v - c.y) * finv.y);
         return make_float3(x, y, z);
       }
 
+      __vm_device__
+      float3 ComputeIcpHelper::reproj_curr(int x, int y, float z)  const
+      {
+        if (!rays.data)
+          return reproj(x, y, z);
+
+        float4 ray = rays(y, x);
+        return make_float3(z * ray.x, z * ray.y, z);
+      }
+
 #if defined USE_DEPTH
       __vm_device__
       int ComputeIcpHelper::find_coresp(int x, int y, float3& nd, float3& d, float3& s) const
@@ -53,7 +64,7 @@ namespace vm
         if (src_z == 0)
           return 40;
 
-        s = aff * reproj(x, y, src_z * 0.001f);
+        s = aff * reproj_curr(x, y, src_z * 0.001f);
 
         float2 coo = proj(s);
         if (s.z <= 0 || coo.x < 0 || coo.y < 0 || coo.x >= cols || coo.y >= rows)
@@ -110,7 +121,7 @@ namespace vm
 #endif
 
       __vm_device__
-      void ComputeIcpHelper::partial_reduce(const float row[7], PtrStep<float>& partial_buf) const
+      void ComputeIcpHelper::partial_reduce(const float row[9], PtrStep<float>& partial_buf) const
       {
       	volatile __shared__ float smem[Policy::CTA_SIZE];
       	int tid = Block::flattenedThreadId();
@@ -316,6 +327,28 @@ namespace vm
           smem[tid] = row[5] * row[6];
           __syncthreads ();
 
+          Block::reduce<Policy::CTA_SIZE>(smem, plus ());
+        STOR
+
+////////////////////////////////////////
+        	__syncthreads ();
+          smem[tid] = row[6] * row[6];
+          __syncthreads ();
+
+          Block::reduce<Policy::CTA_SIZE>(smem, plus ());
+        STOR
+
+        	__syncthreads ();
+          smem[tid] = row[7];
+          __syncthreads ();
+
+          Block::reduce<Policy::CTA_SIZE>(smem, plus ());
+        STOR
+
+        	__syncthreads ();
+          smem[tid] = row[8];
+          __syncthreads ();
+
           Block::reduce<Policy::CTA_SIZE>(smem, plus ());
         STOR
       }
@@ -329,16 +362,20 @@ namespace vm
         int filtered = (x < helper.cols && y < helper.rows) ? helper.find_coresp (x, y, n, d, s) : 1;
         //if (x < helper.cols && y < helper.rows) mask(y, x) = filtered;
 
-        float row[7];
+        float row[9];
 
         if (!filtered)
         {
           *(float3*)&row[0] = cross (s, n);
           *(float3*)&row[3] = n;
           row[6] = dot (n, d - s);
+          row[7] = 1.f;
         }
         else
-          row[0] = row[1] = row[2] = row[3] = row[4] = row[5] = row[6] = 0.f;
+          row[0] = row[1] = row[2] = row[3] = row[4] = row[5] = row[6] = row[7] = 0.f;
+
+        // 1 is outside the image, 40 a pixel without a point
+        row[8] = (filtered != 1 && filtered != 40) ? 1.f : 0.f;
 
         helper.partial_reduce(row, partial_buf);
       }
@@ -11,32 +11,38 @@ namespace vm
 	{
 		namespace device
 		{
-			__global__ void clear_volume_kernel(TsdfVolume tsdf)
+			template<class Voxel>
+			__global__ void clear_volume_kernel(TsdfVolumeT<Voxel> tsdf, int3 beg, int3 end)
       {
-        int x = threadIdx.x + blockIdx.x * blockDim.x;
-        int y = threadIdx.y + blockIdx.y * blockDim.y;
-
-        if (x < tsdf.dims.x && y < tsdf.dims.y)
-        {
-          ushort4 *beg = tsdf.beg(x, y);
-          ushort4 *end = beg + tsdf.dims.x * tsdf.dims.y * tsdf.dims.z;
+        int x = beg.x + threadIdx.x + blockIdx.x * blockDim.x;
+        int y = beg.y + threadIdx.y + blockIdx.y * blockDim.y;
 
-          for(ushort4* pos = beg; pos != end; pos = tsdf.zstep(pos))
-            *pos = pack_tsdf (0.f, 0, 0, 0);
-        }
+        if (x < end.x && y < end.y)
+          for(int z = beg.z; z < end.z; ++z)
+            pack_tsdf (0.f, 0, 0, 0, *tsdf(x, y, z));
       }
 		}
 	}
 }
 
 void vm::scanner::device::clear_volume(TsdfVolume volume)
+{
+  clear_volume(volume, make_int3(0, 0, 0), volume.dims);
+}
+
+void vm::scanner::device::clear_volume(TsdfVolume volume, int3 beg, int3 end)
 {
     dim3 block (32, 8);
     dim3 grid (1, 1, 1);
-    grid.x = divUp (volume.dims.x, block.x);
-    grid.y = divUp (volume.dims.y, block.y);
-
-    clear_volume_kernel<<<grid, block>>>(volume);
+    grid.x = divUp (end.x - beg.x, block.x);
+    grid.y = divUp (end.y - beg.y, block.y);
+
+    switch(volume.layout)
+    {
+    case VOXEL_RGB:      clear_volume_kernel<<<grid, block>>>(volume.typed<voxel6>(), beg, end); break;
+    case VOXEL_GEOMETRY: clear_volume_kernel<<<grid, block>>>(volume.typed<voxel4>(), beg, end); break;
+    default:             clear_volume_kernel<<<grid, block>>>(volume.typed<ushort4>(), beg, end); break;
+    }
     cudaSafeCall ( cudaGetLastError () );
 }
 
@@ -52,23 +58,79 @@ namespace vm
 			texture<float, 2> dists_tex(0, cudaFilterModePoint, cudaAddressModeBorder, cudaCreateChannelDescHalf());
       texture<uchar4, 2> color_tex(0, cudaFilterModePoint, cudaAddressModeBorder, cudaCreateChannelDescHalf());
 
+      __device__ int integrate_max_dist;                 // half bits, non negative halfs order like ints
+      __device__ unsigned long long integrate_culled;
+
+      __global__ void max_dist_kernel(const PtrStepSz<ushort> dists)
+      {
+        int x = blockIdx.x * blockDim.x + threadIdx.x;
+        int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+        __shared__ int cta_buffer[32 * 8];
+
+        int value = (x < dists.cols && y < dists.rows) ? dists(y, x) : 0;
+        value = Block::reduce<32 * 8>(cta_buffer, value, maximum());
+
+        if (Block::flattenedThreadId() == 0)
+          atomicMax(&integrate_max_dist, value);
+      }
+
+      /** Narrows [lo, hi] to the steps i where a + b * i >= 0 */
+      __vm_device__ void clip_range(float a, float b, float& lo, float& hi)
+      {
+        if (b > 0)
+          lo = fmaxf(lo, -a / b);
+        else if (b < 0)
+          hi = fminf(hi, -a / b);
+        else if (a < 0)
+          hi = -1.f;
+      }
+
       struct TsdfIntegrator
       {
+        enum
+        {
+          CTA_SIZE_X = 32, CTA_SIZE_Y = 8,
+          CTA_SIZE = CTA_SIZE_X * CTA_SIZE_Y
+        };
+
         Aff3f vol2cam;
         Projector proj;
         int2 dists_size;
         int2 color_size;
         
         float tranc_dist_inv;
+        TsdfBricks bricks;
 
+        /** Voxels [z0, z1) of a column starting at vc that lie in front of the camera, project into the image and
+          * are not farther than the farthest measurement plus the truncation distance. It is widened by a voxel at
+          * each end against rounding, voxels in it still go through all the tests below. */
         __vm_device__
-        void operator()(TsdfVolume& volume) const
+        int2 column_range(const float3& vc, const float3& zstep, int dims_z, float far) const
+        {
+          float2 size = make_float2(dists_size.x, dists_size.y);
+          float lo = 0.f, hi = dims_z;
+
+          clip_range(vc.z, zstep.z, lo, hi);
+          clip_range(far - vc.z, -zstep.z, lo, hi);
+          clip_range(proj.f.x * vc.x + proj.c.x * vc.z, proj.f.x * zstep.x + proj.c.x * zstep.z, lo, hi);
+          clip_range(proj.f.y * vc.y + proj.c.y * vc.z, proj.f.y * zstep.y + proj.c.y * zstep.z, lo, hi);
+          clip_range((size.x - proj.c.x) * vc.z - proj.f.x * vc.x, (size.x - proj.c.x) * zstep.z - proj.f.x * zstep.x, lo, hi);
+          clip_range((size.y - proj.c.y) * vc.z - proj.f.y * vc.y, (size.y - proj.c.y) * zstep.z - proj.f.y * zstep.y, lo, hi);
+
+          if (lo > hi)
+            return make_int2(0, 0);
+
+          return make_int2(max(0, __float2int_rd(lo) - 1), min(dims_z, __float2int_ru(hi) + 2));
+        }
+
+        template<class Voxel> __vm_device__
+        void operator()(TsdfVolumeT<Voxel>& volume) const
         {
           int x = blockIdx.x * blockDim.x + threadIdx.x;
           int y = blockIdx.y * blockDim.y + threadIdx.y;
 
-          if (x >= volume.dims.x || y >= volume.dims.y)
-            return;
+          bool inside = x < volume.dims.x && y < volume.dims.y;
 
           //float3 zstep = vol2cam.R * make_float3(0.f, 0.f, volume.voxel_size.z);
           float3 zstep = make_float3(vol2cam.R.data[0].z, vol2cam.R.data[1].z, vol2cam.R.data[2].z) * volume.voxel_size.z;
@@ -76,9 +138,31 @@ namespace vm
           float3 vx = make_float3(x * volume.voxel_size.x, y * volume.voxel_size.y, 0);
           float3 vc = vol2cam * vx; //tranform from volume coo frame to camera one
 
-          TsdfVolume::elem_type* vptr = volume.beg(x, y);
-          for(int i = 0; i < volume.dims.z; ++i, vc += zstep, vptr = volume.zstep(vptr))
+          float far = __half2float((ushort)integrate_max_dist) + volume.trunc_dist;
+          int2 range = inside ? column_range(vc, zstep, volume.dims.z, far) : make_int2(0, 0);
+
+          __shared__ int cta_buffer[CTA_SIZE];
+          int culled = Block::reduce<CTA_SIZE>(cta_buffer, inside ? volume.dims.z - (range.y - range.x) : 0, plus());
+
+          if (Block::flattenedThreadId() == 0 && culled)
+            atomicAdd(&integrate_culled, (unsigned long long)culled);
+
+          if (!inside)
+            return;
+
+          vc += zstep * range.x;
+
+          // storage position, for the bricks
+          int px = wrap_voxel(x + volume.origin.x, volume.dims.x);
+          int py = wrap_voxel(y + volume.origin.y, volume.dims.y);
+          int pz = wrap_voxel(range.x + volume.origin.z, volume.dims.z);
+
+          int brick_z = pz >> TsdfBricks::LOG_SIZE0;
+          unsigned int signs = 0;
+
+          for(int i = range.x; i < range.y; ++i, vc += zstep, pz = pz + 1 < volume.dims.z ? pz + 1 : 0)
           {
+            Voxel* vptr = volume.at(px, py, pz);
             float2 coo = proj(vc);
 
             //#if defined __CUDA_ARCH__ && __CUDA_ARCH__ >= 300
@@ -121,13 +205,26 @@ namespace vm
               int weight_new = min (weight_prev + 1, volume.max_weight);
 
               //pack and write
-              gmem::StCs(pack_tsdf (tsdf_new, weight_new, color_new.x, color_new.y), vptr);
+              Voxel packed;
+              pack_tsdf (tsdf_new, weight_new, color_new.x, color_new.y, packed);
+              gmem::StCs(packed, vptr);
+
+              if (pz >> TsdfBricks::LOG_SIZE0 != brick_z)
+              {
+                bricks.mark(px, py, brick_z << TsdfBricks::LOG_SIZE0, signs);
+                brick_z = pz >> TsdfBricks::LOG_SIZE0;
+                signs = 0;
+              }
+              signs |= TsdfBricks::DIRTY | (tsdf_new > 0 ? TsdfBricks::POSITIVE : (tsdf_new < 0 ? TsdfBricks::NEGATIVE : 0));
             }
           }  // for(;;)
+
+          bricks.mark(px, py, brick_z << TsdfBricks::LOG_SIZE0, signs);
         }
       };
 
-      __global__ void integrate_kernel( const TsdfIntegrator integrator, TsdfVolume volume) { integrator(volume); };
+      template<class Voxel>
+      __global__ void integrate_kernel( const TsdfIntegrator integrator, TsdfVolumeT<Voxel> volume) { integrator(volume); };
 
 		}
 	}
@@ -155,14 +252,27 @@ namespace vm
 //   cudaSafeCall ( cudaDeviceSynchronize() );
 // }
 
-void vm::scanner::device::integrate(const PtrStepSz<ushort>& dists, const DeviceArray2D<uchar4>& colors, TsdfVolume& volume, const Aff3f& aff, const Projector& proj)
+unsigned long long vm::scanner::device::integrate(const PtrStepSz<ushort>& dists, const DeviceArray2D<uchar4>& colors, TsdfVolume& volume, const TsdfBricks& bricks,
+                                                  const Aff3f& aff, const Projector& proj)
 {
+  const int zero = 0;
+  const unsigned long long zero_count = 0;
+  cudaSafeCall ( cudaMemcpyToSymbol (integrate_max_dist, &zero, sizeof(zero)) );
+  cudaSafeCall ( cudaMemcpyToSymbol (integrate_culled, &zero_count, sizeof(zero_count)) );
+
+  dim3 max_block(32, 8);
+  dim3 max_grid(divUp(dists.cols, max_block.x), divUp(dists.rows, max_block.y));
+
+  max_dist_kernel<<<max_grid, max_block>>>(dists);
+  cudaSafeCall ( cudaGetLastError () );
+
   TsdfIntegrator ti;
   ti.dists_size = make_int2(dists.cols, dists.rows);
   ti.color_size = make_int2(colors.cols(), colors.rows());
   ti.vol2cam = aff;
   ti.proj = proj;
   ti.tranc_dist_inv = 1.f/volume.trunc_dist;
+  ti.bricks = bricks;
  
   dists_tex.filterMode = cudaFilterModePoint;
   dists_tex.addressMode[0] = cudaAddressModeBorder;
@@ -176,17 +286,29 @@ void vm::scanner::device::integrate(const PtrStepSz<ushort>& dists, const Device
   color_tex.addressMode[2] = cudaAddressModeBorder;
   TextureBinder color_binder(colors, color_tex); (void)color_binder;
   
-  dim3 block(32, 8);
+  // a warp of a bricked volume takes 8 x 4 columns, so each of its z steps stays within one brick
+  dim3 block(TsdfIntegrator::CTA_SIZE_X, TsdfIntegrator::CTA_SIZE_Y);
+  if (volume.order == ORDER_BRICKED)
+    block = dim3(TsdfIntegrator::CTA_SIZE_Y, TsdfIntegrator::CTA_SIZE_X);
   dim3 grid(divUp(volume.dims.x, block.x), divUp(volume.dims.y, block.y));
 
-  integrate_kernel<<<grid, block>>>(ti, volume);
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      integrate_kernel<<<grid, block>>>(ti, volume.typed<voxel6>()); break;
+  case VOXEL_GEOMETRY: integrate_kernel<<<grid, block>>>(ti, volume.typed<voxel4>()); break;
+  default:             integrate_kernel<<<grid, block>>>(ti, volume.typed<ushort4>()); break;
+  }
   cudaSafeCall ( cudaGetLastError () );
   cudaSafeCall ( cudaDeviceSynchronize() );
+
+  unsigned long long culled;
+  cudaSafeCall ( cudaMemcpyFromSymbol (&culled, integrate_culled, sizeof(culled)) );
+  return culled;
 }
 
-////////////////////////
-// Volume Ray Casting //
-////////////////////////
+///////////////////
+// Volume Bricks //
+///////////////////
 
 namespace vm
 {
@@ -194,54 +316,180 @@ namespace vm
 	{
 		namespace device
 		{
-			__vm_device__ void intersect(float3 ray_org, float3 ray_dir, /*float3 box_min,*/ float3 box_max, float &tnear, float &tfar)
+      /** If storage voxels [a, a + n) hold any of [beg, end) along an axis of dim voxels that starts at origin */
+      __vm_device__ bool overlaps(int a, int n, int origin, int dim, int beg, int end)
       {
-        const float3 box_min = make_float3(0.f, 0.f, 0.f);
+        int lo = a - origin < 0 ? a - origin + dim : a - origin;
+        int hi = lo + n;
+        return (lo < end && beg < min(hi, dim)) || (hi > dim && beg < hi - dim);
+      }
 
-        // compute intersection of ray with all six bbox planes
-        float3 invR = make_float3(1.f/ray_dir.x, 1.f/ray_dir.y, 1.f/ray_dir.z);
-        float3 tbot = invR * (box_min - ray_org);
-        float3 ttop = invR * (box_max - ray_org);
+      template<class Voxel>
+      __global__ void update_bricks_kernel(const TsdfVolumeT<Voxel> volume, const TsdfBricks bricks, int3 beg, int3 end)
+      {
+        int bx = threadIdx.x + blockIdx.x * blockDim.x;
+        int by = threadIdx.y + blockIdx.y * blockDim.y;
+        int bz = blockIdx.z;
+
+        if (bx >= bricks.dims[0].x || by >= bricks.dims[0].y)
+          return;
+
+        const int size = 1 << TsdfBricks::LOG_SIZE0;
+        int3 a = make_int3(bx * size, by * size, bz * size);
+        int3 n = make_int3(min(size, volume.dims.x - a.x), min(size, volume.dims.y - a.y), min(size, volume.dims.z - a.z));
+
+        if (!overlaps(a.x, n.x, volume.origin.x, volume.dims.x, beg.x, end.x) ||
+            !overlaps(a.y, n.y, volume.origin.y, volume.dims.y, beg.y, end.y) ||
+            !overlaps(a.z, n.z, volume.origin.z, volume.dims.z, beg.z, end.z))
+          return;
+
+        unsigned int signs = 0;
+        for(int z = a.z; z < a.z + n.z; ++z)
+          for(int y = a.y; y < a.y + n.y; ++y)
+            for(int x = a.x; x < a.x + n.x; ++x)
+            {
+              float tsdf = unpack_tsdf(*volume.at(x, y, z));
+              signs |= tsdf > 0 ? TsdfBricks::POSITIVE : (tsdf < 0 ? TsdfBricks::NEGATIVE : 0);
+            }
 
-        // re-order intersections to find smallest and largest on each axis
-        float3 tmin = make_float3(fminf(ttop.x, tbot.x), fminf(ttop.y, tbot.y), fminf(ttop.z, tbot.z));
-        float3 tmax = make_float3(fmaxf(ttop.x, tbot.x), fmaxf(ttop.y, tbot.y), fmaxf(ttop.z, tbot.z));
+        *bricks(0, a.x, a.y, a.z) = signs | TsdfBricks::DIRTY;
+      }
 
-        // find the largest tmin and the smallest tmax
-        tnear = fmaxf(fmaxf(tmin.x, tmin.y), fmaxf(tmin.x, tmin.z));
-        tfar  = fminf(fminf(tmax.x, tmax.y), fminf(tmax.x, tmax.z));
+      __global__ void update_coarse_bricks_kernel(const TsdfBricks bricks)
+      {
+        int bx = threadIdx.x + blockIdx.x * blockDim.x;
+        int by = threadIdx.y + blockIdx.y * blockDim.y;
+        int bz = blockIdx.z;
+
+        if (bx >= bricks.dims[1].x || by >= bricks.dims[1].y)
+          return;
+
+        const int ratio = 1 << (TsdfBricks::LOG_SIZE1 - TsdfBricks::LOG_SIZE0);
+        const int3 fine = bricks.dims[0];
+
+        unsigned int signs = 0;
+        for(int z = bz * ratio; z < min((bz + 1) * ratio, fine.z); ++z)
+          for(int y = by * ratio; y < min((by + 1) * ratio, fine.y); ++y)
+            for(int x = bx * ratio; x < min((bx + 1) * ratio, fine.x); ++x)
+              signs |= bricks.flags[0][(z * fine.y + y) * fine.x + x];
+
+        bricks.flags[1][(bz * bricks.dims[1].y + by) * bricks.dims[1].x + bx] = signs;
       }
 
-      template<typename Vol>
-      __vm_device__ float interpolate(const Vol& volume, const float3& p_voxels)
+      __device__ int dirty_brick_count;
+
+      __global__ void collect_dirty_bricks_kernel(const TsdfBricks bricks, bool all, PtrSz<int> output)
       {
-        float3 cf = p_voxels;
-
-        //rounding to negative infinity
-        int3 g = make_int3(__float2int_rd (cf.x), __float2int_rd (cf.y), __float2int_rd (cf.z));
-
-        if (g.x < 0 || g.x >= volume.dims.x - 1 || g.y < 0 || g.y >= volume.dims.y - 1 || g.z < 0 || g.z >= volume.dims.z - 1)
-            return numeric_limits<float>::quiet_NaN();
-
-        float a = cf.x - g.x;
-        float b = cf.y - g.y;
-        float c = cf.z - g.z;
-
-        float tsdf = 0.f;
-        tsdf += unpack_tsdf(*volume(g.x + 0, g.y + 0, g.z + 0)) * (1 - a) * (1 - b) * (1 - c);
-        tsdf += unpack_tsdf(*volume(g.x + 0, g.y + 0, g.z + 1)) * (1 - a) * (1 - b) *      c;
-        tsdf += unpack_tsdf(*volume(g.x + 0, g.y + 1, g.z + 0)) * (1 - a) *      b  * (1 - c);
-        tsdf += unpack_tsdf(*volume(g.x + 0, g.y + 1, g.z + 1)) * (1 - a) *      b  *      c;
-        tsdf += unpack_tsdf(*volume(g.x + 1, g.y + 0, g.z + 0)) *      a  * (1 - b) * (1 - c);
-        tsdf += unpack_tsdf(*volume(g.x + 1, g.y + 0, g.z + 1)) *      a  * (1 - b) *      c;
-        tsdf += unpack_tsdf(*volume(g.x + 1, g.y + 1, g.z + 0)) *      a  *      b  * (1 - c);
-        tsdf += unpack_tsdf(*volume(g.x + 1, g.y + 1, g.z + 1)) *      a  *      b  *      c;
-        return tsdf;
+        int x = threadIdx.x + blockIdx.x * blockDim.x;
+        int y = threadIdx.y + blockIdx.y * blockDim.y;
+        int z = blockIdx.z;
+
+        const int3 dims = bricks.dims[0];
+        if (x >= dims.x || y >= dims.y)
+          return;
+
+        // a crossing towards +x, +y or +z belongs to the lower brick, neighbours wrap like the storage
+        int xn = x + 1 < dims.x ? x + 1 : 0;
+        int yn = y + 1 < dims.y ? y + 1 : 0;
+        int zn = z + 1 < dims.z ? z + 1 : 0;
+
+        const unsigned int* f = bricks.flags[0];
+        unsigned int flags = f[(z * dims.y + y) * dims.x + x] | f[(z * dims.y + y) * dims.x + xn] |
+                             f[(z * dims.y + yn) * dims.x + x] | f[(zn * dims.y + y) * dims.x + x];
+
+        if (all || (flags & TsdfBricks::DIRTY))
+        {
+          int index = atomicAdd(&dirty_brick_count, 1);
+          if (index < output.size)
+            output.data[index] = (z * dims.y + y) * dims.x + x;
+        }
       }
 
-      struct TsdfRaycaster
+      __global__ void clear_dirty_kernel(const TsdfBricks bricks, int count)
       {
-        TsdfVolume volume;
+        int i = threadIdx.x + blockIdx.x * blockDim.x;
+
+        if (i < count)
+          bricks.flags[0][i] &= ~TsdfBricks::DIRTY;
+      }
+		}
+	}
+}
+
+void vm::scanner::device::reset_bricks(const TsdfBricks& bricks, int value)
+{
+  size_t count = 0;
+  for(int level = 0; level < TsdfBricks::LEVELS; ++level)
+    count += (size_t)bricks.dims[level].x * bricks.dims[level].y * bricks.dims[level].z;
+
+  cudaSafeCall ( cudaMemset(bricks.flags[0], value, count * sizeof(unsigned int)) );
+}
+
+void vm::scanner::device::update_bricks(const TsdfVolume& volume, const TsdfBricks& bricks, int3 beg, int3 end)
+{
+  dim3 block (8, 8);
+  dim3 grid (divUp (bricks.dims[0].x, block.x), divUp (bricks.dims[0].y, block.y), bricks.dims[0].z);
+
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      update_bricks_kernel<<<grid, block>>>(volume.typed<voxel6>(), bricks, beg, end); break;
+  case VOXEL_GEOMETRY: update_bricks_kernel<<<grid, block>>>(volume.typed<voxel4>(), bricks, beg, end); break;
+  default:             update_bricks_kernel<<<grid, block>>>(volume.typed<ushort4>(), bricks, beg, end); break;
+  }
+  cudaSafeCall ( cudaGetLastError () );
+
+  dim3 coarse_grid (divUp (bricks.dims[1].x, block.x), divUp (bricks.dims[1].y, block.y), bricks.dims[1].z);
+
+  update_coarse_bricks_kernel<<<coarse_grid, block>>>(bricks);
+  cudaSafeCall ( cudaGetLastError () );
+}
+
+int vm::scanner::device::collect_dirty_bricks(const TsdfBricks& bricks, bool all, PtrSz<int> output)
+{
+  const int zero = 0;
+  cudaSafeCall ( cudaMemcpyToSymbol (dirty_brick_count, &zero, sizeof(zero)) );
+
+  dim3 block (8, 8);
+  dim3 grid (divUp (bricks.dims[0].x, block.x), divUp (bricks.dims[0].y, block.y), bricks.dims[0].z);
+
+  collect_dirty_bricks_kernel<<<grid, block>>>(bricks, all, output);
+  cudaSafeCall ( cudaGetLastError () );
+
+  int listed;
+  cudaSafeCall ( cudaMemcpyFromSymbol (&listed, dirty_brick_count, sizeof(listed)) );
+  return min (listed, (int)output.size);
+}
+
+void vm::scanner::device::clear_dirty_bricks(const TsdfBricks& bricks)
+{
+  int count = bricks.dims[0].x * bricks.dims[0].y * bricks.dims[0].z;
+  clear_dirty_kernel<<<divUp (count, 256), 256>>>(bricks, count);
+  cudaSafeCall ( cudaGetLastError () );
+}
+
+////////////////////////
+// Volume Ray Casting //
+////////////////////////
+
+namespace vm
+{
+	namespace scanner
+	{
+		namespace device
+		{
+      __device__ unsigned long long raycast_step_count;
+
+			template<class Voxel>
+			struct TsdfRaycaster
+      {
+        enum
+        {
+          CTA_SIZE_X = 32, CTA_SIZE_Y = 8,
+          CTA_SIZE = CTA_SIZE_X * CTA_SIZE_Y
+        };
+
+        TsdfVolumeT<Voxel> volume;
+        TsdfBricks bricks;
 
         Aff3f aff;
         Mat3f Rinv;
@@ -252,7 +500,7 @@ namespace vm
         float3 gradient_delta;
         float3 voxel_size_inv;
 
-        TsdfRaycaster(const TsdfVolume& volume, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& _reproj);
+        TsdfRaycaster(const TsdfVolumeT<Voxel>& volume, const TsdfBricks& bricks, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& _reproj);
 
         __vm_device__
         float fetch_tsdf(const float3& p) const
@@ -264,14 +512,68 @@ namespace vm
           return unpack_tsdf(*volume(x, y, z));
         }
 
+        /** Whole steps the ray can take from p without leaving a brick that holds no zero crossing. The samples
+          * it skips would have seen a single sign, so the ray stops where it would have without skipping. */
+        __vm_device__
+        int leap(const float3& p, const float3& ray_dir) const
+        {
+          if (!bricks.flags[0])
+            return 0;
+
+          // samples round to the nearest voxel, a voxel spans +-0.5 around its center
+          const float margin = 0.05f;
+
+          float3 g = p * voxel_size_inv;
+          int3 v = make_int3(__float2int_rn(g.x), __float2int_rn(g.y), __float2int_rn(g.z));
+          int3 s = make_int3(wrap_voxel(v.x + volume.origin.x, volume.dims.x), wrap_voxel(v.y + volume.origin.y, volume.dims.y),
+                             wrap_voxel(v.z + volume.origin.z, volume.dims.z));
+
+          for(int level = TsdfBricks::LEVELS - 1; level >= 0; --level)
+          {
+            if ((*bricks(level, s.x, s.y, s.z) & TsdfBricks::SURFACE) == TsdfBricks::SURFACE)
+              continue;
+
+            int size = 1 << (level ? TsdfBricks::LOG_SIZE1 : TsdfBricks::LOG_SIZE0);
+            int3 lo = make_int3(v.x - (s.x & (size - 1)), v.y - (s.y & (size - 1)), v.z - (s.z & (size - 1)));
+            int3 hi = make_int3(lo.x + min(size, volume.dims.x - (s.x & ~(size - 1))), lo.y + min(size, volume.dims.y - (s.y & ~(size - 1))),
+                                lo.z + min(size, volume.dims.z - (s.z & ~(size - 1))));
+
+            float3 d = ray_dir * voxel_size_inv * time_step;
+            float exit = fminf(exit_steps(g.x, d.x, lo.x - 0.5f + margin, hi.x - 0.5f - margin),
+                         fminf(exit_steps(g.y, d.y, lo.y - 0.5f + margin, hi.y - 0.5f - margin),
+                               exit_steps(g.z, d.z, lo.z - 0.5f + margin, hi.z - 0.5f - margin)));
+
+            return max(0, __float2int_ru(exit) - 1);
+          }
+          return 0;
+        }
+
+        /** Steps of d from g until it leaves [lo, hi] */
+        __vm_device__
+        static float exit_steps(float g, float d, float lo, float hi)
+        {
+          return d > 0 ? (hi - g) / d : (d < 0 ? (lo - g) / d : numeric_limits<float>::max());
+        }
+
+        /** Adds the steps of the rays of the block to raycast_step_count */
+        __vm_device__
+        void count(int steps) const
+        {
+          __shared__ int cta_buffer[CTA_SIZE];
+          steps = Block::reduce<CTA_SIZE>(cta_buffer, steps, plus());
+
+          if (Block::flattenedThreadId() == 0 && steps)
+            atomicAdd(&raycast_step_count, (unsigned long long)steps);
+        }
+
         __vm_device__
-        void operator()(PtrStepSz<ushort> depth, PtrStep<Normal> normals) const
+        int operator()(PtrStepSz<ushort> depth, PtrStep<Normal> normals) const
         {
           int x = blockIdx.x * blockDim.x + threadIdx.x;
           int y = blockIdx.y * blockDim.y + threadIdx.y;
 
           if (x >= depth.cols || y >= depth.rows)
-              return;
+              return 0;
 
           const float qnan = numeric_limits<float>::quiet_NaN();
 
@@ -279,7 +581,7 @@ namespace vm
           normals(y, x) = make_float4(qnan, qnan, qnan, qnan);
 
           float3 ray_org = aff.t;
-          float3 ray_dir = normalized( aff.R * reproj(x, y, 1.f) );
+          float3 ray_dir = aff.R * reproj.direction(x, y);
 
           // We do subtract voxel size to minimize checks after
           // Note: origin of volume coordinate is placeed
@@ -292,20 +594,34 @@ namespace vm
           const float min_dist = 0.f;
           tmin = fmax(min_dist, tmin);
           if (tmin >= tmax)
-              return;
+              return 0;
 
           tmax -= time_step;
           float3 vstep = ray_dir * time_step;
           float3 next = ray_org + ray_dir * tmin;
 
           float tsdf_next = fetch_tsdf(next);
+          int steps = 1;
           for (float tcurr = tmin; tcurr < tmax; tcurr += time_step)
           {
             float tsdf_curr = tsdf_next;
             float3     curr = next;
-            next += vstep;
+
+            int skip = leap(curr, ray_dir);
+            if (skip > 0)
+            {
+              tcurr += skip * time_step;
+              if (tcurr >= tmax)
+                break;
+
+              curr = ray_org + ray_dir * tcurr;
+              tsdf_curr = fetch_tsdf(curr);
+              ++steps;
+            }
+            next = curr + vstep;
 
             tsdf_next = fetch_tsdf(next);
+            ++steps;
             if (tsdf_curr < 0.f && tsdf_next > 0.f)
                 break;
 
@@ -330,23 +646,24 @@ namespace vm
               break;
             }
           } /* for (;;) */
+          return steps;
         }
 
         __vm_device__
-        void operator()(PtrStepSz<Point> points, PtrStep<Normal> normals) const
+        int operator()(PtrStepSz<Point> points, PtrStep<Normal> normals) const
         {
           int x = blockIdx.x * blockDim.x + threadIdx.x;
           int y = blockIdx.y * blockDim.y + threadIdx.y;
 
           if (x >= points.cols || y >= points.rows)
-              return;
+              return 0;
 
           const float qnan = numeric_limits<float>::quiet_NaN();
 
           points(y, x) = normals(y, x) = make_float4(qnan, qnan, qnan, qnan);
 
           float3 ray_org = aff.t;
-          float3 ray_dir = normalized( aff.R * reproj(x, y, 1.f) );
+          float3 ray_dir = aff.R * reproj.direction(x, y);
 
           // We do subtract voxel size to minimize checks after
           // Note: origin of volume coordinate is placeed
@@ -359,20 +676,34 @@ namespace vm
           const float min_dist = 0.f;
           tmin = fmax(min_dist, tmin);
           if (tmin >= tmax)
-              return;
+              return 0;
 
           tmax -= time_step;
           float3 vstep = ray_dir * time_step;
           float3 next = ray_org + ray_dir * tmin;
 
           float tsdf_next = fetch_tsdf(next);
+          int steps = 1;
           for (float tcurr = tmin; tcurr < tmax; tcurr += time_step)
           {
             float tsdf_curr = tsdf_next;
             float3     curr = next;
-            next += vstep;
+
+            int skip = leap(curr, ray_dir);
+            if (skip > 0)
+            {
+              tcurr += skip * time_step;
+              if (tcurr >= tmax)
+                break;
+
+              curr = ray_org + ray_dir * tcurr;
+              tsdf_curr = fetch_tsdf(curr);
+              ++steps;
+            }
+            next = curr + vstep;
 
             tsdf_next = fetch_tsdf(next);
+            ++steps;
             if (tsdf_curr < 0.f && tsdf_next > 0.f)
                 break;
 
@@ -397,6 +728,7 @@ namespace vm
               break;
             }
           } /* for (;;) */
+          return steps;
         }
 
 
@@ -421,51 +753,72 @@ namespace vm
         }
       };
 
-      inline TsdfRaycaster::TsdfRaycaster(const TsdfVolume& _volume, const Aff3f& _aff, const Mat3f& _Rinv, const Reprojector& _reproj)
-          : volume(_volume), aff(_aff), Rinv(_Rinv), reproj(_reproj) {}
+      template<class Voxel>
+      inline TsdfRaycaster<Voxel>::TsdfRaycaster(const TsdfVolumeT<Voxel>& _volume, const TsdfBricks& _bricks, const Aff3f& _aff, const Mat3f& _Rinv, const Reprojector& _reproj)
+          : volume(_volume), bricks(_bricks), aff(_aff), Rinv(_Rinv), reproj(_reproj) {}
+
+      /** Output is PtrStepSz<ushort> for depth or PtrStepSz<Point> for points */
+      template<class Voxel, class Output>
+      __global__ void raycast_kernel(const TsdfRaycaster<Voxel> raycaster, Output output, PtrStep<Normal> normals)
+      { raycaster.count(raycaster(output, normals)); };
+
+      template<class Voxel, class Output>
+      void raycast_volume(const TsdfVolumeT<Voxel>& volume, const TsdfBricks& bricks, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& reproj,
+                          Output output, PtrStep<Normal> normals, float raycaster_step_factor, float gradient_delta_factor)
+      {
+        typedef TsdfRaycaster<Voxel> RC;
+        RC rc(volume, bricks, aff, Rinv, reproj);
 
-      __global__ void raycast_kernel(const TsdfRaycaster raycaster, PtrStepSz<ushort> depth, PtrStep<Normal> normals)
-      { raycaster(depth, normals); };
+        rc.volume_size = volume.voxel_size * volume.dims;
+        rc.time_step = volume.trunc_dist * raycaster_step_factor;
+        rc.gradient_delta = volume.voxel_size * gradient_delta_factor;
+        rc.voxel_size_inv = 1.f/volume.voxel_size;
 
-      __global__ void raycast_kernel(const TsdfRaycaster raycaster, PtrStepSz<Point> points, PtrStep<Normal> normals)
-      { raycaster(points, normals); };
+        dim3 block(RC::CTA_SIZE_X, RC::CTA_SIZE_Y);
+        dim3 grid (divUp (output.cols, block.x), divUp (output.rows, block.y));
+
+        raycast_kernel<<<grid, block>>>(rc, output, normals);
+        cudaSafeCall (cudaGetLastError ());
+      }
+
+      template<class Output>
+      void raycast_volume(const TsdfVolume& volume, const TsdfBricks& bricks, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& reproj,
+                          Output output, PtrStep<Normal> normals, float raycaster_step_factor, float gradient_delta_factor)
+      {
+        switch(volume.layout)
+        {
+        case VOXEL_RGB:
+          raycast_volume(volume.typed<voxel6>(), bricks, aff, Rinv, reproj, output, normals, raycaster_step_factor, gradient_delta_factor); break;
+        case VOXEL_GEOMETRY:
+          raycast_volume(volume.typed<voxel4>(), bricks, aff, Rinv, reproj, output, normals, raycaster_step_factor, gradient_delta_factor); break;
+        default:
+          raycast_volume(volume.typed<ushort4>(), bricks, aff, Rinv, reproj, output, normals, raycaster_step_factor, gradient_delta_factor); break;
+        }
+      }
 		}
 	}
 }
 
-void vm::scanner::device::raycast(const TsdfVolume& volume, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& reproj,
+void vm::scanner::device::raycast(const TsdfVolume& volume, const TsdfBricks& bricks, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& reproj,
                               Depth& depth, Normals& normals, float raycaster_step_factor, float gradient_delta_factor)
 {
-  TsdfRaycaster rc(volume, aff, Rinv, reproj);
-
-  rc.volume_size = volume.voxel_size * volume.dims;
-  rc.time_step = volume.trunc_dist * raycaster_step_factor;
-  rc.gradient_delta = volume.voxel_size * gradient_delta_factor;
-  rc.voxel_size_inv = 1.f/volume.voxel_size;
-
-  dim3 block(32, 8);
-  dim3 grid (divUp (depth.cols(), block.x), divUp (depth.rows(), block.y));
-
-  raycast_kernel<<<grid, block>>>(rc, (PtrStepSz<ushort>)depth, normals);
-  cudaSafeCall (cudaGetLastError ());
+  raycast_volume(volume, bricks, aff, Rinv, reproj, (PtrStepSz<ushort>)depth, (PtrStep<Normal>)normals, raycaster_step_factor, gradient_delta_factor);
 }
 
 
-void vm::scanner::device::raycast(const TsdfVolume& volume, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& reproj,
+void vm::scanner::device::raycast(const TsdfVolume& volume, const TsdfBricks& bricks, const Aff3f& aff, const Mat3f& Rinv, const Reprojector& reproj,
                               Points& points, Normals& normals, float raycaster_step_factor, float gradient_delta_factor)
 {
-  TsdfRaycaster rc(volume, aff, Rinv, reproj);
-
-  rc.volume_size = volume.voxel_size * volume.dims;
-  rc.time_step = volume.trunc_dist * raycaster_step_factor;
-  rc.gradient_delta = volume.voxel_size * gradient_delta_factor;
-  rc.voxel_size_inv = 1.f/volume.voxel_size;
-
-  dim3 block(32, 8);
-  dim3 grid (divUp (points.cols(), block.x), divUp (points.rows(), block.y));
+  raycast_volume(volume, bricks, aff, Rinv, reproj, (PtrStepSz<Point>)points, (PtrStep<Normal>)normals, raycaster_step_factor, gradient_delta_factor);
+}
 
-  raycast_kernel<<<grid, block>>>(rc, (PtrStepSz<Point>)points, normals);
-  cudaSafeCall (cudaGetLastError ());
+unsigned long long vm::scanner::device::raycast_steps()
+{
+  unsigned long long steps;
+  const unsigned long long zero = 0;
+  cudaSafeCall ( cudaMemcpyFromSymbol (&steps, raycast_step_count, sizeof(steps)) );
+  cudaSafeCall ( cudaMemcpyToSymbol (raycast_step_count, &zero, sizeof(zero)) );
+  return steps;
 }
 
 /////////////////////////////
@@ -507,6 +860,7 @@ namespace vm
       __device__ unsigned int blocks_done = 0;
 
 
+      template<class Voxel>
       struct FullScan6
       {
         enum
@@ -518,10 +872,18 @@ namespace vm
           MAX_LOCAL_POINTS = 3
         };
 
-        TsdfVolume volume;
+        TsdfVolumeT<Voxel> volume;
         Aff3f aff;
+        int3 beg, end; // voxels scanned, their +1 neighbours may lie past end
+
+        // when set, block (i, 0..1) scans the level 0 brick bricks[i] instead of the box, 16 x 12 threads per slice
+        PtrSz<int> bricks;
+        int3 brick_dims;
+
+        FullScan6(const TsdfVolumeT<Voxel>& vol) : volume(vol), beg(make_int3(0, 0, 0)), end(vol.dims), bricks(0, 0) {}
 
-        FullScan6(const TsdfVolume& vol) : volume(vol) {}
+        /** Volume coordinate of storage position s along an axis */
+        static __vm_device__ int unwrap(int s, int origin, int dim) { return s < origin ? s - origin + dim : s - origin; }
 
         __vm_device__ float fetch(int x, int y, int z, int& weight, ushort& rg, ushort& ba) const
         {
@@ -530,32 +892,60 @@ namespace vm
 
         __vm_device__ void operator () (PtrSz<Point> output) const
         {
-          int x = threadIdx.x + blockIdx.x * CTA_SIZE_X;
-          int y = threadIdx.y + blockIdx.y * CTA_SIZE_Y;
+          int x = beg.x + threadIdx.x + blockIdx.x * CTA_SIZE_X;
+          int y = beg.y + threadIdx.y + blockIdx.y * CTA_SIZE_Y;
 #if __CUDA_ARCH__ < 200
           __shared__ int cta_buffer[CTA_SIZE];
 #endif
 
+          int ftid = Block::flattenedThreadId ();
+
+          // storage z range of a brick, otherwise the box
+          int z_beg = beg.z, z_end = min(end.z, volume.dims.z - 1);
+          bool inside = x < end.x && y < end.y;
+          float w = 0.f;
+
+          if (bricks.data)
+          {
+            const int size = 1 << TsdfBricks::LOG_SIZE0;
+            int brick = bricks.data[blockIdx.x];
+            int3 b = make_int3(brick % brick_dims.x, brick / brick_dims.x % brick_dims.y, brick / (brick_dims.x * brick_dims.y));
+
+            int sx = b.x * size + ftid % size;
+            int sy = b.y * size + ftid / size + blockIdx.y * (CTA_SIZE / size);
+
+            inside = sx < min((b.x + 1) * size, volume.dims.x) && sy < min((b.y + 1) * size, volume.dims.y);
+            x = unwrap(sx, volume.origin.x, volume.dims.x);
+            y = unwrap(sy, volume.origin.y, volume.dims.y);
+
+            z_beg = b.z * size;
+            z_end = min(z_beg + size, volume.dims.z);
+            w = (float)brick;
+          }
+          else
+          {
+            // not for bricks, where a warp of a partial brick may hold no voxel but every block has to reach the counting below
 #if __CUDA_ARCH__ >= 120
-          if (__all (x >= volume.dims.x) || __all (y >= volume.dims.y))
-            return;
+            if (__all (x >= end.x) || __all (y >= end.y))
+              return;
 #else
-          if (Emulation::All(x >= volume.dims.x, cta_buffer) || Emulation::All(y >= volume.dims.y, cta_buffer))
-            return;
+            if (Emulation::All(x >= end.x, cta_buffer) || Emulation::All(y >= end.y, cta_buffer))
+              return;
 #endif
+          }
 
           float3 V;
           V.x = (x + 0.5f) * volume.voxel_size.x;
           V.y = (y + 0.5f) * volume.voxel_size.y;
 
-          int ftid = Block::flattenedThreadId ();
-
-          for (int z = 0; z < volume.dims.z - 1; ++z)
+          for (int i = z_beg; i < z_end; ++i)
           {
+            int z = bricks.data ? unwrap(i, volume.origin.z, volume.dims.z) : i;
+
             float3 points[MAX_LOCAL_POINTS];
             int local_count = 0;
 
-            if (x < volume.dims.x && y < volume.dims.y)
+            if (inside && z + 1 < volume.dims.z)
             {
               int W;
               ushort2 C;
@@ -636,7 +1026,7 @@ namespace vm
                     }
                 } /* if (z + 1 < volume.dims.z) */
               } /* if (W != 0 && F != 1.f) */
-            } /* if (x < volume.dims.x && y < volume.dims.y) */
+            } /* if (inside && z + 1 < volume.dims.z) */
 
 #if __CUDA_ARCH__ >= 200
             ///not we fulfilled points array at current iteration
@@ -680,7 +1070,7 @@ namespace vm
                 float x = storage_X[storage_index + idx];
                 float y = storage_Y[storage_index + idx];
                 float z = storage_Z[storage_index + idx];
-                *pos = make_float4(x, y, z, 0.f);
+                *pos = make_float4(x, y, z, w);
               }
 
               bool full = (old_global_count + total_warp) >= output.size;
@@ -689,7 +1079,7 @@ namespace vm
                 break;
             }
 
-          } /* for(int z = 0; z < volume.dims.z - 1; ++z) */
+          } /* for (int i = z_beg; i < z_end; ++i) */
 
 
 	        ///////////////////////////////
@@ -713,22 +1103,24 @@ namespace vm
 
 
 
-      __global__ void extract_kernel(const FullScan6 fs, PtrSz<Point> output) { fs(output); }
+      template<class Voxel>
+      __global__ void extract_kernel(const FullScan6<Voxel> fs, PtrSz<Point> output) { fs(output); }
 
 
 
+      template<class Voxel>
       struct ExtractNormals
       {
         typedef float8 float8;
 
-        TsdfVolume volume;
+        TsdfVolumeT<Voxel> volume;
         PtrSz<Point> points;
         float3 voxel_size_inv;
         float3 gradient_delta;
         Aff3f aff;
         Mat3f Rinv;
 
-        ExtractNormals(const TsdfVolume& vol) : volume(vol)
+        ExtractNormals(const TsdfVolumeT<Voxel>& vol) : volume(vol)
         {
           voxel_size_inv.x = 1.f/volume.voxel_size.x;
           voxel_size_inv.y = 1.f/volume.voxel_size.y;
@@ -798,21 +1190,23 @@ namespace vm
         }
       };
 
-      __global__ void extract_normals_kernel (const ExtractNormals en, float4* output) { en(output); }
+      template<class Voxel>
+      __global__ void extract_normals_kernel (const ExtractNormals<Voxel> en, float4* output) { en(output); }
 
 
+      template<class Voxel>
       struct ExtractTangentColors
       {
         typedef float8 float8;
 
-        TsdfVolume volume;
+        TsdfVolumeT<Voxel> volume;
         PtrSz<Point> points;
         float3 voxel_size_inv;
         float3 gradient_delta;
         Aff3f aff;
         Mat3f Rinv;
 
-        ExtractTangentColors(const TsdfVolume& vol) : volume(vol)
+        ExtractTangentColors(const TsdfVolumeT<Voxel>& vol) : volume(vol)
         {
           voxel_size_inv.x = 1.f/volume.voxel_size.x;
           voxel_size_inv.y = 1.f/volume.voxel_size.y;
@@ -886,18 +1280,20 @@ namespace vm
         }
       };
 
-      __global__ void extract_tangent_colors_kernel (const ExtractTangentColors ec, uchar4* output) { ec(output); }
+      template<class Voxel>
+      __global__ void extract_tangent_colors_kernel (const ExtractTangentColors<Voxel> ec, uchar4* output) { ec(output); }
 
+      template<class Voxel>
       struct ExtractVertexColors
       {
-        TsdfVolume volume;
+        TsdfVolumeT<Voxel> volume;
         PtrSz<Point> points;
         float3 voxel_size_inv;
         float3 gradient_delta;
         Aff3f aff;
         Mat3f Rinv;
 
-        ExtractVertexColors(const TsdfVolume& vol) : volume(vol)
+        ExtractVertexColors(const TsdfVolumeT<Voxel>& vol) : volume(vol)
         {
           voxel_size_inv.x = 1.f/volume.voxel_size.x;
           voxel_size_inv.y = 1.f/volume.voxel_size.y;
@@ -941,76 +1337,517 @@ namespace vm
 
       };
 
-      __global__ void extract_vertex_colors_kernel (const ExtractVertexColors evc, uchar4* output) { evc(output); }
-      
+      template<class Voxel>
+      __global__ void extract_vertex_colors_kernel (const ExtractVertexColors<Voxel> evc, uchar4* output) { evc(output); }
+
+      template<class Voxel>
+      size_t extract_cloud (const TsdfVolumeT<Voxel>& volume, const Aff3f& aff, int3 beg, int3 end, PtrSz<Point> output)
+      {
+        typedef FullScan6<Voxel> FS;
+        FS fs(volume);
+        fs.aff = aff;
+        fs.beg = beg;
+        fs.end = end;
+
+        dim3 block (FS::CTA_SIZE_X, FS::CTA_SIZE_Y);
+        dim3 grid (divUp (end.x - beg.x, block.x), divUp (end.y - beg.y, block.y));
+
+        extract_kernel<<<grid, block>>>(fs, output);
+        cudaSafeCall ( cudaGetLastError () );
+        cudaSafeCall (cudaDeviceSynchronize ());
+
+        int size;
+        cudaSafeCall ( cudaMemcpyFromSymbol (&size, output_count, sizeof(size)) );
+        return (size_t)size;
+      }
+
+      template<class Voxel>
+      size_t extract_cloud (const TsdfVolumeT<Voxel>& volume, const Aff3f& aff, const PtrSz<int>& bricks, PtrSz<Point> output)
+      {
+        typedef FullScan6<Voxel> FS;
+        FS fs(volume);
+        fs.aff = aff;
+        fs.bricks = bricks;
+        fs.brick_dims = TsdfBricks(0, volume.dims).dims[0];
+
+        if (!bricks.size)
+          return 0;
+
+        const int size = 1 << TsdfBricks::LOG_SIZE0;
+        dim3 block (FS::CTA_SIZE_X, FS::CTA_SIZE_Y);
+        dim3 grid ((unsigned int)bricks.size, divUp (size * size, FS::CTA_SIZE));
+
+        extract_kernel<<<grid, block>>>(fs, output);
+        cudaSafeCall ( cudaGetLastError () );
+        cudaSafeCall (cudaDeviceSynchronize ());
+
+        int count;
+        cudaSafeCall ( cudaMemcpyFromSymbol (&count, output_count, sizeof(count)) );
+        return (size_t)count;
+      }
+
+      template<class Voxel>
+      void extract_normals (const TsdfVolumeT<Voxel>& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, float4* output)
+      {
+        ExtractNormals<Voxel> en(volume);
+        en.points = points;
+        en.gradient_delta = volume.voxel_size * gradient_delta_factor;
+        en.aff = aff;
+        en.Rinv = Rinv;
+
+        dim3 block (256);
+        dim3 grid (divUp ((int)points.size, block.x));
+
+        extract_normals_kernel<<<grid, block>>>(en, output);
+        cudaSafeCall ( cudaGetLastError () );
+        cudaSafeCall (cudaDeviceSynchronize ());
+      }
+
+      template<class Voxel>
+      void extract_tangent_colors (const TsdfVolumeT<Voxel>& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, uchar4* output)
+      {
+        ExtractTangentColors<Voxel> ec(volume);
+        ec.points = points;
+        ec.gradient_delta = volume.voxel_size * gradient_delta_factor;
+        ec.aff = aff;
+        ec.Rinv = Rinv;
+
+        dim3 block(256);
+        dim3 grid(divUp ((int)points.size, block.x));
+
+        extract_tangent_colors_kernel<<<grid, block>>>(ec, output);
+
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+      }
+
+      template<class Voxel>
+      void extract_vertex_colors (const TsdfVolumeT<Voxel>& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, uchar4* output)
+      {
+        ExtractVertexColors<Voxel> evc(volume);
+        evc.points = points;
+        evc.gradient_delta = volume.voxel_size * gradient_delta_factor;
+        evc.aff = aff;
+        evc.Rinv = Rinv;
+
+        dim3 block(256);
+        dim3 grid(divUp ((int)points.size, block.x));
+
+        extract_vertex_colors_kernel<<<grid, block>>>(evc, output);
+
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+      }
+
+      __device__ int surfel_count;
+
+      /** Zero crossings as FullScan6 finds them, with the tsdf gradient normal and a color each. A thread walks a
+        * column of voxels along z. count() stores the crossings of every column, fill() reserves that many records
+        * with one atomic per column and writes them, so an output sized by count() is never overrun. */
+      template<class Voxel>
+      struct ExtractSurfels
+      {
+        enum
+        {
+          CTA_SIZE_X = 32,
+          CTA_SIZE_Y = 8
+        };
+
+        TsdfVolumeT<Voxel> volume;
+        Aff3f aff;
+        float3 voxel_size_inv;
+        float3 gradient_delta;
+        bool tangent_colors;
+
+        ExtractSurfels(const TsdfVolumeT<Voxel>& vol) : volume(vol)
+        {
+          voxel_size_inv.x = 1.f/volume.voxel_size.x;
+          voxel_size_inv.y = 1.f/volume.voxel_size.y;
+          voxel_size_inv.z = 1.f/volume.voxel_size.z;
+        }
+
+        __vm_device__ float fetch(int x, int y, int z, int& weight, ushort2& color) const
+        {
+          return unpack_tsdf(*volume(x, y, z), weight, color.x, color.y);
+        }
+
+        /** Crossings on the +x, +y and +z edges of voxel (x, y, z), in volume coordinates */
+        __vm_device__ int crossings(int x, int y, int z, float3 points[3]) const
+        {
+          int W;
+          ushort2 C;
+          float F = fetch(x, y, z, W, C);
+
+          if (W == 0 || F == 1.f)
+            return 0;
+
+          float3 V = make_float3((x + 0.5f) * volume.voxel_size.x, (y + 0.5f) * volume.voxel_size.y, (z + 0.5f) * volume.voxel_size.z);
+
+          int count = 0;
+          for(int axis = 0; axis < 3; ++axis)
+          {
+            int3 g = make_int3(x + (axis == 0), y + (axis == 1), z + (axis == 2));
+
+            if (g.x >= volume.dims.x || g.y >= volume.dims.y || g.z >= volume.dims.z)
+              continue;
+
+            int Wn;
+            ushort2 Cn;
+            float Fn = fetch(g.x, g.y, g.z, Wn, Cn);
+
+            if (Wn == 0 || Fn == 1.f || !((F > 0 && Fn < 0) || (F < 0 && Fn > 0)))
+              continue;
+
+            float d_inv = 1.f / (fabs (F) + fabs (Fn));
+
+            float3 p = V;
+            if (axis == 0) p.x = (V.x * fabs (Fn) + (V.x + volume.voxel_size.x) * fabs (F)) * d_inv;
+            if (axis == 1) p.y = (V.y * fabs (Fn) + (V.y + volume.voxel_size.y) * fabs (F)) * d_inv;
+            if (axis == 2) p.z = (V.z * fabs (Fn) + (V.z + volume.voxel_size.z) * fabs (F)) * d_inv;
+
+            points[count++] = p;
+          }
+          return count;
+        }
+
+        __vm_device__ Surfel surfel(const float3& point) const
+        {
+          const float qnan = numeric_limits<float>::quiet_NaN ();
+          float3 n = make_float3 (qnan, qnan, qnan);
+          uchar4 color = make_uchar4(0, 0, 0, 0);
+
+          int3 g = make_int3(__float2int_rn (point.x * voxel_size_inv.x), __float2int_rn (point.y * voxel_size_inv.y), __float2int_rn (point.z * voxel_size_inv.z));
+
+          if (g.x > 1 && g.y > 1 && g.z > 1 && g.x < volume.dims.x - 2 && g.y < volume.dims.y - 2 && g.z < volume.dims.z - 2)
+          {
+            float Fx1 = interpolate(volume, make_float3(point.x + gradient_delta.x, point.y, point.z) * voxel_size_inv);
+            float Fx2 = interpolate(volume, make_float3(point.x - gradient_delta.x, point.y, point.z) * voxel_size_inv);
+            n.x = __fdividef(Fx1 - Fx2, gradient_delta.x);
+
+            float Fy1 = interpolate(volume, make_float3(point.x, point.y + gradient_delta.y, point.z) * voxel_size_inv);
+            float Fy2 = interpolate(volume, make_float3(point.x, point.y - gradient_delta.y, point.z) * voxel_size_inv);
+            n.y = __fdividef(Fy1 - Fy2, gradient_delta.y);
+
+            float Fz1 = interpolate(volume, make_float3(point.x, point.y, point.z + gradient_delta.z) * voxel_size_inv);
+            float Fz2 = interpolate(volume, make_float3(point.x, point.y, point.z - gradient_delta.z) * voxel_size_inv);
+            n.z = __fdividef(Fz1 - Fz2, gradient_delta.z);
+
+            n = normalized (aff.R * n);
+
+            if (!tangent_colors)
+            {
+              int W;
+              ushort2 C;
+              fetch(g.x, g.y, g.z, W, C);
+              uchar4 tmp = ushort2rgba(C);  // rgb
+              color = make_uchar4(tmp.z, tmp.y, tmp.x, tmp.w); // bgr
+            }
+          }
+
+          if (tangent_colors)
+          {
+            unsigned char c_r = static_cast<unsigned char>((5.f - n.x * 3.5f) * 25.5f);
+            unsigned char c_g = static_cast<unsigned char>((5.f - n.y * 2.5f) * 25.5f);
+            unsigned char c_b = static_cast<unsigned char>((5.f - n.z * 3.5f) * 25.5f);
+            color = make_uchar4(c_b, c_g, c_r, 0);
+          }
+
+          float3 v = aff * point;
+
+          Surfel s;
+          s.point = make_float4(v.x, v.y, v.z, 0.f);
+          s.normal = make_float4(n.x, n.y, n.z, 0.f);
+          s.color = color;
+          s.pad[0] = s.pad[1] = s.pad[2] = 0;
+          return s;
+        }
+
+        __vm_device__ void count(int* counts) const
+        {
+          int x = threadIdx.x + blockIdx.x * blockDim.x;
+          int y = threadIdx.y + blockIdx.y * blockDim.y;
+
+          if (x >= volume.dims.x || y >= volume.dims.y)
+            return;
+
+          float3 points[3];
+          int total = 0;
+          for(int z = 0; z < volume.dims.z; ++z)
+            total += crossings(x, y, z, points);
+
+          counts[y * volume.dims.x + x] = total;
+          if (total)
+            atomicAdd(&surfel_count, total);
+        }
+
+        /** Crossings FullScan6 finds from the voxels in [beg, end), which skips the last z slice whole */
+        __vm_device__ void count(int3 beg, int3 end) const
+        {
+          int x = beg.x + threadIdx.x + blockIdx.x * blockDim.x;
+          int y = beg.y + threadIdx.y + blockIdx.y * blockDim.y;
+
+          if (x >= end.x || y >= end.y)
+            return;
+
+          float3 points[3];
+          int total = 0;
+          for(int z = beg.z; z < min(end.z, volume.dims.z - 1); ++z)
+            total += crossings(x, y, z, points);
+
+          if (total)
+            atomicAdd(&surfel_count, total);
+        }
+
+        /** Crossings FullScan6 finds from the voxels of the listed level 0 bricks, block i walks brick bricks[i] */
+        __vm_device__ void count(const PtrSz<int>& bricks, int3 brick_dims) const
+        {
+          const int size = 1 << TsdfBricks::LOG_SIZE0;
+          int brick = bricks.data[blockIdx.x];
+          int3 b = make_int3(brick % brick_dims.x, brick / brick_dims.x % brick_dims.y, brick / (brick_dims.x * brick_dims.y));
+
+          int sx = b.x * size + threadIdx.x;
+          int sy = b.y * size + threadIdx.y;
+
+          if (sx >= min((b.x + 1) * size, volume.dims.x) || sy >= min((b.y + 1) * size, volume.dims.y))
+            return;
+
+          int x = FullScan6<Voxel>::unwrap(sx, volume.origin.x, volume.dims.x);
+          int y = FullScan6<Voxel>::unwrap(sy, volume.origin.y, volume.dims.y);
+
+          float3 points[3];
+          int total = 0;
+          for(int i = b.z * size; i < min((b.z + 1) * size, volume.dims.z); ++i)
+          {
+            int z = FullScan6<Voxel>::unwrap(i, volume.origin.z, volume.dims.z);
+            if (z + 1 < volume.dims.z)
+              total += crossings(x, y, z, points);
+          }
+
+          if (total)
+            atomicAdd(&surfel_count, total);
+        }
+
+        __vm_device__ void fill(const int* counts, PtrSz<Surfel> output) const
+        {
+          int x = threadIdx.x + blockIdx.x * blockDim.x;
+          int y = threadIdx.y + blockIdx.y * blockDim.y;
+
+          if (x >= volume.dims.x || y >= volume.dims.y)
+            return;
+
+          int total = counts[y * volume.dims.x + x];
+          if (!total)
+            return;
+
+          int pos = atomicAdd(&surfel_count, total);
+          int end = min(pos + total, (int)output.size);
+
+          float3 points[3];
+          for(int z = 0; z < volume.dims.z && pos < end; ++z)
+          {
+            int n = crossings(x, y, z, points);
+            for(int i = 0; i < n && pos < end; ++i)
+              output.data[pos++] = surfel(points[i]);
+          }
+        }
+      };
+
+      template<class Voxel>
+      __global__ void count_surfels_kernel(const ExtractSurfels<Voxel> es, int* counts) { es.count(counts); }
+
+      template<class Voxel>
+      __global__ void count_cloud_kernel(const ExtractSurfels<Voxel> es, int3 beg, int3 end) { es.count(beg, end); }
+
+      template<class Voxel>
+      __global__ void count_brick_cloud_kernel(const ExtractSurfels<Voxel> es, const PtrSz<int> bricks, int3 brick_dims) { es.count(bricks, brick_dims); }
+
+      template<class Voxel>
+      __global__ void extract_surfels_kernel(const ExtractSurfels<Voxel> es, const int* counts, PtrSz<Surfel> output) { es.fill(counts, output); }
+
+      template<class Voxel>
+      size_t count_surfels(const TsdfVolumeT<Voxel>& volume, int* counts)
+      {
+        typedef ExtractSurfels<Voxel> ES;
+        ES es(volume);
+
+        int zero = 0;
+        cudaSafeCall ( cudaMemcpyToSymbol (surfel_count, &zero, sizeof(zero)) );
+
+        dim3 block (ES::CTA_SIZE_X, ES::CTA_SIZE_Y);
+        dim3 grid (divUp (volume.dims.x, block.x), divUp (volume.dims.y, block.y));
+
+        count_surfels_kernel<<<grid, block>>>(es, counts);
+        cudaSafeCall ( cudaGetLastError () );
+        cudaSafeCall (cudaDeviceSynchronize ());
+
+        int count;
+        cudaSafeCall ( cudaMemcpyFromSymbol (&count, surfel_count, sizeof(count)) );
+        return (size_t)count;
+      }
+
+      template<class Voxel>
+      size_t count_cloud(const TsdfVolumeT<Voxel>& volume, int3 beg, int3 end)
+      {
+        typedef ExtractSurfels<Voxel> ES;
+        ES es(volume);
+
+        int zero = 0;
+        cudaSafeCall ( cudaMemcpyToSymbol (surfel_count, &zero, sizeof(zero)) );
+
+        dim3 block (ES::CTA_SIZE_X, ES::CTA_SIZE_Y);
+        dim3 grid (divUp (end.x - beg.x, block.x), divUp (end.y - beg.y, block.y));
+
+        count_cloud_kernel<<<grid, block>>>(es, beg, end);
+        cudaSafeCall ( cudaGetLastError () );
+        cudaSafeCall (cudaDeviceSynchronize ());
+
+        int count;
+        cudaSafeCall ( cudaMemcpyFromSymbol (&count, surfel_count, sizeof(count)) );
+        return (size_t)count;
+      }
+
+      template<class Voxel>
+      size_t count_cloud(const TsdfVolumeT<Voxel>& volume, const PtrSz<int>& bricks)
+      {
+        typedef ExtractSurfels<Voxel> ES;
+        ES es(volume);
+
+        if (!bricks.size)
+          return 0;
+
+        int zero = 0;
+        cudaSafeCall ( cudaMemcpyToSymbol (surfel_count, &zero, sizeof(zero)) );
+
+        const int size = 1 << TsdfBricks::LOG_SIZE0;
+        dim3 block (size, size);
+        dim3 grid ((unsigned int)bricks.size);
+
+        count_brick_cloud_kernel<<<grid, block>>>(es, bricks, TsdfBricks(0, volume.dims).dims[0]);
+        cudaSafeCall ( cudaGetLastError () );
+        cudaSafeCall (cudaDeviceSynchronize ());
+
+        int count;
+        cudaSafeCall ( cudaMemcpyFromSymbol (&count, surfel_count, sizeof(count)) );
+        return (size_t)count;
+      }
+
+      template<class Voxel>
+      void extract_surfels(const TsdfVolumeT<Voxel>& volume, const Aff3f& aff, float gradient_delta_factor, bool tangent_colors,
+                           const int* counts, PtrSz<Surfel> output)
+      {
+        typedef ExtractSurfels<Voxel> ES;
+        ES es(volume);
+        es.aff = aff;
+        es.gradient_delta = volume.voxel_size * gradient_delta_factor;
+        es.tangent_colors = tangent_colors;
+
+        int zero = 0;
+        cudaSafeCall ( cudaMemcpyToSymbol (surfel_count, &zero, sizeof(zero)) );
+
+        dim3 block (ES::CTA_SIZE_X, ES::CTA_SIZE_Y);
+        dim3 grid (divUp (volume.dims.x, block.x), divUp (volume.dims.y, block.y));
+
+        extract_surfels_kernel<<<grid, block>>>(es, counts, output);
+        cudaSafeCall ( cudaGetLastError () );
+        cudaSafeCall (cudaDeviceSynchronize ());
+      }
+
 		};
 	}
 }
 
 size_t vm::scanner::device::extractCloud (const TsdfVolume& volume, const Aff3f& aff, PtrSz<Point> output)
 {
-    typedef FullScan6 FS;
-    FS fs(volume);
-    fs.aff = aff;
-
-    dim3 block (FS::CTA_SIZE_X, FS::CTA_SIZE_Y);
-    dim3 grid (divUp (volume.dims.x, block.x), divUp (volume.dims.y, block.y));
+  return extractCloud(volume, aff, make_int3(0, 0, 0), volume.dims, output);
+}
 
-    extract_kernel<<<grid, block>>>(fs, output);
-    cudaSafeCall ( cudaGetLastError () );
-    cudaSafeCall (cudaDeviceSynchronize ());
+size_t vm::scanner::device::extractCloud (const TsdfVolume& volume, const Aff3f& aff, int3 beg, int3 end, PtrSz<Point> output)
+{
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      return extract_cloud(volume.typed<voxel6>(), aff, beg, end, output);
+  case VOXEL_GEOMETRY: return extract_cloud(volume.typed<voxel4>(), aff, beg, end, output);
+  default:             return extract_cloud(volume.typed<ushort4>(), aff, beg, end, output);
+  }
+}
 
-    int size;
-    cudaSafeCall ( cudaMemcpyFromSymbol (&size, output_count, sizeof(size)) );
-    return (size_t)size;
+size_t vm::scanner::device::countCloud (const TsdfVolume& volume, int3 beg, int3 end)
+{
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      return count_cloud(volume.typed<voxel6>(), beg, end);
+  case VOXEL_GEOMETRY: return count_cloud(volume.typed<voxel4>(), beg, end);
+  default:             return count_cloud(volume.typed<ushort4>(), beg, end);
+  }
 }
 
-void vm::scanner::device::extractNormals (const TsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, float4* output)
+size_t vm::scanner::device::countCloud (const TsdfVolume& volume, const PtrSz<int>& bricks)
 {
-    ExtractNormals en(volume);
-    en.points = points;
-    en.gradient_delta = volume.voxel_size * gradient_delta_factor;
-    en.aff = aff;
-    en.Rinv = Rinv;
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      return count_cloud(volume.typed<voxel6>(), bricks);
+  case VOXEL_GEOMETRY: return count_cloud(volume.typed<voxel4>(), bricks);
+  default:             return count_cloud(volume.typed<ushort4>(), bricks);
+  }
+}
 
-    dim3 block (256);
-    dim3 grid (divUp ((int)points.size, block.x));
+size_t vm::scanner::device::extractCloud (const TsdfVolume& volume, const Aff3f& aff, const PtrSz<int>& bricks, PtrSz<Point> output)
+{
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      return extract_cloud(volume.typed<voxel6>(), aff, bricks, output);
+  case VOXEL_GEOMETRY: return extract_cloud(volume.typed<voxel4>(), aff, bricks, output);
+  default:             return extract_cloud(volume.typed<ushort4>(), aff, bricks, output);
+  }
+}
 
-    extract_normals_kernel<<<grid, block>>>(en, output);
-    cudaSafeCall ( cudaGetLastError () );
-    cudaSafeCall (cudaDeviceSynchronize ());
+void vm::scanner::device::extractNormals (const TsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, float4* output)
+{
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      extract_normals(volume.typed<voxel6>(), points, aff, Rinv, gradient_delta_factor, output); break;
+  case VOXEL_GEOMETRY: extract_normals(volume.typed<voxel4>(), points, aff, Rinv, gradient_delta_factor, output); break;
+  default:             extract_normals(volume.typed<ushort4>(), points, aff, Rinv, gradient_delta_factor, output); break;
+  }
 }
 
 void vm::scanner::device::extractTangentColors (const TsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, uchar4* output)
 {
-  ExtractTangentColors ec(volume);
-  ec.points = points;
-  ec.gradient_delta = volume.voxel_size * gradient_delta_factor;
-  ec.aff = aff;
-  ec.Rinv = Rinv;
-
-  dim3 block(256);
-  dim3 grid(divUp ((int)points.size, block.x));
-
-  extract_tangent_colors_kernel<<<grid, block>>>(ec, output);
-
-  cudaSafeCall(cudaGetLastError());
-  cudaSafeCall(cudaDeviceSynchronize());
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      extract_tangent_colors(volume.typed<voxel6>(), points, aff, Rinv, gradient_delta_factor, output); break;
+  case VOXEL_GEOMETRY: extract_tangent_colors(volume.typed<voxel4>(), points, aff, Rinv, gradient_delta_factor, output); break;
+  default:             extract_tangent_colors(volume.typed<ushort4>(), points, aff, Rinv, gradient_delta_factor, output); break;
+  }
 }
 
 void vm::scanner::device::extractVertexColors(const TsdfVolume& volume, const PtrSz<Point>& points, const Aff3f& aff, const Mat3f& Rinv, float gradient_delta_factor, uchar4* output)
 {
-  ExtractVertexColors evc(volume);
-  evc.points = points;
-  evc.gradient_delta = volume.voxel_size * gradient_delta_factor;
-  evc.aff = aff;
-  evc.Rinv = Rinv;
-
-  dim3 block(256);
-  dim3 grid(divUp ((int)points.size, block.x));
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      extract_vertex_colors(volume.typed<voxel6>(), points, aff, Rinv, gradient_delta_factor, output); break;
+  case VOXEL_GEOMETRY: extract_vertex_colors(volume.typed<voxel4>(), points, aff, Rinv, gradient_delta_factor, output); break;
+  default:             extract_vertex_colors(volume.typed<ushort4>(), points, aff, Rinv, gradient_delta_factor, output); break;
+  }
+}
 
-  extract_vertex_colors_kernel<<<grid, block>>>(evc, output);
+size_t vm::scanner::device::countSurfels(const TsdfVolume& volume, int* counts)
+{
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      return count_surfels(volume.typed<voxel6>(), counts);
+  case VOXEL_GEOMETRY: return count_surfels(volume.typed<voxel4>(), counts);
+  default:             return count_surfels(volume.typed<ushort4>(), counts);
+  }
+}
 
-  cudaSafeCall(cudaGetLastError());
-  cudaSafeCall(cudaDeviceSynchronize());
+void vm::scanner::device::extractSurfels(const TsdfVolume& volume, const Aff3f& aff, float gradient_delta_factor, bool tangent_colors,
+                                         const int* counts, PtrSz<Surfel> output)
+{
+  switch(volume.layout)
+  {
+  case VOXEL_RGB:      extract_surfels(volume.typed<voxel6>(), aff, gradient_delta_factor, tangent_colors, counts, output); break;
+  case VOXEL_GEOMETRY: extract_surfels(volume.typed<voxel4>(), aff, gradient_delta_factor, tangent_colors, counts, output); break;
+  default:             extract_surfels(volume.typed<ushort4>(), aff, gradient_delta_factor, tangent_colors, counts, output); break;
+  }
 }
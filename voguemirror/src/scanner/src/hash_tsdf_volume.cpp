@@ -0,0 +1,242 @@
+#include <scanner/precomp.hpp>
+
+using namespace vm::scanner;
+using namespace vm::scanner::cuda;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// HashTsdfVolume
+
+namespace
+{
+  inline vm::scanner::device::HashTsdfVolume make_hash_volume(const CudaData& blocks_data, const CudaData& keys, const CudaData& values,
+                                                          const CudaData& block_coords, const CudaData& blocks_count, int hash_size, int max_blocks,
+                                                          const TsdfVolume& tsdf)
+  {
+    device::Vec3i dims = device_cast<device::Vec3i>(tsdf.getDims());
+    device::Vec3f vsz  = device_cast<device::Vec3f>(tsdf.getVoxelSize());
+
+    return device::HashTsdfVolume((ushort4*)blocks_data.ptr<ushort4>(), (unsigned long long*)keys.ptr<unsigned long long>(),
+                                  (int*)values.ptr<int>(), (int3*)block_coords.ptr<int3>(), (int*)blocks_count.ptr<int>(),
+                                  hash_size, max_blocks, dims, vsz, tsdf.getTruncDist(), tsdf.getMaxWeight());
+  }
+}
+
+vm::scanner::cuda::HashTsdfVolume::HashTsdfVolume(const Vec3i& dims, int max_blocks) : TsdfVolume(dims, false), max_blocks_(max_blocks)
+{
+  CV_Assert(max_blocks > 0);
+  CV_Assert(dims[0] % BLOCK_SIZE == 0 && dims[1] % BLOCK_SIZE == 0 && dims[2] % BLOCK_SIZE == 0);
+
+  // keep the load factor under 1/4 so probe sequences stay short
+  hash_size_ = 1;
+  while (hash_size_ < max_blocks * 4)
+    hash_size_ <<= 1;
+
+  blocks_data_.create((size_t)(max_blocks_ + 1) * device::HashTsdfVolume::BLOCK_VOXELS * sizeof(ushort4));
+  keys_.create(hash_size_ * sizeof(unsigned long long));
+  values_.create(hash_size_ * sizeof(int));
+  block_coords_.create((max_blocks_ + 1) * sizeof(int3));
+  blocks_count_.create(sizeof(int));
+
+  // device memory comes uninitialized, so the first clear has to go over the whole pool
+  used_blocks_ = max_blocks_;
+  dropped_blocks_ = 0;
+  clear();
+}
+
+vm::scanner::cuda::HashTsdfVolume::~HashTsdfVolume() {}
+
+int vm::scanner::cuda::HashTsdfVolume::getMaxBlocks() const { return max_blocks_; }
+int vm::scanner::cuda::HashTsdfVolume::getUsedBlocks() const { return used_blocks_; }
+int vm::scanner::cuda::HashTsdfVolume::getDroppedBlocks() const { return dropped_blocks_; }
+
+void vm::scanner::cuda::HashTsdfVolume::clear()
+{
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+  device::clear_volume(volume, used_blocks_);
+  used_blocks_ = 0;
+  dropped_blocks_ = 0;
+}
+
+vm::scanner::cuda::DeviceArray<vm::scanner::Point> vm::scanner::cuda::HashTsdfVolume::shift(const Vec3i&, DeviceArray<Point>&)
+{
+  CV_Error(CV_StsNotImplemented, "Shifting isn't supported by the sparse volume");
+  return DeviceArray<Point>();
+}
+
+vm::scanner::cuda::DeviceArray<vm::scanner::Point> vm::scanner::cuda::HashTsdfVolume::fetchChangedCloud(DeviceArray<Point>&, DeviceArray<int>&)
+{
+  CV_Error(CV_StsNotImplemented, "Incremental extraction isn't supported by the sparse volume");
+  return DeviceArray<Point>();
+}
+
+vm::scanner::cuda::DeviceArray<vm::scanner::Surfel> vm::scanner::cuda::HashTsdfVolume::fetchSurfels(DeviceArray<Surfel>& surfel_buffer, bool tangent_colors) const
+{
+  TraceScope trace("fetch surfels");
+
+  device::Aff3f aff = device_cast<device::Aff3f>(getPose());
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+
+  // indexed by the pool slot, slot 0 is the empty block
+  DeviceArray<int> counts(used_blocks_ + 1);
+  size_t size = device::countSurfels(volume, used_blocks_, counts.ptr());
+
+  if (surfel_buffer.size() < size)
+    surfel_buffer.create(size);
+
+  DeviceArray<device::Surfel> s((device::Surfel*)surfel_buffer.ptr(), size);
+  if (size)
+    device::extractSurfels(volume, used_blocks_, aff, getGradientDeltaFactor(), tangent_colors, counts.ptr(), s);
+
+  return DeviceArray<Surfel>(surfel_buffer.ptr(), size);
+}
+
+void vm::scanner::cuda::HashTsdfVolume::integrate(const Dists& dists, const Image& colors, const Affine3f& camera_pose, const Intr& intr)
+{
+  Affine3f cam2vol = getPose().inv() * camera_pose;
+  Affine3f vol2cam = cam2vol.inv();
+
+  device::Projector proj(intr.fx, intr.fy, intr.cx, intr.cy);
+  device::Reprojector reproj(intr.fx, intr.fy, intr.cx, intr.cy);
+
+  device::Aff3f c2v = device_cast<device::Aff3f>(cam2vol);
+  device::Aff3f v2c = device_cast<device::Aff3f>(vol2cam);
+  device::Image& img = (device::Image&)colors;
+
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+  int requested = device::allocate_blocks(dists, volume, c2v, reproj);
+  used_blocks_ = std::min(requested, max_blocks_);
+  dropped_blocks_ = std::max(0, requested - max_blocks_);
+  device::integrate(dists, img, volume, used_blocks_, v2c, proj);
+}
+
+void vm::scanner::cuda::HashTsdfVolume::raycast(const Affine3f& camera_pose, const Intr& intr, Depth& depth, Normals& normals, const Rays& rays)
+{
+  DeviceArray2D<device::Normal>& n = (DeviceArray2D<device::Normal>&)normals;
+
+  Affine3f cam2vol = getPose().inv() * camera_pose;
+
+  device::Aff3f aff = device_cast<device::Aff3f>(cam2vol);
+  device::Mat3f Rinv = device_cast<device::Mat3f>(cam2vol.rotation().inv(cv::DECOMP_SVD));
+
+  device::Reprojector reproj = make_reprojector(intr, rays, depth.rows(), depth.cols());
+
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+  device::raycast(volume, aff, Rinv, reproj, depth, n, getRaycastStepFactor(), getGradientDeltaFactor());
+}
+
+void vm::scanner::cuda::HashTsdfVolume::raycast(const Affine3f& camera_pose, const Intr& intr, Cloud& points, Normals& normals, const Rays& rays)
+{
+  device::Normals& n = (device::Normals&)normals;
+  device::Points& p = (device::Points&)points;
+
+  Affine3f cam2vol = getPose().inv() * camera_pose;
+
+  device::Aff3f aff = device_cast<device::Aff3f>(cam2vol);
+  device::Mat3f Rinv = device_cast<device::Mat3f>(cam2vol.rotation().inv(cv::DECOMP_SVD));
+
+  device::Reprojector reproj = make_reprojector(intr, rays, points.rows(), points.cols());
+
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+  device::raycast(volume, aff, Rinv, reproj, p, n, getRaycastStepFactor(), getGradientDeltaFactor());
+}
+
+DeviceArray<Point> vm::scanner::cuda::HashTsdfVolume::fetchCloud(DeviceArray<Point>& cloud_buffer) const
+{
+  enum { DEFAULT_CLOUD_BUFFER_SIZE = 10 * 1000 * 1000 };
+
+  if (cloud_buffer.empty ())
+      cloud_buffer.create (DEFAULT_CLOUD_BUFFER_SIZE);
+
+  DeviceArray<device::Point>& b = (DeviceArray<device::Point>&)cloud_buffer;
+  device::Aff3f aff  = device_cast<device::Aff3f>(getPose());
+
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+  size_t size = device::extractCloud(volume, used_blocks_, aff, b);
+
+  return DeviceArray<Point>((Point*)cloud_buffer.ptr(), size);
+}
+
+void vm::scanner::cuda::HashTsdfVolume::fetchNormals(const DeviceArray<Point>& cloud, DeviceArray<Normal>& normals) const
+{
+  normals.create(cloud.size());
+  DeviceArray<device::Point>& c = (DeviceArray<device::Point>&)cloud;
+
+  Affine3f pose = getPose();
+  device::Aff3f aff  = device_cast<device::Aff3f>(pose);
+  device::Mat3f Rinv = device_cast<device::Mat3f>(pose.rotation().inv(cv::DECOMP_SVD));
+
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+  device::extractNormals(volume, c, aff, Rinv, getGradientDeltaFactor(), (float4*)normals.ptr());
+}
+
+void vm::scanner::cuda::HashTsdfVolume::fetchTangentColors(const DeviceArray<Point>& cloud, DeviceArray<RGB>& colors) const
+{
+  colors.create(cloud.size());
+  DeviceArray<device::Point>& c = (DeviceArray<device::Point>&)cloud;
+
+  Affine3f pose = getPose();
+  device::Aff3f aff  = device_cast<device::Aff3f>(pose);
+  device::Mat3f Rinv = device_cast<device::Mat3f>(pose.rotation().inv(cv::DECOMP_SVD));
+
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+  device::extractTangentColors(volume, c, aff, Rinv, getGradientDeltaFactor(), (uchar4*)colors.ptr());
+}
+
+void vm::scanner::cuda::HashTsdfVolume::fetchVertexColors(const DeviceArray<Point>& cloud, DeviceArray<RGB>& colors) const
+{
+  colors.create(cloud.size());
+  DeviceArray<device::Point>& c = (DeviceArray<device::Point>&)cloud;
+
+  Affine3f pose = getPose();
+  device::Aff3f aff  = device_cast<device::Aff3f>(pose);
+  device::Mat3f Rinv = device_cast<device::Mat3f>(pose.rotation().inv(cv::DECOMP_SVD));
+
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+  device::extractVertexColors(volume, c, aff, Rinv, (uchar4*)colors.ptr());
+}
+
+Mesh vm::scanner::cuda::HashTsdfVolume::fetchMesh(Mesh& mesh_buffer) const
+{
+  TraceScope trace("fetch mesh");
+
+  enum { DEFAULT_VERTEX_BUFFER_SIZE = 3 * 1000 * 1000, DEFAULT_INDEX_BUFFER_SIZE = 3 * 6 * 1000 * 1000 };
+
+  if (mesh_buffer.vertices.empty ())
+    mesh_buffer.vertices.create (DEFAULT_VERTEX_BUFFER_SIZE);
+
+  if (mesh_buffer.indices.empty ())
+    mesh_buffer.indices.create (DEFAULT_INDEX_BUFFER_SIZE);
+
+  mesh_buffer.normals.create(mesh_buffer.vertices.size());
+  mesh_buffer.colors.create(mesh_buffer.vertices.size());
+
+  DeviceArray<device::Point>& v = (DeviceArray<device::Point>&)mesh_buffer.vertices;
+  device::Aff3f aff  = device_cast<device::Aff3f>(getPose());
+
+  // lookups outside the allocated blocks land in the empty block, so the dense sweep sees no surface there
+  device::HashTsdfVolume volume = make_hash_volume(blocks_data_, keys_, values_, block_coords_, blocks_count_, hash_size_, max_blocks_, *this);
+
+  size_t indices_count;
+  size_t size = device::extractMesh(volume, aff, getGradientDeltaFactor(), v, (float4*)mesh_buffer.normals.ptr(), (uchar4*)mesh_buffer.colors.ptr(),
+                                    mesh_buffer.indices, indices_count);
+
+  // the buffers only held part of the surface, grow them to the counts it needs and extract it again
+  if (size > mesh_buffer.vertices.size() || indices_count > mesh_buffer.indices.size())
+  {
+    mesh_buffer.vertices.create(std::max(size, mesh_buffer.vertices.size()));
+    mesh_buffer.indices.create(std::max(indices_count, mesh_buffer.indices.size()));
+    mesh_buffer.normals.create(mesh_buffer.vertices.size());
+    mesh_buffer.colors.create(mesh_buffer.vertices.size());
+
+    size = device::extractMesh(volume, aff, getGradientDeltaFactor(), v, (float4*)mesh_buffer.normals.ptr(), (uchar4*)mesh_buffer.colors.ptr(),
+                             mesh_buffer.indices, indices_count);
+    CV_Assert(size <= mesh_buffer.vertices.size() && indices_count <= mesh_buffer.indices.size());
+  }
+
+  Mesh mesh;
+  mesh.vertices = DeviceArray<Point>(mesh_buffer.vertices.ptr(), size);
+  mesh.normals = DeviceArray<Normal>(mesh_buffer.normals.ptr(), size);
+  mesh.colors = DeviceArray<RGB>(mesh_buffer.colors.ptr(), size);
+  mesh.indices = DeviceArray<int>(mesh_buffer.indices.ptr(), indices_count);
+  return mesh;
+}
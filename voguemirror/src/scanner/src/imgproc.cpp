@@ -18,22 +18,30 @@ void vm::scanner::cuda::depthBuildPyramid(const Depth& depth, Depth& pyramid, fl
 void vm::scanner::cuda::waitAllDefaultStream()
 { cudaSafeCall(cudaDeviceSynchronize() ); }
 
-void vm::scanner::cuda::computeNormalsAndMaskDepth(const Intr& intr, Depth& depth, Normals& normals)
+void vm::scanner::cuda::computeRays(const Intr& intr, int rows, int cols, Rays& rays)
 {
-  normals.create(depth.rows(), depth.cols());
+  rays.create(rows, cols);
 
   device::Reprojector reproj(intr.fx, intr.fy, intr.cx, intr.cy);
+  device::computeRays(reproj, rays);
+}
+
+void vm::scanner::cuda::computeNormalsAndMaskDepth(const Intr& intr, Depth& depth, Normals& normals, const Rays& rays)
+{
+  normals.create(depth.rows(), depth.cols());
+
+  device::Reprojector reproj = make_reprojector(intr, rays, depth.rows(), depth.cols());
 
   device::Normals& n = (device::Normals&)normals;
   device::computeNormalsAndMaskDepth(reproj, depth, n);
 }
 
-void vm::scanner::cuda::computePointNormals(const Intr& intr, const Depth& depth, Cloud& points, Normals& normals)
+void vm::scanner::cuda::computePointNormals(const Intr& intr, const Depth& depth, Cloud& points, Normals& normals, const Rays& rays)
 {
   points.create(depth.rows(), depth.cols());
   normals.create(depth.rows(), depth.cols());
 
-  device::Reprojector reproj(intr.fx, intr.fy, intr.cx, intr.cy);
+  device::Reprojector reproj = make_reprojector(intr, rays, depth.rows(), depth.cols());
 
   device::Points& p = (device::Points&)points;
   device::Normals& n = (device::Normals&)normals;
@@ -41,10 +49,55 @@ void vm::scanner::cuda::computePointNormals(const Intr& intr, const Depth& depth
 }
 
 
-void vm::scanner::cuda::computeDists(const Depth& depth, Dists& dists, const Intr& intr)
+void vm::scanner::cuda::computeDists(const Depth& depth, Dists& dists, const Intr& intr, const Rays& rays, CUstream_st* stream)
+{
+  dists.create(depth.rows(), depth.cols());
+  device::compute_dists(make_reprojector(intr, rays, depth.rows(), depth.cols()), depth, dists, stream);
+}
+
+void vm::scanner::cuda::depthFrontEnd(const Intr& intr, const Depth& depth, Dists& dists, Depth& filtered, Cloud& points, Normals& normals,
+                                      int kernel_size, float sigma_spatial, float sigma_depth, float truncate_dist, const Rays& rays)
 {
   dists.create(depth.rows(), depth.cols());
-  device::compute_dists(depth, dists, make_float2(intr.fx, intr.fy), make_float2(intr.cx, intr.cy));
+  filtered.create(depth.rows(), depth.cols());
+  points.create(depth.rows(), depth.cols());
+  normals.create(depth.rows(), depth.cols());
+
+  device::Reprojector reproj = make_reprojector(intr, rays, depth.rows(), depth.cols());
+
+  device::Points& p = (device::Points&)points;
+  device::Normals& n = (device::Normals&)normals;
+  device::depthFrontEnd(reproj, depth, dists, filtered, p, n, kernel_size, sigma_spatial, sigma_depth, truncate_dist);
+}
+
+void vm::scanner::cuda::foregroundDownsample(const Depth& depth, Depth& small, const ForegroundParams& params, CUstream_st* stream)
+{
+  small.create(depth.rows() >> params.level, depth.cols() >> params.level);
+  device::foregroundDownsample(depth, small, params.level, (unsigned short)(params.min_depth * 1000), (unsigned short)std::min(params.max_depth * 1000, 65535.f), stream);
+}
+
+void vm::scanner::cuda::segmentForeground(const Intr& intr, const Depth& small, const ForegroundParams& params, DeviceArray2D<unsigned char>& mask,
+                                          DeviceArray<float>& floor, DeviceArray<int>& buffer, CUstream_st* stream)
+{
+  CV_Assert(small.rows() <= 1024);
+
+  mask.create(small.rows(), small.cols());
+  floor.create(4);
+  buffer.create(device::segmentForegroundBufferSize(small.rows(), small.cols()));
+
+  device::segmentForeground(small, make_float4(intr.fx, intr.fy, intr.cx, intr.cy), params.floor_dist, params.floor_max_tilt,
+                            (int)(params.depth_jump * 1000), params.min_area, buffer.ptr(), mask, (float4*)floor.ptr(), stream);
+}
+
+void vm::scanner::cuda::applyForeground(const Intr& intr, const Depth& depth, const DeviceArray2D<unsigned char>& mask, const DeviceArray<float>& floor,
+                                        const ForegroundParams& params, Depth& masked, CUstream_st* stream)
+{
+  masked.create(depth.rows(), depth.cols());
+
+  device::Reprojector reproj(intr.fx, intr.fy, intr.cx, intr.cy);
+
+  device::applyForeground(reproj, depth, mask, params.level, (const float4*)floor.ptr(), params.floor_dist,
+                          (unsigned short)(params.min_depth * 1000), (unsigned short)std::min(params.max_depth * 1000, 65535.f), masked, stream);
 }
 
 void vm::scanner::cuda::resizeDepthNormals(const Depth& depth, const Normals& normals, Depth& depth_out, Normals& normals_out)
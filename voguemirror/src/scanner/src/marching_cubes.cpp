@@ -0,0 +1,277 @@
+#include <scanner/marching_cubes.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Marching cubes tables
+
+const signed char vm::scanner::mc::corners[8][3] =
+{
+  { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+  { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 }
+};
+
+const signed char vm::scanner::mc::edge_owner[12][4] =
+{
+  { 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+  { 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+  { 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 }
+};
+
+const signed char vm::scanner::mc::triangles[256][16] =
+{
+  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  0,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  1,  0,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  1,  3,  8,  9,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 10,  2,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  0,  3, 10,  2,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 10,  0,  9, 10,  2,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2,  3,  8, 10,  2,  8,  9, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  2, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2, 11,  8,  0,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  2, 11,  1,  0,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2, 11,  8,  1,  2,  8,  9,  1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3, 10, 11,  3,  1, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8, 10, 11,  8,  1, 10,  8,  0,  1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3, 10, 11,  3,  9, 10,  3,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+  {  8, 10, 11,  8,  9, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  4,  8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  0,  3,  7,  4,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  4,  8,  1,  0,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  1,  3,  7,  9,  1,  7,  4,  9, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  4,  8, 10,  2,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  0,  3,  7,  4,  0, 10,  2,  1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  4,  8, 10,  0,  9, 10,  2,  0, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  2,  3,  7, 10,  2,  7,  9, 10,  7,  4,  9, -1, -1, -1, -1 },
+  {  7,  4,  8,  3,  2, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  2, 11,  7,  0,  2,  7,  4,  0, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  4,  8,  3,  2, 11,  1,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  2, 11,  7,  1,  2,  7,  9,  1,  7,  4,  9, -1, -1, -1, -1 },
+  {  7,  4,  8,  3, 10, 11,  3,  1, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  7, 10, 11,  7,  1, 10,  7,  0,  1,  7,  4,  0, -1, -1, -1, -1 },
+  {  7,  4,  8,  3, 10, 11,  3,  9, 10,  3,  0,  9, -1, -1, -1, -1 },
+  {  7, 10, 11,  7,  9, 10,  7,  4,  9, -1, -1, -1, -1, -1, -1, -1 },
+  {  9,  4,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  0,  3,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  1,  4,  5,  1,  0,  4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  1,  3,  8,  5,  1,  8,  4,  5, -1, -1, -1, -1, -1, -1, -1 },
+  { 10,  2,  1,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  0,  3, 10,  2,  1,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1 },
+  { 10,  4,  5, 10,  0,  4, 10,  2,  0, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2,  3,  8, 10,  2,  8,  5, 10,  8,  4,  5, -1, -1, -1, -1 },
+  {  3,  2, 11,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2, 11,  8,  0,  2,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  2, 11,  1,  4,  5,  1,  0,  4, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2, 11,  8,  1,  2,  8,  5,  1,  8,  4,  5, -1, -1, -1, -1 },
+  {  3, 10, 11,  3,  1, 10,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1 },
+  {  8, 10, 11,  8,  1, 10,  8,  0,  1,  9,  4,  5, -1, -1, -1, -1 },
+  {  3, 10, 11,  3,  5, 10,  3,  4,  5,  3,  0,  4, -1, -1, -1, -1 },
+  {  8, 10, 11,  8,  5, 10,  8,  4,  5, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  9,  8,  7,  5,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  0,  3,  7,  9,  0,  7,  5,  9, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  0,  8,  7,  1,  0,  7,  5,  1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  1,  3,  7,  5,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  9,  8,  7,  5,  9, 10,  2,  1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  0,  3,  7,  9,  0,  7,  5,  9, 10,  2,  1, -1, -1, -1, -1 },
+  {  7,  0,  8,  7,  2,  0,  7, 10,  2,  7,  5, 10, -1, -1, -1, -1 },
+  {  7,  2,  3,  7, 10,  2,  7,  5, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  9,  8,  7,  5,  9,  3,  2, 11, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  2, 11,  7,  0,  2,  7,  9,  0,  7,  5,  9, -1, -1, -1, -1 },
+  {  7,  0,  8,  7,  1,  0,  7,  5,  1,  3,  2, 11, -1, -1, -1, -1 },
+  {  7,  2, 11,  7,  1,  2,  7,  5,  1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  9,  8,  7,  5,  9,  3, 10, 11,  3,  1, 10, -1, -1, -1, -1 },
+  {  7, 10, 11,  7,  1, 10,  7,  0,  1,  7,  9,  0,  7,  5,  9, -1 },
+  {  7,  0,  8,  7,  3,  0,  7, 11,  3,  7, 10, 11,  7,  5, 10, -1 },
+  {  7, 10, 11,  7,  5, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  5,  6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  0,  3,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  1,  0,  9,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  1,  3,  8,  9,  1,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  5,  2,  1,  5,  6,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  0,  3,  5,  2,  1,  5,  6,  2, -1, -1, -1, -1, -1, -1, -1 },
+  {  5,  0,  9,  5,  2,  0,  5,  6,  2, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2,  3,  8,  6,  2,  8,  5,  6,  8,  9,  5, -1, -1, -1, -1 },
+  {  3,  2, 11,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2, 11,  8,  0,  2,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  2, 11,  1,  0,  9,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2, 11,  8,  1,  2,  8,  9,  1,  5,  6, 10, -1, -1, -1, -1 },
+  {  3,  6, 11,  3,  5,  6,  3,  1,  5, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  6, 11,  8,  5,  6,  8,  1,  5,  8,  0,  1, -1, -1, -1, -1 },
+  {  3,  6, 11,  3,  5,  6,  3,  9,  5,  3,  0,  9, -1, -1, -1, -1 },
+  {  8,  6, 11,  8,  5,  6,  8,  9,  5, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  4,  8,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  0,  3,  7,  4,  0,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  4,  8,  1,  0,  9,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  1,  3,  7,  9,  1,  7,  4,  9,  5,  6, 10, -1, -1, -1, -1 },
+  {  7,  4,  8,  5,  2,  1,  5,  6,  2, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  0,  3,  7,  4,  0,  5,  2,  1,  5,  6,  2, -1, -1, -1, -1 },
+  {  7,  4,  8,  5,  0,  9,  5,  2,  0,  5,  6,  2, -1, -1, -1, -1 },
+  {  7,  2,  3,  7,  6,  2,  7,  5,  6,  7,  9,  5,  7,  4,  9, -1 },
+  {  7,  4,  8,  3,  2, 11,  5,  6, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  2, 11,  7,  0,  2,  7,  4,  0,  5,  6, 10, -1, -1, -1, -1 },
+  {  7,  4,  8,  3,  2, 11,  1,  0,  9,  5,  6, 10, -1, -1, -1, -1 },
+  {  7,  2, 11,  7,  1,  2,  7,  9,  1,  7,  4,  9,  5,  6, 10, -1 },
+  {  7,  4,  8,  3,  6, 11,  3,  5,  6,  3,  1,  5, -1, -1, -1, -1 },
+  {  7,  6, 11,  7,  5,  6,  7,  1,  5,  7,  0,  1,  7,  4,  0, -1 },
+  {  7,  4,  8,  3,  6, 11,  3,  5,  6,  3,  9,  5,  3,  0,  9, -1 },
+  {  7,  6, 11,  7,  5,  6,  7,  9,  5,  7,  4,  9, -1, -1, -1, -1 },
+  {  9,  6, 10,  9,  4,  6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  0,  3,  9,  6, 10,  9,  4,  6, -1, -1, -1, -1, -1, -1, -1 },
+  {  1,  6, 10,  1,  4,  6,  1,  0,  4, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  1,  3,  8, 10,  1,  8,  6, 10,  8,  4,  6, -1, -1, -1, -1 },
+  {  9,  2,  1,  9,  6,  2,  9,  4,  6, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  0,  3,  9,  2,  1,  9,  6,  2,  9,  4,  6, -1, -1, -1, -1 },
+  {  4,  2,  0,  4,  6,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2,  3,  8,  6,  2,  8,  4,  6, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  2, 11,  9,  6, 10,  9,  4,  6, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  2, 11,  8,  0,  2,  9,  6, 10,  9,  4,  6, -1, -1, -1, -1 },
+  {  3,  2, 11,  1,  6, 10,  1,  4,  6,  1,  0,  4, -1, -1, -1, -1 },
+  {  8,  2, 11,  8,  1,  2,  8, 10,  1,  8,  6, 10,  8,  4,  6, -1 },
+  {  3,  6, 11,  3,  4,  6,  3,  9,  4,  3,  1,  9, -1, -1, -1, -1 },
+  {  8,  6, 11,  8,  4,  6,  8,  9,  4,  8,  1,  9,  8,  0,  1, -1 },
+  {  3,  6, 11,  3,  4,  6,  3,  0,  4, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  6, 11,  8,  4,  6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  9,  8,  7, 10,  9,  7,  6, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  0,  3,  7,  9,  0,  7, 10,  9,  7,  6, 10, -1, -1, -1, -1 },
+  {  7,  0,  8,  7,  1,  0,  7, 10,  1,  7,  6, 10, -1, -1, -1, -1 },
+  {  7,  1,  3,  7, 10,  1,  7,  6, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  9,  8,  7,  1,  9,  7,  2,  1,  7,  6,  2, -1, -1, -1, -1 },
+  {  7,  0,  3,  7,  9,  0,  7,  1,  9,  7,  2,  1,  7,  6,  2, -1 },
+  {  7,  0,  8,  7,  2,  0,  7,  6,  2, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  2,  3,  7,  6,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  9,  8,  7, 10,  9,  7,  6, 10,  3,  2, 11, -1, -1, -1, -1 },
+  {  7,  2, 11,  7,  0,  2,  7,  9,  0,  7, 10,  9,  7,  6, 10, -1 },
+  {  7,  0,  8,  7,  1,  0,  7, 10,  1,  7,  6, 10,  3,  2, 11, -1 },
+  {  7,  2, 11,  7,  1,  2,  7, 10,  1,  7,  6, 10, -1, -1, -1, -1 },
+  {  7,  9,  8,  7,  1,  9,  7,  3,  1,  7, 11,  3,  7,  6, 11, -1 },
+  {  7,  6, 11,  9,  0,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  7,  0,  8,  7,  3,  0,  7, 11,  3,  7,  6, 11, -1, -1, -1, -1 },
+  {  7,  6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  8,  0,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  1,  0,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  8,  1,  3,  8,  9,  1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7, 10,  2,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  8,  0,  3, 10,  2,  1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7, 10,  0,  9, 10,  2,  0, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  8,  2,  3,  8, 10,  2,  8,  9, 10, -1, -1, -1, -1 },
+  {  3,  6,  7,  3,  2,  6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  6,  7,  8,  2,  6,  8,  0,  2, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  6,  7,  3,  2,  6,  1,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  6,  7,  8,  2,  6,  8,  1,  2,  8,  9,  1, -1, -1, -1, -1 },
+  {  3,  6,  7,  3, 10,  6,  3,  1, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  6,  7,  8, 10,  6,  8,  1, 10,  8,  0,  1, -1, -1, -1, -1 },
+  {  3,  6,  7,  3, 10,  6,  3,  9, 10,  3,  0,  9, -1, -1, -1, -1 },
+  {  8,  6,  7,  8, 10,  6,  8,  9, 10, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  4,  8, 11,  6,  4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  0,  3, 11,  4,  0, 11,  6,  4, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  4,  8, 11,  6,  4,  1,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  1,  3, 11,  9,  1, 11,  4,  9, 11,  6,  4, -1, -1, -1, -1 },
+  { 11,  4,  8, 11,  6,  4, 10,  2,  1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  0,  3, 11,  4,  0, 11,  6,  4, 10,  2,  1, -1, -1, -1, -1 },
+  { 11,  4,  8, 11,  6,  4, 10,  0,  9, 10,  2,  0, -1, -1, -1, -1 },
+  { 11,  2,  3, 11, 10,  2, 11,  9, 10, 11,  4,  9, 11,  6,  4, -1 },
+  {  3,  4,  8,  3,  6,  4,  3,  2,  6, -1, -1, -1, -1, -1, -1, -1 },
+  {  0,  6,  4,  0,  2,  6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  4,  8,  3,  6,  4,  3,  2,  6,  1,  0,  9, -1, -1, -1, -1 },
+  {  1,  4,  9,  1,  6,  4,  1,  2,  6, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  4,  8,  3,  6,  4,  3, 10,  6,  3,  1, 10, -1, -1, -1, -1 },
+  { 10,  0,  1, 10,  4,  0, 10,  6,  4, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  4,  8,  3,  6,  4,  3, 10,  6,  3,  9, 10,  3,  0,  9, -1 },
+  { 10,  4,  9, 10,  6,  4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  8,  0,  3,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  1,  4,  5,  1,  0,  4, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  8,  1,  3,  8,  5,  1,  8,  4,  5, -1, -1, -1, -1 },
+  { 11,  6,  7, 10,  2,  1,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  6,  7,  8,  0,  3, 10,  2,  1,  9,  4,  5, -1, -1, -1, -1 },
+  { 11,  6,  7, 10,  4,  5, 10,  0,  4, 10,  2,  0, -1, -1, -1, -1 },
+  { 11,  6,  7,  8,  2,  3,  8, 10,  2,  8,  5, 10,  8,  4,  5, -1 },
+  {  3,  6,  7,  3,  2,  6,  9,  4,  5, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  6,  7,  8,  2,  6,  8,  0,  2,  9,  4,  5, -1, -1, -1, -1 },
+  {  3,  6,  7,  3,  2,  6,  1,  4,  5,  1,  0,  4, -1, -1, -1, -1 },
+  {  8,  6,  7,  8,  2,  6,  8,  1,  2,  8,  5,  1,  8,  4,  5, -1 },
+  {  3,  6,  7,  3, 10,  6,  3,  1, 10,  9,  4,  5, -1, -1, -1, -1 },
+  {  8,  6,  7,  8, 10,  6,  8,  1, 10,  8,  0,  1,  9,  4,  5, -1 },
+  {  3,  6,  7,  3, 10,  6,  3,  5, 10,  3,  4,  5,  3,  0,  4, -1 },
+  {  8,  6,  7,  8, 10,  6,  8,  5, 10,  8,  4,  5, -1, -1, -1, -1 },
+  { 11,  9,  8, 11,  5,  9, 11,  6,  5, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  0,  3, 11,  9,  0, 11,  5,  9, 11,  6,  5, -1, -1, -1, -1 },
+  { 11,  0,  8, 11,  1,  0, 11,  5,  1, 11,  6,  5, -1, -1, -1, -1 },
+  { 11,  1,  3, 11,  5,  1, 11,  6,  5, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  9,  8, 11,  5,  9, 11,  6,  5, 10,  2,  1, -1, -1, -1, -1 },
+  { 11,  0,  3, 11,  9,  0, 11,  5,  9, 11,  6,  5, 10,  2,  1, -1 },
+  { 11,  0,  8, 11,  2,  0, 11, 10,  2, 11,  5, 10, 11,  6,  5, -1 },
+  { 11,  2,  3, 11, 10,  2, 11,  5, 10, 11,  6,  5, -1, -1, -1, -1 },
+  {  3,  9,  8,  3,  5,  9,  3,  6,  5,  3,  2,  6, -1, -1, -1, -1 },
+  {  9,  6,  5,  9,  2,  6,  9,  0,  2, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  0,  8,  3,  1,  0,  3,  5,  1,  3,  6,  5,  3,  2,  6, -1 },
+  {  1,  6,  5,  1,  2,  6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  9,  8,  3,  5,  9,  3,  6,  5,  3, 10,  6,  3,  1, 10, -1 },
+  { 10,  0,  1, 10,  9,  0, 10,  5,  9, 10,  6,  5, -1, -1, -1, -1 },
+  {  3,  0,  8, 10,  6,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 10,  6,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  5,  7, 11, 10,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  5,  7, 11, 10,  5,  8,  0,  3, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  5,  7, 11, 10,  5,  1,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  5,  7, 11, 10,  5,  8,  1,  3,  8,  9,  1, -1, -1, -1, -1 },
+  { 11,  5,  7, 11,  1,  5, 11,  2,  1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  5,  7, 11,  1,  5, 11,  2,  1,  8,  0,  3, -1, -1, -1, -1 },
+  { 11,  5,  7, 11,  9,  5, 11,  0,  9, 11,  2,  0, -1, -1, -1, -1 },
+  { 11,  5,  7, 11,  9,  5, 11,  8,  9, 11,  3,  8, 11,  2,  3, -1 },
+  {  3,  5,  7,  3, 10,  5,  3,  2, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  5,  7,  8, 10,  5,  8,  2, 10,  8,  0,  2, -1, -1, -1, -1 },
+  {  3,  5,  7,  3, 10,  5,  3,  2, 10,  1,  0,  9, -1, -1, -1, -1 },
+  {  8,  5,  7,  8, 10,  5,  8,  2, 10,  8,  1,  2,  8,  9,  1, -1 },
+  {  3,  5,  7,  3,  1,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  5,  7,  8,  1,  5,  8,  0,  1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  5,  7,  3,  9,  5,  3,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  5,  7,  8,  9,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  4,  8, 11,  5,  4, 11, 10,  5, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  0,  3, 11,  4,  0, 11,  5,  4, 11, 10,  5, -1, -1, -1, -1 },
+  { 11,  4,  8, 11,  5,  4, 11, 10,  5,  1,  0,  9, -1, -1, -1, -1 },
+  { 11,  1,  3, 11,  9,  1, 11,  4,  9, 11,  5,  4, 11, 10,  5, -1 },
+  { 11,  4,  8, 11,  5,  4, 11,  1,  5, 11,  2,  1, -1, -1, -1, -1 },
+  { 11,  0,  3, 11,  4,  0, 11,  5,  4, 11,  1,  5, 11,  2,  1, -1 },
+  { 11,  4,  8, 11,  5,  4, 11,  9,  5, 11,  0,  9, 11,  2,  0, -1 },
+  { 11,  2,  3,  5,  4,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  4,  8,  3,  5,  4,  3, 10,  5,  3,  2, 10, -1, -1, -1, -1 },
+  {  5,  2, 10,  5,  0,  2,  5,  4,  0, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  4,  8,  3,  5,  4,  3, 10,  5,  3,  2, 10,  1,  0,  9, -1 },
+  {  1,  4,  9,  1,  5,  4,  1, 10,  5,  1,  2, 10, -1, -1, -1, -1 },
+  {  3,  4,  8,  3,  5,  4,  3,  1,  5, -1, -1, -1, -1, -1, -1, -1 },
+  {  5,  0,  1,  5,  4,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  4,  8,  3,  5,  4,  3,  9,  5,  3,  0,  9, -1, -1, -1, -1 },
+  {  5,  4,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  4,  7, 11,  9,  4, 11, 10,  9, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  4,  7, 11,  9,  4, 11, 10,  9,  8,  0,  3, -1, -1, -1, -1 },
+  { 11,  4,  7, 11,  0,  4, 11,  1,  0, 11, 10,  1, -1, -1, -1, -1 },
+  { 11,  4,  7, 11,  8,  4, 11,  3,  8, 11,  1,  3, 11, 10,  1, -1 },
+  { 11,  4,  7, 11,  9,  4, 11,  1,  9, 11,  2,  1, -1, -1, -1, -1 },
+  { 11,  4,  7, 11,  9,  4, 11,  1,  9, 11,  2,  1,  8,  0,  3, -1 },
+  { 11,  4,  7, 11,  0,  4, 11,  2,  0, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  4,  7, 11,  8,  4, 11,  3,  8, 11,  2,  3, -1, -1, -1, -1 },
+  {  3,  4,  7,  3,  9,  4,  3, 10,  9,  3,  2, 10, -1, -1, -1, -1 },
+  {  8,  4,  7,  8,  9,  4,  8, 10,  9,  8,  2, 10,  8,  0,  2, -1 },
+  {  3,  4,  7,  3,  0,  4,  3,  1,  0,  3, 10,  1,  3,  2, 10, -1 },
+  {  8,  4,  7,  1,  2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  4,  7,  3,  9,  4,  3,  1,  9, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  4,  7,  8,  9,  4,  8,  1,  9,  8,  0,  1, -1, -1, -1, -1 },
+  {  3,  4,  7,  3,  0,  4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  8,  4,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  9,  8, 11, 10,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  0,  3, 11,  9,  0, 11, 10,  9, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  0,  8, 11,  1,  0, 11, 10,  1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  1,  3, 11, 10,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  9,  8, 11,  1,  9, 11,  2,  1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  0,  3, 11,  9,  0, 11,  1,  9, 11,  2,  1, -1, -1, -1, -1 },
+  { 11,  0,  8, 11,  2,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { 11,  2,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  9,  8,  3, 10,  9,  3,  2, 10, -1, -1, -1, -1, -1, -1, -1 },
+  {  9,  2, 10,  9,  0,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  0,  8,  3,  1,  0,  3, 10,  1,  3,  2, 10, -1, -1, -1, -1 },
+  {  1,  2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  9,  8,  3,  1,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  9,  0,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  {  3,  0,  8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 }
+};
@@ -0,0 +1,257 @@
+#include <scanner/precomp.hpp>
+#include <scanner/ply.hpp>
+#include <scanner/trace.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include <pthread.h>
+
+using namespace vm::scanner;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// PLY export
+
+namespace
+{
+  /** Records are packed into a big buffer that goes out with one fwrite when full, so the cost is one memcpy per
+    * field. PLY binary_little_endian matches the memory layout of every platform the scanner runs on. */
+  class PlyFile
+  {
+  public:
+    enum { BUFFER_SIZE = 8 << 20 };
+
+    PlyFile(const std::string& filename) : file_(fopen(filename.c_str(), "wb")), buffer_(BUFFER_SIZE), pos_(0)
+    {
+      if (!file_)
+        CV_Error(CV_StsError, "Can't open " + filename + " for writing");
+    }
+
+    ~PlyFile()
+    {
+      if (file_)
+        fclose(file_);
+    }
+
+    void write(const void* data, size_t size)
+    {
+      if (pos_ + size > buffer_.size())
+        flush();
+
+      if (size > buffer_.size())
+        return put(data, size);
+
+      memcpy(&buffer_[pos_], data, size);
+      pos_ += size;
+    }
+
+    template<typename T> void write(const T& value) { write(&value, sizeof(T)); }
+
+    void close()
+    {
+      flush();
+      FILE* file = file_;
+      file_ = 0;
+      if (fclose(file) != 0)
+        CV_Error(CV_StsError, "Can't finish writing ply file");
+    }
+
+  private:
+    void flush()
+    {
+      put(&buffer_[0], pos_);
+      pos_ = 0;
+    }
+
+    void put(const void* data, size_t size)
+    {
+      if (size && fwrite(data, 1, size, file_) != size)
+        CV_Error(CV_StsError, "Can't write ply file");
+    }
+
+    FILE* file_;
+    std::vector<char> buffer_;
+    size_t pos_;
+  };
+
+  inline bool isLittleEndian()
+  {
+    const unsigned int one = 1;
+    return *(const unsigned char*)&one == 1;
+  }
+}
+
+void vm::scanner::writePly(const std::string& filename, const cv::Mat& points, const cv::Mat& normals, const cv::Mat& colors, const cv::Mat& indices)
+{
+  CV_Assert(isLittleEndian());
+  CV_Assert(points.empty() || (points.type() == CV_32FC4 && points.isContinuous()));
+  CV_Assert(normals.empty() || (normals.type() == CV_32FC4 && normals.isContinuous() && normals.total() == points.total()));
+  CV_Assert(colors.empty() || (colors.type() == CV_8UC4 && colors.isContinuous() && colors.total() == points.total()));
+  CV_Assert(indices.empty() || (indices.type() == CV_32S && indices.isContinuous() && indices.total() % 3 == 0));
+
+  size_t vertices = points.total();
+  size_t faces = indices.total() / 3;
+
+  std::ostringstream header;
+  header << "ply\nformat binary_little_endian 1.0\nelement vertex " << vertices << "\n";
+  header << "property float x\nproperty float y\nproperty float z\n";
+  if (!normals.empty())
+    header << "property float nx\nproperty float ny\nproperty float nz\n";
+  if (!colors.empty())
+    header << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+  if (!indices.empty())
+    header << "element face " << faces << "\nproperty list uchar int vertex_indices\n";
+  header << "end_header\n";
+
+  std::string text = header.str();
+
+  PlyFile file(filename);
+  file.write(text.data(), text.size());
+
+  const Point* p = points.ptr<Point>();
+  const Normal* n = normals.empty() ? 0 : normals.ptr<Normal>();
+  const RGB* c = colors.empty() ? 0 : colors.ptr<RGB>();
+
+  for(size_t i = 0; i < vertices; ++i)
+  {
+    file.write(p[i].data, 3 * sizeof(float));
+
+    if (n)
+      file.write(n[i].data, 3 * sizeof(float));
+
+    if (c)
+    {
+      unsigned char rgb[] = { c[i].r, c[i].g, c[i].b };
+      file.write(rgb, sizeof(rgb));
+    }
+  }
+
+  const int* tri = indices.empty() ? 0 : indices.ptr<int>();
+  for(size_t i = 0; i < faces; ++i, tri += 3)
+  {
+    file.write((unsigned char)3);
+    file.write(tri, 3 * sizeof(int));
+  }
+
+  file.close();
+}
+
+void vm::scanner::writePly(const std::string& filename, const cpu::Mesh& mesh)
+{
+  writePly(filename, mesh.vertices, mesh.normals, mesh.colors, mesh.indices);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// PlyWriter
+
+struct vm::scanner::PlyWriter::Impl
+{
+  std::string filename;
+  cv::Mat points, normals, colors, indices;
+
+  pthread_t thread;
+  bool running;
+  bool failed;
+  std::string error; // of the first failure wait() has to report, kept for error() after it
+  volatile int done;
+
+  Impl() : running(false), failed(false), done(0) {}
+
+  static void* run(void* pthis)
+  {
+    Impl& impl = *static_cast<Impl*>(pthis);
+    Trace::setThreadName("ply writer");
+    try
+    {
+      TraceScope trace("write ply");
+      writePly(impl.filename, impl.points, impl.normals, impl.colors, impl.indices);
+    }
+    catch(const std::exception& e)
+    {
+      if (!impl.failed)
+        impl.error = impl.filename + ": " + e.what();
+      impl.failed = true;
+    }
+    __sync_lock_test_and_set(&impl.done, 1);
+    return 0;
+  }
+
+  bool join()
+  {
+    if (running)
+      pthread_join(thread, 0);
+    running = false;
+    return !failed;
+  }
+
+  // a failure sticks until wait() reported it, the save after it doesn't clear it
+  bool report()
+  {
+    bool ok = join();
+    failed = false;
+    return ok;
+  }
+
+  void start(const std::string& file)
+  {
+    filename = file;
+    done = 0;
+
+    if (pthread_create(&thread, 0, &Impl::run, this) == 0)
+      running = true;
+    else
+      run(this); // no thread available, save inline
+  }
+
+  template<typename T>
+  static void download(const cuda::DeviceArray<T>& array, int type, cv::Mat& host)
+  {
+    if (array.empty())
+      host.release();
+    else
+    {
+      host.create(1, (int)array.size(), type);
+      array.download(host.ptr<T>());
+    }
+  }
+};
+
+vm::scanner::PlyWriter::PlyWriter() : impl_(new Impl()) {}
+vm::scanner::PlyWriter::~PlyWriter() { wait(); }
+
+void vm::scanner::PlyWriter::save(const std::string& filename, const cuda::Mesh& mesh)
+{
+  impl_->join();
+  Impl::download(mesh.vertices, CV_32FC4, impl_->points);
+  Impl::download(mesh.normals, CV_32FC4, impl_->normals);
+  Impl::download(mesh.colors, CV_8UC4, impl_->colors);
+  Impl::download(mesh.indices, CV_32S, impl_->indices);
+  impl_->start(filename);
+}
+
+void vm::scanner::PlyWriter::save(const std::string& filename, const cuda::DeviceArray<Point>& cloud,
+                                  const cuda::DeviceArray<Normal>& normals, const cuda::DeviceArray<RGB>& colors)
+{
+  impl_->join();
+  Impl::download(cloud, CV_32FC4, impl_->points);
+  Impl::download(normals, CV_32FC4, impl_->normals);
+  Impl::download(colors, CV_8UC4, impl_->colors);
+  impl_->indices.release();
+  impl_->start(filename);
+}
+
+void vm::scanner::PlyWriter::save(const std::string& filename, const cpu::Mesh& mesh)
+{
+  impl_->join();
+  mesh.vertices.copyTo(impl_->points);
+  mesh.normals.copyTo(impl_->normals);
+  mesh.colors.copyTo(impl_->colors);
+  mesh.indices.copyTo(impl_->indices);
+  impl_->start(filename);
+}
+
+bool vm::scanner::PlyWriter::wait() { return impl_->report(); }
+const std::string& vm::scanner::PlyWriter::error() const { return impl_->error; }
+bool vm::scanner::PlyWriter::busy() const { return impl_->running && !impl_->done; }
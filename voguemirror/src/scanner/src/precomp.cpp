@@ -22,8 +22,35 @@ std::ostream& operator << (std::ostream& os, const vm::scanner::Intr& intr)
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// TsdfVolume host implementation
 
-vm::scanner::device::TsdfVolume::TsdfVolume(elem_type* _data, int3 _dims, float3 _voxel_size, float _trunc_dist, int _max_weight)
-: data(_data), dims(_dims), voxel_size(_voxel_size), trunc_dist(_trunc_dist), max_weight(_max_weight) {}
+vm::scanner::device::TsdfVolume::TsdfVolume(void* _data, int _layout, int _order, int3 _dims, float3 _voxel_size, float _trunc_dist, int _max_weight, int3 _origin)
+: data(_data), layout(_layout), order(_order), dims(_dims), voxel_size(_voxel_size), trunc_dist(_trunc_dist), max_weight(_max_weight), origin(_origin) {}
+
+size_t vm::scanner::device::TsdfVolume::voxelBytes(int layout)
+{
+  CV_Assert(layout == VOXEL_RGBA || layout == VOXEL_RGB || layout == VOXEL_GEOMETRY);
+  return layout == VOXEL_RGBA ? sizeof(ushort4) : (layout == VOXEL_RGB ? sizeof(voxel6) : sizeof(voxel4));
+}
+
+vm::scanner::device::TsdfBricks::TsdfBricks(unsigned int* _flags, int3 volume_dims)
+{
+  for(int level = 0, offset = 0; level < LEVELS; ++level)
+  {
+    int size = 1 << (level ? LOG_SIZE1 : LOG_SIZE0);
+    dims[level] = make_int3(divUp(volume_dims.x, size), divUp(volume_dims.y, size), divUp(volume_dims.z, size));
+    flags[level] = _flags ? _flags + offset : 0;
+    offset += dims[level].x * dims[level].y * dims[level].z;
+  }
+}
+
+int vm::scanner::device::TsdfBricks::count(int3 volume_dims)
+{
+  TsdfBricks bricks(0, volume_dims);
+
+  int total = 0;
+  for(int level = 0; level < LEVELS; ++level)
+    total += bricks.dims[level].x * bricks.dims[level].y * bricks.dims[level].z;
+  return total;
+}
 
 // vm::scanner::device::TsdfVolume::TsdfVolume(elem_type* _data, color_type* _color, int3 _dims, float3 _voxel_size, float _trunc_dist, int _max_weight)
 // : data(_data), color(_color), dims(_dims), voxel_size(_voxel_size), trunc_dist(_trunc_dist), max_weight(_max_weight){}
@@ -40,6 +67,14 @@ vm::scanner::device::TsdfVolume::TsdfVolume(elem_type* _data, int3 _dims, float3
 //vm::scanner::device::TsdfVolume::elem_type* vm::scannerl::device::TsdfVolume::zstep(elem_type *const ptr) const
 //{ return data + dims.x * dims.y; }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// HashTsdfVolume host implementation
+
+vm::scanner::device::HashTsdfVolume::HashTsdfVolume(elem_type* _data, unsigned long long* _keys, int* _values, int3* _blocks, int* _blocks_count,
+                                                    int _hash_size, int _max_blocks, int3 _dims, float3 _voxel_size, float _trunc_dist, int _max_weight)
+: data(_data), keys(_keys), values(_values), blocks(_blocks), blocks_count(_blocks_count), hash_mask(_hash_size - 1), max_blocks(_max_blocks),
+  dims(_dims), voxel_size(_voxel_size), trunc_dist(_trunc_dist), max_weight(_max_weight) {}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// Projector host implementation
 
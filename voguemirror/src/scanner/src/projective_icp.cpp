@@ -36,7 +36,8 @@ struct vm::scanner::cuda::ProjectiveICP::StreamHelper
   operator float*() { return locked_buffer.data; }
   operator cudaStream_t() { return stream; }
 
-  Mat6f get(Vec6f& b)
+  /** stats gets the squared residual of the inliers, the inliers and the current pixels with a point */
+  Mat6f get(Vec6f& b, cv::Vec3f& stats)
   {
     cudaSafeCall( cudaStreamSynchronize(stream) );
 
@@ -54,6 +55,9 @@ struct vm::scanner::cuda::ProjectiveICP::StreamHelper
         else
           data_A[j * 6 + i] = data_A[i * 6 + j] = value;
       }
+
+    for(int i = 0; i < 3; ++i)
+      stats[i] = locked_buffer.data[shift++];
     return A;
   }
 };
@@ -61,11 +65,14 @@ struct vm::scanner::cuda::ProjectiveICP::StreamHelper
 ///////////////////
 // ProjectiveICP //
 ///////////////////
-vm::scanner::cuda::ProjectiveICP::ProjectiveICP() : angle_thres_(deg2rad(20.f)), dist_thres_(0.1f)
+vm::scanner::cuda::ProjectiveICP::ProjectiveICP() : angle_thres_(deg2rad(20.f)), dist_thres_(0.1f),
+  min_rotation_update_(0.f), min_translation_update_(0.f), min_residual_change_(0.f), min_inlier_ratio_(0.f),
+  iters_done_(MAX_PYRAMID_LEVELS, 0)
 { 
     const int iters[] = {10, 5, 4, 0};
     std::vector<int> vector_iters(iters, iters + 4);
     setIterationsNum(vector_iters);
+    setMinIterationsNum(std::vector<int>());
     device::ComputeIcpHelper::allocate_buffer(buffer_);
 
     shelp_ = cv::Ptr<StreamHelper>(new StreamHelper());
@@ -96,6 +103,42 @@ void vm::scanner::cuda::ProjectiveICP::setIterationsNum(const std::vector<int>&
   }
 }
 
+void vm::scanner::cuda::ProjectiveICP::setMinIterationsNum(const std::vector<int>& iters)
+{
+  min_iters_ = std::vector<int>(MAX_PYRAMID_LEVELS, 0);
+  copy(iters.begin(), iters.begin() + std::min(iters.size(), min_iters_.size()), min_iters_.begin());
+}
+
+void vm::scanner::cuda::ProjectiveICP::setConvergenceCriteria(float rotation, float translation, float residual_change, float min_inlier_ratio)
+{
+  min_rotation_update_ = rotation;
+  min_translation_update_ = translation;
+  min_residual_change_ = residual_change;
+  min_inlier_ratio_ = min_inlier_ratio;
+}
+
+const std::vector<int>& vm::scanner::cuda::ProjectiveICP::getIterationsDone() const
+{ return iters_done_; }
+
+bool vm::scanner::cuda::ProjectiveICP::converged(const cv::Vec6f& update, const cv::Vec3f& stats, float& residual) const
+{
+  float inliers = stats[1], points = stats[2];
+  float previous = residual;
+  residual = inliers > 0 ? std::sqrt(stats[0] / inliers) : 0.f;
+
+  if (points <= 0 || inliers < min_inlier_ratio_ * points)
+    return false;
+
+  float rotation = (float)cv::norm(Vec3f(update.val));
+  float translation = (float)cv::norm(Vec3f(update.val + 3));
+
+  bool small_update = rotation < min_rotation_update_ && translation < min_translation_update_;
+  bool flat_residual = min_residual_change_ > 0 && previous > 0 && std::abs(previous - residual) <= min_residual_change_ * previous;
+  return small_update || flat_residual;
+}
+
+void vm::scanner::cuda::ProjectiveICP::setRays(const std::vector<Rays>& rays) { rays_ = rays; }
+
 int vm::scanner::cuda::ProjectiveICP::getUsedLevelsNum() const
 {
   int i = MAX_PYRAMID_LEVELS - 1;
@@ -125,6 +168,7 @@ bool vm::scanner::cuda::ProjectiveICP::estimateTransform(Affine3f& affine, const
 
   device::ComputeIcpHelper helper(dist_thres_, angle_thres_);
   affine = Affine3f::Identity();
+  std::fill(iters_done_.begin(), iters_done_.end(), 0);
 
   for(int level_index = LEVELS - 1; level_index >= 0; --level_index)
   {
@@ -136,13 +180,20 @@ bool vm::scanner::cuda::ProjectiveICP::estimateTransform(Affine3f& affine, const
     helper.dcurr = dcurr[level_index];
     helper.ncurr = ncurr[level_index];
 
+    bool has_rays = level_index < (int)rays_.size() && !rays_[level_index].empty();
+    CV_Assert(!has_rays || (rays_[level_index].rows() == dcurr[level_index].rows() && rays_[level_index].cols() == dcurr[level_index].cols()));
+    helper.rays = has_rays ? (device::PtrStep<float4>)rays_[level_index] : device::PtrStep<float4>();
+
+    float residual = 0.f;
     for(int iter = 0; iter < iters_[level_index]; ++iter)
     {
       helper.aff = device_cast<device::Aff3f>(affine);
       helper(dprev[level_index], n, buffer_, sh, sh);
 
       StreamHelper::Vec6f b;
-      StreamHelper::Mat6f A  = sh.get(b);
+      cv::Vec3f stats;
+      StreamHelper::Mat6f A  = sh.get(b, stats);
+      ++iters_done_[level_index];
 
       //checking nullspace
       double det = cv::determinant(A);
@@ -157,6 +208,9 @@ bool vm::scanner::cuda::ProjectiveICP::estimateTransform(Affine3f& affine, const
       cv::solve(A, b, r, cv::DECOMP_SVD);
       Affine3f Tinc(Vec3f(r.val), Vec3f(r.val+3));
       affine = Tinc * affine;
+
+      if (iter + 1 >= min_iters_[level_index] && converged(r, stats, residual))
+        break;
     }
   }
   return true;
@@ -169,6 +223,7 @@ bool vm::scanner::cuda::ProjectiveICP::estimateTransform(Affine3f& affine, const
 
   device::ComputeIcpHelper helper(dist_thres_, angle_thres_);
   affine = Affine3f::Identity();
+  std::fill(iters_done_.begin(), iters_done_.end(), 0);
 
   for(int level_index = LEVELS - 1; level_index >= 0; --level_index)
   {
@@ -181,13 +236,16 @@ bool vm::scanner::cuda::ProjectiveICP::estimateTransform(Affine3f& affine, const
     helper.vcurr = vcurr[level_index];
     helper.ncurr = ncurr[level_index];
 
+    float residual = 0.f;
     for(int iter = 0; iter < iters_[level_index]; ++iter)
     {
       helper.aff = device_cast<device::Aff3f>(affine);
       helper(v, n, buffer_, sh, sh);
 
       StreamHelper::Vec6f b;
-      StreamHelper::Mat6f A = sh.get(b);
+      cv::Vec3f stats;
+      StreamHelper::Mat6f A = sh.get(b, stats);
+      ++iters_done_[level_index];
 
       //checking nullspace
       double det = cv::determinant(A);
@@ -203,6 +261,9 @@ bool vm::scanner::cuda::ProjectiveICP::estimateTransform(Affine3f& affine, const
 
       Affine3f Tinc(Vec3f(r.val), Vec3f(r.val+3));
       affine = Tinc * affine;
+
+      if (iter + 1 >= min_iters_[level_index] && converged(r, stats, residual))
+        break;
     }
   }
   return true;
@@ -6,10 +6,13 @@ static inline float deg2rad (float alpha) { return alpha * 0.017453293f; }
 vm::scanner::ScannerParams vm::scanner::ScannerParams::default_params()
 {
 	const int iters[] = {10, 5, 4, 0};
+  const int min_iters[] = {2, 1, 1, 0};
   const int levels = sizeof(iters)/sizeof(iters[0]);
 
   ScannerParams p;
 
+  p.backend = ScannerParams::BACKEND_CUDA;
+
   p.cols = 640;  //pixels
   p.rows = 480;  //pixels
   p.intr = Intr(525.f, 525.f, p.cols/2 - 0.5f, p.rows/2 - 0.5f);
@@ -17,15 +20,36 @@ vm::scanner::ScannerParams vm::scanner::ScannerParams::default_params()
   p.volume_dims = Vec3i::all(512);  //number of voxels
   p.volume_size = Vec3f::all(1.5f);  //meters
   p.volume_pose = Affine3f().translate(Vec3f(-p.volume_size[0]/2, -p.volume_size[1]/2, 0.5f));
+  p.volume_max_blocks = 0; //dense, 65536 blocks take 256MB and cover a person at 512^3 with room to spare
+  p.volume_shift_dist = 0.f; //meters, disabled, the volume stays around the subject
+  p.volume_voxel_layout = cuda::TsdfVolume::VOXEL_RGBA; //8 bytes, 1GB at 512^3
+  p.volume_voxel_order = cuda::TsdfVolume::ORDER_LINEAR;
+
+  p.sensor_poses.clear(); //a single sensor
 
   p.bilateral_sigma_depth = 0.04f;  //meter
   p.bilateral_sigma_spatial = 4.5; //pixels
   p.bilateral_kernel_size = 7;     //pixels
+  p.fused_front_end = true;
+
+  p.foreground.enabled = false;
+  p.foreground.level = 2;                       //160x120
+  p.foreground.min_depth = 0.3f;                //meters
+  p.foreground.max_depth = 3.f;                 //meters
+  p.foreground.floor_dist = 0.03f;              //meters
+  p.foreground.floor_max_tilt = deg2rad(45.f);  //radians
+  p.foreground.depth_jump = 0.05f;              //meters
+  p.foreground.min_area = 100;                  //pixels at level 2
 
   p.icp_truncate_depth_dist = 0.f;        //meters, disabled
   p.icp_dist_thres = 0.1f;                //meters
   p.icp_angle_thres = deg2rad(30.f); //radians
   p.icp_iter_num.assign(iters, iters + levels);
+  p.icp_min_iter_num.assign(min_iters, min_iters + levels);
+  p.icp_min_rotation_update = 1e-4f;      //radians
+  p.icp_min_translation_update = 1e-4f;   //meters
+  p.icp_min_residual_change = 0.01f;      //1%
+  p.icp_min_inlier_ratio = 0.3f;
 
   p.tsdf_min_camera_movement = 0.f; //meters, disabled
   p.tsdf_trunc_dist = 0.04f; //meters;
@@ -40,26 +64,93 @@ vm::scanner::ScannerParams vm::scanner::ScannerParams::default_params()
   return p;
 }
 
-vm::scanner::Scanner::Scanner(const ScannerParams& params) : frame_counter_(0), params_(params)
+vm::scanner::ScannerTimes::ScannerTimes() { clear(); }
+
+void vm::scanner::ScannerTimes::clear()
+{
+  std::fill(stage_ms, stage_ms + STAGES_COUNT, 0.0);
+  total_ms = 0.0;
+}
+
+const char* vm::scanner::ScannerTimes::name(int stage)
+{
+  static const char* names[] = { "foreground", "dists", "bilateral", "pyramid", "normals", "icp", "integrate", "raycast" };
+  CV_Assert(0 <= stage && stage < STAGES_COUNT);
+  return names[stage];
+}
+
+namespace
+{
+  template<typename Volume>
+  void setupVolume(Volume& volume, const vm::scanner::ScannerParams& p)
+  {
+    volume.setTruncDist(p.tsdf_trunc_dist);
+    volume.setMaxWeight(p.tsdf_max_weight);
+    volume.setSize(p.volume_size);
+    volume.setPose(p.volume_pose);
+    volume.setRaycastStepFactor(p.raycast_step_factor);
+    volume.setGradientDeltaFactor(p.gradient_delta_factor);
+  }
+}
+
+vm::scanner::Scanner::Scanner(const ScannerParams& params) : frame_counter_(0), params_(params),
+  timed_poses_count_(0), stage_timing_(ScannerTimes::OFF), stage_start_(0), frame_start_(0)
 {
   CV_Assert(params.volume_dims[0] % 32 == 0);
+  CV_Assert(params.volume_shift_dist <= 0 || params.volume_max_blocks <= 0);
+  CV_Assert(params.backend == ScannerParams::BACKEND_CUDA || params.backend == ScannerParams::BACKEND_CPU);
 
-  volume_ = cv::Ptr<cuda::TsdfVolume>(new cuda::TsdfVolume(params_.volume_dims));
+  if (on_cpu())
+  {
+    CV_Assert(params.volume_max_blocks <= 0 && params.volume_shift_dist <= 0);
 
-  volume_->setTruncDist(params_.tsdf_trunc_dist);
-  volume_->setMaxWeight(params_.tsdf_max_weight);
-  volume_->setSize(params_.volume_size);
-  volume_->setPose(params_.volume_pose);
-  volume_->setRaycastStepFactor(params_.raycast_step_factor);
-  volume_->setGradientDeltaFactor(params_.gradient_delta_factor);
+    cpu_volume_ = cv::Ptr<cpu::TsdfVolume>(new cpu::TsdfVolume(params_.volume_dims, params_.volume_voxel_order));
+    setupVolume(*cpu_volume_, params_);
 
-  icp_ = cv::Ptr<cuda::ProjectiveICP>(new cuda::ProjectiveICP());
-  icp_->setDistThreshold(params_.icp_dist_thres);
-  icp_->setAngleThreshold(params_.icp_angle_thres);
-  icp_->setIterationsNum(params_.icp_iter_num);
+    // no early stop on the host, levels run their maximum iterations
+    cpu_icp_ = cv::Ptr<cpu::ProjectiveICP>(new cpu::ProjectiveICP());
+    cpu_icp_->setDistThreshold(params_.icp_dist_thres);
+    cpu_icp_->setAngleThreshold(params_.icp_angle_thres);
+    cpu_icp_->setIterationsNum(params_.icp_iter_num);
+  }
+  else
+  {
+    if (params_.volume_max_blocks > 0)
+      volume_ = cv::Ptr<cuda::TsdfVolume>(new cuda::HashTsdfVolume(params_.volume_dims, params_.volume_max_blocks));
+    else
+      volume_ = cv::Ptr<cuda::TsdfVolume>(new cuda::TsdfVolume(params_.volume_dims, params_.volume_voxel_layout, params_.volume_voxel_order));
+    setupVolume(*volume_, params_);
+
+    icp_ = cv::Ptr<cuda::ProjectiveICP>(new cuda::ProjectiveICP());
+    icp_->setDistThreshold(params_.icp_dist_thres);
+    icp_->setAngleThreshold(params_.icp_angle_thres);
+    icp_->setIterationsNum(params_.icp_iter_num);
+    icp_->setMinIterationsNum(params_.icp_min_iter_num);
+    icp_->setConvergenceCriteria(params_.icp_min_rotation_update, params_.icp_min_translation_update,
+                                 params_.icp_min_residual_change, params_.icp_min_inlier_ratio);
+  }
 
   allocate_buffers();
   reset();
+
+  setStageTiming(Trace::enabled() ? ScannerTimes::GPU_EVENTS : ScannerTimes::OFF);
+}
+
+vm::scanner::Scanner::~Scanner()
+{
+  for(size_t i = 0; i < events_.size(); ++i)
+    cudaSafeCall( cudaEventDestroy(events_[i]) );
+
+  for(size_t i = 1; i < sensors_.size(); ++i)
+  {
+    for(int b = 0; b < 2; ++b)
+    {
+      cudaSafeCall( cudaEventDestroy(sensors_[i].buffers[b].ready) );
+      cudaSafeCall( cudaEventDestroy(sensors_[i].buffers[b].consumed) );
+    }
+    cudaSafeCall( cudaEventDestroy(sensors_[i].copied) );
+    cudaSafeCall( cudaStreamDestroy(sensors_[i].stream) );
+  }
 }
 
 const vm::scanner::ScannerParams& vm::scanner::Scanner::params() const
@@ -68,17 +159,32 @@ const vm::scanner::ScannerParams& vm::scanner::Scanner::params() const
 vm::scanner::ScannerParams& vm::scanner::Scanner::params()
 { return params_; }
 
+bool vm::scanner::Scanner::on_cpu() const
+{ return params_.backend == ScannerParams::BACKEND_CPU; }
+
 const vm::scanner::cuda::TsdfVolume& vm::scanner::Scanner::tsdf() const
-{ return *volume_; }
+{ CV_Assert(!on_cpu()); return *volume_; }
 
 vm::scanner::cuda::TsdfVolume& vm::scanner::Scanner::tsdf()
-{ return *volume_; }
+{ CV_Assert(!on_cpu()); return *volume_; }
 
 const vm::scanner::cuda::ProjectiveICP& vm::scanner::Scanner::icp() const
-{ return *icp_; }
+{ CV_Assert(!on_cpu()); return *icp_; }
 
 vm::scanner::cuda::ProjectiveICP& vm::scanner::Scanner::icp()
-{ return *icp_; }
+{ CV_Assert(!on_cpu()); return *icp_; }
+
+const vm::scanner::cpu::TsdfVolume& vm::scanner::Scanner::cpuTsdf() const
+{ CV_Assert(on_cpu()); return *cpu_volume_; }
+
+vm::scanner::cpu::TsdfVolume& vm::scanner::Scanner::cpuTsdf()
+{ CV_Assert(on_cpu()); return *cpu_volume_; }
+
+const vm::scanner::cpu::ProjectiveICP& vm::scanner::Scanner::cpuIcp() const
+{ CV_Assert(on_cpu()); return *cpu_icp_; }
+
+vm::scanner::cpu::ProjectiveICP& vm::scanner::Scanner::cpuIcp()
+{ CV_Assert(on_cpu()); return *cpu_icp_; }
 
 void vm::scanner::Scanner::allocate_buffers()
 {
@@ -87,6 +193,31 @@ void vm::scanner::Scanner::allocate_buffers()
   int cols = params_.cols;
   int rows = params_.rows;
 
+  if (on_cpu())
+  {
+    cpu_dists_.create(rows, cols);
+
+    cpu::Frame* frames[] = { &cpu_curr_, &cpu_prev_ };
+    for(int f = 0; f < 2; ++f)
+    {
+      frames[f]->depth_pyr.resize(LEVELS);
+      frames[f]->points_pyr.resize(LEVELS);
+      frames[f]->normals_pyr.resize(LEVELS);
+
+      for(int i = 0; i < LEVELS; ++i)
+      {
+        frames[f]->depth_pyr[i].create(rows >> i, cols >> i);
+        frames[f]->points_pyr[i].create(rows >> i, cols >> i);
+        frames[f]->normals_pyr[i].create(rows >> i, cols >> i);
+      }
+    }
+
+    cpu_rays_.resize(LEVELS);
+    rays_intr_ = Intr(0.f, 0.f, 0.f, 0.f);
+    update_rays();
+    return;
+  }
+
   dists_.create(rows, cols);
 
   curr_.depth_pyr.resize(LEVELS);
@@ -115,6 +246,29 @@ void vm::scanner::Scanner::allocate_buffers()
   depths_.create(params_.rows, params_.cols);
   normals_.create(params_.rows, params_.cols);
   points_.create(params_.rows, params_.cols);
+
+  rays_.resize(LEVELS);
+  rays_intr_ = Intr(0.f, 0.f, 0.f, 0.f);
+  update_rays();
+}
+
+void vm::scanner::Scanner::update_rays()
+{
+  const Intr& intr = params_.intr;
+  if (intr.fx == rays_intr_.fx && intr.fy == rays_intr_.fy && intr.cx == rays_intr_.cx && intr.cy == rays_intr_.cy)
+    return;
+
+  if (on_cpu())
+    for(size_t i = 0; i < cpu_rays_.size(); ++i)
+      cpu::computeRays(intr((int)i), params_.rows >> i, params_.cols >> i, cpu_rays_[i]);
+  else
+  {
+    for(size_t i = 0; i < rays_.size(); ++i)
+      cuda::computeRays(intr((int)i), params_.rows >> i, params_.cols >> i, rays_[i]);
+
+    icp_->setRays(rays_);
+  }
+  rays_intr_ = intr;
 }
 
 void vm::scanner::Scanner::reset()
@@ -126,7 +280,50 @@ void vm::scanner::Scanner::reset()
   poses_.clear();
   poses_.reserve(30000);
   poses_.push_back(Affine3f::Identity());
-  volume_->clear();
+
+  // held rig frames were preprocessed for the model being cleared, none of them has a pose anymore
+  timed_poses_count_ = 0;
+  for(size_t i = 1; i < sensors_.size(); ++i)
+    sensors_[i].held = false;
+
+  if (params_.volume_shift_dist > 0)
+  {
+    volume_->setPose(params_.volume_pose);
+    volume_->setGridOrigin(Vec3i::all(0));
+    shift_anchor_ = Vec3f::all(0.f);
+  }
+
+  if (on_cpu())
+    cpu_volume_->clear();
+  else
+    volume_->clear();
+}
+
+void vm::scanner::Scanner::shift_volume()
+{
+  Affine3f pose = volume_->getPose();
+  Vec3f moved = pose.rotation().t() * (poses_.back().translation() - shift_anchor_);
+
+  if (cv::norm(moved) < params_.volume_shift_dist)
+    return;
+
+  Vec3f vsz = volume_->getVoxelSize();
+  Vec3i voxels(cvRound(moved[0]/vsz[0]), cvRound(moved[1]/vsz[1]), cvRound(moved[2]/vsz[2]));
+
+  cuda::DeviceArray<Point> cloud = volume_->shift(voxels, shift_buffer_);
+
+  size_t size = shifted_cloud_.size();
+  shifted_cloud_.resize(size + cloud.size());
+  if (!cloud.empty())
+    cloud.download(&shifted_cloud_[size]);
+
+  shift_anchor_ += pose.rotation() * Vec3f(voxels[0] * vsz[0], voxels[1] * vsz[1], voxels[2] * vsz[2]);
+}
+
+void vm::scanner::Scanner::fetchShiftedCloud(std::vector<Point>& cloud)
+{
+  cloud.insert(cloud.end(), shifted_cloud_.begin(), shifted_cloud_.end());
+  shifted_cloud_.clear();
 }
 
 vm::scanner::Affine3f vm::scanner::Scanner::getCameraPose (int time) const
@@ -136,44 +333,562 @@ vm::scanner::Affine3f vm::scanner::Scanner::getCameraPose (int time) const
   return poses_[time];
 }
 
-bool vm::scanner::Scanner::operator()(const vm::scanner::cuda::Depth& depth, const vm::scanner::cuda::Image& image)
+void vm::scanner::Scanner::setStageTiming(int mode)
+{
+  CV_Assert(ScannerTimes::OFF <= mode && mode <= ScannerTimes::GPU_EVENTS);
+
+  // no device to record events on, host stages are done when they return
+  if (on_cpu() && mode == ScannerTimes::GPU_EVENTS)
+    mode = ScannerTimes::SYNC;
+  stage_timing_ = mode;
+
+  if (mode == ScannerTimes::GPU_EVENTS && events_.empty())
+  {
+    events_.resize(ScannerTimes::STAGES_COUNT + 1);
+    for(size_t i = 0; i < events_.size(); ++i)
+      cudaSafeCall( cudaEventCreate(&events_[i]) );
+  }
+}
+
+const vm::scanner::ScannerTimes& vm::scanner::Scanner::getTimes() const { return times_; }
+
+const vm::scanner::TimeHistogram& vm::scanner::Scanner::getHistogram(int stage) const
+{
+  CV_Assert(0 <= stage && stage < ScannerTimes::STAGES_COUNT);
+  return histograms_[stage];
+}
+
+const vm::scanner::TimeHistogram& vm::scanner::Scanner::getFrameHistogram() const { return frame_histogram_; }
+
+void vm::scanner::Scanner::frame_begin()
+{
+  times_.clear();
+  stages_.clear();
+
+  stage_start_ = frame_start_ = cv::getTickCount();
+
+  if (stage_timing_ == ScannerTimes::GPU_EVENTS)
+    cudaSafeCall( cudaEventRecord(events_[0]) );
+}
+
+void vm::scanner::Scanner::stage_done(int stage)
+{
+  bool trace = Trace::enabled();
+  if (stage_timing_ == ScannerTimes::OFF && !trace)
+    return;
+
+  if (stage_timing_ == ScannerTimes::SYNC && !on_cpu())
+    cuda::waitAllDefaultStream();
+
+  if (stage_timing_ == ScannerTimes::GPU_EVENTS)
+    cudaSafeCall( cudaEventRecord(events_[stages_.size() + 1]) );
+
+  int64 now = cv::getTickCount();
+
+  if (trace)
+    Trace::record(ScannerTimes::name(stage), stage_start_, now);
+
+  if (stage_timing_ == ScannerTimes::SYNC)
+  {
+    double ms = (now - stage_start_) * 1000.0 / cv::getTickFrequency();
+    times_.stage_ms[stage] += ms;
+    times_.total_ms += ms;
+  }
+
+  stages_.push_back(stage);
+  stage_start_ = now;
+}
+
+void vm::scanner::Scanner::frame_done()
+{
+  if (stage_timing_ != ScannerTimes::OFF && !stages_.empty())
+    add_times();
+}
+
+int vm::scanner::Scanner::getDroppedBlocks() const
+{
+  if (on_cpu() || params_.volume_max_blocks <= 0)
+    return 0;
+
+  return static_cast<const cuda::HashTsdfVolume&>(*volume_).getDroppedBlocks();
+}
+
+void vm::scanner::Scanner::add_times()
+{
+
+  if (stage_timing_ == ScannerTimes::GPU_EVENTS)
+  {
+    // the frame ends on a download or a wait, so this doesn't stall
+    cudaSafeCall( cudaEventSynchronize(events_[stages_.size()]) );
+
+    // the device is idle when a frame begins, so the GPU track is anchored at the frame start on the host
+    double ticks_per_ms = cv::getTickFrequency() / 1000.0;
+    int64 begin = frame_start_;
+
+    for(size_t i = 0; i < stages_.size(); ++i)
+    {
+      float ms;
+      cudaSafeCall( cudaEventElapsedTime(&ms, events_[i], events_[i + 1]) );
+
+      times_.stage_ms[stages_[i]] += ms;
+      times_.total_ms += ms;
+
+      int64 end = begin + (int64)(ms * ticks_per_ms);
+      if (Trace::enabled())
+        Trace::record(ScannerTimes::name(stages_[i]), begin, end, true);
+      begin = end;
+    }
+  }
+
+  for(size_t i = 0; i < stages_.size(); ++i)
+    histograms_[stages_[i]].add(times_.stage_ms[stages_[i]]);
+  frame_histogram_.add(times_.total_ms);
+}
+
+void vm::scanner::Scanner::raycast_prev()
+{
+  const ScannerParams& p = params_;
+
+  if (on_cpu())
+  {
+    const int LEVELS = cpu_icp_->getUsedLevelsNum();
+#if defined USE_DEPTH
+    cpu_volume_->raycast(poses_.back(), p.intr, cpu_prev_.depth_pyr[0], cpu_prev_.normals_pyr[0], cpu_rays_[0]);
+    for (int i = 1; i < LEVELS; ++i)
+      cpu::resizeDepthNormals(cpu_prev_.depth_pyr[i-1], cpu_prev_.normals_pyr[i-1], cpu_prev_.depth_pyr[i], cpu_prev_.normals_pyr[i]);
+#else
+    cpu_volume_->raycast(poses_.back(), p.intr, cpu_prev_.points_pyr[0], cpu_prev_.normals_pyr[0], cpu_rays_[0]);
+    for (int i = 1; i < LEVELS; ++i)
+      cpu::resizePointsNormals(cpu_prev_.points_pyr[i-1], cpu_prev_.normals_pyr[i-1], cpu_prev_.points_pyr[i], cpu_prev_.normals_pyr[i]);
+#endif
+    return;
+  }
+
+  const int LEVELS = icp_->getUsedLevelsNum();
+
+#if defined USE_DEPTH
+  volume_->raycast(poses_.back(), p.intr, prev_.depth_pyr[0], prev_.normals_pyr[0], rays_[0]);
+  for (int i = 1; i < LEVELS; ++i)
+    resizeDepthNormals(prev_.depth_pyr[i-1], prev_.normals_pyr[i-1], prev_.depth_pyr[i], prev_.normals_pyr[i]);
+#else
+  volume_->raycast(poses_.back(), p.intr, prev_.points_pyr[0], prev_.normals_pyr[0], rays_[0]);
+  for (int i = 1; i < LEVELS; ++i)
+    resizePointsNormals(prev_.points_pyr[i-1], prev_.normals_pyr[i-1], prev_.points_pyr[i], prev_.normals_pyr[i]);
+#endif
+  cuda::waitAllDefaultStream();
+}
+
+void vm::scanner::Scanner::checkpoint(const std::string& filename)
+{
+  if (on_cpu())
+    CV_Error(CV_StsNotImplemented, "Snapshots are of device volumes, checkpoints need the cuda backend");
+  snapshot_writer_.save(filename, *volume_, poses_);
+}
+
+bool vm::scanner::Scanner::waitCheckpoint() { return snapshot_writer_.wait(); }
+
+const vm::scanner::SnapshotWriter& vm::scanner::Scanner::checkpointWriter() const { return snapshot_writer_; }
+
+void vm::scanner::Scanner::restore(const std::string& filename)
+{
+  if (on_cpu())
+    CV_Error(CV_StsNotImplemented, "Snapshots are of device volumes, restoring needs the cuda backend");
+
+  TraceScope trace("restore");
+  if (!snapshot_writer_.wait())
+    CV_Error(CV_StsError, "The pending checkpoint failed, " + snapshot_writer_.error());
+
+  std::vector<Affine3f> poses;
+  loadSnapshot(filename, *volume_, &poses);
+  if (poses.empty())
+    poses.push_back(Affine3f::Identity());
+
+  poses_.swap(poses);
+  poses_.reserve(std::max<size_t>(poses_.size(), 30000));
+
+  // the volume is wherever it was shifted to, tracking goes on against it from the last pose
+  shift_anchor_ = volume_->getPose().translation() - params_.volume_pose.translation();
+  shifted_cloud_.clear();
+
+  raycast_prev();
+  frame_counter_ = std::max(frame_counter_, 1);
+}
+
+void vm::scanner::Scanner::startRecording(const std::string& filename)
+{
+  if (on_cpu())
+    recorder_.open(filename, params_.cols, params_.rows, params_.intr, *cpu_volume_);
+  else
+    recorder_.open(filename, params_.cols, params_.rows, params_.intr, *volume_);
+}
+
+bool vm::scanner::Scanner::stopRecording() { return recorder_.close(); }
+
+const vm::scanner::SessionRecorder& vm::scanner::Scanner::recorder() const { return recorder_; }
+
+void vm::scanner::Scanner::record(const cuda::Dists& dists, const cuda::Image& image, const Affine3f& pose, int sensor)
+{
+  // the frame is indexed by its pose, as in checkpoints, so refined poses of the session line up with it
+  if (recorder_.isOpen())
+    recorder_.add((int)poses_.size() - 1, pose, dists, image, sensor, sensor ? params_.sensor_poses[sensor] : Affine3f::Identity());
+}
+
+void vm::scanner::Scanner::record(const cpu::Image& image)
+{
+  if (recorder_.isOpen())
+    recorder_.add((int)poses_.size() - 1, poses_.back(), cpu_dists_, image);
+}
+
+const vm::scanner::cpu::Depth& vm::scanner::Scanner::foreground(const cpu::Depth& input)
 {
+  const ScannerParams& p = params_;
+  if (!p.foreground.enabled)
+    return input;
+
+  cpu::extractForeground(p.intr, input, cpu_fg_depth_, p.foreground);
+  stage_done(ScannerTimes::FOREGROUND);
+  return cpu_fg_depth_;
+}
+
+const vm::scanner::cuda::Depth& vm::scanner::Scanner::foreground(const cuda::Depth& input)
+{
+  const ScannerParams& p = params_;
+  if (!p.foreground.enabled)
+    return input;
+
+  // everything but the person is zeroed out before the front end, so ICP and integration only see the subject
+  cuda::foregroundDownsample(input, fg_small_, p.foreground);
+  cuda::segmentForeground(p.intr(p.foreground.level), fg_small_, p.foreground, fg_mask_, fg_floor_, fg_buffer_);
+  cuda::applyForeground(p.intr, input, fg_mask_, fg_floor_, p.foreground, fg_depth_);
+  stage_done(ScannerTimes::FOREGROUND);
+  return fg_depth_;
+}
+
+bool vm::scanner::Scanner::operator()(int sensor, const cuda::Depth& input, const cuda::Image& image, int64 timestamp)
+{
+  const ScannerParams& p = params_;
+  CV_Assert(!on_cpu() && 0 <= sensor && sensor < std::max<int>(1, (int)p.sensor_poses.size()));
+
+  if (sensor > 0)
+  {
+    // the rig has no pose until the tracked sensor fused its first frame
+    if (timed_poses_count_ == 0)
+      return false;
+
+    hold_sensor_frame(sensor, input, image, timestamp);
+
+    // sensor 0 may already have a pose past it when the sensors' frames arrive out of order
+    if (timestamp <= pose_times_[1])
+      integrate_sensor_frame(sensor, pose_at(timestamp));
+    return false;
+  }
+
+  bool raycast = (*this)(input, image);
+
+  // lost tracking resets, which dropped the held frames with the poses
+  if (frame_counter_ == 0)
+    return raycast;
+
+  timed_poses_[0] = timed_poses_[1];
+  pose_times_[0] = pose_times_[1];
+  timed_poses_[1] = poses_.back();
+  pose_times_[1] = timestamp;
+  timed_poses_count_ = std::min(timed_poses_count_ + 1, 2);
+
+  for(size_t i = 1; i < sensors_.size(); ++i)
+    if (sensors_[i].held && sensors_[i].timestamp <= timestamp)
+      integrate_sensor_frame((int)i, pose_at(sensors_[i].timestamp));
+
+  return raycast;
+}
+
+void vm::scanner::Scanner::hold_sensor_frame(int sensor, const cuda::Depth& input, const cuda::Image& image, int64 timestamp)
+{
+  const ScannerParams& p = params_;
+
+  if (sensors_.size() < p.sensor_poses.size())
+  {
+    size_t first = std::max<size_t>(sensors_.size(), 1);
+    sensors_.resize(p.sensor_poses.size());
+    for(size_t i = first; i < sensors_.size(); ++i)
+    {
+      // non blocking, the legacy default stream would serialize it with the tracking of sensor 0 otherwise
+      SensorFrame& f = sensors_[i];
+      cudaSafeCall( cudaStreamCreateWithFlags(&f.stream, cudaStreamNonBlocking) );
+      cudaSafeCall( cudaEventCreateWithFlags(&f.copied, cudaEventDisableTiming) );
+      for(int b = 0; b < 2; ++b)
+      {
+        cudaSafeCall( cudaEventCreateWithFlags(&f.buffers[b].ready, cudaEventDisableTiming) );
+        cudaSafeCall( cudaEventCreateWithFlags(&f.buffers[b].consumed, cudaEventDisableTiming) );
+      }
+      f.current = 0;
+      f.timestamp = 0;
+      f.held = false;
+    }
+  }
+
+  SensorFrame& f = sensors_[sensor];
+  TraceScope trace("sensor frame");
+
+  // replaced by a newer frame of its sensor before sensor 0 caught up with it
+  if (f.held)
+    integrate_sensor_frame(sensor, pose_at(f.timestamp));
+
+  // the other buffers, the default stream may still be integrating the frame that was held in these
+  f.current ^= 1;
+  SensorFrame::Buffers& b = f.buffers[f.current];
+
+  // rays rebuilt on the default stream are read on this one
+  const Intr& intr = p.intr;
+  bool rebuilt = intr.fx != rays_intr_.fx || intr.fy != rays_intr_.fy || intr.cx != rays_intr_.cx || intr.cy != rays_intr_.cy;
+  update_rays();
+  if (rebuilt)
+    cudaSafeCall( cudaEventRecord(b.consumed, 0) );
+
+  // the buffers are free once the default stream integrated the last frame held in them, two frames back
+  cudaStream_t stream = f.stream;
+  cudaSafeCall( cudaStreamWaitEvent(stream, b.consumed, 0) );
+
+  f.depth.create(input.rows(), input.cols());
+  cudaSafeCall( cudaMemcpy2DAsync(f.depth.ptr(), f.depth.step(), input.ptr(), input.step(), input.colsBytes(), input.rows(),
+                                  cudaMemcpyDeviceToDevice, stream) );
+  if (image.empty())
+    b.image.release();
+  else
+  {
+    b.image.create(image.rows(), image.cols());
+    cudaSafeCall( cudaMemcpy2DAsync(b.image.ptr(), b.image.step(), image.ptr(), image.step(), image.colsBytes(), image.rows(),
+                                    cudaMemcpyDeviceToDevice, stream) );
+  }
+
+  // the caller reuses depth and image through the default stream, which waits for the copies but not for the
+  // preprocessing below, and the host doesn't wait at all
+  cudaSafeCall( cudaEventRecord(f.copied, stream) );
+  cudaSafeCall( cudaStreamWaitEvent(0, f.copied, 0) );
+
+  const cuda::Depth* depth = &f.depth;
+  if (p.foreground.enabled)
+  {
+    cuda::foregroundDownsample(f.depth, f.fg_small, p.foreground, stream);
+    cuda::segmentForeground(p.intr(p.foreground.level), f.fg_small, p.foreground, f.fg_mask, f.fg_floor, f.fg_buffer, stream);
+    cuda::applyForeground(p.intr, f.depth, f.fg_mask, f.fg_floor, p.foreground, f.fg_depth, stream);
+    depth = &f.fg_depth;
+  }
+
+  cuda::computeDists(*depth, b.dists, p.intr, rays_[0], stream);
+  cudaSafeCall( cudaEventRecord(b.ready, stream) );
+
+  f.timestamp = timestamp;
+  f.held = true;
+}
+
+void vm::scanner::Scanner::integrate_sensor_frame(int sensor, const Affine3f& pose)
+{
+  SensorFrame& f = sensors_[sensor];
+  SensorFrame::Buffers& b = f.buffers[f.current];
+
+  TraceScope trace_frame("sensor integrate");
+  frame_begin();
+
+  // no tracking, the sensor sits where the extrinsics put it relative to sensor 0 at its grab time
+  cudaSafeCall( cudaStreamWaitEvent(0, b.ready, 0) );
+  volume_->integrate(b.dists, b.image, pose * params_.sensor_poses[sensor], params_.intr);
+  record(b.dists, b.image, pose, sensor);
+  cudaSafeCall( cudaEventRecord(b.consumed, 0) );
+  stage_done(ScannerTimes::INTEGRATE);
+
+  f.held = false;
+  frame_done();
+}
+
+vm::scanner::Affine3f vm::scanner::Scanner::pose_at(int64 timestamp) const
+{
+  // held to the nearest of the two outside of them
+  if (timed_poses_count_ < 2 || timestamp >= pose_times_[1])
+    return timed_poses_[1];
+  if (timestamp <= pose_times_[0])
+    return timed_poses_[0];
+
+  // the same fraction of the motion in between, the rotation about its axis
+  float a = (float)(timestamp - pose_times_[0]) / (float)(pose_times_[1] - pose_times_[0]);
+  Affine3f delta = timed_poses_[0].inv() * timed_poses_[1];
+  return timed_poses_[0] * Affine3f(delta.rvec() * a, delta.translation() * a);
+}
+
+bool vm::scanner::Scanner::operator()(const cpu::Depth& input, const cpu::Image& image)
+{
+  if (on_cpu())
+    return process(input, image);
+
+  depth_upload_.upload(input.ptr<void>(), input.step, input.rows, input.cols);
+  if (image.empty())
+    return (*this)(depth_upload_);
+
+  image_upload_.upload(image.ptr<void>(), image.step, image.rows, image.cols);
+  return (*this)(depth_upload_, image_upload_);
+}
+
+bool vm::scanner::Scanner::process(const cpu::Depth& input, const cpu::Image& image)
+{
+  cpu_images_ = image;
+
+  const ScannerParams& p = params_;
+  const int LEVELS = cpu_icp_->getUsedLevelsNum();
+
+  TraceScope trace_frame("frame");
+  frame_begin();
+  update_rays();
+
+  const cpu::Depth& depth = foreground(input);
+
+#if defined USE_DEPTH
+  const bool fused = false; // the fused pass makes points, not masked depth
+#else
+  const bool fused = p.fused_front_end;
+#endif
+
+  if (fused)
+  {
+    cpu::depthFrontEnd(p.intr, depth, cpu_dists_, cpu_curr_.depth_pyr[0], cpu_curr_.points_pyr[0], cpu_curr_.normals_pyr[0],
+                       p.bilateral_kernel_size, p.bilateral_sigma_spatial, p.bilateral_sigma_depth, p.icp_truncate_depth_dist, cpu_rays_[0]);
+    stage_done(ScannerTimes::BILATERAL);
+  }
+  else
+  {
+    cpu::computeDists(depth, cpu_dists_, p.intr, cpu_rays_[0]);
+    stage_done(ScannerTimes::DISTS);
+
+    cpu::depthBilateralFilter(depth, cpu_curr_.depth_pyr[0], p.bilateral_kernel_size, p.bilateral_sigma_spatial, p.bilateral_sigma_depth);
+
+    if (p.icp_truncate_depth_dist > 0)
+      cpu::depthTruncation(cpu_curr_.depth_pyr[0], p.icp_truncate_depth_dist);
+    stage_done(ScannerTimes::BILATERAL);
+  }
+
+  for (int i = 1; i < LEVELS; ++i)
+    cpu::depthBuildPyramid(cpu_curr_.depth_pyr[i-1], cpu_curr_.depth_pyr[i], p.bilateral_sigma_depth);
+  stage_done(ScannerTimes::PYRAMID);
+
+  for (int i = fused ? 1 : 0; i < LEVELS; ++i)
+#if defined USE_DEPTH
+    cpu::computeNormalsAndMaskDepth(p.intr(i), cpu_curr_.depth_pyr[i], cpu_curr_.normals_pyr[i], cpu_rays_[i]);
+#else
+    cpu::computePointNormals(p.intr(i), cpu_curr_.depth_pyr[i], cpu_curr_.points_pyr[i], cpu_curr_.normals_pyr[i], cpu_rays_[i]);
+#endif
+  stage_done(ScannerTimes::NORMALS);
+
+  //can't perform more on first frame
+  if (frame_counter_ == 0)
+  {
+    cpu_volume_->integrate(cpu_dists_, cpu_images_, poses_.back(), p.intr);
+    record(cpu_images_);
+    stage_done(ScannerTimes::INTEGRATE);
+#if defined USE_DEPTH
+    cpu_curr_.depth_pyr.swap(cpu_prev_.depth_pyr);
+#else
+    cpu_curr_.points_pyr.swap(cpu_prev_.points_pyr);
+#endif
+    cpu_curr_.normals_pyr.swap(cpu_prev_.normals_pyr);
+    return frame_done(), ++frame_counter_, false;
+  }
+
+  Affine3f affine; // curr -> prev
+  {
+#if defined USE_DEPTH
+    bool ok = cpu_icp_->estimateTransform(affine, p.intr, cpu_curr_.depth_pyr, cpu_curr_.normals_pyr, cpu_prev_.depth_pyr, cpu_prev_.normals_pyr);
+#else
+    bool ok = cpu_icp_->estimateTransform(affine, p.intr, cpu_curr_.points_pyr, cpu_curr_.normals_pyr, cpu_prev_.points_pyr, cpu_prev_.normals_pyr);
+#endif
+    stage_done(ScannerTimes::ICP);
+    if (!ok)
+      return frame_done(), reset(), false;
+  }
+
+  poses_.push_back(poses_.back() * affine); // curr -> global
+
+  float rnorm = (float)cv::norm(affine.rvec());
+  float tnorm = (float)cv::norm(affine.translation());
+  if ((rnorm + tnorm)/2 >= p.tsdf_min_camera_movement)
+  {
+    cpu_volume_->integrate(cpu_dists_, cpu_images_, poses_.back(), p.intr);
+    record(cpu_images_);
+    stage_done(ScannerTimes::INTEGRATE);
+  }
+
+  raycast_prev();
+  stage_done(ScannerTimes::RAYCAST);
+
+  return frame_done(), ++frame_counter_, true;
+}
+
+bool vm::scanner::Scanner::operator()(const vm::scanner::cuda::Depth& input, const vm::scanner::cuda::Image& image)
+{
+  CV_Assert(!on_cpu());
 
   images_ = image;
 
   const ScannerParams& p = params_;
   const int LEVELS = icp_->getUsedLevelsNum();
 
-  cuda::computeDists(depth, dists_, p.intr);
-  cuda::depthBilateralFilter(depth, curr_.depth_pyr[0], p.bilateral_kernel_size, p.bilateral_sigma_spatial, p.bilateral_sigma_depth);
+  TraceScope trace_frame("frame");
+  frame_begin();
+  update_rays();
+
+  const cuda::Depth& depth = foreground(input);
+
+#if defined USE_DEPTH
+  const bool fused = false; // the fused pass makes points, not masked depth
+#else
+  const bool fused = p.fused_front_end;
+#endif
+
+  if (fused)
+  {
+    // dists, bilateral, truncation and level 0 normals in one pass, timed as the bilateral stage
+    cuda::depthFrontEnd(p.intr, depth, dists_, curr_.depth_pyr[0], curr_.points_pyr[0], curr_.normals_pyr[0],
+                        p.bilateral_kernel_size, p.bilateral_sigma_spatial, p.bilateral_sigma_depth, p.icp_truncate_depth_dist, rays_[0]);
+    stage_done(ScannerTimes::BILATERAL);
+  }
+  else
+  {
+    cuda::computeDists(depth, dists_, p.intr, rays_[0]);
+    stage_done(ScannerTimes::DISTS);
+
+    cuda::depthBilateralFilter(depth, curr_.depth_pyr[0], p.bilateral_kernel_size, p.bilateral_sigma_spatial, p.bilateral_sigma_depth);
 
-  if (p.icp_truncate_depth_dist > 0)
-      vm::scanner::cuda::depthTruncation(curr_.depth_pyr[0], p.icp_truncate_depth_dist);
+    if (p.icp_truncate_depth_dist > 0)
+        vm::scanner::cuda::depthTruncation(curr_.depth_pyr[0], p.icp_truncate_depth_dist);
+    stage_done(ScannerTimes::BILATERAL);
+  }
 
   for (int i = 1; i < LEVELS; ++i)
       cuda::depthBuildPyramid(curr_.depth_pyr[i-1], curr_.depth_pyr[i], p.bilateral_sigma_depth);
+  stage_done(ScannerTimes::PYRAMID);
 
-  for (int i = 0; i < LEVELS; ++i)
+  for (int i = fused ? 1 : 0; i < LEVELS; ++i)
 #if defined USE_DEPTH
     cuda::computeNormalsAndMaskDepth(p.intr, curr_.depth_pyr[i], curr_.normals_pyr[i]);
 #else
-    cuda::computePointNormals(p.intr(i), curr_.depth_pyr[i], curr_.points_pyr[i], curr_.normals_pyr[i]);
+    cuda::computePointNormals(p.intr(i), curr_.depth_pyr[i], curr_.points_pyr[i], curr_.normals_pyr[i], rays_[i]);
 #endif
 
     cuda::waitAllDefaultStream();
+    stage_done(ScannerTimes::NORMALS);
 
     //can't perform more on first frame
     if (frame_counter_ == 0)
     {
       //volume_->integrate(dists_, poses_.back(), p.intr);
       volume_->integrate(dists_, images_, poses_.back(), p.intr);
+      record(dists_, images_, poses_.back(), 0);
+      stage_done(ScannerTimes::INTEGRATE);
 #if defined USE_DEPTH
       curr_.depth_pyr.swap(prev_.depth_pyr);
 #else
       curr_.points_pyr.swap(prev_.points_pyr);
 #endif
       curr_.normals_pyr.swap(prev_.normals_pyr);
-      return ++frame_counter_, false;
+      return frame_done(), ++frame_counter_, false;
     }
 
     ///////////////////////////////////////////////////////////////////////////////////////////
@@ -186,8 +901,9 @@ bool vm::scanner::Scanner::operator()(const vm::scanner::cuda::Depth& depth, con
 #else
       bool ok = icp_->estimateTransform(affine, p.intr, curr_.points_pyr, curr_.normals_pyr, prev_.points_pyr, prev_.normals_pyr);
 #endif
+      stage_done(ScannerTimes::ICP);
       if (!ok)
-        return reset(), false;
+        return frame_done(), reset(), false;
     }
 
     poses_.push_back(poses_.back() * affine); // curr -> global
@@ -202,31 +918,29 @@ bool vm::scanner::Scanner::operator()(const vm::scanner::cuda::Depth& depth, con
     if (integrate)
     {
       //ScopeTime time("tsdf");
+      if (p.volume_shift_dist > 0)
+        shift_volume();
+
       //volume_->integrate(dists_, poses_.back(), p.intr);
       volume_->integrate(dists_, images_, poses_.back(), p.intr);
+      record(dists_, images_, poses_.back(), 0);
+      stage_done(ScannerTimes::INTEGRATE);
     }
 
     ///////////////////////////////////////////////////////////////////////////////////////////
     // Ray casting
     {
       //ScopeTime time("ray-cast-all");
-#if defined USE_DEPTH
-      volume_->raycast(poses_.back(), p.intr, prev_.depth_pyr[0], prev_.normals_pyr[0]);
-      for (int i = 1; i < LEVELS; ++i)
-        resizeDepthNormals(prev_.depth_pyr[i-1], prev_.normals_pyr[i-1], prev_.depth_pyr[i], prev_.normals_pyr[i]);
-#else
-        volume_->raycast(poses_.back(), p.intr, prev_.points_pyr[0], prev_.normals_pyr[0]);
-        for (int i = 1; i < LEVELS; ++i)
-            resizePointsNormals(prev_.points_pyr[i-1], prev_.normals_pyr[i-1], prev_.points_pyr[i], prev_.normals_pyr[i]);
-#endif
-        cuda::waitAllDefaultStream();
+      raycast_prev();
+      stage_done(ScannerTimes::RAYCAST);
     }
 
-    return ++frame_counter_, true;
+    return frame_done(), ++frame_counter_, true;
 }
 
 void vm::scanner::Scanner::renderImage(cuda::Image& image, int flag)
 {
+  CV_Assert(!on_cpu());
   const ScannerParams& p = params_;
   image.create(p.rows, flag != 3 ? p.cols : p.cols * 2);
 
@@ -254,11 +968,13 @@ void vm::scanner::Scanner::renderImage(cuda::Image& image, int flag)
 
 void vm::scanner::Scanner::renderImage(cuda::Image& image, const Affine3f& pose, int flag)
 {
+  CV_Assert(!on_cpu());
   const ScannerParams& p = params_;
   image.create(p.rows, flag != 3 ? p.cols : p.cols * 2);
   depths_.create(p.rows, p.cols);
   normals_.create(p.rows, p.cols);
   points_.create(p.rows, p.cols);
+  update_rays();
 
 #if defined USE_DEPTH
   #define PASS1 depths_
@@ -266,7 +982,7 @@ void vm::scanner::Scanner::renderImage(cuda::Image& image, const Affine3f& pose,
   #define PASS1 points_
 #endif
 
-  volume_->raycast(pose, p.intr, PASS1, normals_);
+  volume_->raycast(pose, p.intr, PASS1, normals_, rays_[0]);
 
   if (flag < 1 || flag > 3)
     cuda::renderImage(PASS1, normals_, params_.intr, params_.light_pose, image);
@@ -281,4 +997,80 @@ void vm::scanner::Scanner::renderImage(cuda::Image& image, const Affine3f& pose,
     cuda::renderTangentColors(normals_, i2);
 	}
 	#undef PASS1
-}
\ No newline at end of file
+}
+
+void vm::scanner::Scanner::renderImage(cpu::Image& image, int flag)
+{
+  if (!on_cpu())
+  {
+    renderImage(image_download_, flag);
+    image.create(image_download_.rows(), image_download_.cols());
+    image_download_.download(image.ptr<void>(), image.step);
+    return;
+  }
+
+  const ScannerParams& p = params_;
+  image.create(p.rows, flag != 3 ? p.cols : p.cols * 2);
+
+#if defined USE_DEPTH
+  #define PASS1 cpu_prev_.depth_pyr
+#else
+  #define PASS1 cpu_prev_.points_pyr
+#endif
+
+  if (flag < 1 || flag > 3)
+    cpu::renderImage(PASS1[0], cpu_prev_.normals_pyr[0], params_.intr, params_.light_pose, image);
+  else if (flag == 2)
+    cpu::renderTangentColors(cpu_prev_.normals_pyr[0], image);
+  else /* if (flag == 3) */
+  {
+    cpu::Image i1 = image.colRange(0, p.cols), i2 = image.colRange(p.cols, p.cols * 2);
+
+    cpu::renderImage(PASS1[0], cpu_prev_.normals_pyr[0], params_.intr, params_.light_pose, i1);
+#if defined USE_DEPTH
+    cpu::renderTangentColors(cpu_prev_.normals_pyr[0], i2);
+#else
+    if (cpu_images_.empty())
+      cpu::renderTangentColors(cpu_prev_.normals_pyr[0], i2);
+    else
+      cpu::renderVertexColors(PASS1[0], cpu_prev_.normals_pyr[0], params_.intr, params_.light_pose, cpu_images_, i2);
+#endif
+  }
+  #undef PASS1
+}
+
+void vm::scanner::Scanner::renderImage(cpu::Image& image, const Affine3f& pose, int flag)
+{
+  if (!on_cpu())
+  {
+    renderImage(image_download_, pose, flag);
+    image.create(image_download_.rows(), image_download_.cols());
+    image_download_.download(image.ptr<void>(), image.step);
+    return;
+  }
+
+  const ScannerParams& p = params_;
+  image.create(p.rows, flag != 3 ? p.cols : p.cols * 2);
+  update_rays();
+
+#if defined USE_DEPTH
+  #define PASS1 cpu_depths_
+#else
+  #define PASS1 cpu_points_
+#endif
+
+  cpu_volume_->raycast(pose, p.intr, PASS1, cpu_normals_, cpu_rays_[0]);
+
+  if (flag < 1 || flag > 3)
+    cpu::renderImage(PASS1, cpu_normals_, params_.intr, params_.light_pose, image);
+  else if (flag == 2)
+    cpu::renderTangentColors(cpu_normals_, image);
+  else /* if (flag == 3) */
+  {
+    cpu::Image i1 = image.colRange(0, p.cols), i2 = image.colRange(p.cols, p.cols * 2);
+
+    cpu::renderImage(PASS1, cpu_normals_, params_.intr, params_.light_pose, i1);
+    cpu::renderTangentColors(cpu_normals_, i2);
+  }
+  #undef PASS1
+}
@@ -0,0 +1,563 @@
+#include <scanner/precomp.hpp>
+#include <scanner/cpu/internal.hpp>
+#include <scanner/session.hpp>
+#include <scanner/trace.hpp>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vm::scanner;
+
+namespace
+{
+  inline bool isLittleEndian()
+  {
+    const unsigned int one = 1;
+    return *(const unsigned char*)&one == 1;
+  }
+
+  void put(FILE* file, const void* data, size_t size)
+  {
+    if (size && fwrite(data, 1, size, file) != size)
+      CV_Error(CV_StsError, "Can't write session file");
+  }
+
+  cv::Mat decodeImage(const unsigned char* data, unsigned int bytes, int rows, int cols, int type)
+  {
+    cv::Mat encoded(1, (int)bytes, CV_8U, (void*)data);
+    cv::Mat image = cv::imdecode(encoded, -1 /* as stored */);
+
+    if (image.rows != rows || image.cols != cols || image.type() != type)
+      CV_Error(CV_StsError, "Corrupted frame in session file");
+    return image;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// SessionRecorder
+
+struct vm::scanner::SessionRecorder::Impl
+{
+  struct Slot
+  {
+    SessionFrame frame;
+    cv::Mat_<unsigned short> dists;
+    cpu::Image colors;
+  };
+
+  enum { WAIT_US = 1000 };
+
+  FILE* file;
+  SessionHeader header;
+  std::vector< cv::Ptr<Slot> > slots;
+
+  // head is advanced by add(), tail by the writer once a slot is on disk, so add() never overwrites the one being written
+  volatile unsigned int head, tail;
+  volatile int closing;
+  volatile int64 recorded, dropped;
+  int segment, last_frame;
+
+  pthread_t thread;
+  bool running;
+  bool failed;
+  std::string error; // the first failure, close() reports it
+
+  // writer thread only
+  std::vector<unsigned char> dists_bytes, color_bytes;
+  cv::Mat bgr;
+
+  Impl() : file(0), head(0), tail(0), closing(0), recorded(0), dropped(0), segment(0), last_frame(-1), running(false), failed(false) {}
+
+  void write(Slot& slot)
+  {
+    std::vector<int> png(2), jpeg(2);
+    png[0] = CV_IMWRITE_PNG_COMPRESSION, png[1] = 1;
+    jpeg[0] = CV_IMWRITE_JPEG_QUALITY, jpeg[1] = 90;
+
+    {
+      TraceScope trace("encode frame");
+      if (!cv::imencode(".png", slot.dists, dists_bytes, png))
+        CV_Error(CV_StsError, "Can't encode session frame");
+
+      color_bytes.clear();
+      if (!slot.colors.empty())
+      {
+        cv::cvtColor(slot.colors, bgr, CV_BGRA2BGR);
+        if (!cv::imencode(".jpg", bgr, color_bytes, jpeg))
+          CV_Error(CV_StsError, "Can't encode session frame");
+      }
+    }
+
+    slot.frame.dists_bytes = (unsigned int)dists_bytes.size();
+    slot.frame.color_bytes = (unsigned int)color_bytes.size();
+
+    put(file, &slot.frame, sizeof(slot.frame));
+    put(file, &dists_bytes[0], dists_bytes.size());
+    put(file, color_bytes.empty() ? 0 : &color_bytes[0], color_bytes.size());
+    __sync_fetch_and_add(&recorded, 1);
+  }
+
+  void open(const std::string& filename, int cols, int rows, const Intr& intr, const Vec3f& size, const Affine3f& pose, float trunc_dist, int capacity);
+
+  /** Slot the frame goes to with its header filled in, null if the ring is full and the frame is dropped. add() bumps head once the rest is in. */
+  Slot* acquire(int frame, const Affine3f& pose, int sensor, const Affine3f& sensor_pose)
+  {
+    // a reset or a restore takes the scanner back to an earlier pose, other sensors share the pose of the last frame
+    if (frame < last_frame || (frame == last_frame && sensor == 0))
+      ++segment;
+    last_frame = frame;
+
+    if (head - tail >= slots.size())
+      return __sync_fetch_and_add(&dropped, 1), (Slot*)0;
+
+    Slot& slot = *slots[head % slots.size()];
+    slot.frame.frame = frame;
+    slot.frame.segment = segment;
+    slot.frame.sensor = sensor;
+    std::copy(pose.matrix.val, pose.matrix.val + 16, slot.frame.pose);
+    std::copy(sensor_pose.matrix.val, sensor_pose.matrix.val + 16, slot.frame.sensor_pose);
+    return &slot;
+  }
+
+  static void* run(void* pthis)
+  {
+    Impl& impl = *static_cast<Impl*>(pthis);
+    Trace::setThreadName("session recorder");
+
+    for(;;)
+    {
+      // read before checking the ring so frames queued right before close() still go out
+      bool closing = impl.closing != 0;
+
+      if (impl.tail == impl.head)
+      {
+        if (closing)
+          break;
+        usleep(WAIT_US);
+        continue;
+      }
+
+      // after a failure the ring is still drained, so add() doesn't start dropping frames
+      Slot& slot = *impl.slots[impl.tail % impl.slots.size()];
+      try
+      {
+        if (!impl.failed)
+          impl.write(slot);
+      }
+      catch(const std::exception& e)
+      {
+        impl.error = e.what();
+        impl.failed = true;
+      }
+      __sync_fetch_and_add(&impl.tail, 1);
+    }
+    return 0;
+  }
+};
+
+vm::scanner::SessionRecorder::SessionRecorder() : impl_(new Impl()) {}
+vm::scanner::SessionRecorder::~SessionRecorder() { close(); }
+
+void vm::scanner::SessionRecorder::open(const std::string& filename, int cols, int rows, const Intr& intr, const cuda::TsdfVolume& volume, int capacity)
+{
+  close();
+  impl_->open(filename, cols, rows, intr, volume.getSize(), volume.getPose(), volume.getTruncDist(), capacity);
+}
+
+void vm::scanner::SessionRecorder::open(const std::string& filename, int cols, int rows, const Intr& intr, const cpu::TsdfVolume& volume, int capacity)
+{
+  close();
+  impl_->open(filename, cols, rows, intr, volume.getSize(), volume.getPose(), volume.getTruncDist(), capacity);
+}
+
+void vm::scanner::SessionRecorder::Impl::open(const std::string& filename, int cols, int rows, const Intr& intr,
+                                              const Vec3f& size, const Affine3f& pose, float trunc_dist, int capacity)
+{
+  CV_Assert(isLittleEndian() && capacity >= 1);
+
+  file = fopen(filename.c_str(), "wb");
+  if (!file)
+    CV_Error(CV_StsError, "Can't open " + filename + " for writing");
+
+  SessionHeader& h = header;
+  memset(&h, 0, sizeof(h));
+  h.magic = SessionHeader::MAGIC;
+  h.version = SessionHeader::VERSION;
+  h.cols = cols;
+  h.rows = rows;
+  h.intr[0] = intr.fx, h.intr[1] = intr.fy, h.intr[2] = intr.cx, h.intr[3] = intr.cy;
+
+  std::copy(size.val, size.val + 3, h.volume_size);
+  std::copy(pose.matrix.val, pose.matrix.val + 16, h.volume_pose);
+  h.trunc_dist = trunc_dist;
+
+  // the frame count goes in on close()
+  try { put(file, &h, sizeof(h)); }
+  catch(...) { fclose(file); file = 0; throw; }
+
+  slots.resize(capacity);
+  for(size_t i = 0; i < slots.size(); ++i)
+  {
+    slots[i] = new Slot();
+    slots[i]->dists.create(rows, cols);
+  }
+
+  head = tail = 0;
+  closing = 0;
+  recorded = dropped = 0;
+  segment = 0;
+  last_frame = -1;
+  failed = false;
+  error.clear();
+
+  if (pthread_create(&thread, 0, &Impl::run, this) != 0)
+  {
+    fclose(file);
+    file = 0;
+    CV_Error(CV_StsError, "Can't start session recorder thread");
+  }
+  running = true;
+}
+
+bool vm::scanner::SessionRecorder::close()
+{
+  Impl& impl = *impl_;
+  if (!impl.running)
+    return true;
+
+  __sync_lock_test_and_set(&impl.closing, 1);
+  pthread_join(impl.thread, 0);
+  impl.running = false;
+
+  try
+  {
+    impl.header.frames = (int)impl.recorded;
+    if (fseek(impl.file, 0, SEEK_SET) != 0)
+      CV_Error(CV_StsError, "Can't write session file");
+    put(impl.file, &impl.header, sizeof(impl.header));
+  }
+  catch(const std::exception& e)
+  {
+    if (!impl.failed)
+      impl.error = e.what();
+    impl.failed = true;
+  }
+
+  if (fclose(impl.file) != 0 && !impl.failed)
+  {
+    impl.error = "Can't write session file";
+    impl.failed = true;
+  }
+  impl.file = 0;
+
+  return !impl.failed;
+}
+
+bool vm::scanner::SessionRecorder::isOpen() const { return impl_->running; }
+const std::string& vm::scanner::SessionRecorder::error() const { return impl_->error; }
+
+bool vm::scanner::SessionRecorder::add(int frame, const Affine3f& pose, const cuda::Dists& dists, const cuda::Image& colors,
+                                       int sensor, const Affine3f& sensor_pose)
+{
+  Impl& impl = *impl_;
+  if (!impl.running)
+    return false;
+
+  CV_Assert(dists.rows() == impl.header.rows && dists.cols() == impl.header.cols);
+  CV_Assert(colors.empty() || (colors.rows() == dists.rows() && colors.cols() == dists.cols()));
+
+  Impl::Slot* slot = impl.acquire(frame, pose, sensor, sensor_pose);
+  if (!slot)
+    return false;
+
+  TraceScope trace("record frame");
+  dists.download(slot->dists.ptr<void>(), slot->dists.step);
+
+  if (colors.empty())
+    slot->colors.release();
+  else
+  {
+    slot->colors.create(colors.rows(), colors.cols());
+    colors.download(slot->colors.ptr<void>(), slot->colors.step);
+  }
+
+  __sync_fetch_and_add(&impl.head, 1);
+  return true;
+}
+
+bool vm::scanner::SessionRecorder::add(int frame, const Affine3f& pose, const cpu::Dists& dists, const cpu::Image& colors,
+                                       int sensor, const Affine3f& sensor_pose)
+{
+  Impl& impl = *impl_;
+  if (!impl.running)
+    return false;
+
+  CV_Assert(dists.rows == impl.header.rows && dists.cols == impl.header.cols);
+  CV_Assert(colors.empty() || (colors.rows == dists.rows && colors.cols == dists.cols));
+
+  Impl::Slot* slot = impl.acquire(frame, pose, sensor, sensor_pose);
+  if (!slot)
+    return false;
+
+  // stored as the half floats the device fuses, so sessions don't depend on the backend that recorded them
+  TraceScope trace("record frame");
+  for(int y = 0; y < dists.rows; ++y)
+  {
+    const float* src = dists[y];
+    unsigned short* dst = slot->dists[y];
+    for(int x = 0; x < dists.cols; ++x)
+      dst[x] = host::float2half(src[x]);
+  }
+
+  if (colors.empty())
+    slot->colors.release();
+  else
+    colors.copyTo(slot->colors);
+
+  __sync_fetch_and_add(&impl.head, 1);
+  return true;
+}
+
+int64 vm::scanner::SessionRecorder::recorded() const { return impl_->recorded; }
+int64 vm::scanner::SessionRecorder::dropped() const { return impl_->dropped; }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// SessionReader
+
+vm::scanner::SessionReader::SessionReader(const std::string& filename) : data_(0), size_(0)
+{
+  CV_Assert(isLittleEndian());
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    CV_Error(CV_StsError, "Can't open " + filename);
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SessionHeader))
+  {
+    void* map = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      data_ = (const unsigned char*)map;
+      size_ = (size_t)st.st_size;
+    }
+  }
+  close(fd);
+
+  if (!data_)
+    CV_Error(CV_StsError, "Can't map " + filename);
+
+  const SessionHeader& h = header();
+  if (h.magic != SessionHeader::MAGIC || h.version != SessionHeader::VERSION || h.cols <= 0 || h.rows <= 0)
+  {
+    munmap((void*)data_, size_);
+    CV_Error(CV_StsError, filename + " isn't a scanning session");
+  }
+
+  // frames of a recording that wasn't closed are there up to the last one written whole
+  size_t offset = sizeof(SessionHeader);
+  while(offset + sizeof(SessionFrame) <= size_)
+  {
+    const SessionFrame& f = *(const SessionFrame*)(data_ + offset);
+    size_t end = offset + sizeof(SessionFrame) + (size_t)f.dists_bytes + f.color_bytes;
+    if (end > size_ || f.dists_bytes == 0)
+      break;
+
+    offsets_.push_back(offset);
+    offset = end;
+  }
+}
+
+vm::scanner::SessionReader::~SessionReader()
+{ munmap((void*)data_, size_); }
+
+const vm::scanner::SessionHeader& vm::scanner::SessionReader::header() const
+{ return *(const SessionHeader*)data_; }
+
+vm::scanner::Intr vm::scanner::SessionReader::intr() const
+{
+  const float* intr = header().intr;
+  return Intr(intr[0], intr[1], intr[2], intr[3]);
+}
+
+int vm::scanner::SessionReader::size() const { return (int)offsets_.size(); }
+
+const vm::scanner::SessionFrame& vm::scanner::SessionReader::frame(int i) const
+{
+  CV_Assert(0 <= i && i < size());
+  return *(const SessionFrame*)(data_ + offsets_[i]);
+}
+
+vm::scanner::Affine3f vm::scanner::SessionReader::pose(int i) const
+{
+  const SessionFrame& f = frame(i);
+  Affine3f pose, sensor_pose;
+  std::copy(f.pose, f.pose + 16, pose.matrix.val);
+  std::copy(f.sensor_pose, f.sensor_pose + 16, sensor_pose.matrix.val);
+  return pose * sensor_pose;
+}
+
+int vm::scanner::SessionReader::lastSegment() const
+{ return size() ? frame(size() - 1).segment : 0; }
+
+void vm::scanner::SessionReader::decode(int i, cv::Mat_<unsigned short>& dists, cpu::Image& colors) const
+{
+  const SessionHeader& h = header();
+  const SessionFrame& f = frame(i);
+  const unsigned char* data = (const unsigned char*)&f + sizeof(SessionFrame);
+
+  dists = decodeImage(data, f.dists_bytes, h.rows, h.cols, CV_16U);
+
+  colors.release();
+  if (f.color_bytes)
+  {
+    cv::Mat bgr = decodeImage(data + f.dists_bytes, f.color_bytes, h.rows, h.cols, CV_8UC3);
+    cv::cvtColor(bgr, colors, CV_BGR2BGRA);
+  }
+}
+
+void vm::scanner::SessionReader::decode(int i, cpu::Dists& dists, cpu::Image& colors) const
+{
+  cv::Mat_<unsigned short> halfs;
+  decode(i, halfs, colors);
+
+  dists.create(halfs.rows, halfs.cols);
+  for(int y = 0; y < halfs.rows; ++y)
+  {
+    const unsigned short* src = halfs[y];
+    float* dst = dists[y];
+    for(int x = 0; x < halfs.cols; ++x)
+      dst[x] = host::half2float(src[x]);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Refusion
+
+namespace
+{
+  /** Frames of the segment in recording order */
+  std::vector<int> segmentFrames(const SessionReader& session, int segment, const std::vector<Affine3f>& poses)
+  {
+    if (segment < 0)
+      segment = session.lastSegment();
+
+    std::vector<int> frames;
+    for(int i = 0; i < session.size(); ++i)
+      if (session.frame(i).segment == segment)
+      {
+        CV_Assert(poses.empty() || session.frame(i).frame < (int)poses.size());
+        frames.push_back(i);
+      }
+    return frames;
+  }
+
+  inline Affine3f framePose(const SessionReader& session, int i, const std::vector<Affine3f>& poses)
+  {
+    if (poses.empty())
+      return session.pose(i);
+
+    const float* m = session.frame(i).sensor_pose;
+    Affine3f sensor_pose;
+    std::copy(m, m + 16, sensor_pose.matrix.val);
+    return poses[session.frame(i).frame] * sensor_pose;
+  }
+
+  template<typename DistsType>
+  struct FrameDecoder : public cv::ParallelLoopBody
+  {
+    const SessionReader& session;
+    const int* frames;
+    std::vector<DistsType>& dists;
+    std::vector<cpu::Image>& colors;
+
+    FrameDecoder(const SessionReader& s, const int* f, std::vector<DistsType>& d, std::vector<cpu::Image>& c)
+      : session(s), frames(f), dists(d), colors(c) {}
+
+    void operator()(const cv::Range& range) const
+    {
+      for(int i = range.start; i < range.end; ++i)
+        session.decode(frames[i], dists[i], colors[i]);
+    }
+  };
+}
+
+int vm::scanner::refuseSession(const SessionReader& session, cpu::TsdfVolume& volume, const std::vector<Affine3f>& poses, int segment, int batch)
+{
+  CV_Assert(batch > 0);
+  TraceScope trace("refuse session");
+
+  std::vector<int> frames = segmentFrames(session, segment, poses);
+  Intr intr = session.intr();
+
+  std::vector<cpu::Dists> dists;
+  std::vector<cpu::Image> colors;
+  std::vector<Affine3f> batch_poses;
+
+  for(size_t start = 0; start < frames.size(); start += batch)
+  {
+    int count = (int)std::min(frames.size() - start, (size_t)batch);
+    dists.resize(count);
+    colors.resize(count);
+    batch_poses.resize(count);
+
+    {
+      TraceScope trace_decode("decode batch");
+      cv::parallel_for_(cv::Range(0, count), FrameDecoder<cpu::Dists>(session, &frames[start], dists, colors));
+    }
+
+    for(int i = 0; i < count; ++i)
+      batch_poses[i] = framePose(session, frames[start + i], poses);
+
+    TraceScope trace_integrate("integrate batch");
+    volume.integrate(dists, colors, batch_poses, intr);
+  }
+  return (int)frames.size();
+}
+
+int vm::scanner::refuseSession(const SessionReader& session, cuda::TsdfVolume& volume, const std::vector<Affine3f>& poses, int segment)
+{
+  TraceScope trace("refuse session");
+
+  std::vector<int> frames = segmentFrames(session, segment, poses);
+  Intr intr = session.intr();
+
+  // decoding is what takes the time, so a batch is decoded in parallel and then uploaded frame by frame
+  const int batch = std::max(cv::getNumThreads(), 1) * 2;
+
+  std::vector< cv::Mat_<unsigned short> > halfs(batch);
+  std::vector<cpu::Image> colors(batch);
+
+  cuda::Dists dists_device;
+  cuda::Image colors_device;
+
+  for(size_t start = 0; start < frames.size(); start += batch)
+  {
+    int count = (int)std::min(frames.size() - start, (size_t)batch);
+    cv::parallel_for_(cv::Range(0, count), FrameDecoder< cv::Mat_<unsigned short> >(session, &frames[start], halfs, colors));
+
+    for(int i = 0; i < count; ++i)
+    {
+      dists_device.upload(halfs[i].data, halfs[i].step, halfs[i].rows, halfs[i].cols);
+      // a frame without color goes in as it did live, with an empty image
+      if (colors[i].empty())
+        colors_device.release();
+      else
+        colors_device.upload(colors[i].data, colors[i].step, colors[i].rows, colors[i].cols);
+
+      volume.integrate(dists_device, colors_device, framePose(session, frames[start + i], poses), intr);
+    }
+  }
+  cuda::waitAllDefaultStream();
+  return (int)frames.size();
+}
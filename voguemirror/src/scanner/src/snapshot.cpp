@@ -0,0 +1,545 @@
+#include <scanner/precomp.hpp>
+#include <scanner/cpu/internal.hpp>
+#include <scanner/snapshot.hpp>
+#include <scanner/trace.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vm::scanner;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Snapshot format
+
+namespace
+{
+  /** Non empty bricks of a volume on the host, raw voxels back to back */
+  struct Bricks
+  {
+    SnapshotHeader header;
+    std::vector<int> indices;
+    std::vector<unsigned char> voxels;
+    std::vector<Affine3f> poses;
+  };
+
+  inline bool isLittleEndian()
+  {
+    const unsigned int one = 1;
+    return *(const unsigned char*)&one == 1;
+  }
+
+  inline bool isEmpty(const unsigned char* data, size_t size)
+  {
+    for(size_t i = 0; i < size; ++i)
+      if (data[i])
+        return false;
+    return true;
+  }
+
+  /** Runs of at least two equal voxels become one, the rest goes out as literals. Returns the packed size, dst holds
+    * count * voxel_bytes + count / 128 + 1 bytes. */
+  size_t packVoxels(const unsigned char* src, int count, int voxel_bytes, unsigned char* dst)
+  {
+    size_t size = 0;
+    for(int i = 0; i < count; )
+    {
+      const unsigned char* v = src + i * voxel_bytes;
+
+      int run = 1;
+      while(i + run < count && run < 129 && !memcmp(v, v + run * voxel_bytes, voxel_bytes))
+        ++run;
+
+      if (run > 1)
+      {
+        dst[size++] = (unsigned char)(run + 126);
+        memcpy(dst + size, v, voxel_bytes);
+        size += voxel_bytes;
+        i += run;
+        continue;
+      }
+
+      // literals up to the next run
+      int literals = 1;
+      while(i + literals < count && literals < 128 &&
+            (i + literals + 1 == count || memcmp(v + literals * voxel_bytes, v + (literals + 1) * voxel_bytes, voxel_bytes)))
+        ++literals;
+
+      dst[size++] = (unsigned char)(literals - 1);
+      memcpy(dst + size, v, literals * voxel_bytes);
+      size += literals * voxel_bytes;
+      i += literals;
+    }
+    return size;
+  }
+
+  /** False if src doesn't unpack into exactly count voxels */
+  bool unpackVoxels(const unsigned char* src, size_t size, int count, int voxel_bytes, unsigned char* dst)
+  {
+    const unsigned char* end = src + size;
+    int i = 0;
+    while(src < end)
+    {
+      int c = *src++;
+      int n = c < 128 ? c + 1 : c - 126;
+      size_t bytes = (size_t)(c < 128 ? n : 1) * voxel_bytes;
+
+      if (i + n > count || (size_t)(end - src) < bytes)
+        return false;
+
+      if (c < 128)
+        memcpy(dst + (size_t)i * voxel_bytes, src, bytes);
+      else
+        for(int k = 0; k < n; ++k)
+          memcpy(dst + (size_t)(i + k) * voxel_bytes, src, voxel_bytes);
+
+      src += bytes;
+      i += n;
+    }
+    return i == count;
+  }
+
+  /** Voxels of brick (bx, by) of a layer of nz storage slices, zero past the volume. Snapshot bricks are x fastest
+    * whatever the volume's VoxelOrder, a layer starts at a multiple of 8 so its bricked voxels are in place too. */
+  void copyBrick(const unsigned char* layer, const Vec3i& dims, int order, int nz, int bx, int by, int voxel_bytes, unsigned char* brick)
+  {
+    const int size = SnapshotHeader::BRICK_SIZE;
+    memset(brick, 0, (size_t)size * size * size * voxel_bytes);
+
+    int nx = std::min(size, dims[0] - bx * size);
+    int ny = std::min(size, dims[1] - by * size);
+
+    for(int z = 0; z < nz; ++z)
+      for(int y = 0; y < ny; ++y)
+      {
+        unsigned char* dst = brick + ((size_t)z * size + y) * size * voxel_bytes;
+
+        if (order == cuda::TsdfVolume::ORDER_LINEAR)
+          memcpy(dst, layer + host::voxel_offset(bx * size, by * size + y, z, dims, order) * voxel_bytes, (size_t)nx * voxel_bytes);
+        else
+          for(int x = 0; x < nx; ++x)
+            memcpy(dst + (size_t)x * voxel_bytes, layer + host::voxel_offset(bx * size + x, by * size + y, z, dims, order) * voxel_bytes, voxel_bytes);
+      }
+  }
+
+  /** The inverse of copyBrick */
+  void pasteBrick(const unsigned char* brick, const Vec3i& dims, int order, int nz, int bx, int by, int voxel_bytes, unsigned char* layer)
+  {
+    const int size = SnapshotHeader::BRICK_SIZE;
+
+    int nx = std::min(size, dims[0] - bx * size);
+    int ny = std::min(size, dims[1] - by * size);
+
+    for(int z = 0; z < nz; ++z)
+      for(int y = 0; y < ny; ++y)
+      {
+        const unsigned char* src = brick + ((size_t)z * size + y) * size * voxel_bytes;
+
+        if (order == cuda::TsdfVolume::ORDER_LINEAR)
+          memcpy(layer + host::voxel_offset(bx * size, by * size + y, z, dims, order) * voxel_bytes, src, (size_t)nx * voxel_bytes);
+        else
+          for(int x = 0; x < nx; ++x)
+            memcpy(layer + host::voxel_offset(bx * size + x, by * size + y, z, dims, order) * voxel_bytes, src + (size_t)x * voxel_bytes, voxel_bytes);
+      }
+  }
+
+  /** Downloads the volume a brick layer at a time and keeps its non empty bricks */
+  void gather(const cuda::TsdfVolume& volume, const std::vector<Affine3f>& poses, Bricks& bricks)
+  {
+    TraceScope trace("gather snapshot");
+
+    CudaData data = volume.data();
+    if (data.empty())
+      CV_Error(CV_StsNotImplemented, "Snapshots are taken of the dense volume only");
+
+    SnapshotHeader& h = bricks.header;
+    memset(&h, 0, sizeof(h));
+    h.magic = SnapshotHeader::MAGIC;
+    h.version = SnapshotHeader::VERSION;
+    h.layout = volume.getLayout();
+
+    Vec3i dims = volume.getDims(), origin = volume.getGridOrigin();
+    Vec3f size = volume.getSize();
+    Affine3f pose = volume.getPose();
+
+    h.voxel_bytes = (int)(data.sizeBytes() / ((size_t)dims[0] * dims[1] * dims[2]));
+    std::copy(dims.val, dims.val + 3, h.dims);
+    std::copy(size.val, size.val + 3, h.size);
+    std::copy(pose.matrix.val, pose.matrix.val + 16, h.pose);
+    h.trunc_dist = volume.getTruncDist();
+    h.max_weight = volume.getMaxWeight();
+    std::copy(origin.val, origin.val + 3, h.grid_origin);
+    h.poses = (int)poses.size();
+
+    const int bs = SnapshotHeader::BRICK_SIZE;
+    Vec3i brick_dims = h.brickDims();
+    size_t slice_bytes = (size_t)dims[0] * dims[1] * h.voxel_bytes;
+
+    std::vector<unsigned char> layer(slice_bytes * bs), brick(h.brickBytes());
+    bricks.indices.clear();
+    bricks.voxels.clear();
+
+    for(int bz = 0; bz < brick_dims[2]; ++bz)
+    {
+      int nz = std::min(bs, dims[2] - bz * bs);
+      cuda::DeviceArray<unsigned char>(data.ptr<unsigned char>() + bz * bs * slice_bytes, nz * slice_bytes).download(&layer[0]);
+
+      for(int by = 0; by < brick_dims[1]; ++by)
+        for(int bx = 0; bx < brick_dims[0]; ++bx)
+        {
+          copyBrick(&layer[0], dims, volume.getOrder(), nz, bx, by, h.voxel_bytes, &brick[0]);
+          if (isEmpty(&brick[0], brick.size()))
+            continue;
+
+          bricks.indices.push_back((bz * brick_dims[1] + by) * brick_dims[0] + bx);
+          bricks.voxels.insert(bricks.voxels.end(), brick.begin(), brick.end());
+        }
+    }
+
+    h.bricks = (int)bricks.indices.size();
+    bricks.poses = poses;
+  }
+
+  void put(FILE* file, const void* data, size_t size)
+  {
+    if (size && fwrite(data, 1, size, file) != size)
+      CV_Error(CV_StsError, "Can't write snapshot file");
+  }
+
+  void write(const std::string& filename, Bricks& bricks, bool compress)
+  {
+    TraceScope trace("write snapshot");
+    CV_Assert(isLittleEndian());
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file)
+      CV_Error(CV_StsError, "Can't open " + filename + " for writing");
+
+    try
+    {
+      SnapshotHeader& h = bricks.header;
+      size_t brick_bytes = h.brickBytes();
+      int count = (int)(brick_bytes / h.voxel_bytes);
+
+      std::vector<SnapshotBrick> table(h.bricks);
+      std::vector<unsigned char> packed(brick_bytes + count / 128 + 1);
+
+      // the header goes out again at the end, with the offsets
+      put(file, &h, sizeof(h));
+      uint64 offset = sizeof(h);
+
+      for(int i = 0; i < h.bricks; ++i)
+      {
+        const unsigned char* raw = &bricks.voxels[i * brick_bytes];
+        size_t size = compress ? packVoxels(raw, count, h.voxel_bytes, &packed[0]) : brick_bytes;
+
+        table[i].index = bricks.indices[i];
+        table[i].bytes = (unsigned int)std::min(size, brick_bytes);
+        table[i].offset = offset;
+
+        put(file, size < brick_bytes ? &packed[0] : raw, table[i].bytes);
+        offset += table[i].bytes;
+      }
+
+      h.table_offset = offset;
+      put(file, table.empty() ? 0 : &table[0], table.size() * sizeof(SnapshotBrick));
+      offset += table.size() * sizeof(SnapshotBrick);
+
+      h.poses_offset = offset;
+      for(size_t i = 0; i < bricks.poses.size(); ++i)
+        put(file, bricks.poses[i].matrix.val, 16 * sizeof(float));
+
+      if (fseek(file, 0, SEEK_SET) != 0)
+        CV_Error(CV_StsError, "Can't write snapshot file");
+      put(file, &h, sizeof(h));
+    }
+    catch(...)
+    {
+      fclose(file);
+      throw;
+    }
+
+    if (fclose(file) != 0)
+      CV_Error(CV_StsError, "Can't finish writing snapshot file");
+  }
+}
+
+vm::scanner::Vec3i vm::scanner::SnapshotHeader::brickDims() const
+{
+  return Vec3i((dims[0] + BRICK_SIZE - 1) / BRICK_SIZE, (dims[1] + BRICK_SIZE - 1) / BRICK_SIZE, (dims[2] + BRICK_SIZE - 1) / BRICK_SIZE);
+}
+
+size_t vm::scanner::SnapshotHeader::brickBytes() const
+{ return (size_t)BRICK_SIZE * BRICK_SIZE * BRICK_SIZE * voxel_bytes; }
+
+void vm::scanner::saveSnapshot(const std::string& filename, const cuda::TsdfVolume& volume, const std::vector<Affine3f>& poses, bool compress)
+{
+  Bricks bricks;
+  gather(volume, poses, bricks);
+  write(filename, bricks, compress);
+}
+
+void vm::scanner::loadSnapshot(const std::string& filename, cuda::TsdfVolume& volume, std::vector<Affine3f>* poses)
+{
+  TraceScope trace("load snapshot");
+
+  SnapshotReader reader(filename);
+  const SnapshotHeader& h = reader.header();
+
+  CudaData data = volume.data();
+  Vec3i dims = volume.getDims();
+
+  if (data.empty() || Vec3i(h.dims[0], h.dims[1], h.dims[2]) != dims || h.layout != volume.getLayout())
+    CV_Error(CV_StsBadArg, "The snapshot doesn't match the dims and the voxel layout of the volume");
+
+  const int bs = SnapshotHeader::BRICK_SIZE;
+  Vec3i brick_dims = h.brickDims();
+  size_t slice_bytes = (size_t)dims[0] * dims[1] * h.voxel_bytes;
+
+  std::vector<unsigned char> layer(slice_bytes * bs), buffer;
+
+  // the table is sorted by index, so by layer
+  for(int bz = 0, i = 0; bz < brick_dims[2]; ++bz)
+  {
+    int nz = std::min(bs, dims[2] - bz * bs);
+    memset(&layer[0], 0, nz * slice_bytes);
+
+    for(; i < h.bricks && reader.brick(i).index / (brick_dims[0] * brick_dims[1]) == bz; ++i)
+    {
+      int index = reader.brick(i).index;
+      pasteBrick(reader.voxels(i, buffer), dims, volume.getOrder(), nz, index % brick_dims[0], index / brick_dims[0] % brick_dims[1], h.voxel_bytes, &layer[0]);
+    }
+
+    cuda::DeviceArray<unsigned char>(data.ptr<unsigned char>() + bz * bs * slice_bytes, nz * slice_bytes).upload(&layer[0], nz * slice_bytes);
+  }
+
+  Affine3f pose;
+  std::copy(h.pose, h.pose + 16, pose.matrix.val);
+
+  volume.setSize(Vec3f(h.size[0], h.size[1], h.size[2]));
+  volume.setTruncDist(h.trunc_dist);
+  volume.setMaxWeight(h.max_weight);
+  volume.setPose(pose);
+  volume.setGridOrigin(Vec3i(h.grid_origin[0], h.grid_origin[1], h.grid_origin[2]));
+  volume.updateBricks();
+
+  if (poses)
+    *poses = reader.poses();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// SnapshotReader
+
+vm::scanner::SnapshotReader::SnapshotReader(const std::string& filename) : data_(0), size_(0), cached_(-1)
+{
+  CV_Assert(isLittleEndian());
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    CV_Error(CV_StsError, "Can't open " + filename);
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SnapshotHeader))
+  {
+    void* map = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      data_ = (const unsigned char*)map;
+      size_ = (size_t)st.st_size;
+    }
+  }
+  close(fd);
+
+  if (!data_)
+    CV_Error(CV_StsError, "Can't map " + filename);
+
+  const SnapshotHeader& h = header();
+  bool valid = h.magic == SnapshotHeader::MAGIC && h.version == SnapshotHeader::VERSION &&
+               h.layout >= cuda::TsdfVolume::VOXEL_RGBA && h.layout <= cuda::TsdfVolume::VOXEL_GEOMETRY && h.voxel_bytes > 0 &&
+               h.dims[0] > 0 && h.dims[1] > 0 && h.dims[2] > 0 && h.bricks >= 0 && h.poses >= 0 &&
+               h.table_offset + (uint64)h.bricks * sizeof(SnapshotBrick) <= size_ &&
+               h.poses_offset + (uint64)h.poses * 16 * sizeof(float) <= size_;
+
+  for(int i = 0; valid && i < h.bricks; ++i)
+    valid = brick(i).offset + brick(i).bytes <= size_ && brick(i).bytes <= h.brickBytes();
+
+  if (!valid)
+  {
+    munmap((void*)data_, size_);
+    CV_Error(CV_StsError, filename + " isn't a volume snapshot");
+  }
+}
+
+vm::scanner::SnapshotReader::~SnapshotReader()
+{ munmap((void*)data_, size_); }
+
+const vm::scanner::SnapshotHeader& vm::scanner::SnapshotReader::header() const
+{ return *(const SnapshotHeader*)data_; }
+
+const vm::scanner::SnapshotBrick& vm::scanner::SnapshotReader::brick(int i) const
+{ return ((const SnapshotBrick*)(data_ + header().table_offset))[i]; }
+
+int vm::scanner::SnapshotReader::find(int index) const
+{
+  int lo = 0, hi = header().bricks;
+  while(lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (brick(mid).index < index)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < header().bricks && brick(lo).index == index ? lo : -1;
+}
+
+const unsigned char* vm::scanner::SnapshotReader::voxels(int i, std::vector<unsigned char>& buffer) const
+{
+  const SnapshotHeader& h = header();
+  const SnapshotBrick& b = brick(i);
+
+  if (b.bytes == h.brickBytes())
+    return data_ + b.offset;
+
+  buffer.resize(h.brickBytes());
+  if (!unpackVoxels(data_ + b.offset, b.bytes, (int)(h.brickBytes() / h.voxel_bytes), h.voxel_bytes, &buffer[0]))
+    CV_Error(CV_StsError, "Corrupted brick in volume snapshot");
+  return &buffer[0];
+}
+
+bool vm::scanner::SnapshotReader::voxel(int x, int y, int z, float& tsdf, int& weight) const
+{
+  const SnapshotHeader& h = header();
+  CV_Assert(0 <= x && x < h.dims[0] && 0 <= y && y < h.dims[1] && 0 <= z && z < h.dims[2]);
+
+  // storage position
+  x = (x + h.grid_origin[0]) % h.dims[0];
+  y = (y + h.grid_origin[1]) % h.dims[1];
+  z = (z + h.grid_origin[2]) % h.dims[2];
+
+  const int bs = SnapshotHeader::BRICK_SIZE;
+  Vec3i brick_dims = h.brickDims();
+  int i = find((z / bs * brick_dims[1] + y / bs) * brick_dims[0] + x / bs);
+
+  if (i < 0)
+    return false;
+
+  if (i != cached_)
+  {
+    const unsigned char* v = voxels(i, cache_);
+    if (v != &cache_[0])
+      cache_.assign(v, v + h.brickBytes());
+    cached_ = i;
+  }
+
+  const unsigned char* v = &cache_[(((z % bs) * bs + y % bs) * bs + x % bs) * h.voxel_bytes];
+
+  unsigned short half;
+  memcpy(&half, v, sizeof(half));
+  tsdf = cuda::TsdfVolume::Entry::half2float(half);
+
+  if (h.layout == cuda::TsdfVolume::VOXEL_RGBA)
+  {
+    unsigned short w;
+    memcpy(&w, v + 2, sizeof(w));
+    weight = w;
+  }
+  else
+    weight = v[2];
+  return true;
+}
+
+std::vector<vm::scanner::Affine3f> vm::scanner::SnapshotReader::poses() const
+{
+  const SnapshotHeader& h = header();
+  std::vector<Affine3f> poses(h.poses);
+
+  const float* m = (const float*)(data_ + h.poses_offset);
+  for(int i = 0; i < h.poses; ++i, m += 16)
+    std::copy(m, m + 16, poses[i].matrix.val);
+  return poses;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// SnapshotWriter
+
+struct vm::scanner::SnapshotWriter::Impl
+{
+  std::string filename;
+  Bricks bricks;
+  bool compress;
+
+  pthread_t thread;
+  bool running;
+  bool failed;
+  std::string error; // of the first failure wait() has to report, kept for error() after it
+  volatile int done;
+
+  Impl() : compress(true), running(false), failed(false), done(0) {}
+
+  static void* run(void* pthis)
+  {
+    Impl& impl = *static_cast<Impl*>(pthis);
+    Trace::setThreadName("snapshot writer");
+    try
+    {
+      write(impl.filename, impl.bricks, impl.compress);
+    }
+    catch(const std::exception& e)
+    {
+      if (!impl.failed)
+        impl.error = impl.filename + ": " + e.what();
+      impl.failed = true;
+    }
+    __sync_lock_test_and_set(&impl.done, 1);
+    return 0;
+  }
+
+  bool join()
+  {
+    if (running)
+      pthread_join(thread, 0);
+    running = false;
+    return !failed;
+  }
+
+  // a failure sticks until wait() reported it, the save after it doesn't clear it
+  bool report()
+  {
+    bool ok = join();
+    failed = false;
+    return ok;
+  }
+
+  void start(const std::string& file)
+  {
+    filename = file;
+    done = 0;
+
+    if (pthread_create(&thread, 0, &Impl::run, this) == 0)
+      running = true;
+    else
+      run(this); // no thread available, save inline
+  }
+};
+
+vm::scanner::SnapshotWriter::SnapshotWriter() : impl_(new Impl()) {}
+vm::scanner::SnapshotWriter::~SnapshotWriter() { wait(); }
+
+void vm::scanner::SnapshotWriter::save(const std::string& filename, const cuda::TsdfVolume& volume, const std::vector<Affine3f>& poses, bool compress)
+{
+  impl_->join();
+  gather(volume, poses, impl_->bricks);
+  impl_->compress = compress;
+  impl_->start(filename);
+}
+
+bool vm::scanner::SnapshotWriter::wait() { return impl_->report(); }
+const std::string& vm::scanner::SnapshotWriter::error() const { return impl_->error; }
+bool vm::scanner::SnapshotWriter::busy() const { return impl_->running && !impl_->done; }
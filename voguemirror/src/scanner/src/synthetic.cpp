@@ -0,0 +1,316 @@
+#include <scanner/precomp.hpp>
+#include <scanner/capture.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+using namespace vm::scanner;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Analytic scenes
+
+namespace
+{
+  /** Scene center, in the middle of the default volume, and the floor height below it. Camera y points down. */
+  const Vec3f CENTER(0.f, 0.f, 1.25f);
+  const float FLOOR_Y = 0.7f;
+
+  struct Primitive
+  {
+    enum Type { SPHERE, BOX, CAPSULE, PLANE };
+
+    int type;
+    Vec3f a, b;   // sphere center; box center and half size; capsule ends; plane normal in b
+    float r;      // sphere and capsule radius, plane offset
+    cv::Vec3b color;
+
+    static Primitive sphere(const Vec3f& c, float r, const cv::Vec3b& color)
+    { Primitive p = { SPHERE, c, Vec3f(), r, color }; return p; }
+
+    static Primitive box(const Vec3f& c, const Vec3f& half, const cv::Vec3b& color)
+    { Primitive p = { BOX, c, half, 0.f, color }; return p; }
+
+    static Primitive capsule(const Vec3f& a, const Vec3f& b, float r, const cv::Vec3b& color)
+    { Primitive p = { CAPSULE, a, b, r, color }; return p; }
+
+    static Primitive plane(const Vec3f& n, float d, const cv::Vec3b& color)
+    { Primitive p = { PLANE, Vec3f(), n, d, color }; return p; }
+
+    float distance(const Vec3f& p) const
+    {
+      switch(type)
+      {
+      case SPHERE: return (float)cv::norm(p - a) - r;
+      case PLANE:  return p.dot(b) + r;
+      case BOX:
+        {
+          Vec3f q(std::abs(p[0] - a[0]) - b[0], std::abs(p[1] - a[1]) - b[1], std::abs(p[2] - a[2]) - b[2]);
+          Vec3f outside(std::max(q[0], 0.f), std::max(q[1], 0.f), std::max(q[2], 0.f));
+          return (float)cv::norm(outside) + std::min(std::max(q[0], std::max(q[1], q[2])), 0.f);
+        }
+      default:
+        {
+          Vec3f pa = p - a, ba = b - a;
+          float h = std::min(std::max(pa.dot(ba) / ba.dot(ba), 0.f), 1.f);
+          return (float)cv::norm(pa - ba * h) - r;
+        }
+      }
+    }
+  };
+
+  typedef std::vector<Primitive> Scene;
+
+  /** Limb of the body hanging from a joint, swung around the x axis */
+  Vec3f swing(const Vec3f& joint, const Vec3f& end, float angle)
+  {
+    Vec3f d = end - joint;
+    float c = std::cos(angle), s = std::sin(angle);
+    return joint + Vec3f(d[0], c * d[1] - s * d[2], s * d[1] + c * d[2]);
+  }
+
+  void buildScene(const SyntheticSource::Params& params, int frame, Scene& scene)
+  {
+    const cv::Vec3b floor(150, 180, 200), skin(120, 150, 210), shirt(170, 90, 40), pants(80, 70, 60);
+    const float x = CENTER[0], z = CENTER[2];
+
+    scene.clear();
+    scene.push_back(Primitive::plane(Vec3f(0.f, -1.f, 0.f), FLOOR_Y, floor));
+
+    if (params.scene == SyntheticSource::BODY)
+    {
+      // 1.4m tall, so that the whole body fits into the default 1.5m volume
+      float angle = params.limb_swing * std::sin(frame * 0.2f);
+
+      Vec3f head(x, -0.57f, z), hips(x, 0.02f, z), neck(x, -0.34f, z);
+      Vec3f shoulder_l(x - 0.22f, -0.32f, z), shoulder_r(x + 0.22f, -0.32f, z);
+      Vec3f hip_l(x - 0.09f, 0.06f, z), hip_r(x + 0.09f, 0.06f, z);
+
+      scene.push_back(Primitive::sphere(head, 0.11f, skin));
+      scene.push_back(Primitive::capsule(neck, hips, 0.15f, shirt));
+      scene.push_back(Primitive::capsule(shoulder_l, swing(shoulder_l, Vec3f(x - 0.3f, 0.12f, z), angle), 0.045f, skin));
+      scene.push_back(Primitive::capsule(shoulder_r, swing(shoulder_r, Vec3f(x + 0.3f, 0.12f, z), -angle), 0.045f, skin));
+      scene.push_back(Primitive::capsule(hip_l, swing(hip_l, Vec3f(x - 0.1f, FLOOR_Y - 0.06f, z), -angle), 0.065f, pants));
+      scene.push_back(Primitive::capsule(hip_r, swing(hip_r, Vec3f(x + 0.1f, FLOOR_Y - 0.06f, z), angle), 0.065f, pants));
+    }
+    else
+    {
+      const cv::Vec3b wood(60, 110, 160), red(40, 40, 200), green(60, 170, 60), blue(190, 110, 40);
+
+      scene.push_back(Primitive::box(Vec3f(x, 0.45f, z), Vec3f(0.35f, 0.25f, 0.25f), wood));
+      scene.push_back(Primitive::sphere(Vec3f(x - 0.15f, 0.08f, z - 0.05f), 0.12f, red));
+      scene.push_back(Primitive::sphere(Vec3f(x + 0.2f, 0.12f, z + 0.08f), 0.08f, green));
+      scene.push_back(Primitive::box(Vec3f(x + 0.08f, 0.12f, z - 0.14f), Vec3f(0.06f, 0.08f, 0.05f), blue));
+    }
+  }
+
+  float sceneDistance(const Scene& scene, const Vec3f& p, int* closest = 0)
+  {
+    float best = FLT_MAX;
+    for(size_t i = 0; i < scene.size(); ++i)
+    {
+      float d = scene[i].distance(p);
+      if (d < best)
+      {
+        best = d;
+        if (closest)
+          *closest = (int)i;
+      }
+    }
+    return best;
+  }
+
+  struct Render : public cv::ParallelLoopBody
+  {
+    enum { MAX_STEPS = 128 };
+
+    const SyntheticSource::Params& params;
+    const Scene& scene;
+    Affine3f pose;
+    int frame;
+
+    cv::Mat_<unsigned short>& depth;
+    cv::Mat_<cv::Vec4b>& image;
+
+    Render(const SyntheticSource::Params& p, const Scene& s, cv::Mat_<unsigned short>& d, cv::Mat_<cv::Vec4b>& i)
+      : params(p), scene(s), depth(d), image(i) {}
+
+    virtual void operator()(const cv::Range& range) const
+    {
+      const Intr& intr = params.intr;
+      const Mat3f R = pose.rotation();
+      const Vec3f origin = pose.translation();
+
+      // one generator per row and frame, so the noise doesn't depend on how rows are split between threads
+      for(int y = range.start; y < range.end; ++y)
+      {
+        cv::RNG rng(((uint64)params.seed << 32) + (uint64)frame * params.rows + y + 1);
+
+        for(int x = 0; x < params.cols; ++x)
+        {
+          Vec3f ray((x - intr.cx) / intr.fx, (y - intr.cy) / intr.fy, 1.f);
+          float ray_len = (float)cv::norm(ray);
+          Vec3f dir = R * (ray * (1.f / ray_len));
+
+          float t = 0.2f;
+          int id = -1;
+          bool hit = false;
+          for(int i = 0; i < MAX_STEPS && t < 6.f; ++i)
+          {
+            float d = sceneDistance(scene, origin + dir * t, &id);
+            if (d < 5e-4f)
+            {
+              hit = true;
+              break;
+            }
+            t += d;
+          }
+
+          depth(y, x) = 0;
+          image(y, x) = cv::Vec4b(0, 0, 0, 255);
+          if (!hit)
+            continue;
+
+          Vec3f p = origin + dir * t;
+          const float e = 1e-3f;
+          Vec3f n(sceneDistance(scene, p + Vec3f(e, 0, 0)) - sceneDistance(scene, p - Vec3f(e, 0, 0)),
+                  sceneDistance(scene, p + Vec3f(0, e, 0)) - sceneDistance(scene, p - Vec3f(0, e, 0)),
+                  sceneDistance(scene, p + Vec3f(0, 0, e)) - sceneDistance(scene, p - Vec3f(0, 0, e)));
+          n *= 1.f / std::max((float)cv::norm(n), 1e-9f);
+
+          // head light
+          float cosine = -n.dot(dir);
+          float shade = 0.3f + 0.7f * std::max(cosine, 0.f);
+          const cv::Vec3b& c = scene[id].color;
+          image(y, x) = cv::Vec4b(cv::saturate_cast<uchar>(c[0] * shade), cv::saturate_cast<uchar>(c[1] * shade),
+                                  cv::saturate_cast<uchar>(c[2] * shade), 255);
+
+          // the sensor loses grazing surfaces and everything out of its range
+          float z = t / ray_len;
+          if (cosine < 0.15f || z < 0.4f || z > 4.f)
+            continue;
+
+          if (params.noise)
+          {
+            float sigma = 0.0012f + 0.0019f * (z - 0.4f) * (z - 0.4f);
+            z += (float)rng.gaussian(sigma);
+          }
+
+          if (params.quantize)
+          {
+            const float fb = intr.fx * 0.075f;
+            float disparity = cvRound(fb / z * 8.f) / 8.f;
+            z = disparity > 0 ? fb / disparity : 0.f;
+          }
+
+          depth(y, x) = cv::saturate_cast<unsigned short>(z * 1000.f);
+        }
+      }
+    }
+  };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// SyntheticSource
+
+vm::scanner::SyntheticSource::Params vm::scanner::SyntheticSource::Params::default_params()
+{
+  Params p;
+  p.cols = 640;  //pixels
+  p.rows = 480;  //pixels
+  p.intr = Intr(525.f, 525.f, p.cols/2 - 0.5f, p.rows/2 - 0.5f);
+  p.scene = BODY;
+  p.trajectory = ORBIT;
+  p.frames = 300;
+  p.orbit_step = deg2rad(1.f); //radians, 300 frames go most of the way around
+  p.limb_swing = 0.f;
+  p.noise = true;
+  p.quantize = true;
+  p.seed = 0;
+  return p;
+}
+
+vm::scanner::SyntheticSource::SyntheticSource() : params_(Params::default_params()), frame_(0) {}
+vm::scanner::SyntheticSource::SyntheticSource(const Params& params) : params_(params), frame_(0) {}
+
+void vm::scanner::SyntheticSource::open(const Params& params)
+{
+  params_ = params;
+  frame_ = 0;
+}
+
+const vm::scanner::SyntheticSource::Params& vm::scanner::SyntheticSource::params() const { return params_; }
+void vm::scanner::SyntheticSource::reset() { frame_ = 0; }
+int vm::scanner::SyntheticSource::frame() const { return frame_; }
+
+vm::scanner::Affine3f vm::scanner::SyntheticSource::pose(int frame) const
+{
+  float angle = 0.f;
+  Affine3f wobble;
+
+  switch(params_.trajectory)
+  {
+  case ORBIT:
+    angle = frame * params_.orbit_step;
+    break;
+  case HANDHELD:
+    // +-20 degree arc, plus a few mm and a degree of hand shake; all of it is zero at frame 0
+    angle = 0.35f * std::sin(frame * params_.orbit_step);
+    wobble = Affine3f(Vec3f(0.02f * std::sin(0.41f * frame), 0.f, 0.015f * std::sin(0.23f * frame)),
+                      Vec3f(0.01f * std::sin(0.37f * frame), 0.008f * std::sin(0.53f * frame), 0.015f * std::sin(0.29f * frame)));
+    break;
+  default:
+    break;
+  }
+
+  // turning around the vertical axis through the scene center keeps the camera looking at it
+  Affine3f orbit = Affine3f().translate(CENTER) * Affine3f(Vec3f(0.f, angle, 0.f), Vec3f()) * Affine3f().translate(-CENTER);
+  return orbit * wobble;
+}
+
+vm::scanner::Affine3f vm::scanner::SyntheticSource::pose() const { return pose(std::max(frame_ - 1, 0)); }
+
+void vm::scanner::SyntheticSource::render(int frame, cv::Mat& depth, cv::Mat& image)
+{
+  depth.create(params_.rows, params_.cols, CV_16U);
+  image.create(params_.rows, params_.cols, CV_8UC4);
+
+  Scene scene;
+  buildScene(params_, frame, scene);
+
+  cv::Mat_<unsigned short> d = depth;
+  cv::Mat_<cv::Vec4b> i = image;
+
+  Render render(params_, scene, d, i);
+  render.pose = pose(frame);
+  render.frame = frame;
+  cv::parallel_for_(cv::Range(0, params_.rows), render);
+}
+
+bool vm::scanner::SyntheticSource::grabRGBA(cv::Mat& depth, cv::Mat& image)
+{
+  if (params_.frames > 0 && frame_ >= params_.frames)
+    return false;
+
+  render(frame_++, depth, image);
+  return true;
+}
+
+bool vm::scanner::SyntheticSource::grab(cv::Mat& depth, cv::Mat& image)
+{
+  cv::Mat rgba;
+  if (!grabRGBA(depth, rgba))
+    return false;
+
+  // RGB byte layout is b, g, r, a in memory
+  image.create(rgba.rows, rgba.cols, CV_8UC3);
+  for(int y = 0; y < rgba.rows; ++y)
+  {
+    const cv::Vec4b* src = rgba.ptr<cv::Vec4b>(y);
+    cv::Vec3b* dst = image.ptr<cv::Vec3b>(y);
+    for(int x = 0; x < rgba.cols; ++x)
+      dst[x] = cv::Vec3b(src[x][0], src[x][1], src[x][2]);
+  }
+  return true;
+}
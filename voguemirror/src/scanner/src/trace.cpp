@@ -0,0 +1,309 @@
+#include <scanner/precomp.hpp>
+#include <scanner/trace.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+
+#include <pthread.h>
+
+using namespace vm::scanner;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// TimeHistogram
+
+namespace
+{
+  const double HISTOGRAM_MIN_MS = 0.01;
+  const double HISTOGRAM_BINS_PER_OCTAVE = 4.0;
+}
+
+vm::scanner::TimeHistogram::TimeHistogram() { clear(); }
+
+void vm::scanner::TimeHistogram::clear()
+{
+  std::fill(bins_, bins_ + BINS, 0);
+  pos_ = count_ = 0;
+  sum_ = 0.0;
+}
+
+void vm::scanner::TimeHistogram::add(double ms)
+{
+  if (count_ == WINDOW)
+  {
+    --bins_[binIndex(samples_[pos_])];
+    sum_ -= samples_[pos_];
+  }
+  else
+    ++count_;
+
+  samples_[pos_] = ms;
+  ++bins_[binIndex(ms)];
+  sum_ += ms;
+
+  pos_ = (pos_ + 1) % WINDOW;
+}
+
+int vm::scanner::TimeHistogram::count() const { return count_; }
+double vm::scanner::TimeHistogram::mean() const { return count_ ? sum_ / count_ : 0.0; }
+int vm::scanner::TimeHistogram::bin(int index) const { return bins_[index]; }
+
+double vm::scanner::TimeHistogram::max() const
+{
+  return count_ ? *std::max_element(samples_, samples_ + count_) : 0.0;
+}
+
+double vm::scanner::TimeHistogram::percentile(double p) const
+{
+  if (!count_)
+    return 0.0;
+
+  int rank = std::min(count_ - 1, std::max(0, (int)(p * count_)));
+
+  int seen = 0, i = 0;
+  for(; i < BINS - 1; ++i)
+    if (seen + bins_[i] > rank)
+      break;
+    else
+      seen += bins_[i];
+
+  // linear within the bin
+  double lower = i ? binUpper(i - 1) : 0.0;
+  double t = bins_[i] ? (rank - seen + 0.5) / bins_[i] : 1.0;
+  return std::min(lower + t * (binUpper(i) - lower), max());
+}
+
+double vm::scanner::TimeHistogram::binUpper(int index)
+{
+  return HISTOGRAM_MIN_MS * std::pow(2.0, index / HISTOGRAM_BINS_PER_OCTAVE);
+}
+
+int vm::scanner::TimeHistogram::binIndex(double ms)
+{
+  if (ms <= HISTOGRAM_MIN_MS)
+    return 0;
+
+  int index = (int)std::ceil(std::log(ms / HISTOGRAM_MIN_MS) / std::log(2.0) * HISTOGRAM_BINS_PER_OCTAVE);
+  return std::min(index, (int)BINS - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Trace
+
+namespace
+{
+  struct TraceEvent
+  {
+    const char* name;
+    int64 begin, end;
+  };
+
+  /** Written only by its own thread, events are published by bumping written after they are stored */
+  struct TraceRing
+  {
+    enum { MAX_DEPTH = 64 };
+
+    int id;
+    std::string name;
+
+    std::vector<TraceEvent> events;
+    volatile unsigned int written;
+    volatile unsigned int cleared; // events before it are left out of exports
+
+    int depth;
+    TraceEvent open[MAX_DEPTH];
+
+    TraceRing(int id_, const std::string& name_) : id(id_), name(name_), events(Trace::RING_SIZE), written(0), cleared(0), depth(0) {}
+
+    void push(const char* event_name, int64 begin, int64 end)
+    {
+      TraceEvent& e = events[written % Trace::RING_SIZE];
+      e.name = event_name;
+      e.begin = begin;
+      e.end = end;
+      __sync_synchronize();
+      written = written + 1;
+    }
+  };
+
+  struct TraceState
+  {
+    volatile int enabled;
+    int64 epoch;
+    std::string filename;
+
+    pthread_mutex_t mutex; // guards rings, taken once per thread and by exports
+    std::vector<TraceRing*> rings;
+    TraceRing* volatile gpu;
+
+    TraceState() : epoch(cv::getTickCount()), gpu(0)
+    {
+      pthread_mutex_init(&mutex, 0);
+
+      const char* env = getenv("VM_SCANNER_TRACE");
+      filename = env ? env : "";
+      enabled = filename.empty() ? 0 : 1;
+    }
+
+    // called with the mutex held
+    TraceRing* add(const char* name)
+    {
+      int id = (int)rings.size() + 1;
+
+      char text[32];
+      sprintf(text, "thread %d", id);
+
+      rings.push_back(new TraceRing(id, name ? name : text));
+      return rings.back();
+    }
+  };
+
+  // rings live as long as the process, so a thread exiting never leaves a dangling pointer behind
+  TraceState& state()
+  {
+    static TraceState* s = new TraceState();
+    return *s;
+  }
+
+  __thread TraceRing* thread_ring = 0;
+
+  TraceRing& ring()
+  {
+    if (!thread_ring)
+    {
+      TraceState& s = state();
+      pthread_mutex_lock(&s.mutex);
+      thread_ring = s.add(0);
+      pthread_mutex_unlock(&s.mutex);
+    }
+    return *thread_ring;
+  }
+
+  TraceRing& gpu_ring()
+  {
+    TraceState& s = state();
+    if (!s.gpu)
+    {
+      pthread_mutex_lock(&s.mutex);
+      if (!s.gpu)
+        s.gpu = s.add("gpu");
+      pthread_mutex_unlock(&s.mutex);
+    }
+    return *s.gpu;
+  }
+
+  void writeJsonString(FILE* file, const std::string& text)
+  {
+    fputc('"', file);
+    for(size_t i = 0; i < text.size(); ++i)
+    {
+      char c = text[i];
+      if (c == '"' || c == '\\')
+        fputc('\\', file);
+      fputc((unsigned char)c < 0x20 ? ' ' : c, file);
+    }
+    fputc('"', file);
+  }
+}
+
+void vm::scanner::Trace::setEnabled(bool enable) { state().enabled = enable ? 1 : 0; }
+bool vm::scanner::Trace::enabled() { return state().enabled != 0; }
+
+void vm::scanner::Trace::setThreadName(const char* name)
+{
+  TraceRing& r = ring();
+  pthread_mutex_lock(&state().mutex);
+  r.name = name;
+  pthread_mutex_unlock(&state().mutex);
+}
+
+void vm::scanner::Trace::begin(const char* name)
+{
+  TraceRing& r = ring();
+  if (r.depth < TraceRing::MAX_DEPTH)
+  {
+    r.open[r.depth].name = name;
+    r.open[r.depth].begin = cv::getTickCount();
+  }
+  ++r.depth;
+}
+
+void vm::scanner::Trace::end()
+{
+  TraceRing& r = ring();
+  if (r.depth == 0)
+    return;
+
+  --r.depth;
+  if (r.depth < TraceRing::MAX_DEPTH)
+    r.push(r.open[r.depth].name, r.open[r.depth].begin, cv::getTickCount());
+}
+
+void vm::scanner::Trace::record(const char* name, int64 begin_ticks, int64 end_ticks, bool gpu)
+{
+  // only the thread driving the GPU records on its track
+  (gpu ? gpu_ring() : ring()).push(name, begin_ticks, end_ticks);
+}
+
+bool vm::scanner::Trace::writeChromeTrace(const std::string& filename)
+{
+  TraceState& s = state();
+  std::string path = filename.empty() ? s.filename : filename;
+  if (path.empty())
+    return false;
+
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+
+  const double us = 1e6 / cv::getTickFrequency();
+  bool first = true;
+
+  fprintf(file, "{\"traceEvents\":[\n");
+
+  pthread_mutex_lock(&s.mutex);
+  for(size_t r = 0; r < s.rings.size(); ++r)
+  {
+    const TraceRing& ring = *s.rings[r];
+
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", ring.id);
+    writeJsonString(file, ring.name);
+    fprintf(file, "}}");
+    first = false;
+
+    unsigned int written = ring.written;
+    __sync_synchronize();
+
+    unsigned int size = std::min(written - ring.cleared, (unsigned int)RING_SIZE);
+    std::vector<TraceEvent> events(size);
+    for(unsigned int i = 0; i < size; ++i)
+      events[i] = ring.events[(written - size + i) % RING_SIZE];
+
+    // whatever the owner wrote meanwhile may have overwritten the oldest copies
+    __sync_synchronize();
+    unsigned int overwritten = std::min(ring.written - written, size);
+
+    for(unsigned int i = overwritten; i < size; ++i)
+    {
+      const TraceEvent& e = events[i];
+      fprintf(file, ",\n{\"name\":");
+      writeJsonString(file, e.name);
+      fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", ring.id, (e.begin - s.epoch) * us, (e.end - e.begin) * us);
+    }
+  }
+  pthread_mutex_unlock(&s.mutex);
+
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
+
+void vm::scanner::Trace::clear()
+{
+  TraceState& s = state();
+  pthread_mutex_lock(&s.mutex);
+  for(size_t r = 0; r < s.rings.size(); ++r)
+    s.rings[r]->cleared = s.rings[r]->written;
+  pthread_mutex_unlock(&s.mutex);
+}
@@ -1,4 +1,5 @@
 #include <scanner/precomp.hpp>
+#include <scanner/cpu/internal.hpp>
 
 using namespace vm::scanner;
 using namespace vm::scanner::cuda;
@@ -6,25 +7,38 @@ using namespace vm::scanner::cuda;
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// TsdfVolume::Entry
 
-float vm::scanner::cuda::TsdfVolume::Entry::half2float(half)
-{ throw "Not implemented"; }
+float vm::scanner::cuda::TsdfVolume::Entry::half2float(half value)
+{ return host::half2float(value); }
 
 vm::scanner::cuda::TsdfVolume::Entry::half vm::scanner::cuda::TsdfVolume::Entry::float2half(float value)
-{ throw "Not implemented"; }
+{ return host::float2half(value); }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// TsdfVolume
 
-vm::scanner::cuda::TsdfVolume::TsdfVolume(const Vec3i& dims) : data_(), trunc_dist_(0.03f), max_weight_(128), dims_(dims),
-  size_(Vec3f::all(3.f)), pose_(Affine3f::Identity()), gradient_delta_factor_(0.75f), raycast_step_factor_(0.75f)
+vm::scanner::cuda::TsdfVolume::TsdfVolume(const Vec3i& dims, int layout, int order) : data_(), layout_(layout), order_(order), trunc_dist_(0.03f), max_weight_(128), dims_(dims),
+  size_(Vec3f::all(3.f)), pose_(Affine3f::Identity()), grid_origin_(0, 0, 0), gradient_delta_factor_(0.75f), raycast_step_factor_(0.75f),
+  all_bricks_changed_(true), empty_space_skipping_(true), culled_voxels_(0)
 { create(dims_); }
 
+vm::scanner::cuda::TsdfVolume::TsdfVolume(const Vec3i& dims, bool allocate) : data_(), layout_(VOXEL_RGBA), order_(ORDER_LINEAR), trunc_dist_(0.03f), max_weight_(128), dims_(dims),
+  size_(Vec3f::all(3.f)), pose_(Affine3f::Identity()), grid_origin_(0, 0, 0), gradient_delta_factor_(0.75f), raycast_step_factor_(0.75f),
+  all_bricks_changed_(true), empty_space_skipping_(true), culled_voxels_(0)
+{
+  if (allocate)
+    create(dims_);
+}
+
 vm::scanner::cuda::TsdfVolume::~TsdfVolume() {}
 
 void vm::scanner::cuda::TsdfVolume::create(const Vec3i& dims)
 {
+  CV_Assert(order_ == ORDER_LINEAR || (order_ == ORDER_BRICKED && dims[0] % 8 == 0 && dims[1] % 8 == 0 && dims[2] % 8 == 0));
+
   int voxels_number = dims[0] * dims[1] * dims[2];
-  data_.create(voxels_number * sizeof(int) * 2);
+  data_.create(voxels_number * device::TsdfVolume::voxelBytes(layout_));
+  bricks_.create(device::TsdfBricks::count(device_cast<device::Vec3i>(dims)) * sizeof(unsigned int));
+  changed_bricks_.create(device::TsdfBricks::count(device_cast<device::Vec3i>(dims)) * sizeof(int));
   setTruncDist(trunc_dist_);
   clear();
 }
@@ -37,12 +51,15 @@ Vec3f vm::scanner::cuda::TsdfVolume::getVoxelSize() const
   return Vec3f(size_[0]/dims_[0], size_[1]/dims_[1], size_[2]/dims_[2]);
 }
 
+int vm::scanner::cuda::TsdfVolume::getLayout() const { return layout_; }
+int vm::scanner::cuda::TsdfVolume::getOrder() const { return order_; }
+
 const CudaData vm::scanner::cuda::TsdfVolume::data() const { return data_; }
 CudaData vm::scanner::cuda::TsdfVolume::data() {  return data_; }
 
 Vec3f vm::scanner::cuda::TsdfVolume::getSize() const { return size_; }
 void vm::scanner::cuda::TsdfVolume::setSize(const Vec3f& size)
-{ size_ = size; setTruncDist(trunc_dist_); }
+{ size_ = size; setTruncDist(trunc_dist_); all_bricks_changed_ = true; }
 
 float vm::scanner::cuda::TsdfVolume::getTruncDist() const { return trunc_dist_; }
 
@@ -56,21 +73,58 @@ void vm::scanner::cuda::TsdfVolume::setTruncDist(float distance)
 int vm::scanner::cuda::TsdfVolume::getMaxWeight() const { return max_weight_; }
 void vm::scanner::cuda::TsdfVolume::setMaxWeight(int weight) { max_weight_ = weight; }
 Affine3f vm::scanner::cuda::TsdfVolume::getPose() const  { return pose_; }
-void vm::scanner::cuda::TsdfVolume::setPose(const Affine3f& pose) { pose_ = pose; }
+void vm::scanner::cuda::TsdfVolume::setPose(const Affine3f& pose) { pose_ = pose; all_bricks_changed_ = true; }
 float vm::scanner::cuda::TsdfVolume::getRaycastStepFactor() const { return raycast_step_factor_; }
 void vm::scanner::cuda::TsdfVolume::setRaycastStepFactor(float factor) { raycast_step_factor_ = factor; }
 float vm::scanner::cuda::TsdfVolume::getGradientDeltaFactor() const { return gradient_delta_factor_; }
 void vm::scanner::cuda::TsdfVolume::setGradientDeltaFactor(float factor) { gradient_delta_factor_ = factor; }
-void vm::scanner::cuda::TsdfVolume::swap(CudaData& data) { data_.swap(data); }
-void vm::scanner::cuda::TsdfVolume::applyAffine(const Affine3f& affine) { pose_ = affine * pose_; }
+bool vm::scanner::cuda::TsdfVolume::getEmptySpaceSkipping() const { return empty_space_skipping_; }
+void vm::scanner::cuda::TsdfVolume::setEmptySpaceSkipping(bool enabled) { empty_space_skipping_ = enabled; }
+
+void vm::scanner::cuda::TsdfVolume::swap(CudaData& data)
+{
+  data_.swap(data);
+  all_bricks_changed_ = true;
+
+  // nothing is known about the new voxels, no brick can be skipped
+  if (!bricks_.empty())
+    device::reset_bricks(device::TsdfBricks(bricks_.ptr<unsigned int>(), device_cast<device::Vec3i>(dims_)), 0xFF);
+}
+
+void vm::scanner::cuda::TsdfVolume::updateBricks()
+{
+  all_bricks_changed_ = true;
+  if (bricks_.empty())
+    return;
+
+  device::Vec3i dims = device_cast<device::Vec3i>(dims_);
+  device::Vec3f vsz  = device_cast<device::Vec3f>(getVoxelSize());
+
+  device::TsdfVolume volume(data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
+  device::update_bricks(volume, device::TsdfBricks(bricks_.ptr<unsigned int>(), dims), device_cast<device::Vec3i>(Vec3i(0, 0, 0)), dims);
+}
+
+void vm::scanner::cuda::TsdfVolume::applyAffine(const Affine3f& affine) { pose_ = affine * pose_; all_bricks_changed_ = true; }
+Vec3i vm::scanner::cuda::TsdfVolume::getGridOrigin() const { return grid_origin_; }
+
+void vm::scanner::cuda::TsdfVolume::setGridOrigin(const Vec3i& origin)
+{
+  for(int i = 0; i < 3; ++i)
+    grid_origin_[i] = (origin[i] % dims_[i] + dims_[i]) % dims_[i];
+  all_bricks_changed_ = true;
+}
 
 void vm::scanner::cuda::TsdfVolume::clear()
 { 
   device::Vec3i dims = device_cast<device::Vec3i>(dims_);
   device::Vec3f vsz  = device_cast<device::Vec3f>(getVoxelSize());
 
-  device::TsdfVolume volume(data_.ptr<ushort4>(), dims, vsz, trunc_dist_, max_weight_);
+  device::TsdfVolume volume(data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
   device::clear_volume(volume);
+
+  device::TsdfBricks bricks(bricks_.ptr<unsigned int>(), dims);
+  device::reset_bricks(bricks, 0);
+  all_bricks_changed_ = true;
 }
 
 // void vm::scanner::cuda::TsdfVolume::integrate(const Dists& dists, const Affine3f& camera_pose, const Intr& intr)
@@ -98,11 +152,71 @@ void vm::scanner::cuda::TsdfVolume::integrate(const Dists& dists, const Image& c
   device::Aff3f aff = device_cast<device::Aff3f>(vol2cam);
   device::Image& img = (device::Image&)colors;
 
-  device::TsdfVolume volume(data_.ptr<ushort4>(), dims, vsz, trunc_dist_, max_weight_);
-  device::integrate(dists, img, volume, aff, proj);
+  device::TsdfVolume volume(data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
+  device::TsdfBricks bricks(bricks_.ptr<unsigned int>(), dims);
+  culled_voxels_ = (int64)device::integrate(dists, img, volume, bricks, aff, proj);
+}
+
+int64 vm::scanner::cuda::TsdfVolume::getCulledVoxelsNum() const { return culled_voxels_; }
+
+DeviceArray<Point> vm::scanner::cuda::TsdfVolume::shift(const Vec3i& voxels, DeviceArray<Point>& cloud_buffer)
+{
+  TraceScope trace("shift volume");
+
+  device::Vec3i dims = device_cast<device::Vec3i>(dims_);
+  device::Vec3f vsz  = device_cast<device::Vec3f>(getVoxelSize());
+
+  // one axis at a time, so the slices an axis has cleared aren't scanned again for the next one
+  size_t size = 0;
+  for(int i = 0; i < 3; ++i)
+  {
+    int n = std::max(-dims_[i], std::min(voxels[i], dims_[i]));
+    if (!n)
+      continue;
+
+    // the slices leaving the volume
+    Vec3i beg(0, 0, 0), end = dims_;
+    if (n > 0)
+      end[i] = n;
+    else
+      beg[i] = dims_[i] + n;
+
+    device::Aff3f aff = device_cast<device::Aff3f>(pose_);
+    device::TsdfVolume volume(data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
+
+    // counted first, the slices are cleared below and every point in them has to be out by then
+    device::Vec3i b0 = device_cast<device::Vec3i>(beg), b1 = device_cast<device::Vec3i>(end);
+    size_t count = device::countCloud(volume, b0, b1);
+
+    if (size + count > cloud_buffer.size())
+    {
+      DeviceArray<Point> grown(std::max(size + count, cloud_buffer.size() * 2));
+      DeviceArray<Point> head(grown.ptr(), size);
+      if (size)
+        DeviceArray<Point>(cloud_buffer.ptr(), size).copyTo(head);
+      cloud_buffer = grown;
+    }
+
+    if (count)
+    {
+      DeviceArray<device::Point>& b = (DeviceArray<device::Point>&)cloud_buffer;
+      size += device::extractCloud(volume, aff, b0, b1, DeviceArray<device::Point>(b.ptr() + size, count));
+    }
+    device::clear_volume(volume, b0, b1);
+    device::update_bricks(volume, device::TsdfBricks(bricks_.ptr<unsigned int>(), dims), b0, b1);
+
+    // the cleared slices become the far side of the volume, update_bricks has marked them changed
+    grid_origin_[i] = (grid_origin_[i] + n + dims_[i]) % dims_[i];
+
+    Vec3f t(0.f, 0.f, 0.f);
+    t[i] = n * getVoxelSize()[i];
+    pose_ = pose_ * Affine3f().translate(t);
+  }
+
+  return DeviceArray<Point>((Point*)cloud_buffer.ptr(), size);
 }
 
-void vm::scanner::cuda::TsdfVolume::raycast(const Affine3f& camera_pose, const Intr& intr, Depth& depth, Normals& normals)
+void vm::scanner::cuda::TsdfVolume::raycast(const Affine3f& camera_pose, const Intr& intr, Depth& depth, Normals& normals, const Rays& rays)
 {
   DeviceArray2D<device::Normal>& n = (DeviceArray2D<device::Normal>&)normals;
 
@@ -111,17 +225,18 @@ void vm::scanner::cuda::TsdfVolume::raycast(const Affine3f& camera_pose, const I
   device::Aff3f aff = device_cast<device::Aff3f>(cam2vol);
   device::Mat3f Rinv = device_cast<device::Mat3f>(cam2vol.rotation().inv(cv::DECOMP_SVD));
 
-  device::Reprojector reproj(intr.fx, intr.fy, intr.cx, intr.cy);
+  device::Reprojector reproj = make_reprojector(intr, rays, depth.rows(), depth.cols());
 
   device::Vec3i dims = device_cast<device::Vec3i>(dims_);
   device::Vec3f vsz  = device_cast<device::Vec3f>(getVoxelSize());
 
-  device::TsdfVolume volume(data_.ptr<ushort4>(), dims, vsz, trunc_dist_, max_weight_);
-  device::raycast(volume, aff, Rinv, reproj, depth, n, raycast_step_factor_, gradient_delta_factor_);
+  device::TsdfVolume volume(data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
+  device::TsdfBricks bricks(empty_space_skipping_ ? bricks_.ptr<unsigned int>() : 0, dims);
+  device::raycast(volume, bricks, aff, Rinv, reproj, depth, n, raycast_step_factor_, gradient_delta_factor_);
 
 }
 
-void vm::scanner::cuda::TsdfVolume::raycast(const Affine3f& camera_pose, const Intr& intr, Cloud& points, Normals& normals)
+void vm::scanner::cuda::TsdfVolume::raycast(const Affine3f& camera_pose, const Intr& intr, Cloud& points, Normals& normals, const Rays& rays)
 {
   device::Normals& n = (device::Normals&)normals;
   device::Points& p = (device::Points&)points;
@@ -131,15 +246,18 @@ void vm::scanner::cuda::TsdfVolume::raycast(const Affine3f& camera_pose, const I
   device::Aff3f aff = device_cast<device::Aff3f>(cam2vol);
   device::Mat3f Rinv = device_cast<device::Mat3f>(cam2vol.rotation().inv(cv::DECOMP_SVD));
 
-  device::Reprojector reproj(intr.fx, intr.fy, intr.cx, intr.cy);
+  device::Reprojector reproj = make_reprojector(intr, rays, points.rows(), points.cols());
 
   device::Vec3i dims = device_cast<device::Vec3i>(dims_);
   device::Vec3f vsz  = device_cast<device::Vec3f>(getVoxelSize());
 
-  device::TsdfVolume volume(data_.ptr<ushort4>(), dims, vsz, trunc_dist_, max_weight_);
-  device::raycast(volume, aff, Rinv, reproj, p, n, raycast_step_factor_, gradient_delta_factor_);
+  device::TsdfVolume volume(data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
+  device::TsdfBricks bricks(empty_space_skipping_ ? bricks_.ptr<unsigned int>() : 0, dims);
+  device::raycast(volume, bricks, aff, Rinv, reproj, p, n, raycast_step_factor_, gradient_delta_factor_);
 }
 
+int64 vm::scanner::cuda::TsdfVolume::fetchRaycastSteps() { return (int64)device::raycast_steps(); }
+
 DeviceArray<Point> vm::scanner::cuda::TsdfVolume::fetchCloud(DeviceArray<Point>& cloud_buffer) const
 {
   enum { DEFAULT_CLOUD_BUFFER_SIZE = 10 * 1000 * 1000 };
@@ -153,12 +271,64 @@ DeviceArray<Point> vm::scanner::cuda::TsdfVolume::fetchCloud(DeviceArray<Point>&
   device::Vec3f vsz  = device_cast<device::Vec3f>(getVoxelSize());
   device::Aff3f aff  = device_cast<device::Aff3f>(pose_);
 
-  device::TsdfVolume volume((ushort4*)data_.ptr<ushort4>(), dims, vsz, trunc_dist_, max_weight_);
+  device::TsdfVolume volume((void*)data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
   size_t size = extractCloud(volume, aff, b);
 
   return DeviceArray<Point>((Point*)cloud_buffer.ptr(), size);
 }
 
+DeviceArray<Point> vm::scanner::cuda::TsdfVolume::fetchChangedCloud(DeviceArray<Point>& cloud_buffer, DeviceArray<int>& changed_bricks)
+{
+  device::Vec3i dims = device_cast<device::Vec3i>(dims_);
+  device::Vec3f vsz  = device_cast<device::Vec3f>(getVoxelSize());
+  device::Aff3f aff  = device_cast<device::Aff3f>(pose_);
+
+  device::TsdfBricks bricks(bricks_.ptr<unsigned int>(), dims);
+  PtrSz<int> list(changed_bricks_.ptr<int>(), changed_bricks_.sizeBytes()/sizeof(int));
+  list.size = device::collect_dirty_bricks(bricks, all_bricks_changed_, list);
+
+  changed_bricks = DeviceArray<int>(list.data, list.size);
+
+  device::TsdfVolume volume(data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
+
+  // counted first, the caller drops its points of the listed bricks and every new one has to fit
+  size_t count = device::countCloud(volume, list);
+  if (count > cloud_buffer.size())
+    cloud_buffer.create(count);
+
+  DeviceArray<device::Point>& b = (DeviceArray<device::Point>&)cloud_buffer;
+  size_t size = count ? device::extractCloud(volume, aff, list, b) : 0;
+
+  // only now that the points are out, a throw above leaves the bricks listed for the next call
+  device::clear_dirty_bricks(bricks);
+  all_bricks_changed_ = false;
+
+  return DeviceArray<Point>((Point*)cloud_buffer.ptr(), size);
+}
+
+DeviceArray<Surfel> vm::scanner::cuda::TsdfVolume::fetchSurfels(DeviceArray<Surfel>& surfel_buffer, bool tangent_colors) const
+{
+  TraceScope trace("fetch surfels");
+
+  device::Vec3i dims = device_cast<device::Vec3i>(dims_);
+  device::Vec3f vsz  = device_cast<device::Vec3f>(getVoxelSize());
+  device::Aff3f aff  = device_cast<device::Aff3f>(pose_);
+
+  device::TsdfVolume volume((void*)data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
+
+  DeviceArray<int> counts((size_t)dims_[0] * dims_[1]);
+  size_t size = device::countSurfels(volume, counts.ptr());
+
+  if (surfel_buffer.size() < size)
+    surfel_buffer.create(size);
+
+  DeviceArray<device::Surfel> s((device::Surfel*)surfel_buffer.ptr(), size);
+  if (size)
+    device::extractSurfels(volume, aff, gradient_delta_factor_, tangent_colors, counts.ptr(), s);
+
+  return DeviceArray<Surfel>(surfel_buffer.ptr(), size);
+}
+
 void vm::scanner::cuda::TsdfVolume::fetchNormals(const DeviceArray<Point>& cloud, DeviceArray<Normal>& normals) const
 {
   normals.create(cloud.size());
@@ -169,7 +339,7 @@ void vm::scanner::cuda::TsdfVolume::fetchNormals(const DeviceArray<Point>& cloud
   device::Aff3f aff  = device_cast<device::Aff3f>(pose_);
   device::Mat3f Rinv = device_cast<device::Mat3f>(pose_.rotation().inv(cv::DECOMP_SVD));
 
-  device::TsdfVolume volume((ushort4*)data_.ptr<ushort4>(), dims, vsz, trunc_dist_, max_weight_);
+  device::TsdfVolume volume((void*)data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
   device::extractNormals(volume, c, aff, Rinv, gradient_delta_factor_, (float4*)normals.ptr());
 }
 
@@ -183,7 +353,7 @@ void vm::scanner::cuda::TsdfVolume::fetchTangentColors(const DeviceArray<Point>&
   device::Aff3f aff  = device_cast<device::Aff3f>(pose_);
   device::Mat3f Rinv = device_cast<device::Mat3f>(pose_.rotation().inv(cv::DECOMP_SVD));
 
-  device::TsdfVolume volume((ushort4*)data_.ptr<ushort4>(), dims, vsz, trunc_dist_, max_weight_);
+  device::TsdfVolume volume((void*)data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
   device::extractTangentColors(volume, c, aff, Rinv, gradient_delta_factor_, (uchar4*)colors.ptr());
 }
 
@@ -198,8 +368,56 @@ void vm::scanner::cuda::TsdfVolume::fetchVertexColors(const DeviceArray<Point>&
   device::Aff3f aff  = device_cast<device::Aff3f>(pose_);
   device::Mat3f Rinv = device_cast<device::Mat3f>(pose_.rotation().inv(cv::DECOMP_SVD));
 
-  device::TsdfVolume volume((ushort4*)data_.ptr<ushort4>(), dims, vsz, trunc_dist_, max_weight_);
+  device::TsdfVolume volume((void*)data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
 
   device::extractVertexColors(volume, c, aff, Rinv, gradient_delta_factor_, (uchar4*)colors.ptr());
 
+}
+
+Mesh vm::scanner::cuda::TsdfVolume::fetchMesh(Mesh& mesh_buffer) const
+{
+  TraceScope trace("fetch mesh");
+
+  enum { DEFAULT_VERTEX_BUFFER_SIZE = 3 * 1000 * 1000, DEFAULT_INDEX_BUFFER_SIZE = 3 * 6 * 1000 * 1000 };
+
+  if (mesh_buffer.vertices.empty ())
+    mesh_buffer.vertices.create (DEFAULT_VERTEX_BUFFER_SIZE);
+
+  if (mesh_buffer.indices.empty ())
+    mesh_buffer.indices.create (DEFAULT_INDEX_BUFFER_SIZE);
+
+  mesh_buffer.normals.create(mesh_buffer.vertices.size());
+  mesh_buffer.colors.create(mesh_buffer.vertices.size());
+
+  DeviceArray<device::Point>& v = (DeviceArray<device::Point>&)mesh_buffer.vertices;
+
+  device::Vec3i dims = device_cast<device::Vec3i>(dims_);
+  device::Vec3f vsz  = device_cast<device::Vec3f>(getVoxelSize());
+  device::Aff3f aff  = device_cast<device::Aff3f>(pose_);
+
+  device::TsdfVolume volume((void*)data_.ptr<void>(), layout_, order_, dims, vsz, trunc_dist_, max_weight_, device_cast<device::Vec3i>(grid_origin_));
+
+  size_t indices_count;
+  size_t size = device::extractMesh(volume, aff, gradient_delta_factor_, v, (float4*)mesh_buffer.normals.ptr(), (uchar4*)mesh_buffer.colors.ptr(),
+                                    mesh_buffer.indices, indices_count);
+
+  // the buffers only held part of the surface, grow them to the counts it needs and extract it again
+  if (size > mesh_buffer.vertices.size() || indices_count > mesh_buffer.indices.size())
+  {
+    mesh_buffer.vertices.create(std::max(size, mesh_buffer.vertices.size()));
+    mesh_buffer.indices.create(std::max(indices_count, mesh_buffer.indices.size()));
+    mesh_buffer.normals.create(mesh_buffer.vertices.size());
+    mesh_buffer.colors.create(mesh_buffer.vertices.size());
+
+    size = device::extractMesh(volume, aff, gradient_delta_factor_, v, (float4*)mesh_buffer.normals.ptr(), (uchar4*)mesh_buffer.colors.ptr(),
+                             mesh_buffer.indices, indices_count);
+    CV_Assert(size <= mesh_buffer.vertices.size() && indices_count <= mesh_buffer.indices.size());
+  }
+
+  Mesh mesh;
+  mesh.vertices = DeviceArray<Point>(mesh_buffer.vertices.ptr(), size);
+  mesh.normals = DeviceArray<Normal>(mesh_buffer.normals.ptr(), size);
+  mesh.colors = DeviceArray<RGB>(mesh_buffer.colors.ptr(), size);
+  mesh.indices = DeviceArray<int>(mesh_buffer.indices.ptr(), indices_count);
+  return mesh;
 }
\ No newline at end of file
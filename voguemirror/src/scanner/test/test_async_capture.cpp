@@ -0,0 +1,140 @@
+#include "test_utils.hpp"
+
+#include <unistd.h>
+
+using namespace vm::scanner;
+
+namespace
+{
+  const int FRAMES = 12;
+
+  SyntheticSource::Params params()
+  {
+    SyntheticSource::Params p = test::smallParams();
+    p.frames = FRAMES;
+    return p;
+  }
+
+  /** Depth of every frame of the source in grab order, each frame of the orbit differs from the others */
+  std::vector<cv::Mat> reference()
+  {
+    SyntheticSource source(params());
+
+    std::vector<cv::Mat> frames;
+    cv::Mat depth, image;
+    while(source.grabRGBA(depth, image))
+      frames.push_back(depth.clone());
+    return frames;
+  }
+
+  /** Index of the reference frame depth is, -1 if none */
+  int frameOf(const std::vector<cv::Mat>& frames, const cv::Mat& depth)
+  {
+    for(size_t i = 0; i < frames.size(); ++i)
+      if (test::bitExact(frames[i], depth))
+        return (int)i;
+    return -1;
+  }
+
+  /** The slots are page-locked, which takes a device like the uploads they are meant for */
+  bool haveDevice()
+  {
+    if (cuda::getCudaEnabledDeviceCount() > 0)
+      return true;
+
+    std::cout << "No CUDA device, skipped" << std::endl;
+    return false;
+  }
+}
+
+TEST(AsyncCapture, LosslessDeliversEveryFrameInOrder)
+{
+  if (!haveDevice())
+    return;
+
+  std::vector<cv::Mat> frames = reference();
+  ASSERT_EQ(FRAMES, (int)frames.size());
+
+  SyntheticSource source(params());
+  AsyncCapture capture(source, AsyncCapture::LOSSLESS, 3);
+  capture.start();
+
+  cv::Mat depth, image;
+  int64 prev = 0, timestamp;
+  for(int i = 0; i < FRAMES; ++i)
+  {
+    // a slow consumer for the first frames, so the grab thread runs into the full ring and waits
+    if (i < 4)
+      usleep(20000);
+
+    ASSERT_TRUE(capture.retrieve(depth, image, &timestamp)) << "frame " << i;
+    EXPECT_EQ(i, frameOf(frames, depth));
+    EXPECT_GE(timestamp, prev);
+    prev = timestamp;
+  }
+
+  EXPECT_FALSE(capture.retrieve(depth, image));
+  EXPECT_TRUE(capture.finished());
+  EXPECT_TRUE(capture.error().empty());
+
+  AsyncCapture::Stats stats = capture.stats();
+  EXPECT_EQ(FRAMES, stats.grabbed);
+  EXPECT_EQ(FRAMES, stats.delivered);
+  EXPECT_EQ(0, stats.dropped);
+  EXPECT_EQ(0, stats.queued);
+}
+
+TEST(AsyncCapture, LatestOnlyKeepsTheNewest)
+{
+  if (!haveDevice())
+    return;
+
+  std::vector<cv::Mat> frames = reference();
+
+  SyntheticSource source(params());
+  AsyncCapture capture(source, AsyncCapture::LATEST_ONLY);
+  capture.start();
+
+  // the grab thread never waits, it runs through the source before anything is retrieved
+  for(int i = 0; i < 1000 && !capture.finished(); ++i)
+    usleep(10000);
+  ASSERT_TRUE(capture.finished());
+
+  cv::Mat depth, image;
+  ASSERT_TRUE(capture.retrieve(depth, image));
+  EXPECT_EQ(FRAMES - 1, frameOf(frames, depth));
+  EXPECT_FALSE(capture.retrieve(depth, image));
+
+  AsyncCapture::Stats stats = capture.stats();
+  EXPECT_EQ(FRAMES, stats.grabbed);
+  EXPECT_EQ(1, stats.delivered);
+  EXPECT_EQ(FRAMES - 1, stats.dropped);
+}
+
+TEST(AsyncCapture, LatestOnlyNeverGoesBack)
+{
+  if (!haveDevice())
+    return;
+
+  std::vector<cv::Mat> frames = reference();
+
+  SyntheticSource source(params());
+  AsyncCapture capture(source, AsyncCapture::LATEST_ONLY);
+  capture.start();
+
+  // whatever the timing, frames come newer each time, none twice, and the last one is never dropped
+  cv::Mat depth, image;
+  int last = -1;
+  while(capture.retrieve(depth, image))
+  {
+    int frame = frameOf(frames, depth);
+    EXPECT_GT(frame, last);
+    last = frame;
+    usleep(5000);
+  }
+  EXPECT_EQ(FRAMES - 1, last);
+
+  AsyncCapture::Stats stats = capture.stats();
+  EXPECT_EQ(FRAMES, stats.grabbed);
+  EXPECT_EQ(stats.grabbed, stats.delivered + stats.dropped);
+}
@@ -0,0 +1,129 @@
+#include "test_utils.hpp"
+
+#include <scanner/cpu/imgproc.hpp>
+
+using namespace vm::scanner;
+
+namespace
+{
+  const int KSZ = 7;
+  const float SIGMA_SPATIAL = 4.5f;
+  const float SIGMA_DEPTH = 0.04f;
+  const float TRUNCATE_DIST = 2.5f;
+
+  struct Outputs
+  {
+    cpu::Depth filtered, pyramid;
+    cpu::Dists dists;
+    cpu::Cloud points;
+    cpu::Normals normals;
+  };
+
+  /** Every pass on the same input, so a difference in one doesn't carry over into the next */
+  void runPasses(const Intr& intr, const cpu::Depth& depth, const cpu::Depth& filtered, const cpu::Rays& rays, Outputs& out)
+  {
+    cpu::depthBilateralFilter(depth, out.filtered, KSZ, SIGMA_SPATIAL, SIGMA_DEPTH);
+    cpu::depthBuildPyramid(filtered, out.pyramid, SIGMA_DEPTH);
+    cpu::computeDists(depth, out.dists, intr, rays);
+    cpu::computePointNormals(intr, filtered, out.points, out.normals, rays);
+  }
+}
+
+TEST(CpuImgproc, Avx2MatchesScalar)
+{
+  SyntheticSource source(test::smallParams());
+  const Intr& intr = source.params().intr;
+
+  cpu::Depth depth, filtered;
+  cpu::Image image;
+  test::grab(source, depth, image);
+  cpu::depthBilateralFilter(depth, filtered, KSZ, SIGMA_SPATIAL, SIGMA_DEPTH);
+
+  cpu::Rays rays;
+  cpu::computeRays(intr, depth.rows, depth.cols, rays);
+
+  // without AVX2 on this machine both runs are scalar and the test holds trivially
+  for(int with_rays = 0; with_rays < 2; ++with_rays)
+  {
+    Outputs simd, scalar;
+    runPasses(intr, depth, filtered, with_rays ? rays : cpu::Rays(), simd);
+    {
+      test::OptimizedScope off(false);
+      runPasses(intr, depth, filtered, with_rays ? rays : cpu::Rays(), scalar);
+    }
+
+    // the vector rows keep the scalar operation order
+    EXPECT_TRUE(test::bitExact(simd.filtered, scalar.filtered));
+    EXPECT_TRUE(test::bitExact(simd.pyramid, scalar.pyramid));
+    EXPECT_TRUE(test::bitExact(simd.dists, scalar.dists));
+    EXPECT_TRUE(test::bitExact(simd.points, scalar.points));
+    EXPECT_TRUE(test::bitExact(simd.normals, scalar.normals));
+  }
+}
+
+TEST(CpuImgproc, FrontEndMatchesSeparateCalls)
+{
+  SyntheticSource source(test::smallParams());
+  const Intr& intr = source.params().intr;
+
+  cpu::Depth depth;
+  cpu::Image image;
+  test::grab(source, depth, image);
+
+  cpu::Rays rays;
+  cpu::computeRays(intr, depth.rows, depth.cols, rays);
+
+  for(int optimized = 0; optimized < 2; ++optimized)
+    for(int truncate = 0; truncate < 2; ++truncate)
+    {
+      test::OptimizedScope scope(optimized != 0);
+      float truncate_dist = truncate ? TRUNCATE_DIST : 0.f;
+
+      Outputs fused, separate;
+      cpu::depthFrontEnd(intr, depth, fused.dists, fused.filtered, fused.points, fused.normals,
+                         KSZ, SIGMA_SPATIAL, SIGMA_DEPTH, truncate_dist, rays);
+
+      cpu::computeDists(depth, separate.dists, intr, rays);
+      cpu::depthBilateralFilter(depth, separate.filtered, KSZ, SIGMA_SPATIAL, SIGMA_DEPTH);
+      if (truncate_dist > 0)
+        cpu::depthTruncation(separate.filtered, truncate_dist);
+      cpu::computePointNormals(intr, separate.filtered, separate.points, separate.normals, rays);
+
+      EXPECT_TRUE(test::bitExact(fused.dists, separate.dists));
+      EXPECT_TRUE(test::bitExact(fused.filtered, separate.filtered));
+      EXPECT_TRUE(test::bitExact(fused.points, separate.points));
+      EXPECT_TRUE(test::bitExact(fused.normals, separate.normals));
+    }
+}
+
+TEST(CpuImgproc, SameResultAcrossThreadCounts)
+{
+  SyntheticSource source(test::smallParams());
+  const Intr& intr = source.params().intr;
+
+  cpu::Depth depth, filtered;
+  cpu::Image image;
+  test::grab(source, depth, image);
+  cpu::depthBilateralFilter(depth, filtered, KSZ, SIGMA_SPATIAL, SIGMA_DEPTH);
+
+  Outputs reference;
+  {
+    test::ThreadsScope single(1);
+    runPasses(intr, depth, filtered, cpu::Rays(), reference);
+  }
+
+  const int threads[] = { 2, 3, 8 };
+  for(size_t i = 0; i < sizeof(threads)/sizeof(threads[0]); ++i)
+  {
+    test::ThreadsScope scope(threads[i]);
+
+    Outputs out;
+    runPasses(intr, depth, filtered, cpu::Rays(), out);
+
+    EXPECT_TRUE(test::bitExact(out.filtered, reference.filtered));
+    EXPECT_TRUE(test::bitExact(out.pyramid, reference.pyramid));
+    EXPECT_TRUE(test::bitExact(out.dists, reference.dists));
+    EXPECT_TRUE(test::bitExact(out.points, reference.points));
+    EXPECT_TRUE(test::bitExact(out.normals, reference.normals));
+  }
+}
@@ -0,0 +1,120 @@
+#include "test_utils.hpp"
+
+#include <scanner/cpu/imgproc.hpp>
+#include <scanner/cpu/projective_icp.hpp>
+
+using namespace vm::scanner;
+
+namespace
+{
+  const int LEVELS = 3;
+
+  /** Points and normals pyramid of a frame as Scanner builds it for the cpu backend */
+  struct Pyramid
+  {
+    cpu::ProjectiveICP::PointsPyr points;
+    cpu::ProjectiveICP::NormalsPyr normals;
+
+    Pyramid(const Intr& intr, const cpu::Depth& depth) : points(LEVELS), normals(LEVELS)
+    {
+      ScannerParams p = ScannerParams::default_params();
+
+      std::vector<cpu::Depth> depths(LEVELS);
+      cpu::depthBilateralFilter(depth, depths[0], p.bilateral_kernel_size, p.bilateral_sigma_spatial, p.bilateral_sigma_depth);
+      for(int i = 1; i < LEVELS; ++i)
+        cpu::depthBuildPyramid(depths[i-1], depths[i], p.bilateral_sigma_depth);
+
+      for(int i = 0; i < LEVELS; ++i)
+        cpu::computePointNormals(intr(i), depths[i], points[i], normals[i]);
+    }
+  };
+
+  /** Two consecutive frames of the orbit and the ground truth motion between them, curr -> prev */
+  struct Pair
+  {
+    Intr intr;
+    cv::Ptr<Pyramid> prev, curr;
+    Affine3f motion;
+
+    Pair()
+    {
+      SyntheticSource source(test::smallParams(320, 240));
+      intr = source.params().intr;
+
+      cpu::Depth depth;
+      cpu::Image image;
+      test::grab(source, depth, image);
+      prev = new Pyramid(intr, depth);
+      Affine3f prev_pose = source.pose();
+
+      test::grab(source, depth, image);
+      curr = new Pyramid(intr, depth);
+      motion = prev_pose.inv() * source.pose();
+    }
+  };
+
+  cv::Ptr<cpu::ProjectiveICP> makeIcp()
+  {
+    ScannerParams p = ScannerParams::default_params();
+
+    cv::Ptr<cpu::ProjectiveICP> icp(new cpu::ProjectiveICP());
+    icp->setDistThreshold(p.icp_dist_thres);
+    icp->setAngleThreshold(p.icp_angle_thres);
+    icp->setIterationsNum(std::vector<int>(p.icp_iter_num.begin(), p.icp_iter_num.begin() + LEVELS));
+    return icp;
+  }
+
+  Affine3f estimate(const Pair& pair)
+  {
+    Affine3f affine;
+    EXPECT_TRUE(makeIcp()->estimateTransform(affine, pair.intr, pair.curr->points, pair.curr->normals, pair.prev->points, pair.prev->normals));
+    return affine;
+  }
+}
+
+TEST(CpuProjectiveIcp, SameResultAcrossThreadCounts)
+{
+  Pair pair;
+
+  Affine3f reference;
+  {
+    test::ThreadsScope single(1);
+    reference = estimate(pair);
+  }
+
+  // partial sums over fixed row stripes merged in a fixed order, so not a bit of the pose may change
+  const int threads[] = { 2, 3, 8 };
+  for(size_t i = 0; i < sizeof(threads)/sizeof(threads[0]); ++i)
+  {
+    test::ThreadsScope scope(threads[i]);
+    Affine3f affine = estimate(pair);
+    EXPECT_TRUE(test::bitExact(cv::Mat(affine.matrix), cv::Mat(reference.matrix))) << threads[i] << " threads";
+  }
+}
+
+TEST(CpuProjectiveIcp, Avx2MatchesScalar)
+{
+  Pair pair;
+
+  Affine3f simd = estimate(pair), scalar;
+  {
+    test::OptimizedScope off(false);
+    scalar = estimate(pair);
+  }
+
+  // the vector rows sum a row in floats before it goes into the double stripe sums, so only close
+  Affine3f delta = simd.inv() * scalar;
+  EXPECT_LT(cv::norm(delta.rvec()), 1e-4);
+  EXPECT_LT(cv::norm(delta.translation()), 1e-4);
+}
+
+TEST(CpuProjectiveIcp, RecoversTheMotion)
+{
+  Pair pair;
+  Affine3f affine = estimate(pair);
+
+  // a degree of orbit moves the camera by about 2cm, the estimate lands within a few mm of it
+  Affine3f error = pair.motion.inv() * affine;
+  EXPECT_LT(cv::norm(error.rvec()), 0.2 * CV_PI / 180);
+  EXPECT_LT(cv::norm(error.translation()), 0.005);
+}
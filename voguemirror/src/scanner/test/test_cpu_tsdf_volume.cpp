@@ -0,0 +1,145 @@
+#include "test_utils.hpp"
+
+#include <scanner/cpu/imgproc.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+
+using namespace vm::scanner;
+
+namespace
+{
+  const int FRAMES = 3;
+
+  /** A few frames of the orbit with their dists, colors and ground truth poses */
+  struct Sequence
+  {
+    Intr intr;
+    std::vector<cpu::Dists> dists;
+    std::vector<cpu::Image> colors;
+    std::vector<Affine3f> poses;
+
+    Sequence()
+    {
+      SyntheticSource source(test::smallParams());
+      intr = source.params().intr;
+
+      for(int i = 0; i < FRAMES; ++i)
+      {
+        cpu::Depth depth;
+        cpu::Image image;
+        test::grab(source, depth, image);
+
+        dists.push_back(cpu::Dists());
+        cpu::computeDists(depth, dists.back(), intr);
+        colors.push_back(image);
+        poses.push_back(source.pose());
+      }
+    }
+  };
+
+  /** Same placement as the Scanner defaults, at a resolution that keeps the volume at 16MB */
+  cv::Ptr<cpu::TsdfVolume> makeVolume(int order)
+  {
+    ScannerParams p = ScannerParams::default_params();
+
+    cv::Ptr<cpu::TsdfVolume> volume(new cpu::TsdfVolume(Vec3i::all(128), order));
+    volume->setSize(p.volume_size);
+    volume->setPose(p.volume_pose);
+    volume->setTruncDist(p.tsdf_trunc_dist);
+    volume->setMaxWeight(p.tsdf_max_weight);
+    volume->setRaycastStepFactor(p.raycast_step_factor);
+    volume->setGradientDeltaFactor(p.gradient_delta_factor);
+    volume->clear();
+    return volume;
+  }
+
+  void integrate(cpu::TsdfVolume& volume, const Sequence& seq)
+  {
+    for(int i = 0; i < FRAMES; ++i)
+      volume.integrate(seq.dists[i], seq.colors[i], seq.poses[i], seq.intr);
+  }
+}
+
+TEST(CpuTsdfVolume, Avx2MatchesScalar)
+{
+  Sequence seq;
+
+  for(int order = cpu::TsdfVolume::ORDER_LINEAR; order <= cpu::TsdfVolume::ORDER_BRICKED; ++order)
+  {
+    cv::Ptr<cpu::TsdfVolume> simd = makeVolume(order), scalar = makeVolume(order);
+
+    integrate(*simd, seq);
+    {
+      test::OptimizedScope off(false);
+      integrate(*scalar, seq);
+    }
+
+    // the vector rows do the scalar math in the same order and round the halfs to nearest even as well
+    EXPECT_TRUE(test::bitExact(simd->data(), scalar->data())) << "order " << order;
+    EXPECT_EQ(simd->getCulledVoxelsNum(), scalar->getCulledVoxelsNum());
+  }
+}
+
+TEST(CpuTsdfVolume, SameResultAcrossThreadCounts)
+{
+  Sequence seq;
+
+  cv::Ptr<cpu::TsdfVolume> reference = makeVolume(cpu::TsdfVolume::ORDER_LINEAR);
+  {
+    test::ThreadsScope single(1);
+    integrate(*reference, seq);
+  }
+
+  const int threads[] = { 2, 3, 8 };
+  for(size_t i = 0; i < sizeof(threads)/sizeof(threads[0]); ++i)
+  {
+    test::ThreadsScope scope(threads[i]);
+
+    cv::Ptr<cpu::TsdfVolume> volume = makeVolume(cpu::TsdfVolume::ORDER_LINEAR);
+    integrate(*volume, seq);
+    EXPECT_TRUE(test::bitExact(volume->data(), reference->data())) << threads[i] << " threads";
+  }
+}
+
+TEST(CpuTsdfVolume, BatchMatchesFrameByFrame)
+{
+  Sequence seq;
+
+  for(int order = cpu::TsdfVolume::ORDER_LINEAR; order <= cpu::TsdfVolume::ORDER_BRICKED; ++order)
+  {
+    cv::Ptr<cpu::TsdfVolume> batch = makeVolume(order), frames = makeVolume(order);
+
+    batch->integrate(seq.dists, seq.colors, seq.poses, seq.intr);
+    integrate(*frames, seq);
+
+    EXPECT_TRUE(test::bitExact(batch->data(), frames->data())) << "order " << order;
+  }
+}
+
+TEST(CpuTsdfVolume, SurfaceNearTheMeasurements)
+{
+  Sequence seq;
+  cv::Ptr<cpu::TsdfVolume> volume = makeVolume(cpu::TsdfVolume::ORDER_LINEAR);
+  integrate(*volume, seq);
+
+  // the raycast from the first pose sees the depth it was fused from, up to the noise and a voxel or two
+  cpu::Depth depth, raycast;
+  cpu::Normals normals;
+  SyntheticSource source(test::smallParams());
+  cpu::Image image;
+  test::grab(source, depth, image);
+
+  raycast.create(depth.rows, depth.cols);
+  volume->raycast(seq.poses[0], seq.intr, raycast, normals);
+
+  int compared = 0, close = 0;
+  for(int y = 0; y < depth.rows; ++y)
+    for(int x = 0; x < depth.cols; ++x)
+      if (depth(y, x) && raycast(y, x))
+      {
+        ++compared;
+        close += std::abs(depth(y, x) - raycast(y, x)) < 30;
+      }
+
+  ASSERT_GT(compared, depth.rows * depth.cols / 20);
+  EXPECT_GT(close, compared * 9 / 10);
+}
@@ -0,0 +1,64 @@
+#include "test_utils.hpp"
+
+#include <scanner/cuda/imgproc.hpp>
+
+using namespace vm::scanner;
+
+namespace
+{
+  template<typename T>
+  cv::Mat download(const cuda::DeviceArray2D<T>& array, int type)
+  {
+    cv::Mat host(array.rows(), array.cols(), type);
+    array.download(host.ptr<void>(), host.step);
+    return host;
+  }
+}
+
+TEST(CudaImgproc, FrontEndMatchesSeparateCalls)
+{
+  // the tests run on build machines without a device too
+  if (cuda::getCudaEnabledDeviceCount() == 0)
+  {
+    std::cout << "No CUDA device, skipped" << std::endl;
+    return;
+  }
+
+  ScannerParams p = ScannerParams::default_params();
+  SyntheticSource source(test::smallParams());
+  const Intr& intr = source.params().intr;
+
+  cpu::Depth host_depth;
+  cpu::Image image;
+  test::grab(source, host_depth, image);
+
+  cuda::Depth depth;
+  depth.upload(host_depth.data, host_depth.step, host_depth.rows, host_depth.cols);
+
+  cuda::Rays rays;
+  cuda::computeRays(intr, depth.rows(), depth.cols(), rays);
+
+  for(int truncate = 0; truncate < 2; ++truncate)
+  {
+    float truncate_dist = truncate ? 2.5f : 0.f;
+
+    cuda::Dists dists[2];
+    cuda::Depth filtered[2];
+    cuda::Cloud points[2];
+    cuda::Normals normals[2];
+
+    cuda::depthFrontEnd(intr, depth, dists[0], filtered[0], points[0], normals[0], p.bilateral_kernel_size,
+                        p.bilateral_sigma_spatial, p.bilateral_sigma_depth, truncate_dist, rays);
+
+    cuda::computeDists(depth, dists[1], intr, rays);
+    cuda::depthBilateralFilter(depth, filtered[1], p.bilateral_kernel_size, p.bilateral_sigma_spatial, p.bilateral_sigma_depth);
+    if (truncate_dist > 0)
+      cuda::depthTruncation(filtered[1], truncate_dist);
+    cuda::computePointNormals(intr, filtered[1], points[1], normals[1], rays);
+
+    EXPECT_TRUE(test::bitExact(download(dists[0], CV_16U), download(dists[1], CV_16U)));
+    EXPECT_TRUE(test::bitExact(download(filtered[0], CV_16U), download(filtered[1], CV_16U)));
+    EXPECT_TRUE(test::bitExact(download(points[0], CV_32FC4), download(points[1], CV_32FC4)));
+    EXPECT_TRUE(test::bitExact(download(normals[0], CV_32FC4), download(normals[1], CV_32FC4)));
+  }
+}
@@ -0,0 +1,136 @@
+#include "test_utils.hpp"
+
+#include <map>
+
+#include <scanner/marching_cubes.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+#include <scanner/cpu/internal.hpp>
+
+using namespace vm::scanner;
+
+namespace
+{
+  /** Corner index of the given offset, -1 if it isn't one */
+  int corner(int dx, int dy, int dz)
+  {
+    for(int i = 0; i < 8; ++i)
+      if (mc::corners[i][0] == dx && mc::corners[i][1] == dy && mc::corners[i][2] == dz)
+        return i;
+    return -1;
+  }
+
+  /** The two corners cell edge e joins */
+  void edgeCorners(int e, int& c0, int& c1)
+  {
+    const signed char* o = mc::edge_owner[e];
+    c0 = corner(o[0], o[1], o[2]);
+    c1 = corner(o[0] + (o[3] == 0), o[1] + (o[3] == 1), o[2] + (o[3] == 2));
+  }
+
+  /** Sphere of radius r around center, both in voxels, weight 1 everywhere so every cell is meshed */
+  void fillSphere(cpu::TsdfVolume& volume, const Vec3f& center, float r)
+  {
+    const Vec3i dims = volume.getDims();
+    const float trunc = volume.getTruncDist() / volume.getVoxelSize()[0];
+
+    cv::Mat data = volume.data();
+    for(int z = 0; z < dims[2]; ++z)
+      for(int y = 0; y < dims[1]; ++y)
+      {
+        host::Voxel* row = data.ptr<host::Voxel>(y + z * dims[1]);
+        for(int x = 0; x < dims[0]; ++x)
+        {
+          float d = (float)cv::norm(Vec3f((float)x, (float)y, (float)z) - center) - r;
+          row[x].tsdf = host::float2half(std::max(-1.f, std::min(1.f, d / trunc)));
+          row[x].weight = 1;
+          row[x].rg = row[x].ba = 0;
+        }
+      }
+  }
+}
+
+TEST(MarchingCubes, CaseTable)
+{
+  for(int c = 0; c < 256; ++c)
+  {
+    const signed char* t = mc::triangles[c];
+
+    int n = 0;
+    while(n < 16 && t[n] != -1)
+      ++n;
+
+    ASSERT_LT(n, 16) << "case " << c << " isn't terminated";
+    ASSERT_EQ(0, n % 3) << "case " << c;
+    ASSERT_LE(n / 3, (int)mc::MAX_TRIANGLES) << "case " << c;
+
+    // a triangle vertex lies on an edge whose corners are on opposite sides, and every such edge gets one
+    bool crossed[12] = { false };
+    for(int e = 0; e < 12; ++e)
+    {
+      int c0, c1;
+      edgeCorners(e, c0, c1);
+      ASSERT_GE(c0, 0);
+      ASSERT_GE(c1, 0);
+      crossed[e] = ((c >> c0) & 1) != ((c >> c1) & 1);
+    }
+
+    bool used[12] = { false };
+    for(int i = 0; i < n; ++i)
+    {
+      ASSERT_TRUE(0 <= t[i] && t[i] < 12) << "case " << c;
+      EXPECT_TRUE(crossed[t[i]]) << "case " << c << " edge " << (int)t[i];
+      used[t[i]] = true;
+    }
+
+    for(int e = 0; e < 12; ++e)
+      EXPECT_EQ(crossed[e], used[e]) << "case " << c << " edge " << e;
+  }
+}
+
+TEST(MarchingCubes, SphereMeshIsClosed)
+{
+  cpu::TsdfVolume volume(Vec3i::all(48));
+  volume.setSize(Vec3f::all(0.48f));
+  volume.setPose(Affine3f::Identity());
+  volume.setTruncDist(0.04f);
+
+  const Vec3f center(23.7f, 24.2f, 23.9f);
+  const float radius = 15.3f;
+  fillSphere(volume, center, radius);
+
+  cpu::Mesh buffer;
+  cpu::Mesh mesh = volume.fetchMesh(buffer);
+
+  const int vertices = mesh.vertices.cols;
+  const int indices = mesh.indices.cols;
+  ASSERT_GT(vertices, 0);
+  ASSERT_EQ(0, indices % 3);
+
+  // vertices sit on the sphere up to the linear interpolation of the distance
+  const float voxel = volume.getVoxelSize()[0];
+  for(int i = 0; i < vertices; ++i)
+  {
+    const cv::Vec4f& v = mesh.vertices(0, i);
+    float r = (float)cv::norm(Vec3f(v[0], v[1], v[2]) / voxel - center);
+    EXPECT_NEAR(radius, r, 0.1f) << "vertex " << i;
+  }
+
+  // closed and without cracks: every edge is shared by exactly two triangles
+  std::map<std::pair<int, int>, int> edges;
+  for(int i = 0; i < indices; i += 3)
+    for(int k = 0; k < 3; ++k)
+    {
+      int a = mesh.indices(0, i + k), b = mesh.indices(0, i + (k + 1) % 3);
+      ASSERT_TRUE(0 <= a && a < vertices && 0 <= b && b < vertices);
+      ASSERT_NE(a, b) << "degenerate triangle " << i / 3;
+      ++edges[std::make_pair(std::min(a, b), std::max(a, b))];
+    }
+
+  int open = 0;
+  for(std::map<std::pair<int, int>, int>::const_iterator it = edges.begin(); it != edges.end(); ++it)
+    open += it->second != 2;
+  EXPECT_EQ(0, open);
+
+  // Euler characteristic of a sphere
+  EXPECT_EQ(2, vertices - (int)edges.size() + indices / 3);
+}
@@ -0,0 +1,166 @@
+#include "test_utils.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <scanner/ply.hpp>
+
+using namespace vm::scanner;
+
+namespace
+{
+  /** What a reader gets back from one of our files, the layout is the one writePly documents */
+  struct Ply
+  {
+    std::string header;
+    cpu::Mesh mesh;
+  };
+
+  ::testing::AssertionResult readPly(const std::string& filename, Ply& ply)
+  {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file)
+      return ::testing::AssertionFailure() << "can't open " << filename;
+
+    int vertices = 0, faces = 0;
+    bool normals = false, colors = false;
+    for(std::string line; std::getline(file, line) && line != "end_header"; )
+    {
+      ply.header += line + "\n";
+
+      std::istringstream words(line);
+      std::string word, name;
+      int count = 0;
+      if (words >> word >> name >> count && word == "element")
+        (name == "vertex" ? vertices : faces) = count;
+      normals = normals || line == "property float nx";
+      colors = colors || line == "property uchar red";
+    }
+
+    ply.mesh.vertices.create(1, vertices);
+    if (normals)
+      ply.mesh.normals.create(1, vertices);
+    if (colors)
+      ply.mesh.colors.create(1, vertices);
+
+    for(int i = 0; i < vertices; ++i)
+    {
+      cv::Vec4f& p = ply.mesh.vertices(0, i);
+      p = cv::Vec4f::all(0.f);
+      file.read((char*)p.val, 3 * sizeof(float));
+
+      if (normals)
+      {
+        cv::Vec4f& n = ply.mesh.normals(0, i);
+        n = cv::Vec4f::all(0.f);
+        file.read((char*)n.val, 3 * sizeof(float));
+      }
+
+      if (colors)
+      {
+        unsigned char rgb[3];
+        file.read((char*)rgb, sizeof(rgb));
+        ply.mesh.colors(0, i) = cv::Vec4b(rgb[2], rgb[1], rgb[0], 0); // bgra
+      }
+    }
+
+    if (faces)
+      ply.mesh.indices.create(1, faces * 3);
+    for(int i = 0; i < faces; ++i)
+    {
+      unsigned char count = 0;
+      file.read((char*)&count, 1);
+      if (count != 3)
+        return ::testing::AssertionFailure() << "face " << i << " has " << (int)count << " vertices";
+      file.read((char*)&ply.mesh.indices(0, i * 3), 3 * sizeof(int));
+    }
+
+    if (!file)
+      return ::testing::AssertionFailure() << filename << " is shorter than its header says";
+    if (file.peek() != EOF)
+      return ::testing::AssertionFailure() << filename << " is longer than its header says";
+    return ::testing::AssertionSuccess();
+  }
+
+  /** A few random vertices with normals, colors and triangles, w and alpha left zero as the file can't hold them */
+  cpu::Mesh makeMesh(int vertices, int faces)
+  {
+    cv::RNG rng(42);
+
+    cpu::Mesh mesh;
+    mesh.vertices.create(1, vertices);
+    mesh.normals.create(1, vertices);
+    mesh.colors.create(1, vertices);
+    mesh.indices.create(1, faces * 3);
+
+    for(int i = 0; i < vertices; ++i)
+    {
+      mesh.vertices(0, i) = cv::Vec4f(rng.uniform(-3.f, 3.f), rng.uniform(-3.f, 3.f), rng.uniform(0.f, 5.f), 0.f);
+      mesh.normals(0, i) = cv::Vec4f(rng.uniform(-1.f, 1.f), rng.uniform(-1.f, 1.f), rng.uniform(-1.f, 1.f), 0.f);
+      mesh.colors(0, i) = cv::Vec4b((uchar)rng.uniform(0, 256), (uchar)rng.uniform(0, 256), (uchar)rng.uniform(0, 256), 0);
+    }
+
+    for(int i = 0; i < faces * 3; ++i)
+      mesh.indices(0, i) = rng.uniform(0, vertices);
+    return mesh;
+  }
+
+  struct TempFile
+  {
+    std::string name;
+    TempFile() : name(cv::tempfile(".ply")) {}
+    ~TempFile() { std::remove(name.c_str()); }
+  };
+}
+
+TEST(Ply, MeshRoundTrip)
+{
+  TempFile file;
+  cpu::Mesh mesh = makeMesh(1000, 700);
+  writePly(file.name, mesh);
+
+  Ply ply;
+  ASSERT_TRUE(readPly(file.name, ply));
+  EXPECT_TRUE(test::bitExact(ply.mesh.vertices, mesh.vertices));
+  EXPECT_TRUE(test::bitExact(ply.mesh.normals, mesh.normals));
+  EXPECT_TRUE(test::bitExact(ply.mesh.colors, mesh.colors));
+  EXPECT_TRUE(test::bitExact(ply.mesh.indices, mesh.indices));
+}
+
+TEST(Ply, EmptyPropertiesAreLeftOut)
+{
+  TempFile file;
+  cpu::Mesh mesh = makeMesh(100, 0);
+  writePly(file.name, mesh.vertices);
+
+  Ply ply;
+  ASSERT_TRUE(readPly(file.name, ply));
+  EXPECT_EQ(std::string::npos, ply.header.find("nx"));
+  EXPECT_EQ(std::string::npos, ply.header.find("red"));
+  EXPECT_EQ(std::string::npos, ply.header.find("face"));
+  EXPECT_TRUE(test::bitExact(ply.mesh.vertices, mesh.vertices));
+}
+
+TEST(Ply, WriterKeepsAFailureForWait)
+{
+  TempFile file;
+  cpu::Mesh mesh = makeMesh(100, 50);
+  PlyWriter writer;
+
+  writer.save(file.name, mesh);
+  EXPECT_TRUE(writer.wait());
+  EXPECT_TRUE(writer.error().empty());
+
+  // the save after a failed one succeeds, wait() still reports the failure, and only once
+  const std::string bad = "/nonexistent/dir/mesh.ply";
+  writer.save(bad, mesh);
+  writer.save(file.name, mesh);
+  EXPECT_FALSE(writer.wait());
+  EXPECT_EQ(0u, writer.error().find(bad));
+  EXPECT_TRUE(writer.wait());
+
+  Ply ply;
+  ASSERT_TRUE(readPly(file.name, ply));
+  EXPECT_TRUE(test::bitExact(ply.mesh.indices, mesh.indices));
+}
@@ -0,0 +1,194 @@
+#include "test_utils.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include <scanner/session.hpp>
+#include <scanner/cpu/imgproc.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+#include <scanner/cpu/internal.hpp>
+
+using namespace vm::scanner;
+
+namespace
+{
+  struct TempFile
+  {
+    std::string name;
+    TempFile() : name(cv::tempfile(".session")) {}
+    ~TempFile() { std::remove(name.c_str()); }
+  };
+
+  /** One add() of the recording and what the reader should give back for it */
+  struct Recorded
+  {
+    int frame, segment, sensor;
+    Affine3f pose, sensor_pose;
+    cpu::Dists dists;
+    cpu::Image colors;
+  };
+
+  /** Frames 0 to 3, a second sensor next to frame 1 without color, then a reset and frames 0 to 2 again */
+  std::vector<Recorded> record(const std::string& filename, const SyntheticSource::Params& params)
+  {
+    SyntheticSource source(params);
+    cpu::TsdfVolume volume(Vec3i::all(64));
+
+    // the ring holds the whole recording, so nothing is dropped however slow the writer is
+    SessionRecorder recorder;
+    recorder.open(filename, params.cols, params.rows, params.intr, volume, 16);
+
+    const int frames[] = { 0, 1, 1, 2, 3, 0, 1, 2 };
+    const int sensors[] = { 0, 0, 1, 0, 0, 0, 0, 0 };
+    const int segments[] = { 0, 0, 0, 0, 0, 1, 1, 1 };
+    const Affine3f side(Vec3f(0.f, 1.2f, 0.f), Vec3f(0.4f, 0.f, -0.1f));
+
+    std::vector<Recorded> recorded;
+    cpu::Depth depth;
+    cpu::Image image;
+    for(int i = 0; i < 8; ++i)
+    {
+      if (sensors[i] == 0)
+        test::grab(source, depth, image);
+
+      Recorded r;
+      r.frame = frames[i];
+      r.segment = segments[i];
+      r.sensor = sensors[i];
+      r.pose = source.pose();
+      r.sensor_pose = sensors[i] ? side : Affine3f::Identity();
+      cpu::computeDists(depth, r.dists, params.intr);
+      if (sensors[i] == 0)
+        r.colors = image.clone();
+
+      EXPECT_TRUE(recorder.add(r.frame, r.pose, r.dists, r.colors, r.sensor, r.sensor_pose)) << "frame " << i;
+      recorded.push_back(r);
+    }
+
+    EXPECT_TRUE(recorder.close()) << recorder.error();
+    EXPECT_EQ(8, recorder.recorded());
+    EXPECT_EQ(0, recorder.dropped());
+    return recorded;
+  }
+
+  /** The distances as the session stores them, rounded to half floats */
+  cpu::Dists halfRounded(const cpu::Dists& dists)
+  {
+    cpu::Dists rounded(dists.size());
+    for(int y = 0; y < dists.rows; ++y)
+      for(int x = 0; x < dists.cols; ++x)
+        rounded(y, x) = host::half2float(host::float2half(dists(y, x)));
+    return rounded;
+  }
+
+  /** Mean absolute difference of the color channels, alpha isn't stored */
+  double colorError(const cpu::Image& a, const cpu::Image& b)
+  {
+    cv::Mat a3, b3;
+    cv::cvtColor(a, a3, CV_BGRA2BGR);
+    cv::cvtColor(b, b3, CV_BGRA2BGR);
+    return cv::norm(a3, b3, cv::NORM_L1) / (a3.total() * 3);
+  }
+
+  std::vector<char> readFile(const std::string& filename)
+  {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+}
+
+TEST(Session, RecordAndRead)
+{
+  TempFile file;
+  SyntheticSource::Params params = test::smallParams();
+  std::vector<Recorded> recorded = record(file.name, params);
+
+  SessionReader reader(file.name);
+  const SessionHeader& h = reader.header();
+  EXPECT_EQ(8, h.frames);
+  EXPECT_EQ(params.cols, h.cols);
+  EXPECT_EQ(params.rows, h.rows);
+  EXPECT_EQ(params.intr.fx, reader.intr().fx);
+  EXPECT_EQ(params.intr.cy, reader.intr().cy);
+  ASSERT_EQ(8, reader.size());
+  EXPECT_EQ(1, reader.lastSegment());
+
+  cpu::Dists dists;
+  cpu::Image colors;
+  cv::Mat_<unsigned short> halfs;
+  for(int i = 0; i < reader.size(); ++i)
+  {
+    const Recorded& r = recorded[i];
+    const SessionFrame& f = reader.frame(i);
+    EXPECT_EQ(r.frame, f.frame) << "frame " << i;
+    EXPECT_EQ(r.segment, f.segment) << "frame " << i;
+    EXPECT_EQ(r.sensor, f.sensor) << "frame " << i;
+
+    // the sensor in the frame of sensor 0 goes on top of the tracked pose
+    Affine3f pose = r.pose * r.sensor_pose;
+    EXPECT_LT(cv::norm(cv::Mat(reader.pose(i).matrix), cv::Mat(pose.matrix), cv::NORM_INF), 1e-6) << "frame " << i;
+
+    // the distances are lossless up to the half floats the device fuses
+    reader.decode(i, dists, colors);
+    EXPECT_TRUE(test::bitExact(dists, halfRounded(r.dists))) << "frame " << i;
+
+    reader.decode(i, halfs, colors);
+    for(int y = 0; y < halfs.rows; ++y)
+      for(int x = 0; x < halfs.cols; ++x)
+        ASSERT_EQ(host::float2half(r.dists(y, x)), halfs(y, x)) << "frame " << i << " at (" << x << ", " << y << ")";
+
+    // color is a JPEG
+    if (r.colors.empty())
+      EXPECT_TRUE(colors.empty()) << "frame " << i;
+    else
+    {
+      ASSERT_EQ(r.colors.size(), colors.size());
+      EXPECT_LT(colorError(r.colors, colors), 4.0) << "frame " << i;
+    }
+  }
+
+  // each segment is fused on its own
+  cpu::TsdfVolume volume(Vec3i::all(32));
+  EXPECT_EQ(5, refuseSession(reader, volume, std::vector<Affine3f>(), 0));
+  EXPECT_EQ(3, refuseSession(reader, volume));
+}
+
+TEST(Session, ReaderKeepsTheWholeFrames)
+{
+  TempFile file;
+  record(file.name, test::smallParams());
+  std::vector<char> data = readFile(file.name);
+
+  // a recording that wasn't closed ends inside a frame, the frames before it are read
+  SessionFrame last = SessionReader(file.name).frame(7);
+  size_t cut = data.size() - last.dists_bytes - last.color_bytes + 10;
+  {
+    std::ofstream out(file.name.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(&data[0], cut);
+  }
+
+  SessionReader reader(file.name);
+  EXPECT_EQ(7, reader.size());
+  EXPECT_EQ(1, reader.lastSegment());
+}
+
+TEST(Session, OtherFilesAreRejected)
+{
+  TempFile file;
+  record(file.name, test::smallParams());
+  std::vector<char> data = readFile(file.name);
+
+  ((SessionHeader*)&data[0])->version = SessionHeader::VERSION + 1;
+  {
+    std::ofstream out(file.name.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(&data[0], data.size());
+  }
+  EXPECT_THROW(SessionReader reader(file.name), cv::Exception);
+  EXPECT_THROW(SessionReader reader(file.name + ".missing"), cv::Exception);
+
+  cpu::TsdfVolume volume(Vec3i::all(32));
+  SessionRecorder recorder;
+  EXPECT_THROW(recorder.open("/nonexistent/dir/scan.session", 160, 120, test::smallParams().intr, volume), cv::Exception);
+  EXPECT_FALSE(recorder.isOpen());
+}
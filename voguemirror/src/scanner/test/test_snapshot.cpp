@@ -0,0 +1,260 @@
+#include "test_utils.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+#include <scanner/snapshot.hpp>
+#include <scanner/cpu/internal.hpp>
+
+using namespace vm::scanner;
+
+namespace
+{
+  struct TempFile
+  {
+    std::string name;
+    TempFile() : name(cv::tempfile(".snapshot")) {}
+    ~TempFile() { std::remove(name.c_str()); }
+  };
+
+  /** VOXEL_GEOMETRY voxel, half tsdf and 8 bit weight */
+  void putVoxel(unsigned char* v, float tsdf, int weight)
+  {
+    unsigned short half = host::float2half(tsdf);
+    memcpy(v, &half, sizeof(half));
+    v[2] = (unsigned char)weight;
+    v[3] = 0;
+  }
+
+  /** Exact in halfs, different for most neighbours */
+  float tsdfAt(int x, int y, int z) { return ((x + y + z) % 9 - 4) / 4.f; }
+  int weightAt(int x, int y, int z) { return (x + 2 * y + 3 * z) % 200 + 1; }
+
+  /** Written by hand from the format in snapshot.hpp, so the reader is checked against the documented layout:
+    * 40 x 16 x 16 voxels, three bricks along x, brick 0 stored as is, brick 1 packed into one run of the same voxel
+    * and brick 2 left out. Storage is shifted by the grid origin (4, 0, 0). */
+  std::vector<unsigned char> makeFile(const std::vector<Affine3f>& poses)
+  {
+    const int bs = SnapshotHeader::BRICK_SIZE;
+
+    SnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = SnapshotHeader::MAGIC;
+    h.version = SnapshotHeader::VERSION;
+    h.layout = cuda::TsdfVolume::VOXEL_GEOMETRY;
+    h.voxel_bytes = 4;
+    h.dims[0] = 40, h.dims[1] = 16, h.dims[2] = 16;
+    h.size[0] = h.size[1] = h.size[2] = 1.f;
+    h.pose[0] = h.pose[5] = h.pose[10] = h.pose[15] = 1.f;
+    h.trunc_dist = 0.1f;
+    h.max_weight = 64;
+    h.grid_origin[0] = 4;
+    h.bricks = 2;
+    h.poses = (int)poses.size();
+
+    std::vector<unsigned char> raw(h.brickBytes());
+    for(int z = 0; z < bs; ++z)
+      for(int y = 0; y < bs; ++y)
+        for(int x = 0; x < bs; ++x)
+          putVoxel(&raw[((z * bs + y) * bs + x) * 4], tsdfAt(x, y, z), weightAt(x, y, z));
+
+    // runs of at most 129 voxels, control byte run + 126
+    std::vector<unsigned char> packed;
+    unsigned char voxel[4];
+    putVoxel(voxel, -0.5f, 7);
+    for(int left = bs * bs * bs; left > 0; )
+    {
+      int run = std::min(left, 129);
+      packed.push_back((unsigned char)(run + 126));
+      packed.insert(packed.end(), voxel, voxel + 4);
+      left -= run;
+    }
+
+    SnapshotBrick table[2];
+    table[0].index = 0;
+    table[0].bytes = (unsigned int)raw.size();
+    table[0].offset = sizeof(h);
+    table[1].index = 1;
+    table[1].bytes = (unsigned int)packed.size();
+    table[1].offset = table[0].offset + raw.size();
+    h.table_offset = table[1].offset + packed.size();
+    h.poses_offset = h.table_offset + sizeof(table);
+
+    std::vector<unsigned char> file((const unsigned char*)&h, (const unsigned char*)(&h + 1));
+    file.insert(file.end(), raw.begin(), raw.end());
+    file.insert(file.end(), packed.begin(), packed.end());
+    file.insert(file.end(), (const unsigned char*)table, (const unsigned char*)(table + 2));
+    for(size_t i = 0; i < poses.size(); ++i)
+      file.insert(file.end(), (const unsigned char*)poses[i].matrix.val, (const unsigned char*)(poses[i].matrix.val + 16));
+    return file;
+  }
+
+  void writeFile(const std::string& filename, const std::vector<unsigned char>& data)
+  {
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    file.write((const char*)&data[0], data.size());
+  }
+
+  std::vector<Affine3f> makePoses()
+  {
+    std::vector<Affine3f> poses;
+    poses.push_back(Affine3f::Identity());
+    poses.push_back(Affine3f(Vec3f(0.1f, -0.2f, 0.3f), Vec3f(1.f, 2.f, 3.f)));
+    return poses;
+  }
+}
+
+TEST(Snapshot, ReaderFollowsTheFormat)
+{
+  TempFile file;
+  std::vector<Affine3f> poses = makePoses();
+  writeFile(file.name, makeFile(poses));
+
+  SnapshotReader reader(file.name);
+  EXPECT_EQ(2, reader.header().bricks);
+  EXPECT_EQ(0, reader.find(0));
+  EXPECT_EQ(1, reader.find(1));
+  EXPECT_EQ(-1, reader.find(2));
+
+  float tsdf;
+  int weight;
+  for(int z = 0; z < 16; ++z)
+    for(int y = 0; y < 16; ++y)
+      for(int x = 0; x < 40; ++x)
+      {
+        // volume x sits at storage x + 4, wrapping at 40
+        int sx = (x + 4) % 40;
+        bool stored = reader.voxel(x, y, z, tsdf, weight);
+
+        if (sx < 16)
+        {
+          ASSERT_TRUE(stored);
+          EXPECT_EQ(tsdfAt(sx, y, z), tsdf);
+          EXPECT_EQ(weightAt(sx, y, z), weight);
+        }
+        else if (sx < 32)
+        {
+          ASSERT_TRUE(stored);
+          EXPECT_EQ(-0.5f, tsdf);
+          EXPECT_EQ(7, weight);
+        }
+        else
+          EXPECT_FALSE(stored);
+      }
+
+  std::vector<Affine3f> read = reader.poses();
+  ASSERT_EQ(poses.size(), read.size());
+  for(size_t i = 0; i < poses.size(); ++i)
+    EXPECT_TRUE(test::bitExact(cv::Mat(read[i].matrix), cv::Mat(poses[i].matrix)));
+}
+
+TEST(Snapshot, ReaderRejectsOtherFiles)
+{
+  TempFile file;
+  std::vector<unsigned char> good = makeFile(makePoses());
+  SnapshotHeader h;
+  memcpy(&h, &good[0], sizeof(h));
+
+  // a newer version may lay the bricks out differently, it isn't guessed at
+  std::vector<unsigned char> data = good;
+  ((SnapshotHeader*)&data[0])->version = SnapshotHeader::VERSION + 1;
+  writeFile(file.name, data);
+  EXPECT_THROW(SnapshotReader reader(file.name), cv::Exception);
+
+  data = good;
+  ((SnapshotHeader*)&data[0])->magic = 0;
+  writeFile(file.name, data);
+  EXPECT_THROW(SnapshotReader reader(file.name), cv::Exception);
+
+  // cut inside the brick table
+  data.assign(good.begin(), good.begin() + h.table_offset + sizeof(SnapshotBrick));
+  writeFile(file.name, data);
+  EXPECT_THROW(SnapshotReader reader(file.name), cv::Exception);
+
+  // a packed brick that unpacks into too few voxels
+  data = good;
+  ((SnapshotBrick*)&data[h.table_offset])[1].bytes -= 5;
+  writeFile(file.name, data);
+  {
+    SnapshotReader reader(file.name);
+    std::vector<unsigned char> buffer;
+    EXPECT_THROW(reader.voxels(1, buffer), cv::Exception);
+  }
+
+  EXPECT_THROW(SnapshotReader reader(file.name + ".missing"), cv::Exception);
+}
+
+TEST(Snapshot, DeviceRoundTrip)
+{
+  // the tests run on build machines without a device too
+  if (cuda::getCudaEnabledDeviceCount() == 0)
+  {
+    std::cout << "No CUDA device, skipped" << std::endl;
+    return;
+  }
+
+  // partial bricks along every axis, bricked voxel order so the snapshot reorders them
+  const Vec3i dims(48, 40, 24);
+  cuda::TsdfVolume volume(dims, cuda::TsdfVolume::VOXEL_RGB, cuda::TsdfVolume::ORDER_BRICKED);
+  volume.setSize(Vec3f(0.96f, 0.8f, 0.48f));
+  volume.setTruncDist(0.05f);
+  volume.setMaxWeight(32);
+  volume.setPose(Affine3f(Vec3f(0.f, 0.3f, 0.f), Vec3f(-0.5f, 0.2f, 1.f)));
+  volume.setGridOrigin(Vec3i(8, 0, 16));
+
+  // random voxels in the lower half of the storage, runs in part of it, the rest empty and left out of the file
+  std::vector<unsigned char> voxels(volume.data().sizeBytes(), 0);
+  cv::RNG rng(7);
+  size_t half = voxels.size() / 2;
+  for(size_t i = 0; i < half; i += 6)
+    if (i % 1200 < 600)
+      for(int b = 0; b < 6; ++b)
+        voxels[i + b] = (unsigned char)rng.uniform(0, 256);
+    else
+      voxels[i] = 1;
+  volume.data().upload(&voxels[0], voxels.size());
+
+  std::vector<Affine3f> poses = makePoses();
+
+  for(int compress = 0; compress < 2; ++compress)
+  {
+    TempFile file;
+    saveSnapshot(file.name, volume, poses, compress != 0);
+
+    SnapshotReader reader(file.name);
+    Vec3i brick_dims = reader.header().brickDims();
+    EXPECT_LT(reader.header().bricks, brick_dims[0] * brick_dims[1] * brick_dims[2]);
+
+    cuda::TsdfVolume loaded(dims, cuda::TsdfVolume::VOXEL_RGB, cuda::TsdfVolume::ORDER_BRICKED);
+    std::vector<Affine3f> read;
+    loadSnapshot(file.name, loaded, &read);
+
+    std::vector<unsigned char> back(voxels.size());
+    loaded.data().download(&back[0]);
+    EXPECT_TRUE(back == voxels) << "compress " << compress;
+
+    EXPECT_EQ(volume.getSize(), loaded.getSize());
+    EXPECT_EQ(volume.getTruncDist(), loaded.getTruncDist());
+    EXPECT_EQ(volume.getMaxWeight(), loaded.getMaxWeight());
+    EXPECT_EQ(volume.getGridOrigin(), loaded.getGridOrigin());
+    EXPECT_TRUE(test::bitExact(cv::Mat(volume.getPose().matrix), cv::Mat(loaded.getPose().matrix)));
+
+    ASSERT_EQ(poses.size(), read.size());
+    for(size_t i = 0; i < poses.size(); ++i)
+      EXPECT_TRUE(test::bitExact(cv::Mat(read[i].matrix), cv::Mat(poses[i].matrix)));
+  }
+
+  // a volume of other dims isn't overwritten
+  TempFile file;
+  saveSnapshot(file.name, volume, poses);
+  cuda::TsdfVolume other(Vec3i(48, 40, 32), cuda::TsdfVolume::VOXEL_RGB, cuda::TsdfVolume::ORDER_BRICKED);
+  EXPECT_THROW(loadSnapshot(file.name, other), cv::Exception);
+
+  // the writer keeps a failure for wait(), past a later save that succeeds
+  SnapshotWriter writer;
+  writer.save("/nonexistent/dir/volume.snapshot", volume, poses);
+  writer.save(file.name, volume, poses);
+  EXPECT_FALSE(writer.wait());
+  EXPECT_EQ(0u, writer.error().find("/nonexistent/dir/volume.snapshot"));
+  EXPECT_TRUE(writer.wait());
+}
@@ -0,0 +1,69 @@
+#ifndef VM_SCANNER_TEST_UTILS_HPP
+#define VM_SCANNER_TEST_UTILS_HPP
+
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include <scanner/capture.hpp>
+
+namespace vm
+{
+  namespace scanner
+  {
+    namespace test
+    {
+      /** The synthetic body at a quarter of VGA, small enough for the tests to run in a few seconds. Noise and
+        * quantization stay on so the filters and ICP see depth like a sensor's. */
+      inline SyntheticSource::Params smallParams(int cols = 160, int rows = 120)
+      {
+        SyntheticSource::Params p = SyntheticSource::Params::default_params();
+        p.cols = cols;
+        p.rows = rows;
+        p.intr = Intr(525.f * cols / 640, 525.f * rows / 480, cols/2 - 0.5f, rows/2 - 0.5f);
+        return p;
+      }
+
+      /** Next frame of the source, depth in mm and RGBA image */
+      inline void grab(SyntheticSource& source, cpu::Depth& depth, cpu::Image& image)
+      {
+        cv::Mat d, i;
+        CV_Assert(source.grabRGBA(d, i));
+        depth = d;
+        image = i;
+      }
+
+      /** Same bytes everywhere, NaNs included, reports the first pixel that differs */
+      inline ::testing::AssertionResult bitExact(const cv::Mat& a, const cv::Mat& b)
+      {
+        if (a.size() != b.size() || a.type() != b.type())
+          return ::testing::AssertionFailure() << "sizes or types differ";
+
+        size_t elem = a.elemSize();
+        for(int y = 0; y < a.rows; ++y)
+          for(int x = 0; x < a.cols; ++x)
+            if (memcmp(a.ptr(y) + x * elem, b.ptr(y) + x * elem, elem) != 0)
+              return ::testing::AssertionFailure() << "differs at (" << x << ", " << y << ")";
+
+        return ::testing::AssertionSuccess();
+      }
+
+      /** Turns the AVX2 paths off or on for its scope, see host::useAvx2 */
+      struct OptimizedScope
+      {
+        bool prev;
+        OptimizedScope(bool on) : prev(cv::useOptimized()) { cv::setUseOptimized(on); }
+        ~OptimizedScope() { cv::setUseOptimized(prev); }
+      };
+
+      struct ThreadsScope
+      {
+        int prev;
+        ThreadsScope(int threads) : prev(cv::getNumThreads()) { cv::setNumThreads(threads); }
+        ~ThreadsScope() { cv::setNumThreads(prev); }
+      };
+    }
+  }
+}
+
+#endif
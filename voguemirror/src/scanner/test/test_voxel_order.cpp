@@ -0,0 +1,131 @@
+#include "test_utils.hpp"
+
+#include <scanner/cpu/imgproc.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+#include <scanner/cpu/internal.hpp>
+
+using namespace vm::scanner;
+
+namespace
+{
+  /** Scanner placement at a resolution small enough to compare voxel by voxel */
+  cv::Ptr<cpu::TsdfVolume> makeVolume(int order)
+  {
+    ScannerParams p = ScannerParams::default_params();
+
+    cv::Ptr<cpu::TsdfVolume> volume(new cpu::TsdfVolume(Vec3i::all(64), order));
+    volume->setSize(p.volume_size);
+    volume->setPose(p.volume_pose);
+    volume->setTruncDist(p.tsdf_trunc_dist);
+    volume->setMaxWeight(p.tsdf_max_weight);
+    volume->clear();
+    return volume;
+  }
+}
+
+TEST(VoxelOrder, SpreadBits)
+{
+  EXPECT_EQ(0u, host::spread_bits3(0));
+  EXPECT_EQ(01u, host::spread_bits3(1));
+  EXPECT_EQ(010u, host::spread_bits3(2));
+  EXPECT_EQ(0100u, host::spread_bits3(4));
+  EXPECT_EQ(0111u, host::spread_bits3(7));
+
+  // only the 3 bits within a brick are taken
+  EXPECT_EQ(host::spread_bits3(5), host::spread_bits3(5 + 8));
+}
+
+TEST(VoxelOrder, LinearIsRowMajor)
+{
+  const Vec3i dims(24, 16, 8);
+  for(int z = 0; z < dims[2]; ++z)
+    for(int y = 0; y < dims[1]; ++y)
+      for(int x = 0; x < dims[0]; ++x)
+        ASSERT_EQ((size_t)(x + dims[0] * (y + dims[1] * z)), host::voxel_offset(x, y, z, dims, host::ORDER_LINEAR));
+}
+
+TEST(VoxelOrder, BricksAreContiguousMortonBlocks)
+{
+  const Vec3i dims(24, 16, 40);
+  const size_t total = (size_t)dims[0] * dims[1] * dims[2];
+
+  std::vector<int> seen(total, 0);
+  for(int z = 0; z < dims[2]; ++z)
+    for(int y = 0; y < dims[1]; ++y)
+      for(int x = 0; x < dims[0]; ++x)
+      {
+        size_t offset = host::voxel_offset(x, y, z, dims, host::ORDER_BRICKED);
+        ASSERT_LT(offset, total) << "(" << x << ", " << y << ", " << z << ")";
+        ++seen[offset];
+
+        // the 512 voxels of a brick share one block, x varying fastest between bricks
+        size_t brick = (x / 8) + (y / 8 + (size_t)(z / 8) * (dims[1] / 8)) * (dims[0] / 8);
+        EXPECT_EQ(brick, offset / 512);
+
+        // inside it the bits of x, y, z interleave, so the 8 corners of an even cell are consecutive
+        size_t morton = offset % 512;
+        for(int bit = 0; bit < 3; ++bit)
+        {
+          int digit = ((x >> bit) & 1) | (((y >> bit) & 1) << 1) | (((z >> bit) & 1) << 2);
+          EXPECT_EQ((size_t)digit, (morton >> (3 * bit)) & 7);
+        }
+      }
+
+  // every voxel has a slot of its own
+  for(size_t i = 0; i < total; ++i)
+    ASSERT_EQ(1, seen[i]) << "offset " << i;
+}
+
+TEST(VoxelOrder, BrickedMatchesLinear)
+{
+  SyntheticSource source(test::smallParams());
+  Intr intr = source.params().intr;
+
+  cv::Ptr<cpu::TsdfVolume> linear = makeVolume(cpu::TsdfVolume::ORDER_LINEAR);
+  cv::Ptr<cpu::TsdfVolume> bricked = makeVolume(cpu::TsdfVolume::ORDER_BRICKED);
+
+  for(int i = 0; i < 3; ++i)
+  {
+    cpu::Depth depth;
+    cpu::Image image;
+    cpu::Dists dists;
+    test::grab(source, depth, image);
+    cpu::computeDists(depth, dists, intr);
+
+    linear->integrate(dists, image, source.pose(), intr);
+    bricked->integrate(dists, image, source.pose(), intr);
+  }
+
+  // the same voxels, only stored elsewhere
+  const Vec3i dims = linear->getDims();
+  const host::Voxel* l = linear->data().ptr<host::Voxel>();
+  const host::Voxel* b = bricked->data().ptr<host::Voxel>();
+
+  int differ = 0, fused = 0;
+  for(int z = 0; z < dims[2]; ++z)
+    for(int y = 0; y < dims[1]; ++y)
+      for(int x = 0; x < dims[0]; ++x)
+      {
+        const host::Voxel& lv = l[host::voxel_offset(x, y, z, dims, host::ORDER_LINEAR)];
+        const host::Voxel& bv = b[host::voxel_offset(x, y, z, dims, host::ORDER_BRICKED)];
+        differ += memcmp(&lv, &bv, sizeof(host::Voxel)) != 0;
+        fused += lv.weight != 0;
+      }
+  EXPECT_EQ(0, differ);
+  EXPECT_GT(fused, 0);
+
+  // and read back through the order
+  cpu::Depth raycast_linear(source.params().rows, source.params().cols), raycast_bricked(raycast_linear.size());
+  cpu::Normals normals_linear, normals_bricked;
+  linear->raycast(source.pose(), intr, raycast_linear, normals_linear);
+  bricked->raycast(source.pose(), intr, raycast_bricked, normals_bricked);
+  EXPECT_TRUE(test::bitExact(raycast_linear, raycast_bricked));
+  EXPECT_TRUE(test::bitExact(normals_linear, normals_bricked));
+
+  cpu::Mesh buffer_linear, buffer_bricked;
+  cpu::Mesh mesh_linear = linear->fetchMesh(buffer_linear);
+  cpu::Mesh mesh_bricked = bricked->fetchMesh(buffer_bricked);
+  EXPECT_GT(mesh_linear.vertices.cols, 0);
+  EXPECT_TRUE(test::bitExact(mesh_linear.vertices, mesh_bricked.vertices));
+  EXPECT_TRUE(test::bitExact(mesh_linear.indices, mesh_bricked.indices));
+}
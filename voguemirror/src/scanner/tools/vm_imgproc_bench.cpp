@@ -0,0 +1,263 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+
+#include <scanner/scanner.hpp>
+#include <scanner/cuda/imgproc.hpp>
+#include <scanner/cpu/imgproc.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+
+using namespace vm::scanner;
+
+/** Depth front end (dists, bilateral, pyramid, point normals per level) of cpu:: (avx2 and scalar) and cuda:: on a synthetic frame,
+  * separate stages and the fused depthFrontEnd, whose level 0 output is checked bit for bit against the separate stages */
+struct ImgprocBench
+{
+  enum { DISTS, BILATERAL, PYRAMID, NORMALS, STAGES_COUNT };
+
+  ImgprocBench(int frames, int cols, int rows) : frames_(frames), params_(ScannerParams::default_params())
+  {
+    intr_ = params_.intr(cols == params_.cols ? 0 : 1);
+    // as many levels as the icp uses, like Scanner
+    for(levels_ = (int)params_.icp_iter_num.size(); levels_ > 0 && !params_.icp_iter_num[levels_ - 1]; --levels_);
+
+    // noisy sphere in front of a wall, like a person in front of the background
+    depth_.create(rows, cols);
+
+    Vec3f center(0.f, 0.f, 1.f);
+    float radius = 0.3f, wall = 1.4f;
+
+    cv::RNG rng(0);
+    for(int y = 0; y < depth_.rows; ++y)
+      for(int x = 0; x < depth_.cols; ++x)
+      {
+        Vec3f dir((x - intr_.cx)/intr_.fx, (y - intr_.cy)/intr_.fy, 1.f);
+        dir *= 1.f/(float)cv::norm(dir);
+
+        float b = dir.dot(center);
+        float disc = b * b - center.dot(center) + radius * radius;
+        float z = (disc > 0 ? b - std::sqrt(disc) : wall / dir[2]) * dir[2];
+
+        depth_(y, x) = rng.uniform(0, 50) ? (ushort)cvRound(z * 1000 + rng.gaussian(2.0)) : 0;
+      }
+  }
+
+  void run_cpu(bool optimized)
+  {
+    cv::setUseOptimized(optimized);
+
+    cpu::Dists dists;
+    std::vector<cpu::Depth> depth_pyr(levels_);
+    std::vector<cpu::Cloud> points_pyr(levels_);
+    std::vector<cpu::Normals> normals_pyr(levels_);
+
+    double stage_ms[STAGES_COUNT] = { 0 };
+    for(int i = 0; i < frames_; ++i)
+    {
+      double ticks[STAGES_COUNT + 1];
+      ticks[0] = (double)cv::getTickCount();
+
+      cpu::computeDists(depth_, dists, intr_);
+      ticks[1] = (double)cv::getTickCount();
+
+      cpu::depthBilateralFilter(depth_, depth_pyr[0], params_.bilateral_kernel_size, params_.bilateral_sigma_spatial, params_.bilateral_sigma_depth);
+      ticks[2] = (double)cv::getTickCount();
+
+      for(int l = 1; l < levels_; ++l)
+        cpu::depthBuildPyramid(depth_pyr[l-1], depth_pyr[l], params_.bilateral_sigma_depth);
+      ticks[3] = (double)cv::getTickCount();
+
+      for(int l = 0; l < levels_; ++l)
+        cpu::computePointNormals(intr_(l), depth_pyr[l], points_pyr[l], normals_pyr[l]);
+      ticks[4] = (double)cv::getTickCount();
+
+      accumulate(ticks, stage_ms);
+    }
+
+    report(cv::format("cpu %-6s", cpu::TsdfVolume::getSimdPath()), stage_ms);
+
+    cpu::Dists fused_dists;
+    cpu::Depth fused_depth;
+    cpu::Cloud fused_points;
+    cpu::Normals fused_normals;
+
+    std::fill(stage_ms, stage_ms + STAGES_COUNT, 0.0);
+    for(int i = 0; i < frames_; ++i)
+    {
+      double ticks[STAGES_COUNT + 1];
+      ticks[0] = ticks[1] = (double)cv::getTickCount();
+
+      cpu::depthFrontEnd(intr_, depth_, fused_dists, depth_pyr[0], points_pyr[0], normals_pyr[0],
+                         params_.bilateral_kernel_size, params_.bilateral_sigma_spatial, params_.bilateral_sigma_depth, 0.f);
+      ticks[2] = (double)cv::getTickCount();
+
+      for(int l = 1; l < levels_; ++l)
+        cpu::depthBuildPyramid(depth_pyr[l-1], depth_pyr[l], params_.bilateral_sigma_depth);
+      ticks[3] = (double)cv::getTickCount();
+
+      for(int l = 1; l < levels_; ++l)
+        cpu::computePointNormals(intr_(l), depth_pyr[l], points_pyr[l], normals_pyr[l]);
+      ticks[4] = (double)cv::getTickCount();
+
+      accumulate(ticks, stage_ms);
+    }
+
+    cpu::computeDists(depth_, dists, intr_);
+    cpu::depthBilateralFilter(depth_, fused_depth, params_.bilateral_kernel_size, params_.bilateral_sigma_spatial, params_.bilateral_sigma_depth);
+    cpu::computePointNormals(intr_, fused_depth, fused_points, fused_normals);
+
+    bool exact = same(dists, fused_dists) && same(depth_pyr[0], fused_depth) && same(points_pyr[0], fused_points) && same(normals_pyr[0], fused_normals);
+    report(cv::format("cpu %-6s fused", cpu::TsdfVolume::getSimdPath()), stage_ms, exact ? "bit exact" : "MISMATCH");
+  }
+
+  void run_cuda()
+  {
+    cuda::Depth depth;
+    depth.upload(depth_.data, depth_.step, depth_.rows, depth_.cols);
+
+    cuda::Dists dists;
+    std::vector<cuda::Depth> depth_pyr(levels_);
+    std::vector<cuda::Cloud> points_pyr(levels_);
+    std::vector<cuda::Normals> normals_pyr(levels_);
+
+    double stage_ms[STAGES_COUNT] = { 0 };
+    for(int i = 0; i < frames_; ++i)
+    {
+      double ticks[STAGES_COUNT + 1];
+      ticks[0] = (double)cv::getTickCount();
+
+      cuda::computeDists(depth, dists, intr_);
+      cuda::waitAllDefaultStream();
+      ticks[1] = (double)cv::getTickCount();
+
+      cuda::depthBilateralFilter(depth, depth_pyr[0], params_.bilateral_kernel_size, params_.bilateral_sigma_spatial, params_.bilateral_sigma_depth);
+      cuda::waitAllDefaultStream();
+      ticks[2] = (double)cv::getTickCount();
+
+      for(int l = 1; l < levels_; ++l)
+        cuda::depthBuildPyramid(depth_pyr[l-1], depth_pyr[l], params_.bilateral_sigma_depth);
+      cuda::waitAllDefaultStream();
+      ticks[3] = (double)cv::getTickCount();
+
+      for(int l = 0; l < levels_; ++l)
+        cuda::computePointNormals(intr_(l), depth_pyr[l], points_pyr[l], normals_pyr[l]);
+      cuda::waitAllDefaultStream();
+      ticks[4] = (double)cv::getTickCount();
+
+      accumulate(ticks, stage_ms);
+    }
+
+    report("cuda      ", stage_ms);
+
+    cuda::Dists fused_dists;
+
+    std::fill(stage_ms, stage_ms + STAGES_COUNT, 0.0);
+    for(int i = 0; i < frames_; ++i)
+    {
+      double ticks[STAGES_COUNT + 1];
+      ticks[0] = ticks[1] = (double)cv::getTickCount();
+
+      cuda::depthFrontEnd(intr_, depth, fused_dists, depth_pyr[0], points_pyr[0], normals_pyr[0],
+                          params_.bilateral_kernel_size, params_.bilateral_sigma_spatial, params_.bilateral_sigma_depth, 0.f);
+      cuda::waitAllDefaultStream();
+      ticks[2] = (double)cv::getTickCount();
+
+      for(int l = 1; l < levels_; ++l)
+        cuda::depthBuildPyramid(depth_pyr[l-1], depth_pyr[l], params_.bilateral_sigma_depth);
+      cuda::waitAllDefaultStream();
+      ticks[3] = (double)cv::getTickCount();
+
+      for(int l = 1; l < levels_; ++l)
+        cuda::computePointNormals(intr_(l), depth_pyr[l], points_pyr[l], normals_pyr[l]);
+      cuda::waitAllDefaultStream();
+      ticks[4] = (double)cv::getTickCount();
+
+      accumulate(ticks, stage_ms);
+    }
+
+    cuda::Depth filtered;
+    cuda::Cloud points;
+    cuda::Normals normals;
+    cuda::computeDists(depth, dists, intr_);
+    cuda::depthBilateralFilter(depth, filtered, params_.bilateral_kernel_size, params_.bilateral_sigma_spatial, params_.bilateral_sigma_depth);
+    cuda::computePointNormals(intr_, filtered, points, normals);
+
+    bool exact = same(dists, fused_dists) && same(filtered, depth_pyr[0]) && same(points, points_pyr[0]) && same(normals, normals_pyr[0]);
+    report("cuda       fused", stage_ms, exact ? "bit exact" : "MISMATCH");
+  }
+
+  template<typename T>
+  static cv::Mat download(const cuda::DeviceArray2D<T>& array)
+  {
+    cv::Mat host(array.rows(), array.cols() * (int)sizeof(T), CV_8U);
+    array.download(host.data, host.step);
+    return host;
+  }
+
+  template<typename T>
+  static bool same(const cuda::DeviceArray2D<T>& a, const cuda::DeviceArray2D<T>& b)
+  { return same(download(a), download(b)); }
+
+  /** Byte comparison, so matching NaNs count as equal */
+  static bool same(const cv::Mat& a, const cv::Mat& b)
+  {
+    if (a.size() != b.size() || a.type() != b.type())
+      return false;
+
+    for(int y = 0; y < a.rows; ++y)
+      if (memcmp(a.ptr(y), b.ptr(y), a.cols * a.elemSize()))
+        return false;
+    return true;
+  }
+
+  static void accumulate(const double* ticks, double* stage_ms)
+  {
+    for(int s = 0; s < STAGES_COUNT; ++s)
+      stage_ms[s] += (ticks[s + 1] - ticks[s]) * 1000 / cv::getTickFrequency();
+  }
+
+  /** The fused pass is reported as bilateral, dists stays zero */
+  void report(const std::string& name, const double* stage_ms, const char* note = "") const
+  {
+    double total_ms = 0;
+    for(int s = 0; s < STAGES_COUNT; ++s)
+      total_ms += stage_ms[s];
+
+    printf("%-16s %4dx%-4d  dists %6.3f  bilateral %6.3f  pyramid %6.3f  normals %6.3f   total %6.3f ms/frame  %s\n", name.c_str(),
+           depth_.cols, depth_.rows, stage_ms[DISTS]/frames_, stage_ms[BILATERAL]/frames_, stage_ms[PYRAMID]/frames_,
+           stage_ms[NORMALS]/frames_, total_ms/frames_, note);
+  }
+
+  int frames_;
+  int levels_;
+  ScannerParams params_;
+  Intr intr_;
+
+  cpu::Depth depth_;
+};
+
+int main (int argc, char** argv)
+{
+  int frames = argc > 1 ? atoi(argv[1]) : 100;
+  std::cout << "Threads: " << cv::getNumThreads() << ", frames: " << frames << std::endl;
+
+  int cuda_devices = cuda::getCudaEnabledDeviceCount();
+  if (cuda_devices > 0)
+    cuda::printShortCudaDeviceInfo(0);
+
+  const int sizes[][2] = { {640, 480}, {320, 240} };
+  for(int i = 0; i < 2; ++i)
+  {
+    ImgprocBench bench(frames, sizes[i][0], sizes[i][1]);
+    bench.run_cpu(true);
+    bench.run_cpu(false);
+
+    if (cuda_devices > 0)
+      bench.run_cuda();
+  }
+
+  cv::setUseOptimized(true);
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+
+#include <scanner/scanner.hpp>
+#include <scanner/session.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+
+using namespace vm::scanner;
+
+static void usage()
+{
+  std::cout << "Usage: vm_refuse <session.vms> <mesh.ply> [--dims N] [--cuda] [--poses file] [--segment N] [--batch N]" << std::endl
+            << "  --dims N     voxels along each axis of the volume the session is fused into (default 512)" << std::endl
+            << "  --cuda       fuse on the device instead of on all host cores" << std::endl
+            << "  --poses file camera poses to fuse with instead of the recorded ones, a line of 16 row major floats per" << std::endl
+            << "               frame index as in Scanner::getCameraPose" << std::endl
+            << "  --segment N  which segment of frames between resets to fuse (default the last one)" << std::endl
+            << "  --batch N    frames integrated together on the host (default 32)" << std::endl;
+}
+
+static bool load_poses(const std::string& filename, std::vector<Affine3f>& poses)
+{
+  std::ifstream file(filename.c_str());
+  if (!file)
+    return false;
+
+  Affine3f pose;
+  for(;;)
+  {
+    for(int i = 0; i < 16; ++i)
+      file >> pose.matrix.val[i];
+    if (!file)
+      break;
+    poses.push_back(pose);
+  }
+  return !poses.empty();
+}
+
+template<typename Volume>
+static void setup(Volume& volume, const SessionHeader& h)
+{
+  Affine3f pose;
+  std::copy(h.volume_pose, h.volume_pose + 16, pose.matrix.val);
+
+  volume.setSize(Vec3f(h.volume_size[0], h.volume_size[1], h.volume_size[2]));
+  volume.setPose(pose);
+  volume.setTruncDist(h.trunc_dist);
+  volume.clear();
+}
+
+int main (int argc, char** argv)
+{
+  if (argc < 3)
+    return usage(), 1;
+
+  std::string session_file = argv[1], mesh_file = argv[2], poses_file;
+  int dims = 512, segment = -1, batch = 32;
+  bool use_cuda = false;
+
+  for(int i = 3; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--dims" && i + 1 < argc)
+      dims = atoi(argv[++i]);
+    else if (arg == "--cuda")
+      use_cuda = true;
+    else if (arg == "--poses" && i + 1 < argc)
+      poses_file = argv[++i];
+    else if (arg == "--segment" && i + 1 < argc)
+      segment = atoi(argv[++i]);
+    else if (arg == "--batch" && i + 1 < argc)
+      batch = atoi(argv[++i]);
+    else
+      return usage(), 1;
+  }
+
+  std::vector<Affine3f> poses;
+  if (!poses_file.empty() && !load_poses(poses_file, poses))
+    return std::cerr << "Can't read poses from " << poses_file << std::endl, 1;
+
+  try
+  {
+    SessionReader session(session_file);
+    std::cerr << session.size() << " frames in " << session.lastSegment() + 1 << " segments" << std::endl;
+
+    int64 start = cv::getTickCount();
+    double seconds = 0;
+    int fused = 0;
+
+    if (use_cuda)
+    {
+      cuda::setDevice (0);
+      cuda::printShortCudaDeviceInfo (0);
+
+      cuda::TsdfVolume volume(Vec3i::all(dims));
+      setup(volume, session.header());
+      fused = refuseSession(session, volume, poses, segment);
+      seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+      cuda::Mesh mesh_buffer;
+      PlyWriter writer;
+      writer.save(mesh_file, volume.fetchMesh(mesh_buffer));
+      if (!writer.wait())
+        return std::cerr << "Can't write " << writer.error() << std::endl, 1;
+    }
+    else
+    {
+      std::cerr << "Threads: " << cv::getNumThreads() << ", " << cpu::TsdfVolume::getSimdPath() << std::endl;
+
+      cpu::TsdfVolume volume(Vec3i::all(dims));
+      setup(volume, session.header());
+      fused = refuseSession(session, volume, poses, segment, batch);
+      seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+      cpu::Mesh mesh_buffer;
+      writePly(mesh_file, volume.fetchMesh(mesh_buffer));
+    }
+
+    std::cerr << "Fused " << fused << " frames into " << dims << "^3 in " << seconds << "s, " << fused / seconds << " frames/s" << std::endl;
+  }
+  catch(const cv::Exception& e)
+  {
+    return std::cerr << e.what() << std::endl, 1;
+  }
+  return 0;
+}
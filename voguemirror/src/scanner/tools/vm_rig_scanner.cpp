@@ -0,0 +1,130 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <scanner/scanner.hpp>
+#include <scanner/capture.hpp>
+
+using namespace vm::scanner;
+
+/** The rig file holds a line of 16 row major floats per sensor after the first, its pose in the frame of sensor 0 in meters */
+static bool load_rig(const std::string& filename, int sensors, std::vector<Affine3f>& poses)
+{
+  std::ifstream file(filename.c_str());
+  if (!file)
+    return false;
+
+  poses.assign(1, Affine3f::Identity());
+  for(int s = 1; s < sensors; ++s)
+  {
+    Affine3f pose;
+    for(int i = 0; i < 16; ++i)
+      file >> pose.matrix.val[i];
+    if (!file)
+      return false;
+    poses.push_back(pose);
+  }
+  return true;
+}
+
+// Fuses several sensors into one volume, sensor 0 is tracked and the others follow it through the rig extrinsics
+int main (int argc, char** argv)
+{
+  if (argc < 3)
+    return std::cout << "Usage: vm_rig_scanner <sensors> <rig.txt>" << std::endl, 1;
+
+  int sensors = atoi(argv[1]);
+  ScannerParams params = ScannerParams::default_params();
+  if (sensors < 1 || !load_rig(argv[2], sensors, params.sensor_poses))
+    return std::cout << "Can't read the poses of " << sensors << " sensors from " << argv[2] << std::endl, 1;
+
+  int device = 0;
+  cuda::setDevice (device);
+  cuda::printShortCudaDeviceInfo (device);
+
+  if(cuda::checkIfPreFermiGPU(device))
+    return std::cout << std::endl << "Scanner is not supported for pre-Fermi GPU architectures" << std::endl, 1;
+
+  std::vector< cv::Ptr<OpenNISource> > sources;
+  std::vector<OpenNISource*> pointers;
+  for(int s = 0; s < sensors; ++s)
+  {
+    sources.push_back(cv::Ptr<OpenNISource>(new OpenNISource(s)));
+    sources.back()->setRegistration(true);
+    pointers.push_back(sources.back());
+  }
+
+  Scanner scanner(params);
+  MultiCapture capture(pointers);
+
+  cuda::Depth depth_device;
+  cuda::Image image_device, view_device;
+  cv::Mat depth, image, view_host;
+  cuda::Mesh mesh_buffer;
+  PlyWriter ply_writer;
+
+  std::vector<int64> fused(sensors, 0);
+  int dropped_blocks = 0;
+  int64 start = cv::getTickCount();
+
+  capture.start();
+
+  int sensor;
+  int64 timestamp;
+  for(bool quit = false; !quit && capture.retrieve(sensor, depth, image, &timestamp); )
+  {
+    // the device buffers keep their size, so uploads reuse them for every sensor
+    depth_device.upload(depth.data, depth.step, depth.rows, depth.cols);
+    image_device.upload(image.data, image.step, image.rows, image.cols);
+
+    try
+    {
+      if (scanner(sensor, depth_device, image_device, timestamp))
+      {
+        scanner.renderImage(view_device, 3);
+        view_host.create(view_device.rows(), view_device.cols(), CV_8UC4);
+        view_device.download(view_host.ptr<void>(), view_host.step);
+        cv::imshow("Scene", view_host);
+      }
+      ++fused[sensor];
+    }
+    catch(const cv::Exception& e)
+    {
+      // only this frame is lost, frames the other sensors still hold go in with the next pose
+      std::cout << "Sensor " << sensor << " frame failed: " << e.what() << std::endl;
+    }
+
+    int dropped = scanner.getDroppedBlocks();
+    if (dropped > dropped_blocks)
+      std::cout << "The sparse volume is out of blocks, " << dropped - dropped_blocks << " more weren't fused, raise volume_max_blocks" << std::endl;
+    dropped_blocks = dropped;
+
+    switch(cv::waitKey(1))
+    {
+      case 's': case 'S' : ply_writer.save("model_mesh.ply", scanner.tsdf().fetchMesh(mesh_buffer)); break;
+      case 'v': case 'V' :
+        if (scanner.recorder().isOpen())
+        {
+          if (!scanner.stopRecording())
+            std::cout << "Failed recording: " << scanner.recorder().error() << std::endl;
+        }
+        else
+          scanner.startRecording("session.vms");
+        break;
+      case 27: case 32: quit = true; break;
+    }
+  }
+
+  capture.stop();
+
+  double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+  for(int s = 0; s < sensors; ++s)
+  {
+    AsyncCapture::Stats stats = capture.stats(s);
+    std::cout << "Sensor " << s << ": grabbed " << stats.grabbed << ", fused " << fused[s] << ", "
+              << fused[s] / seconds << " frames/s" << std::endl;
+  }
+  return 0;
+}
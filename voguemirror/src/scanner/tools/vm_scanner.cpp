@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <numeric>
 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -27,9 +28,19 @@ struct ScannerApp
 
     if(event.code == 's' || event.code =='S')
       scanner.save_mesh(*scanner.scanner_);
+
+    if(event.code == 'c' || event.code == 'C')
+      scanner.checkpoint(*scanner.scanner_);
+
+    if(event.code == 'r' || event.code == 'R')
+      scanner.restore(*scanner.scanner_);
+
+    if(event.code == 'v' || event.code == 'V')
+      scanner.toggle_recording(*scanner.scanner_);
   }
 
-  ScannerApp(OpenNISource& source) : exit_ (false),  iteractive_mode_(false), capture_ (source)
+  ScannerApp(OpenNISource& source, AsyncCapture::DropPolicy policy)
+    : exit_ (false),  iteractive_mode_(false), capture_ (source), async_ (source, policy)
   {
     ScannerParams params = ScannerParams::default_params();
     scanner_ = Scanner::Ptr( new Scanner(params) );
@@ -65,21 +76,22 @@ struct ScannerApp
 
   void take_cloud(Scanner& scanner)
   {
-    cuda::DeviceArray<Point> cloud = scanner.tsdf().fetchCloud(cloud_buffer);
-    cuda::DeviceArray<Normal> normal;
-    cuda::DeviceArray<RGB> color;
+    cuda::DeviceArray<Surfel> surfels = scanner.tsdf().fetchSurfels(surfel_buffer);
 
-    scanner.tsdf().fetchNormals(cloud, normal);
-    //scanner.tsdf().fetchTangentColors(cloud, color);
-    scanner.tsdf().fetchVertexColors(cloud, color);
+    std::vector<Surfel> host(surfels.size());
+    if (!host.empty())
+      surfels.download(&host[0]);
 
-    cv::Mat cloud_host(1, (int)cloud.size(), CV_32FC4);
-    cv::Mat normal_host(1, (int)normal.size(), CV_32FC4);
-    cv::Mat color_host(1, (int)cloud.size(), CV_8UC4);
+    cv::Mat cloud_host(1, (int)host.size(), CV_32FC4);
+    cv::Mat normal_host(1, (int)host.size(), CV_32FC4);
+    cv::Mat color_host(1, (int)host.size(), CV_8UC4);
 
-    cloud.download(cloud_host.ptr<Point>());
-    normal.download(normal_host.ptr<Normal>());
-    color.download(color_host.ptr<RGB>());
+    for(size_t i = 0; i < host.size(); ++i)
+    {
+      cloud_host.ptr<Point>()[i] = host[i].point;
+      normal_host.ptr<Normal>()[i] = host[i].normal;
+      color_host.ptr<RGB>()[i] = host[i].color;
+    }
 
     viz.showWidget("Colored Cloud", cv::viz::WCloud(cloud_host, color_host, normal_host));
   }
@@ -128,88 +140,50 @@ struct ScannerApp
 
   }
 
-  void combine_mesh(){
-    std::ifstream norm_file("model_tangent.ply");
-    std::ifstream tex_file("model_color.ply");
-
-    std::ofstream combo_file("model_combo.ply");
-      
-
-    std::string s;
-    int vcount;
-
-      //Get vcount
-    while(1){
-      norm_file >> s;
-      if(s.compare("vertex") == 0)
-        break;
-    }
+  void save_mesh(Scanner& scanner)
+  {
+    // written on the writer thread, fusion keeps going meanwhile, a failure shows up with the next save
+    if (!ply_writer_.wait())
+      std::cout << "Can't write " << ply_writer_.error() << std::endl;
 
-    norm_file >> vcount;
+    cuda::Mesh mesh = scanner.tsdf().fetchMesh(mesh_buffer);
+    ply_writer_.save("model_mesh.ply", mesh);
+  }
 
-    // End normal file header  
-    while(1){
-      norm_file >> s;
-      if(s.compare("end_header") == 0)
-        break;
-    }
+  void checkpoint(Scanner& scanner)
+  {
+    // written on the writer thread, a failure shows up with the next checkpoint
+    if (!scanner.waitCheckpoint())
+      std::cout << "Can't checkpoint " << scanner.checkpointWriter().error() << std::endl;
+    scanner.checkpoint("session.snapshot");
+  }
 
-    //End tex file header
-    while(1){
-      tex_file >> s;
-      if(s.compare("end_header") == 0)
-        break;
+  void restore(Scanner& scanner)
+  {
+    try
+    {
+      scanner.restore("session.snapshot");
     }
-
-    //MAke combo file
-    
-    combo_file << "ply\nformat ascii 1.0\nelement vertex "<< vcount<< "\n";
-    combo_file << "property float x\nproperty float y\nproperty float z\n";
-    combo_file << "property float nx\nproperty float ny\nproperty float nz\n";
-    combo_file << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
-    combo_file << "element face 0\nproperty list uchar int vertex_indices\n";
-    combo_file << "end_header\n";
-    
-    float x,y,z , nx,ny,nz;
-    int r,g,b;
-    int rn,gn,bn;
-    for(int i = 0; i < vcount ; i++){
-      
-      norm_file >> x >> y >> z >> rn >> gn >> bn;
-      tex_file >> x >> y >> z >> r >> g >> b;
-
-      nx  = 1.0f - 2.0f*(rn/255.0f);
-      ny  = 1.0f - 2.0f*(gn/255.0f);
-      nz  = 1.0f - 2.0f*(bn/255.0f);
-
-      combo_file <<x<<' '<<y<<' '<<z<<' '<<nx<<' '<<ny<<' '<<nz<<' '<<r<<' '<<g<<' '<<b<<'\n';
+    catch(const cv::Exception& e)
+    {
+      std::cout << "Can't restore: " << e.what() << std::endl;
     }
-
-    norm_file.close();
-    tex_file.close();
-    combo_file.close();   
   }
 
-  void save_mesh(Scanner& scanner)
-  {   
-    cuda::DeviceArray<Point> cloud = scanner.tsdf().fetchCloud(cloud_buffer);
-    cuda::DeviceArray<RGB> tangent_color;
-    cuda::DeviceArray<RGB> vertex_color;
-
-    scanner.tsdf().fetchVertexColors(cloud, vertex_color);
-    scanner.tsdf().fetchTangentColors(cloud, tangent_color);
-
-    cv::Mat cloud_host(1, (int)cloud.size(), CV_32FC4);
-    cv::Mat vertex_color_host(1, (int)vertex_color.size(), CV_8UC4);
-    cv::Mat tangent_color_host(1, (int)tangent_color.size(), CV_8UC4);
+  void toggle_recording(Scanner& scanner)
+  {
+    // replayed later at any resolution with vm_refuse
+    if (!scanner.recorder().isOpen())
+    {
+      scanner.startRecording("session.vms");
+      std::cout << "Recording to session.vms" << std::endl;
+      return;
+    }
 
-    cloud.download(cloud_host.ptr<Point>());
-    vertex_color.download(vertex_color_host.ptr<RGB>());
-    tangent_color.download(tangent_color_host.ptr<RGB>());
-    
-    cv::viz::writeCloud("model_color.ply", cloud_host, vertex_color_host);
-    cv::viz::writeCloud("model_tangent.ply", cloud_host, tangent_color_host);
-    combine_mesh();
+    bool ok = scanner.stopRecording();
+    if (!ok)
+      std::cout << "Failed recording: " << scanner.recorder().error() << std::endl;
+    std::cout << "Recorded " << scanner.recorder().recorded() << " frames, dropped " << scanner.recorder().dropped() << std::endl;
   }
 
   bool execute()
@@ -218,21 +192,43 @@ struct ScannerApp
     cv::Mat depth, image;
     double time_ms = 0;
     bool has_image = false;
+    int64 icp_frames = 0, icp_iterations = 0;
+    int dropped_blocks = 0;
+
+    // grabbing and RGBA conversion run on the capture thread, depth and image are RGBA ring slots
+    async_.start();
 
     while(!exit_ && !viz.wasStopped())
     {
-      bool has_frame = capture_.grab(depth, image);
+      bool has_frame = async_.retrieve(depth, image);
       if (!has_frame)
         return std::cout << "Can't grab" << std::endl, false;
 
-      cv::cvtColor(image, image, CV_RGB2RGBA);
-
       depth_device_.upload(depth.data, depth.step, depth.rows, depth.cols);
       image_device_.upload(image.data, image.step, image.rows, image.cols);
+      try
       {
         SampledScopeTime fps(time_ms); (void)fps;
         has_image = scanner(depth_device_, image_device_);
       }
+      catch(const cv::Exception& e)
+      {
+        // only this frame is lost, the next one goes on from the last pose
+        std::cout << "Frame failed: " << e.what() << std::endl;
+        has_image = false;
+      }
+
+      int dropped = scanner.getDroppedBlocks();
+      if (dropped > dropped_blocks)
+        std::cout << "The sparse volume is out of blocks, " << dropped - dropped_blocks << " more weren't fused, raise volume_max_blocks" << std::endl;
+      dropped_blocks = dropped;
+
+      if (has_image)
+      {
+        const std::vector<int>& iters = scanner.icp().getIterationsDone();
+        icp_iterations += std::accumulate(iters.begin(), iters.end(), 0);
+        ++icp_frames;
+      }
 
       if (has_image)
         show_raycasted(scanner);
@@ -250,17 +246,42 @@ struct ScannerApp
         case 't': case 'T' : take_cloud(scanner); break;
         case 'i': case 'I' : iteractive_mode_ = !iteractive_mode_; break;
         case 's': case 'S' : save_mesh(scanner); break;
+        case 'c': case 'C' : checkpoint(scanner); break;
+        case 'r': case 'R' : restore(scanner); break;
+        case 'v': case 'V' : toggle_recording(scanner); break;
         case 27: case 32: exit_ = true; break;
       }
 
       //exit_ = exit_ || i > 100;
       viz.spinOnce(3, true);
     }
+
+    async_.stop();
+
+    AsyncCapture::Stats stats = async_.stats();
+    std::cout << "Frames grabbed: " << stats.grabbed << ", fused: " << stats.delivered << ", dropped: " << stats.dropped << std::endl;
+
+    if (icp_frames)
+      std::cout << "ICP iterations per frame: " << (double)icp_iterations / icp_frames << std::endl;
+
+    // stage timing is on when VM_SCANNER_TRACE is set
+    const TimeHistogram& frame = scanner.getFrameHistogram();
+    if (frame.count())
+    {
+      std::cout << "Frame time: mean " << frame.mean() << "ms, p95 " << frame.percentile(0.95) << "ms, max " << frame.max() << "ms" << std::endl;
+      for(int s = 0; s < ScannerTimes::STAGES_COUNT; ++s)
+        std::cout << "  " << ScannerTimes::name(s) << ": mean " << scanner.getHistogram(s).mean() << "ms, p95 "
+                  << scanner.getHistogram(s).percentile(0.95) << "ms" << std::endl;
+    }
+
+    if (Trace::enabled())
+      Trace::writeChromeTrace();
     return true;
   }
 
   bool exit_, iteractive_mode_;
   OpenNISource& capture_;
+  AsyncCapture async_;
   Scanner::Ptr scanner_;
   cv::viz::Viz3d viz;
 
@@ -268,7 +289,9 @@ struct ScannerApp
   cuda::Image view_device_;
   cuda::Depth depth_device_;
   cuda::DeviceArray2D<RGB> image_device_;
-  cuda::DeviceArray<Point> cloud_buffer;
+  cuda::DeviceArray<Surfel> surfel_buffer;
+  cuda::Mesh mesh_buffer;
+  PlyWriter ply_writer_;
 };
 
 int main (int argc, char** argv)
@@ -299,7 +322,8 @@ int main (int argc, char** argv)
   //capture.open("/home/pragyan/dataset/burghers.oni");
   //capture.open("/home/pragyan/dataset/copyroom.oni");
   
-  ScannerApp app (capture);
+  // a live sensor keeps going anyway so only its latest frame matters, a recording is fused frame by frame
+  ScannerApp app (capture, argc == 2 ? AsyncCapture::LOSSLESS : AsyncCapture::LATEST_ONLY);
 
   // executing
   try { app.execute (); }
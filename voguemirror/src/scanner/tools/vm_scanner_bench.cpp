@@ -0,0 +1,326 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <scanner/scanner.hpp>
+#include <scanner/capture.hpp>
+#include <scanner/cuda/imgproc.hpp>
+
+using namespace vm::scanner;
+
+/** Headless replay of a recording through Scanner on either backend, frames are decoded up front so only the pipeline is measured.
+  * Takes an .oni recording, a raw dump of consecutive 640x480 ushort depth frames (millimeters, no color) or
+  * synthetic[:body|:objects] for frames of a SyntheticSource, which also reports the drift from its ground truth. */
+struct ScannerBench
+{
+  struct Stats
+  {
+    double mean, p50, p95, p99, max;
+  };
+
+  ScannerBench() : frames_(300), warmup_(10), stage_timing_(ScannerTimes::SYNC), voxel_order_(cuda::TsdfVolume::ORDER_LINEAR),
+    backend_(ScannerParams::BACKEND_CUDA), wall_ms_(0.0) {}
+
+  bool load(const std::string& filename)
+  {
+    if (filename.compare(0, 9, "synthetic") == 0)
+      return load_synthetic(filename);
+
+    const std::string oni = ".oni";
+    if (filename.size() >= oni.size() && filename.compare(filename.size() - oni.size(), oni.size(), oni) == 0)
+      return load_oni(filename);
+    return load_raw(filename);
+  }
+
+  bool load_oni(const std::string& filename)
+  {
+    // playback loops at the end of the recording, so frames_ is what bounds this
+    OpenNISource capture(filename);
+    capture.setRegistration(true);
+
+    while ((int)depths_.size() < frames_)
+    {
+      cv::Mat depth, image;
+      if (!capture.grabRGBA(depth, image))
+        break;
+
+      if (image.empty())
+        image = cv::Mat::zeros(depth.rows, depth.cols, CV_8UC4);
+
+      depths_.push_back(depth);
+      images_.push_back(image);
+    }
+    return !depths_.empty();
+  }
+
+  bool load_synthetic(const std::string& name)
+  {
+    SyntheticSource::Params params = SyntheticSource::Params::default_params();
+    params.frames = frames_;
+
+    if (name == "synthetic:objects")
+      params.scene = SyntheticSource::SPHERES_AND_BOX;
+    else if (name != "synthetic" && name != "synthetic:body")
+      return false;
+
+    SyntheticSource source(params);
+
+    cv::Mat depth, image;
+    while (source.grabRGBA(depth, image))
+    {
+      depths_.push_back(depth.clone());
+      images_.push_back(image.clone());
+      ground_truth_.push_back(source.pose());
+    }
+    return !depths_.empty();
+  }
+
+  bool load_raw(const std::string& filename)
+  {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file)
+      return false;
+
+    ScannerParams params = ScannerParams::default_params();
+    cv::Mat black = cv::Mat::zeros(params.rows, params.cols, CV_8UC4);
+
+    while ((int)depths_.size() < frames_)
+    {
+      cv::Mat depth(params.rows, params.cols, CV_16U);
+      if (!file.read((char*)depth.data, depth.total() * depth.elemSize()))
+        break;
+
+      depths_.push_back(depth);
+      images_.push_back(black);
+    }
+    return !depths_.empty();
+  }
+
+  void run()
+  {
+    ScannerParams params = ScannerParams::default_params();
+    params.cols = depths_[0].cols;
+    params.rows = depths_[0].rows;
+    params.volume_voxel_order = voxel_order_;
+    params.backend = backend_;
+
+    Scanner scanner(params);
+    scanner.setStageTiming(stage_timing_);
+
+    cuda::Depth depth_device;
+    cuda::Image image_device;
+
+    frame_ms_.clear();
+    translation_error_.clear();
+    rotation_error_.clear();
+    stage_ms_.assign(ScannerTimes::STAGES_COUNT, std::vector<double>());
+
+    int64 run_start = 0;
+    for(size_t i = 0; i < depths_.size(); ++i)
+    {
+      if ((int)i == warmup_)
+        run_start = cv::getTickCount();
+
+      int64 start = cv::getTickCount();
+
+      if (backend_ == ScannerParams::BACKEND_CPU)
+        scanner(cpu::Depth(depths_[i]), cpu::Image(images_[i]));
+      else
+      {
+        depth_device.upload(depths_[i].data, depths_[i].step, depths_[i].rows, depths_[i].cols);
+        image_device.upload(images_[i].data, images_[i].step, images_[i].rows, images_[i].cols);
+        scanner(depth_device, image_device);
+        cuda::waitAllDefaultStream();
+      }
+
+      double ms = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+
+      if ((int)i < warmup_)
+        continue;
+
+      frame_ms_.push_back(ms);
+
+      if (!ground_truth_.empty())
+      {
+        // both trajectories start at the identity, so no alignment is needed
+        Affine3f error = ground_truth_[i].inv() * scanner.getCameraPose();
+        translation_error_.push_back(cv::norm(error.translation()) * 1000.0);
+        rotation_error_.push_back(cv::norm(error.rvec()) * 180.0 / CV_PI);
+      }
+
+      const ScannerTimes& times = scanner.getTimes();
+      for(int s = 0; s < ScannerTimes::STAGES_COUNT; ++s)
+        stage_ms_[s].push_back(times.stage_ms[s]);
+    }
+
+    wall_ms_ = run_start ? (cv::getTickCount() - run_start) * 1000.0 / cv::getTickFrequency() : 0.0;
+  }
+
+  static Stats stats(std::vector<double> values)
+  {
+    Stats s = { 0, 0, 0, 0, 0 };
+    if (values.empty())
+      return s;
+
+    std::sort(values.begin(), values.end());
+
+    double sum = 0;
+    for(size_t i = 0; i < values.size(); ++i)
+      sum += values[i];
+
+    // nearest rank
+    size_t n = values.size();
+    s.mean = sum / n;
+    s.p50 = values[std::min(n - 1, (size_t)(0.50 * n))];
+    s.p95 = values[std::min(n - 1, (size_t)(0.95 * n))];
+    s.p99 = values[std::min(n - 1, (size_t)(0.99 * n))];
+    s.max = values.back();
+    return s;
+  }
+
+  static void write(std::ostream& os, const char* name, const Stats& s, const char* indent, const std::string& unit = "ms")
+  {
+    os << indent << "\"" << name << "\": { \"mean_" << unit << "\": " << s.mean << ", \"p50_" << unit << "\": " << s.p50
+       << ", \"p95_" << unit << "\": " << s.p95 << ", \"p99_" << unit << "\": " << s.p99 << ", \"max_" << unit << "\": " << s.max << " }";
+  }
+
+  std::string json(const std::string& source) const
+  {
+    std::ostringstream os;
+    os.precision(4);
+    os << std::fixed;
+
+    size_t measured = frame_ms_.size();
+
+    os << "{\n";
+    os << "  \"source\": \"" << source << "\",\n";
+    if (backend_ == ScannerParams::BACKEND_CPU)
+      os << "  \"device\": \"cpu " << cpu::TsdfVolume::getSimdPath() << ", " << cv::getNumThreads() << " threads\",\n";
+    else
+      os << "  \"device\": \"" << cuda::getDeviceName(0) << "\",\n";
+    os << "  \"resolution\": [" << depths_[0].cols << ", " << depths_[0].rows << "],\n";
+    os << "  \"frames\": " << measured << ",\n";
+    os << "  \"warmup_frames\": " << std::min((size_t)warmup_, depths_.size()) << ",\n";
+    const char* modes[] = { "off", "sync", "gpu_events" };
+    os << "  \"stage_timing\": \"" << modes[stage_timing_] << "\",\n";
+    os << "  \"voxel_order\": \"" << (voxel_order_ == cuda::TsdfVolume::ORDER_BRICKED ? "bricked" : "linear") << "\",\n";
+    os << "  \"throughput_fps\": " << (wall_ms_ > 0 ? measured * 1000.0 / wall_ms_ : 0.0) << ",\n";
+    write(os, "frame", stats(frame_ms_), "  ");
+
+    if (stage_timing_)
+    {
+      os << ",\n  \"stages\": {\n";
+      for(int s = 0; s < ScannerTimes::STAGES_COUNT; ++s)
+      {
+        write(os, ScannerTimes::name(s), stats(stage_ms_[s]), "    ");
+        os << (s + 1 < ScannerTimes::STAGES_COUNT ? ",\n" : "\n");
+      }
+      os << "  }";
+    }
+
+    if (!translation_error_.empty())
+    {
+      os << ",\n  \"pose_error\": {\n";
+      write(os, "translation", stats(translation_error_), "    ", "mm");
+      os << ",\n";
+      write(os, "rotation", stats(rotation_error_), "    ", "deg");
+      os << "\n  }";
+    }
+    os << "\n}\n";
+    return os.str();
+  }
+
+  int frames_, warmup_;
+  int stage_timing_;
+  int voxel_order_;
+  int backend_;
+
+  std::vector<cv::Mat> depths_;
+  std::vector<cv::Mat> images_;
+  std::vector<Affine3f> ground_truth_;
+
+  std::vector<double> frame_ms_;
+  std::vector<double> translation_error_, rotation_error_;
+  std::vector< std::vector<double> > stage_ms_;
+  double wall_ms_;
+};
+
+static void usage()
+{
+  std::cout << "Usage: vm_scanner_bench <recording.oni | depth.raw | synthetic[:body|:objects]> [--frames N] [--warmup N] [--no-stages | --events] [--bricked] [--cpu] [--json file] [--trace file]" << std::endl
+            << "  --frames N   frames to replay, warmup included (default 300)" << std::endl
+            << "  --warmup N   leading frames left out of the statistics (default 10)" << std::endl
+            << "  --no-stages  skip the per stage device syncs to measure raw throughput" << std::endl
+            << "  --events     time stages with CUDA events instead of device syncs" << std::endl
+            << "  --bricked    fuse into a volume in 8^3 Morton bricks instead of linear x-fastest order" << std::endl
+            << "  --cpu        run the scanner on the host cores, no device needed" << std::endl
+            << "  --json file  write the report to file instead of stdout" << std::endl
+            << "  --trace file write a Chrome trace of the run" << std::endl;
+}
+
+int main (int argc, char** argv)
+{
+  if (argc < 2)
+    return usage(), 1;
+
+  ScannerBench bench;
+  std::string source = argv[1], json_file, trace_file;
+
+  for(int i = 2; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--frames" && i + 1 < argc)
+      bench.frames_ = atoi(argv[++i]);
+    else if (arg == "--warmup" && i + 1 < argc)
+      bench.warmup_ = atoi(argv[++i]);
+    else if (arg == "--no-stages")
+      bench.stage_timing_ = ScannerTimes::OFF;
+    else if (arg == "--events")
+      bench.stage_timing_ = ScannerTimes::GPU_EVENTS;
+    else if (arg == "--bricked")
+      bench.voxel_order_ = cuda::TsdfVolume::ORDER_BRICKED;
+    else if (arg == "--cpu")
+      bench.backend_ = ScannerParams::BACKEND_CPU;
+    else if (arg == "--json" && i + 1 < argc)
+      json_file = argv[++i];
+    else if (arg == "--trace" && i + 1 < argc)
+      trace_file = argv[++i];
+    else
+      return usage(), 1;
+  }
+
+  if (bench.backend_ == ScannerParams::BACKEND_CUDA)
+  {
+    cuda::setDevice (0);
+    if(cuda::checkIfPreFermiGPU(0))
+      return std::cerr << "Scanner is not supported for pre-Fermi GPU architectures" << std::endl, 1;
+  }
+
+  if (!bench.load(source))
+    return std::cerr << "Can't read frames from " << source << std::endl, 1;
+
+  std::cerr << "Replaying " << bench.depths_.size() << " frames" << std::endl;
+
+  if (!trace_file.empty())
+    Trace::setEnabled(true);
+
+  bench.run();
+
+  if (!trace_file.empty() && !Trace::writeChromeTrace(trace_file))
+    std::cerr << "Can't write " << trace_file << std::endl;
+
+  std::string report = bench.json(source);
+  if (json_file.empty())
+    std::cout << report;
+  else
+  {
+    std::ofstream file(json_file.c_str());
+    file << report;
+  }
+
+  return 0;
+}
@@ -0,0 +1,173 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include <scanner/scanner.hpp>
+#include <scanner/cuda/imgproc.hpp>
+#include <scanner/cpu/tsdf_volume.hpp>
+
+using namespace vm::scanner;
+
+/** Integrate/raycast throughput of cpu::TsdfVolume (avx2 and scalar paths) and cuda::TsdfVolume (every voxel layout), in linear and bricked voxel order, on a synthetic frame */
+struct TsdfBench
+{
+  TsdfBench(int frames) : frames_(frames), intr_(525.f, 525.f, 319.5f, 239.5f), volume_size_(1.5f)
+  {
+    // sphere in front of a wall, both in the middle of the volume
+    dists_.create(480, 640);
+    colors_.create(480, 640);
+
+    Vec3f center(0.f, 0.f, 1.f);
+    float radius = 0.3f, wall = 1.4f;
+
+    for(int y = 0; y < dists_.rows; ++y)
+      for(int x = 0; x < dists_.cols; ++x)
+      {
+        Vec3f dir((x - intr_.cx)/intr_.fx, (y - intr_.cy)/intr_.fy, 1.f);
+        dir *= 1.f/(float)cv::norm(dir);
+
+        float b = dir.dot(center);
+        float disc = b * b - center.dot(center) + radius * radius;
+        float dist = disc > 0 ? b - std::sqrt(disc) : wall / dir[2];
+
+        dists_(y, x) = dist;
+        colors_(y, x) = cv::Vec4b((uchar)x, (uchar)y, (uchar)(x + y), 255);
+      }
+
+    // camera looks down +z through the center of the volume face
+    camera_pose_ = Affine3f().translate(Vec3f(volume_size_/2, volume_size_/2, -0.25f));
+  }
+
+  void run_cpu(int dims, bool optimized, int order)
+  {
+    cv::setUseOptimized(optimized);
+
+    cpu::TsdfVolume volume(Vec3i::all(dims), order);
+    volume.setSize(Vec3f::all(volume_size_));
+
+    cpu::Depth depth(dists_.rows, dists_.cols);
+    cpu::Normals normals;
+
+    double integrate_ms = 0, raycast_ms = 0;
+    for(int i = 0; i < frames_; ++i)
+    {
+      double start = (double)cv::getTickCount();
+      volume.integrate(dists_, colors_, camera_pose_, intr_);
+      double mid = (double)cv::getTickCount();
+      volume.raycast(camera_pose_, intr_, depth, normals);
+      double end = (double)cv::getTickCount();
+
+      integrate_ms += (mid - start) * 1000 / cv::getTickFrequency();
+      raycast_ms += (end - mid) * 1000 / cv::getTickFrequency();
+    }
+
+    cpu::Cloud buffer;
+    report(cv::format("cpu %-6s %-7s", cpu::TsdfVolume::getSimdPath(), order_name(order)), dims, integrate_ms, raycast_ms, volume.getCulledVoxelsNum(), volume.fetchCloud(buffer).cols);
+  }
+
+  void run_cuda(int dims, int layout, int order)
+  {
+    cv::Mat_<ushort> halfs(dists_.rows, dists_.cols);
+    for(int y = 0; y < dists_.rows; ++y)
+      for(int x = 0; x < dists_.cols; ++x)
+        halfs(y, x) = cuda::TsdfVolume::Entry::float2half(dists_(y, x));
+
+    cuda::Dists dists;
+    cuda::Image colors;
+    dists.upload(halfs.data, halfs.step, halfs.rows, halfs.cols);
+    colors.upload(colors_.data, colors_.step, colors_.rows, colors_.cols);
+
+    cuda::TsdfVolume volume(Vec3i::all(dims), layout, order);
+    volume.setSize(Vec3f::all(volume_size_));
+
+    cuda::Depth depth(dists_.rows, dists_.cols);
+    cuda::Normals normals(dists_.rows, dists_.cols);
+
+    volume.fetchRaycastSteps();
+
+    double integrate_ms = 0, raycast_ms = 0;
+    for(int i = 0; i < frames_; ++i)
+    {
+      double start = (double)cv::getTickCount();
+      volume.integrate(dists, colors, camera_pose_, intr_);
+      cuda::waitAllDefaultStream();
+      double mid = (double)cv::getTickCount();
+      volume.raycast(camera_pose_, intr_, depth, normals);
+      cuda::waitAllDefaultStream();
+      double end = (double)cv::getTickCount();
+
+      integrate_ms += (mid - start) * 1000 / cv::getTickFrequency();
+      raycast_ms += (end - mid) * 1000 / cv::getTickFrequency();
+    }
+
+    int64 steps = volume.fetchRaycastSteps();
+
+    // the same raycasts marching through every step
+    volume.setEmptySpaceSkipping(false);
+
+    double marching_ms = 0;
+    for(int i = 0; i < frames_; ++i)
+    {
+      double start = (double)cv::getTickCount();
+      volume.raycast(camera_pose_, intr_, depth, normals);
+      cuda::waitAllDefaultStream();
+      marching_ms += ((double)cv::getTickCount() - start) * 1000 / cv::getTickFrequency();
+    }
+
+    int64 marching_steps = volume.fetchRaycastSteps();
+
+    std::string name = cv::format("cuda %dB    %-7s", (int)(volume.data().sizeBytes() / ((size_t)dims * dims * dims)), order_name(order));
+
+    cuda::DeviceArray<Point> buffer;
+    report(name, dims, integrate_ms, raycast_ms, volume.getCulledVoxelsNum(), (int)volume.fetchCloud(buffer).size());
+
+    double rays = (double)frames_ * depth.rows() * depth.cols();
+    printf("%s %4d^3  raycast %8.2f ms/frame %6.1f steps/ray with empty space skipping, %8.2f ms/frame %6.1f steps/ray without\n", name.c_str(), dims,
+           raycast_ms/frames_, steps / rays, marching_ms/frames_, marching_steps / rays);
+  }
+
+  static const char* order_name(int order) { return order == cuda::TsdfVolume::ORDER_BRICKED ? "bricked" : "linear"; }
+
+  void report(const std::string& name, int dims, double integrate_ms, double raycast_ms, int64 culled, int points) const
+  {
+    double voxels = (double)dims * dims * dims;
+    printf("%s %4d^3  integrate %8.2f ms/frame %8.1f Mvoxels/s (%5.1f%% culled)   raycast %8.2f ms/frame   cloud %d points\n", name.c_str(), dims,
+           integrate_ms/frames_, voxels * frames_ / integrate_ms / 1000, culled * 100.0 / voxels, raycast_ms/frames_, points);
+  }
+
+  int frames_;
+  Intr intr_;
+  float volume_size_;
+  Affine3f camera_pose_;
+
+  cpu::Dists dists_;
+  cpu::Image colors_;
+};
+
+int main (int argc, char** argv)
+{
+  int frames = argc > 1 ? atoi(argv[1]) : 10;
+  std::cout << "Threads: " << cv::getNumThreads() << ", frames: " << frames << std::endl;
+
+  TsdfBench bench(frames);
+
+  int cuda_devices = cuda::getCudaEnabledDeviceCount();
+  if (cuda_devices > 0)
+    cuda::printShortCudaDeviceInfo(0);
+
+  const int dims[] = { 256, 512 };
+  for(int i = 0; i < 2; ++i)
+    for(int order = cuda::TsdfVolume::ORDER_LINEAR; order <= cuda::TsdfVolume::ORDER_BRICKED; ++order)
+    {
+      bench.run_cpu(dims[i], true, order);
+      bench.run_cpu(dims[i], false, order);
+
+      // 8, 6 and 4 byte voxels
+      for(int layout = cuda::TsdfVolume::VOXEL_RGBA; cuda_devices > 0 && layout <= cuda::TsdfVolume::VOXEL_GEOMETRY; ++layout)
+        bench.run_cuda(dims[i], layout, order);
+    }
+
+  cv::setUseOptimized(true);
+  return 0;
+}